@@ -0,0 +1,399 @@
+#include "app_config.h"
+#include "http_resources.h"
+#include "metrics.h"
+#include "sensors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/data/json.h>
+#include <zephyr/init.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(APP_CONFIG, CONFIG_APP_CONFIG_LOG_LEVEL);
+
+// Registry of the settings that can be tuned without reflashing, generated from
+// APP_CONFIG_ITEMS. The values are read lock-free by the sampling threads. Changes come from the
+// shell or from POST /config, are validated as a whole, applied to the running sensors and stored
+// under "app/<name>" in the settings, from where they are loaded at boot.
+
+struct app_config_item {
+	const char *name;
+	int32_t def;
+	int32_t min;
+	int32_t max;
+	bool doubling;
+	enum app_config_apply apply;
+};
+
+static const struct app_config_item items[APP_CONFIG_COUNT] = {
+#define APP_CONFIG_ITEM(_id, _name, _def, _min, _max, _doubling, _apply)                           \
+	[APP_CONFIG_##_id] = {.name = #_name,                                                      \
+			      .def = _def,                                                         \
+			      .min = _min,                                                         \
+			      .max = _max,                                                         \
+			      .doubling = _doubling,                                               \
+			      .apply = _apply},
+	APP_CONFIG_ITEMS(APP_CONFIG_ITEM)
+#undef APP_CONFIG_ITEM
+};
+
+static atomic_t values[APP_CONFIG_COUNT] = {
+#define APP_CONFIG_DEFAULT(_id, _name, _def, ...) [APP_CONFIG_##_id] = ATOMIC_INIT(_def),
+	APP_CONFIG_ITEMS(APP_CONFIG_DEFAULT)
+#undef APP_CONFIG_DEFAULT
+};
+
+// POST /config takes any subset of the settings, the parser reports which ones were present
+struct app_config_command {
+#define APP_CONFIG_FIELD(_id, _name, ...) int32_t _name;
+	APP_CONFIG_ITEMS(APP_CONFIG_FIELD)
+#undef APP_CONFIG_FIELD
+};
+
+static const struct json_obj_descr app_config_command_descr[] = {
+#define APP_CONFIG_DESCR(_id, _name, ...)                                                          \
+	JSON_OBJ_DESCR_PRIM(struct app_config_command, _name, JSON_TOK_NUMBER),
+	APP_CONFIG_ITEMS(APP_CONFIG_DESCR)
+#undef APP_CONFIG_DESCR
+};
+
+BUILD_ASSERT(APP_CONFIG_COUNT <= 32, "The JSON parser reports at most 32 fields");
+
+static K_MUTEX_DEFINE(config_lock);
+
+int32_t app_config_get(enum app_config_id id)
+{
+	return (int32_t)atomic_get(&values[id]);
+}
+
+static bool app_config_valid(enum app_config_id id, int32_t value)
+{
+	const struct app_config_item *item = &items[id];
+
+	if (value < item->min || value > item->max) {
+		return false;
+	}
+
+	return !item->doubling || (value % item->min == 0 && IS_POWER_OF_TWO(value / item->min));
+}
+
+static int app_config_find(const char *name)
+{
+	for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+		if (strcmp(items[i].name, name) == 0) {
+			return i;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Tell the parts of the application in the apply bitmask to use the new values */
+static int app_config_apply(uint32_t apply)
+{
+	int ret = 0;
+
+	if (apply & BIT(APP_CONFIG_APPLY_BMI270)) {
+		ret = sensors_reconfigure(METRICS_DEV_BMI270);
+	}
+
+	if (ret == 0 && (apply & BIT(APP_CONFIG_APPLY_ADXL367))) {
+		ret = sensors_reconfigure(METRICS_DEV_ADXL367);
+	}
+
+	if (ret == 0 && (apply & BIT(APP_CONFIG_APPLY_THREADS))) {
+		sensors_wake();
+	}
+
+	return ret;
+}
+
+static void app_config_save(enum app_config_id id)
+{
+	char key[48];
+	int32_t value = app_config_get(id);
+	int ret;
+
+	snprintf(key, sizeof(key), "app/%s", items[id].name);
+
+	ret = settings_save_one(key, &value, sizeof(value));
+	if (ret) {
+		LOG_ERR("Failed to store %s, err %d", key, ret);
+	}
+}
+
+int app_config_set(const enum app_config_id *ids, const int32_t *new_values, size_t count)
+{
+	int32_t old[APP_CONFIG_COUNT];
+	uint32_t apply = 0;
+	int ret;
+
+	for (size_t i = 0; i < count; i++) {
+		if (ids[i] >= APP_CONFIG_COUNT || !app_config_valid(ids[i], new_values[i])) {
+			return -EINVAL;
+		}
+	}
+
+	k_mutex_lock(&config_lock, K_FOREVER);
+
+	for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+		old[i] = app_config_get(i);
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (new_values[i] != old[ids[i]]) {
+			atomic_set(&values[ids[i]], new_values[i]);
+			apply |= BIT(items[ids[i]].apply);
+		}
+	}
+
+	ret = app_config_apply(apply);
+	if (ret) {
+		LOG_ERR("Failed to apply the configuration, err %d, rolling back", ret);
+		for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+			atomic_set(&values[i], old[i]);
+		}
+		(void)app_config_apply(apply);
+	} else {
+		for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+			if (app_config_get(i) != old[i]) {
+				LOG_INF("%s = %d", items[i].name, app_config_get(i));
+				app_config_save(i);
+			}
+		}
+	}
+
+	k_mutex_unlock(&config_lock);
+
+	return ret;
+}
+
+/* Render the settings as {"stream_interval_ms":50,...,"err":0} */
+static int app_config_json(char *buf, size_t len, int err)
+{
+	int off = 0;
+
+	off += snprintf(buf + off, len - off, "{");
+	for (int i = 0; i < APP_CONFIG_COUNT && off < len; i++) {
+		off += snprintf(buf + off, len - off, "\"%s\":%d,", items[i].name,
+				app_config_get(i));
+	}
+	if (off < len) {
+		off += snprintf(buf + off, len - off, "\"err\":%d}", err);
+	}
+
+	if (off >= len) {
+		return -ENOSPC;
+	}
+
+	return off;
+}
+
+/* State of a GET or POST request */
+struct app_config_request {
+	uint8_t post_payload_buf[256];
+	size_t cursor;
+	bool response_sent;
+};
+
+HTTP_REQ_POOL_DEFINE(app_config_http_reqs, struct app_config_request);
+
+int app_config_handler(struct http_client_ctx *client, enum http_data_status status,
+		       uint8_t *buffer, size_t len, void *user_data)
+{
+	struct app_config_request *req = user_data;
+	struct app_config_command cmd = {0};
+	enum app_config_id ids[APP_CONFIG_COUNT];
+	int32_t new_values[APP_CONFIG_COUNT];
+	size_t count = 0;
+	int err = 0;
+	int ret;
+
+	if (status == HTTP_SERVER_DATA_ABORTED) {
+		return 0;
+	}
+
+	if (len + req->cursor > sizeof(req->post_payload_buf) - 1) {
+		return -ENOMEM;
+	}
+
+	memcpy(req->post_payload_buf + req->cursor, buffer, len);
+	req->cursor += len;
+
+	if (status != HTTP_SERVER_DATA_FINAL) {
+		return 0;
+	}
+
+	if (req->response_sent) {
+		/* Response already sent, return 0 to end the response */
+		return 0;
+	}
+
+	if (client->method == HTTP_POST) {
+		req->post_payload_buf[req->cursor] = '\0';
+
+		ret = json_obj_parse(req->post_payload_buf, req->cursor, app_config_command_descr,
+				     ARRAY_SIZE(app_config_command_descr), &cmd);
+		if (ret < 0) {
+			err = ret;
+		} else {
+#define APP_CONFIG_VALUE(_id, _name, ...) [APP_CONFIG_##_id] = cmd._name,
+			const int32_t fields[APP_CONFIG_COUNT] = {
+				APP_CONFIG_ITEMS(APP_CONFIG_VALUE)
+			};
+#undef APP_CONFIG_VALUE
+
+			// The parser reports the fields in the order of the descriptors, the ids
+			for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+				if (ret & BIT(i)) {
+					ids[count] = i;
+					new_values[count] = fields[i];
+					count++;
+				}
+			}
+			err = app_config_set(ids, new_values, count);
+		}
+
+		if (err) {
+			LOG_WRN("Rejected configuration %s, err %d", req->post_payload_buf, err);
+		}
+	}
+
+	ret = app_config_json(buffer, APP_CONFIG_BUF_LEN, err);
+
+	// The server sends the response of a POST without calling again, a GET calls again for the
+	// end of its response
+	if (client->method == HTTP_POST) {
+		memset(req, 0, sizeof(*req));
+	} else {
+		req->response_sent = true;
+	}
+
+	return ret;
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_config_show(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+		shell_print(sh, "%-24s %6d  (%d..%d%s, default %d)", items[i].name,
+			    app_config_get(i), items[i].min, items[i].max,
+			    items[i].doubling ? " doubling" : "", items[i].def);
+	}
+
+	return 0;
+}
+
+static int cmd_config_set(const struct shell *sh, size_t argc, char **argv)
+{
+	enum app_config_id id;
+	int32_t value;
+	int ret;
+
+	ret = app_config_find(argv[1]);
+	if (ret < 0) {
+		shell_error(sh, "Unknown setting %s", argv[1]);
+		return ret;
+	}
+	id = ret;
+	value = strtol(argv[2], NULL, 10);
+
+	ret = app_config_set(&id, &value, 1);
+	if (ret == -EINVAL) {
+		shell_error(sh, "%d is not valid for %s", value, argv[1]);
+	} else if (ret) {
+		shell_error(sh, "Failed to apply %s, err %d", argv[1], ret);
+	}
+
+	return ret;
+}
+
+static int cmd_config_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	enum app_config_id ids[APP_CONFIG_COUNT];
+	int32_t defaults[APP_CONFIG_COUNT];
+	int ret;
+
+	for (int i = 0; i < APP_CONFIG_COUNT; i++) {
+		ids[i] = i;
+		defaults[i] = items[i].def;
+	}
+
+	ret = app_config_set(ids, defaults, APP_CONFIG_COUNT);
+	if (ret) {
+		shell_error(sh, "Failed to apply the defaults, err %d", ret);
+	}
+
+	return ret;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(config_cmds,
+			       SHELL_CMD(show, NULL, "Show the settings", cmd_config_show),
+			       SHELL_CMD_ARG(set, NULL, "Change a setting <name> <value>",
+					     cmd_config_set, 3, 0),
+			       SHELL_CMD(reset, NULL, "Restore the defaults", cmd_config_reset),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(config, &config_cmds, "Runtime settings", NULL);
+
+//////////////////////////////////////// Settings //////////////////////////////////////////
+
+static int app_config_settings_set(const char *key, size_t len, settings_read_cb read_cb,
+				   void *cb_arg)
+{
+	int32_t value;
+	int id;
+	int ret;
+
+	id = app_config_find(key);
+	if (id < 0 || len != sizeof(value)) {
+		LOG_WRN("Ignoring stored setting %s", key);
+		return 0;
+	}
+
+	ret = read_cb(cb_arg, &value, sizeof(value));
+	if (ret < 0) {
+		return ret;
+	}
+
+	// The limits may have changed since it was stored
+	if (!app_config_valid(id, value)) {
+		LOG_WRN("Ignoring stored %s = %d", key, value);
+		return 0;
+	}
+
+	atomic_set(&values[id], value);
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(app_config, "app", NULL, app_config_settings_set, NULL, NULL);
+
+static int app_config_init(void)
+{
+	int ret;
+
+	// Loaded before main() configures the sensors
+	ret = settings_subsys_init();
+	if (ret == 0) {
+		ret = settings_load_subtree("app");
+	}
+	if (ret) {
+		LOG_ERR("Failed to load the settings, err %d, using the defaults", ret);
+	}
+
+	return 0;
+}
+SYS_INIT(app_config_init, APPLICATION, 0);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/http/server.h>
+
+#include "sensors.h"
+
+/* Parts of the application that must be told about a change, see app_config_set() */
+enum app_config_apply {
+	APP_CONFIG_APPLY_NONE,    // Read again by its user for every sample or measurement
+	APP_CONFIG_APPLY_BMI270,  // The BMI270 is configured again
+	APP_CONFIG_APPLY_ADXL367, // The ADXL367 is configured again
+	APP_CONFIG_APPLY_THREADS, // The sampling threads are woken up to use the new interval
+};
+
+// The BMI270 and ADXL367 rates must not fall below the rates the IMU sampler polls at
+#ifdef CONFIG_APP_IMU_SAMPLER
+#define APP_CONFIG_BMI270_ODR_MIN  SENSORS_BMI270_RATE_HZ
+#define APP_CONFIG_ADXL367_ODR_MIN SENSORS_ADXL367_RATE_HZ
+#else
+#define APP_CONFIG_BMI270_ODR_MIN  25
+#define APP_CONFIG_ADXL367_ODR_MIN 25
+#endif // CONFIG_APP_IMU_SAMPLER
+
+// The BMI270 range must hold the shock threshold of the motion events
+#if !defined(CONFIG_APP_MOTION)
+#define APP_CONFIG_BMI270_ACCEL_RANGE_MIN 2
+#elif CONFIG_APP_MOTION_SHOCK_MG < 4000
+#define APP_CONFIG_BMI270_ACCEL_RANGE_MIN 4
+#elif CONFIG_APP_MOTION_SHOCK_MG < 8000
+#define APP_CONFIG_BMI270_ACCEL_RANGE_MIN 8
+#else
+#define APP_CONFIG_BMI270_ACCEL_RANGE_MIN 16
+#endif // CONFIG_APP_MOTION
+
+/*
+ * Runtime settings: X(id, name, default, min, max, doubling, apply). With doubling set only the
+ * minimum times a power of two is valid, for the rates and ranges of the sensors.
+ */
+#define APP_CONFIG_ITEMS(X)                                                                        \
+	X(STREAM_INTERVAL_MS, stream_interval_ms, CONFIG_NET_SAMPLE_WEBSOCKET_SENSOR_INTERVAL, 10, \
+	  10000, false, APP_CONFIG_APPLY_THREADS)                                                  \
+	X(BMI270_ODR_HZ, bmi270_odr_hz, SENSORS_BMI270_RATE_HZ, APP_CONFIG_BMI270_ODR_MIN, 1600,   \
+	  true, APP_CONFIG_APPLY_BMI270)                                                           \
+	X(BMI270_ACCEL_RANGE_G, bmi270_accel_range_g, APP_CONFIG_BMI270_ACCEL_RANGE_MIN,           \
+	  APP_CONFIG_BMI270_ACCEL_RANGE_MIN, 16, true, APP_CONFIG_APPLY_BMI270)                    \
+	X(BMI270_ACCEL_OSR, bmi270_accel_osr, 1, 1, 128, true, APP_CONFIG_APPLY_BMI270)            \
+	X(BMI270_GYRO_RANGE_DPS, bmi270_gyro_range_dps, 1000, 125, 2000, true,                     \
+	  APP_CONFIG_APPLY_BMI270)                                                                 \
+	X(BMI270_GYRO_OSR, bmi270_gyro_osr, 2, 1, 4, true, APP_CONFIG_APPLY_BMI270)                \
+	X(ADXL367_ODR_HZ, adxl367_odr_hz, SENSORS_ADXL367_RATE_HZ, APP_CONFIG_ADXL367_ODR_MIN,     \
+	  400, true, APP_CONFIG_APPLY_ADXL367)                                                     \
+	X(ENV_INTERVAL_MS, env_interval_ms, 250, 100, 60000, false, APP_CONFIG_APPLY_THREADS)
+
+enum app_config_id {
+#define APP_CONFIG_ID(id, ...) APP_CONFIG_##id,
+	APP_CONFIG_ITEMS(APP_CONFIG_ID)
+#undef APP_CONFIG_ID
+	APP_CONFIG_COUNT,
+};
+
+/**
+ * @brief Get the current value of a setting.
+ */
+int32_t app_config_get(enum app_config_id id);
+
+/**
+ * @brief Validate, apply and store a set of changes.
+ *
+ * Nothing changes unless all values are valid. The settings of one device are applied with a
+ * single reconfiguration, and if it fails all the changes are rolled back.
+ *
+ * @param ids Settings to change.
+ * @param values New values, in the order of ids.
+ * @return 0 if successful, -EINVAL if a value is out of range, negative error code otherwise.
+ */
+int app_config_set(const enum app_config_id *ids, const int32_t *values, size_t count);
+
+int app_config_handler(struct http_client_ctx *client, enum http_data_status status,
+		       uint8_t *buffer, size_t len, void *user_data);
+extern struct http_req_pool app_config_http_reqs;
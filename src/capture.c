@@ -0,0 +1,787 @@
+#include "app_config.h"
+#include "capture.h"
+#include "http_resources.h"
+#include "imu.h"
+#include "metrics.h"
+#include "power.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(CAPTURE, CONFIG_CAPTURE_LOG_LEVEL);
+
+// A capture records every BMI270 and ADXL367 sample for a fixed duration to the capture_storage
+// partition on the external flash. The IMU listener packs samples into one of two RAM blocks and
+// hands a full block to the capture thread, which erases the next flash block and writes it while
+// the listener fills the other one. A sample only gets lost if the flash falls a whole block
+// behind, and that is counted.
+//
+// Flash layout, in blocks of CONFIG_APP_CAPTURE_BLOCK_SIZE bytes:
+//   block 0      capture_header at offset 0, capture_footer at CAPTURE_FOOTER_OFFSET. The footer
+//                is programmed when the capture completes, so a capture without one is incomplete.
+//   block 1..n   records, RECORDS_PER_BLOCK in every block but the last
+//
+// Only the latest capture is kept, a new one overwrites it.
+//
+// The capture ends on the first IMU sample past its end. If the samples stop coming, a timeout
+// CONFIG_APP_CAPTURE_TIMEOUT_MS after the end or after a stop ends it in their place.
+
+#define CAPTURE_PARTITION_ID FIXED_PARTITION_ID(capture_storage)
+
+#define CAPTURE_MAGIC         0x54504143 // "CAPT"
+#define CAPTURE_VERSION       2
+#define CAPTURE_BLOCK_SIZE    CONFIG_APP_CAPTURE_BLOCK_SIZE
+#define CAPTURE_FOOTER_OFFSET 256
+
+// The ADXL367 driver runs at its default range of +-2 g, 0.25 mg per LSB
+#define ADXL367_SCALE (0.00025f * (float)GRAVITY)
+
+// Samples are stored in sensor LSBs, with the scales of the ranges the capture started with in the
+// header
+struct capture_record {
+	uint32_t t_us;  // Time since the start of the capture
+	uint8_t source; // enum imu_source
+	uint8_t reserved;
+	uint16_t seq;   // Per source, a gap shows a dropped sample
+	int16_t data[6];
+} __packed;
+
+struct capture_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t id;
+	uint32_t block_size;
+	int64_t start_us; // Uptime when the capture started
+	uint32_t duration_ms;
+	uint16_t bmi270_rate_hz;
+	uint16_t adxl367_rate_hz;
+	float accel_scale;   // BMI270 m/s^2 per LSB
+	float gyro_scale;    // BMI270 rad/s per LSB
+	float adxl367_scale; // ADXL367 m/s^2 per LSB
+} __packed;
+
+struct capture_footer {
+	uint32_t magic;
+	uint32_t records;
+	uint32_t dropped;
+	uint32_t duration_ms; // Actual duration, shorter if the capture was stopped
+} __packed;
+
+#define RECORDS_PER_BLOCK (CAPTURE_BLOCK_SIZE / sizeof(struct capture_record))
+
+BUILD_ASSERT(sizeof(struct capture_header) <= CAPTURE_FOOTER_OFFSET);
+BUILD_ASSERT(CAPTURE_FOOTER_OFFSET + sizeof(struct capture_footer) <= CAPTURE_BLOCK_SIZE);
+
+enum capture_state {
+	CAPTURE_IDLE,
+	CAPTURE_RUNNING,
+	CAPTURE_DONE,
+};
+
+static const char *const state_names[] = {
+	[CAPTURE_IDLE] = "idle",
+	[CAPTURE_RUNNING] = "running",
+	[CAPTURE_DONE] = "done",
+};
+
+struct capture_block_msg {
+	uint8_t block;
+	uint16_t records;
+	bool last;
+};
+
+static const struct flash_area *capture_fa;
+static uint32_t max_blocks;
+
+/* Protects the state, the header and footer, and the flash outside of the capture thread */
+static K_MUTEX_DEFINE(capture_lock);
+static enum capture_state state;
+static struct capture_header header;
+static struct capture_footer footer;
+static uint32_t last_id;
+
+// Listener state, only touched by the IMU thread while capturing
+static uint8_t blocks[2][CAPTURE_BLOCK_SIZE] __aligned(4);
+static atomic_t block_busy[2];
+static uint8_t active_block;
+static uint16_t active_records;
+static uint32_t blocks_submitted;
+static uint16_t seq[2];
+static int64_t end_us;
+
+static atomic_t capturing;
+static atomic_t stop_requested;
+static atomic_t dropped;
+
+static void capture_timeout_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(capture_timeout_work, capture_timeout_handler);
+
+K_MSGQ_DEFINE(capture_msgq, sizeof(struct capture_block_msg), 3, 4);
+
+K_THREAD_STACK_DEFINE(capture_stack_area, CONFIG_APP_CAPTURE_THREAD_STACK_SIZE);
+struct k_thread capture_thread_data;
+k_tid_t capture_thread_id;
+
+static int16_t to_lsb(float value, float scale)
+{
+	float lsb = roundf(value / scale);
+
+	return (int16_t)CLAMP(lsb, INT16_MIN, INT16_MAX);
+}
+
+/* Scale of a stored value, see struct capture_header */
+static float record_scale(const struct capture_record *record, int i)
+{
+	if (record->source != IMU_SOURCE_BMI270) {
+		return header.adxl367_scale;
+	}
+
+	return i < 3 ? header.accel_scale : header.gyro_scale;
+}
+
+////////////////////////////////////////// Recording ////////////////////////////////////////////
+
+static void submit_block(bool last)
+{
+	struct capture_block_msg msg = {
+		.block = active_block,
+		.records = active_records,
+		.last = last,
+	};
+
+	atomic_set(&block_busy[active_block], 1);
+	(void)k_msgq_put(&capture_msgq, &msg, K_NO_WAIT);
+
+	active_block ^= 1;
+	active_records = 0;
+	blocks_submitted++;
+}
+
+static void capture_on_sample(const struct imu_sample *sample)
+{
+	struct capture_record *record;
+
+	if (!atomic_get(&capturing)) {
+		return;
+	}
+
+	if (atomic_get(&stop_requested) || sample->timestamp_us >= end_us) {
+		atomic_clear(&capturing);
+		submit_block(true);
+		return;
+	}
+
+	if (atomic_get(&block_busy[active_block])) {
+		// The flash is a whole block behind
+		atomic_inc(&dropped);
+		seq[sample->source]++;
+		return;
+	}
+
+	record = (struct capture_record *)blocks[active_block] + active_records;
+	record->t_us = (uint32_t)(sample->timestamp_us - header.start_us);
+	record->source = sample->source;
+	record->reserved = 0;
+	record->seq = seq[sample->source]++;
+	for (int i = 0; i < ARRAY_SIZE(record->data); i++) {
+		record->data[i] = to_lsb(sample->data[i], record_scale(record, i));
+	}
+
+	if (++active_records == RECORDS_PER_BLOCK) {
+		bool full = blocks_submitted + 1 == max_blocks;
+
+		submit_block(full);
+		if (full) {
+			atomic_clear(&capturing);
+		}
+	}
+}
+
+static struct imu_listener capture_listener = {
+	.on_sample = capture_on_sample,
+};
+
+/* Write the footer and make the capture available for download */
+static void capture_finish(uint32_t records, int err)
+{
+	int64_t now_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	int ret;
+
+	(void)k_work_cancel_delayable(&capture_timeout_work);
+	imu_remove_listener(&capture_listener);
+	sensors_set_interval(0);
+	power_demand_put();
+
+	k_mutex_lock(&capture_lock, K_FOREVER);
+
+	footer.magic = CAPTURE_MAGIC;
+	footer.records = records;
+	footer.dropped = atomic_get(&dropped);
+	footer.duration_ms = (uint32_t)((now_us - header.start_us) / USEC_PER_MSEC);
+
+	ret = err;
+	if (ret == 0) {
+		ret = flash_area_write(capture_fa, CAPTURE_FOOTER_OFFSET, &footer, sizeof(footer));
+	}
+
+	state = ret == 0 ? CAPTURE_DONE : CAPTURE_IDLE;
+	http_resources_set_capture_id(state == CAPTURE_DONE ? header.id : 0);
+
+	k_mutex_unlock(&capture_lock);
+
+	if (ret) {
+		LOG_ERR("Capture %u failed, err %d", header.id, ret);
+		return;
+	}
+
+	LOG_INF("Capture %u done, %u records in %u ms, %u dropped", header.id, footer.records,
+		footer.duration_ms, footer.dropped);
+}
+
+/* End a capture that got no IMU sample past its end, with the samples recorded so far */
+static void capture_timeout_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&capture_lock, K_FOREVER);
+
+	if (state == CAPTURE_RUNNING && atomic_get(&capturing)) {
+		// Once removed, the listener no longer runs and its state is ours
+		imu_remove_listener(&capture_listener);
+		if (atomic_cas(&capturing, 1, 0)) {
+			LOG_WRN("Capture %u got no IMU sample for %d ms, ending it", header.id,
+				CONFIG_APP_CAPTURE_TIMEOUT_MS);
+			submit_block(true);
+		}
+	}
+
+	k_mutex_unlock(&capture_lock);
+}
+
+static void capture_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct capture_block_msg msg;
+	uint32_t blocks_written = 0;
+	uint32_t records = 0;
+	int err = 0;
+	int ret;
+
+	while (true) {
+		k_msgq_get(&capture_msgq, &msg, K_FOREVER);
+
+		if (msg.records > 0 && err == 0) {
+			off_t off = (off_t)(1 + blocks_written) * CAPTURE_BLOCK_SIZE;
+
+			ret = flash_area_erase(capture_fa, off, CAPTURE_BLOCK_SIZE);
+			if (ret == 0) {
+				ret = flash_area_write(capture_fa, off, blocks[msg.block],
+						       msg.records * sizeof(struct capture_record));
+			}
+
+			if (ret) {
+				LOG_ERR("Failed to write capture block %u, err %d", blocks_written,
+					ret);
+				err = ret;
+				atomic_set(&stop_requested, 1);
+			} else {
+				blocks_written++;
+				records += msg.records;
+			}
+		}
+
+		atomic_clear(&block_busy[msg.block]);
+
+		if (msg.last) {
+			capture_finish(records, err);
+			blocks_written = 0;
+			records = 0;
+			err = 0;
+		}
+	}
+}
+
+int capture_start(uint32_t duration_ms)
+{
+	uint32_t max_duration_ms;
+	int ret;
+
+	if (capture_fa == NULL) {
+		return -ENODEV;
+	}
+
+	// The duration is limited by the size of the partition
+	max_duration_ms = (uint32_t)((uint64_t)max_blocks * RECORDS_PER_BLOCK * MSEC_PER_SEC /
+				     (SENSORS_BMI270_RATE_HZ + SENSORS_ADXL367_RATE_HZ));
+	duration_ms = CLAMP(duration_ms, 1, max_duration_ms);
+
+	k_mutex_lock(&capture_lock, K_FOREVER);
+
+	if (state == CAPTURE_RUNNING) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	// The previous capture is gone as soon as its header is erased
+	state = CAPTURE_IDLE;
+	http_resources_set_capture_id(0);
+
+	ret = flash_area_erase(capture_fa, 0, CAPTURE_BLOCK_SIZE);
+	if (ret) {
+		LOG_ERR("Failed to erase the capture header, err %d", ret);
+		goto out;
+	}
+
+	header = (struct capture_header){
+		.magic = CAPTURE_MAGIC,
+		.version = CAPTURE_VERSION,
+		.record_size = sizeof(struct capture_record),
+		.id = ++last_id,
+		.block_size = CAPTURE_BLOCK_SIZE,
+		.start_us = k_ticks_to_us_floor64(k_uptime_ticks()),
+		.duration_ms = duration_ms,
+		.bmi270_rate_hz = SENSORS_BMI270_RATE_HZ,
+		.adxl367_rate_hz = SENSORS_ADXL367_RATE_HZ,
+		.accel_scale = app_config_get(APP_CONFIG_BMI270_ACCEL_RANGE_G) * (float)GRAVITY /
+			       32768.0f,
+		.gyro_scale = app_config_get(APP_CONFIG_BMI270_GYRO_RANGE_DPS) * (float)PI /
+			      (180.0f * 32768.0f),
+		.adxl367_scale = ADXL367_SCALE,
+	};
+	memset(&footer, 0, sizeof(footer));
+
+	ret = flash_area_write(capture_fa, 0, &header, sizeof(header));
+	if (ret) {
+		LOG_ERR("Failed to write the capture header, err %d", ret);
+		goto out;
+	}
+
+	active_block = 0;
+	active_records = 0;
+	blocks_submitted = 0;
+	memset(seq, 0, sizeof(seq));
+	end_us = header.start_us + (int64_t)duration_ms * USEC_PER_MSEC;
+	atomic_clear(&dropped);
+	atomic_clear(&stop_requested);
+
+	power_demand_get();
+
+	state = CAPTURE_RUNNING;
+	atomic_set(&capturing, 1);
+	imu_add_listener(&capture_listener);
+	k_work_reschedule(&capture_timeout_work,
+			  K_MSEC((int64_t)duration_ms + CONFIG_APP_CAPTURE_TIMEOUT_MS));
+
+	// Slow down the live stream to leave the buses to the capture
+	sensors_set_interval(CONFIG_APP_CAPTURE_LIVE_INTERVAL);
+
+	LOG_INF("Capture %u started for %u ms", header.id, duration_ms);
+	ret = header.id;
+
+out:
+	k_mutex_unlock(&capture_lock);
+
+	return ret;
+}
+
+int capture_stop(void)
+{
+	if (!atomic_get(&capturing)) {
+		return -EALREADY;
+	}
+
+	atomic_set(&stop_requested, 1);
+	k_work_reschedule(&capture_timeout_work, K_MSEC(CONFIG_APP_CAPTURE_TIMEOUT_MS));
+
+	return 0;
+}
+
+/* Render the capture status as JSON */
+static int capture_status_json(char *buf, size_t len)
+{
+	int ret;
+
+	k_mutex_lock(&capture_lock, K_FOREVER);
+	ret = snprintf(buf, len,
+		       "{\"state\":\"%s\",\"id\":%u,\"duration_ms\":%u,\"records\":%u,"
+		       "\"dropped\":%u}",
+		       state_names[state], header.magic == CAPTURE_MAGIC ? header.id : 0,
+		       state == CAPTURE_DONE ? footer.duration_ms : header.duration_ms,
+		       footer.records, state == CAPTURE_DONE ? footer.dropped
+							     : (uint32_t)atomic_get(&dropped));
+	k_mutex_unlock(&capture_lock);
+
+	return MIN(ret, len - 1);
+}
+
+////////////////////////////////////////// /capture //////////////////////////////////////////
+
+/* State of a GET or POST request */
+struct capture_request {
+	uint8_t post_payload_buf[64];
+	size_t cursor;
+	bool response_sent;
+};
+
+HTTP_REQ_POOL_DEFINE(capture_http_reqs, struct capture_request);
+
+int capture_handler(struct http_client_ctx *client, enum http_data_status status, uint8_t *buffer,
+		    size_t len, void *user_data)
+{
+	struct capture_request *req = user_data;
+	struct capture_command cmd;
+	int ret;
+
+	if (status == HTTP_SERVER_DATA_ABORTED) {
+		return 0;
+	}
+
+	if (len + req->cursor > sizeof(req->post_payload_buf) - 1) {
+		return -ENOMEM;
+	}
+
+	memcpy(req->post_payload_buf + req->cursor, buffer, len);
+	req->cursor += len;
+
+	if (status != HTTP_SERVER_DATA_FINAL) {
+		return 0;
+	}
+
+	if (req->response_sent) {
+		/* Response already sent, return 0 to end the response */
+		return 0;
+	}
+
+	if (client->method == HTTP_POST) {
+		req->post_payload_buf[req->cursor] = '\0';
+		memset(&cmd, 0, sizeof(cmd));
+
+		ret = json_obj_parse(req->post_payload_buf, req->cursor, capture_command_descr,
+				     ARRAY_SIZE(capture_command_descr), &cmd);
+		if (ret < 0 || !(ret & BIT(0))) {
+			LOG_WRN("Failed to parse capture command, ret=%d", ret);
+		} else if (strcmp(cmd.action, "start") == 0) {
+			ret = capture_start(cmd.seconds > 0 ? cmd.seconds * MSEC_PER_SEC
+							    : CONFIG_APP_CAPTURE_DEFAULT_DURATION_S *
+								      MSEC_PER_SEC);
+			if (ret < 0) {
+				LOG_WRN("Failed to start capture, err %d", ret);
+			}
+		} else if (strcmp(cmd.action, "stop") == 0) {
+			(void)capture_stop();
+		}
+	}
+
+	ret = capture_status_json(buffer, CAPTURE_BUF_LEN);
+
+	// The server sends the response of a POST without calling again, a GET calls again for the
+	// end of its response
+	if (client->method == HTTP_POST) {
+		memset(req, 0, sizeof(*req));
+	} else {
+		req->response_sent = true;
+	}
+
+	return ret;
+}
+
+//////////////////////////////////////// /capture/<id> //////////////////////////////////////////
+
+/* State of a download, zeroed by the request pool at the start of every request */
+struct capture_download {
+	uint32_t id;
+	uint32_t record;
+	bool started;
+	bool header_sent;
+	bool done;
+};
+
+HTTP_REQ_POOL_DEFINE(capture_download_http_reqs, struct capture_download);
+
+static int read_records(uint32_t index, uint32_t count, void *out)
+{
+	off_t off = (off_t)(1 + index / RECORDS_PER_BLOCK) * CAPTURE_BLOCK_SIZE +
+		    (index % RECORDS_PER_BLOCK) * sizeof(struct capture_record);
+
+	return flash_area_read(capture_fa, off, out, count * sizeof(struct capture_record));
+}
+
+/* Parse the capture id from "/capture/<id>.csv" */
+static uint32_t parse_id(const char *url)
+{
+	const char *id = strstr(url, "/capture/");
+
+	return id == NULL ? 0 : strtoul(id + strlen("/capture/"), NULL, 10);
+}
+
+/* Raw download: the header, the footer, then the records back to back */
+static size_t render_bin(struct capture_download *req, uint8_t *buf, size_t len)
+{
+	size_t off = 0;
+	uint32_t count;
+
+	if (!req->header_sent) {
+		memcpy(buf, &header, sizeof(header));
+		memcpy(buf + sizeof(header), &footer, sizeof(footer));
+		off = sizeof(header) + sizeof(footer);
+		req->header_sent = true;
+	}
+
+	while (req->record < footer.records) {
+		// Records are contiguous within a block
+		count = MIN((len - off) / sizeof(struct capture_record),
+			    RECORDS_PER_BLOCK - req->record % RECORDS_PER_BLOCK);
+		count = MIN(count, footer.records - req->record);
+		if (count == 0) {
+			return off;
+		}
+
+		if (read_records(req->record, count, buf + off) != 0) {
+			break;
+		}
+
+		off += count * sizeof(struct capture_record);
+		req->record += count;
+	}
+
+	req->done = true;
+
+	return off;
+}
+
+/* CSV download with one row per sample in SI units */
+static size_t render_csv(struct capture_download *req, uint8_t *buf, size_t len)
+{
+	struct capture_record record;
+	char row[96];
+	size_t off = 0;
+	int ret;
+
+	if (!req->header_sent) {
+		ret = snprintf(buf, len, "t_us,source,seq,ax,ay,az,gx,gy,gz\n");
+		off = ret;
+		req->header_sent = true;
+	}
+
+	while (req->record < footer.records) {
+		if (read_records(req->record, 1, &record) != 0) {
+			break;
+		}
+
+		if (record.source == IMU_SOURCE_BMI270) {
+			ret = snprintf(row, sizeof(row), "%u,bmi270,%u,%.4f,%.4f,%.4f,%.5f,%.5f,%.5f\n",
+				       record.t_us, record.seq, record.data[0] * header.accel_scale,
+				       record.data[1] * header.accel_scale,
+				       record.data[2] * header.accel_scale,
+				       record.data[3] * header.gyro_scale,
+				       record.data[4] * header.gyro_scale,
+				       record.data[5] * header.gyro_scale);
+		} else {
+			ret = snprintf(row, sizeof(row), "%u,adxl367,%u,%.4f,%.4f,%.4f,,,\n",
+				       record.t_us, record.seq, record.data[0] * header.adxl367_scale,
+				       record.data[1] * header.adxl367_scale,
+				       record.data[2] * header.adxl367_scale);
+		}
+
+		// The row only counts as sent if it fits, otherwise it goes in the next chunk
+		if (off + ret > len) {
+			return off;
+		}
+
+		memcpy(buf + off, row, ret);
+		off += ret;
+		req->record++;
+	}
+
+	req->done = true;
+
+	return off;
+}
+
+static int capture_download(struct http_client_ctx *client, enum http_data_status status,
+			    uint8_t *buffer, struct capture_download *req, bool csv)
+{
+	size_t ret;
+
+	switch (status) {
+	case HTTP_SERVER_DATA_ABORTED: {
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_MORE: {
+		/* A payload is not expected with the GET request */
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_FINAL: {
+		if (!req->started) {
+			req->id = parse_id(client->url_buffer);
+			req->started = true;
+		}
+
+		if (req->done) {
+			/* Response complete, return 0 to end the chunked transfer */
+			return 0;
+		}
+
+		k_mutex_lock(&capture_lock, K_FOREVER);
+
+		if (state != CAPTURE_DONE || header.id != req->id) {
+			// Not available, or overwritten by a new capture while downloading
+			req->done = true;
+			ret = 0;
+		} else if (csv) {
+			ret = render_csv(req, buffer, CAPTURE_BUF_LEN);
+		} else {
+			ret = render_bin(req, buffer, CAPTURE_BUF_LEN);
+		}
+
+		k_mutex_unlock(&capture_lock);
+
+		return ret;
+	}
+	default: {
+		LOG_WRN("Unexpected status %d", status);
+		return -1;
+	}
+	}
+}
+
+int capture_csv_handler(struct http_client_ctx *client, enum http_data_status status,
+			uint8_t *buffer, size_t len, void *user_data)
+{
+	ARG_UNUSED(len);
+
+	return capture_download(client, status, buffer, user_data, true);
+}
+
+int capture_bin_handler(struct http_client_ctx *client, enum http_data_status status,
+			uint8_t *buffer, size_t len, void *user_data)
+{
+	ARG_UNUSED(len);
+
+	return capture_download(client, status, buffer, user_data, false);
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_capture_start(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t seconds = CONFIG_APP_CAPTURE_DEFAULT_DURATION_S;
+	int ret;
+
+	if (argc > 1) {
+		seconds = strtoul(argv[1], NULL, 10);
+	}
+
+	ret = capture_start(seconds * MSEC_PER_SEC);
+	if (ret < 0) {
+		shell_error(sh, "Failed to start capture, err %d", ret);
+		return ret;
+	}
+
+	shell_print(sh, "Capture %d started", ret);
+
+	return 0;
+}
+
+static int cmd_capture_stop(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	if (capture_stop() != 0) {
+		shell_print(sh, "No capture running");
+	}
+
+	return 0;
+}
+
+static int cmd_capture_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	char status[128];
+
+	capture_status_json(status, sizeof(status));
+	shell_print(sh, "%s", status);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(capture_cmds,
+			       SHELL_CMD_ARG(start, NULL, "Start a capture [seconds]",
+					     cmd_capture_start, 1, 1),
+			       SHELL_CMD(stop, NULL, "Stop the running capture", cmd_capture_stop),
+			       SHELL_CMD(status, NULL, "Show the capture status", cmd_capture_status),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(capture, &capture_cmds, "High-rate IMU capture to flash", NULL);
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void capture_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_capture_dropped_samples", "gauge",
+		       "Samples dropped by the running or last capture");
+	metrics_printf(w, "thingy_capture_dropped_samples %u\n",
+		       (uint32_t)atomic_get(&dropped));
+}
+
+static struct metrics_collector capture_collector = {
+	.collect = capture_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int capture_init(void)
+{
+	int ret;
+
+	ret = flash_area_open(CAPTURE_PARTITION_ID, &capture_fa);
+	if (ret) {
+		LOG_ERR("Failed to open the capture partition, err %d", ret);
+		capture_fa = NULL;
+		return 0;
+	}
+
+	max_blocks = capture_fa->fa_size / CAPTURE_BLOCK_SIZE - 1;
+
+	// Pick up the capture stored before the reboot
+	if (flash_area_read(capture_fa, 0, &header, sizeof(header)) == 0 &&
+	    header.magic == CAPTURE_MAGIC && header.version == CAPTURE_VERSION) {
+		last_id = header.id;
+
+		if (flash_area_read(capture_fa, CAPTURE_FOOTER_OFFSET, &footer, sizeof(footer)) ==
+			    0 &&
+		    footer.magic == CAPTURE_MAGIC) {
+			state = CAPTURE_DONE;
+			http_resources_set_capture_id(header.id);
+		} else {
+			memset(&footer, 0, sizeof(footer));
+		}
+	} else {
+		memset(&header, 0, sizeof(header));
+	}
+
+	capture_thread_id = k_thread_create(&capture_thread_data, capture_stack_area,
+					    K_THREAD_STACK_SIZEOF(capture_stack_area),
+					    capture_thread, NULL, NULL, NULL, 6, 0, K_NO_WAIT);
+	k_thread_name_set(capture_thread_id, "capture");
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&capture_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(capture_init, APPLICATION, 0);
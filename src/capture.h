@@ -0,0 +1,30 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/http/server.h>
+
+/**
+ * @brief Start recording every accelerometer and gyroscope sample to flash.
+ *
+ * Overwrites the previous capture. The duration is limited to what fits in the partition.
+ *
+ * @return Id of the new capture, -EBUSY if a capture is running, negative error code otherwise.
+ */
+int capture_start(uint32_t duration_ms);
+
+/**
+ * @brief Stop the running capture early. The samples recorded so far are kept.
+ *
+ * @return 0 if successful, -EALREADY if no capture is running.
+ */
+int capture_stop(void);
+
+int capture_handler(struct http_client_ctx *client, enum http_data_status status, uint8_t *buffer,
+		    size_t len, void *user_data);
+int capture_csv_handler(struct http_client_ctx *client, enum http_data_status status,
+			uint8_t *buffer, size_t len, void *user_data);
+int capture_bin_handler(struct http_client_ctx *client, enum http_data_status status,
+			uint8_t *buffer, size_t len, void *user_data);
+extern struct http_req_pool capture_http_reqs;
+/* Shared by the CSV and binary downloads */
+extern struct http_req_pool capture_download_http_reqs;
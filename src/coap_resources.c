@@ -0,0 +1,414 @@
+#include "http_resources.h"
+#include "led.h"
+#include "metrics.h"
+#include "sensors.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/data/json.h>
+#include <zephyr/init.h>
+#include <zephyr/net/coap.h>
+#include <zephyr/net/coap_service.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zcbor_decode.h>
+#include <zcbor_encode.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(COAP_RESOURCES, CONFIG_COAP_RESOURCES_LOG_LEVEL);
+
+// CoAP server for constrained gateways that cannot hold a websocket or an HTTP/1.1 session. The
+// payloads are CBOR:
+//
+//   GET/observe /sensors   {"ts": <us>, "valid": <bits>, "v": [<float32>, ...]}
+//   GET/observe /location  {"lat": <float>, "lon": <float>, "acc": <float>}
+//   PUT         /led       [r, g, b]
+//
+// The sensor resource takes the latest sample of the acquisition thread, so observers cost no bus
+// reads. A work item checks for a new sample every CONFIG_APP_COAP_NOTIFY_INTERVAL_MS, encodes it
+// once and notifies all observers. The notifications are non-confirmable, except every
+// CONFIG_APP_COAP_CON_INTERVAL-th one, which lets the server drop observers that went away.
+
+#define COAP_PAYLOAD_LEN 128
+
+static uint16_t coap_port = CONFIG_APP_COAP_PORT;
+
+COAP_SERVICE_DEFINE(thingy_coap, NULL, &coap_port, COAP_SERVICE_AUTOSTART);
+
+static void coap_notify_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(coap_notify_work, coap_notify_work_handler);
+
+// Encoded once per notification round, read by the notify callbacks
+static uint8_t sensors_payload[COAP_PAYLOAD_LEN];
+static size_t sensors_payload_len;
+static int64_t notified_us;
+
+static uint8_t location_payload[COAP_PAYLOAD_LEN];
+static size_t location_payload_len;
+
+static atomic_t notifications;
+static atomic_t notified_bytes;
+
+/* Encode a sample as {"ts": <us>, "valid": <bits>, "v": [<float32>, ...]} */
+static int coap_encode_sample(const struct sensor_sample *sample, uint8_t *buf, size_t len)
+{
+	ZCBOR_STATE_E(state, 1, buf, len, 0);
+	bool ok;
+
+	ok = zcbor_map_start_encode(state, 3) && zcbor_tstr_put_lit(state, "ts") &&
+	     zcbor_int64_put(state, sample->timestamp_us) && zcbor_tstr_put_lit(state, "valid") &&
+	     zcbor_uint32_put(state, sample->valid) && zcbor_tstr_put_lit(state, "v") &&
+	     zcbor_list_start_encode(state, NUM_SENSOR_MEASUREMENTS);
+
+	for (int i = 0; ok && i < NUM_SENSOR_MEASUREMENTS; i++) {
+		ok = zcbor_float32_put(state, (float)sample->data[i]);
+	}
+
+	ok = ok && zcbor_list_end_encode(state, NUM_SENSOR_MEASUREMENTS) &&
+	     zcbor_map_end_encode(state, 3);
+	if (!ok) {
+		return -ENOSPC;
+	}
+
+	return state->payload - buf;
+}
+
+struct location_reply {
+	struct json_obj_token lat;
+	struct json_obj_token lon;
+	struct json_obj_token uncertainty;
+};
+
+static const struct json_obj_descr location_reply_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct location_reply, lat, JSON_TOK_FLOAT),
+	JSON_OBJ_DESCR_PRIM(struct location_reply, lon, JSON_TOK_FLOAT),
+	JSON_OBJ_DESCR_PRIM(struct location_reply, uncertainty, JSON_TOK_FLOAT),
+};
+
+static float coap_token_to_float(const struct json_obj_token *token)
+{
+	char str[24];
+
+	memcpy(str, token->start, MIN(token->length, sizeof(str) - 1));
+	str[MIN(token->length, sizeof(str) - 1)] = '\0';
+
+	return strtof(str, NULL);
+}
+
+/* Encode the last nRF Cloud location reply as {"lat": .., "lon": .., "acc": ..} */
+static int coap_encode_location(uint8_t *buf, size_t len)
+{
+	struct location_reply reply;
+	char json[256];
+	bool ok;
+	int ret;
+
+	// The parser works in place, so on a copy
+	strncpy(json, (const char *)location_buf, sizeof(json) - 1);
+	json[sizeof(json) - 1] = '\0';
+
+	ret = json_obj_parse(json, strlen(json), location_reply_descr,
+			     ARRAY_SIZE(location_reply_descr), &reply);
+	if (ret != BIT_MASK(ARRAY_SIZE(location_reply_descr))) {
+		return -ENODATA;
+	}
+
+	ZCBOR_STATE_E(state, 1, buf, len, 0);
+
+	ok = zcbor_map_start_encode(state, 3) && zcbor_tstr_put_lit(state, "lat") &&
+	     zcbor_float32_put(state, coap_token_to_float(&reply.lat)) &&
+	     zcbor_tstr_put_lit(state, "lon") &&
+	     zcbor_float32_put(state, coap_token_to_float(&reply.lon)) &&
+	     zcbor_tstr_put_lit(state, "acc") &&
+	     zcbor_float32_put(state, coap_token_to_float(&reply.uncertainty)) &&
+	     zcbor_map_end_encode(state, 3);
+	if (!ok) {
+		return -ENOSPC;
+	}
+
+	return state->payload - buf;
+}
+
+/**
+ * @brief Send a response or a notification.
+ *
+ * @param request Request to answer, NULL for a notification.
+ * @param observe Value of the observe option, negative to leave it out.
+ * @return Size of the message if successful, negative error code otherwise.
+ */
+static int coap_send(struct coap_resource *resource, const struct coap_packet *request,
+		     const struct sockaddr *addr, socklen_t addr_len, const uint8_t *token,
+		     uint8_t tkl, uint8_t code, int observe, const uint8_t *payload, size_t len)
+{
+	uint8_t buf[CONFIG_COAP_SERVER_MESSAGE_SIZE];
+	struct coap_packet response;
+	uint8_t type;
+	uint16_t id;
+	int ret;
+
+	if (request != NULL) {
+		type = coap_header_get_type(request) == COAP_TYPE_CON ? COAP_TYPE_ACK
+								       : COAP_TYPE_NON_CON;
+		id = type == COAP_TYPE_ACK ? coap_header_get_id(request) : coap_next_id();
+	} else {
+		type = observe % CONFIG_APP_COAP_CON_INTERVAL == 0 ? COAP_TYPE_CON
+								    : COAP_TYPE_NON_CON;
+		id = coap_next_id();
+	}
+
+	ret = coap_packet_init(&response, buf, sizeof(buf), COAP_VERSION_1, type, tkl, token, code,
+			       id);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (observe >= 0) {
+		ret = coap_append_option_int(&response, COAP_OPTION_OBSERVE, observe);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	if (payload != NULL) {
+		ret = coap_append_option_int(&response, COAP_OPTION_CONTENT_FORMAT,
+					     COAP_CONTENT_FORMAT_APP_CBOR);
+		if (ret < 0) {
+			return ret;
+		}
+
+		ret = coap_append_option_int(&response, COAP_OPTION_MAX_AGE,
+					     CONFIG_APP_COAP_MAX_AGE_S);
+		if (ret < 0) {
+			return ret;
+		}
+
+		ret = coap_packet_append_payload_marker(&response);
+		if (ret < 0) {
+			return ret;
+		}
+
+		ret = coap_packet_append_payload(&response, payload, len);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	ret = coap_resource_send(resource, &response, addr, addr_len, NULL);
+	if (ret < 0) {
+		return ret;
+	}
+
+	return response.offset;
+}
+
+/* Answer a GET, and register or remove the client as an observer if it asks for it */
+static int coap_get(struct coap_resource *resource, struct coap_packet *request,
+		    struct sockaddr *addr, socklen_t addr_len, const uint8_t *payload, size_t len)
+{
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	uint8_t tkl;
+	int observe;
+	int ret;
+
+	tkl = coap_header_get_token(request, token);
+	observe = coap_resource_parse_observe(resource, request, addr);
+
+	if (len == 0) {
+		ret = coap_send(resource, request, addr, addr_len, token, tkl,
+				COAP_RESPONSE_CODE_SERVICE_UNAVAILABLE, -1, NULL, 0);
+	} else {
+		ret = coap_send(resource, request, addr, addr_len, token, tkl,
+				COAP_RESPONSE_CODE_CONTENT, observe == 0 ? resource->age : -1,
+				payload, len);
+	}
+
+	return MIN(ret, 0);
+}
+
+//////////////////////////////////////// Sensors //////////////////////////////////////////
+
+static int coap_sensors_get(struct coap_resource *resource, struct coap_packet *request,
+			    struct sockaddr *addr, socklen_t addr_len)
+{
+	struct sensor_sample sample;
+	uint8_t payload[COAP_PAYLOAD_LEN];
+	int ret;
+
+	ret = sensors_get_latest(&sample);
+	if (ret == 0) {
+		ret = coap_encode_sample(&sample, payload, sizeof(payload));
+	}
+
+	return coap_get(resource, request, addr, addr_len, payload, MAX(ret, 0));
+}
+
+static void coap_sensors_notify(struct coap_resource *resource, struct coap_observer *observer)
+{
+	int ret;
+
+	ret = coap_send(resource, NULL, &observer->addr, sizeof(observer->addr), observer->token,
+			observer->tkl, COAP_RESPONSE_CODE_CONTENT, resource->age, sensors_payload,
+			sensors_payload_len);
+	if (ret < 0) {
+		LOG_DBG("Failed to notify, err %d", ret);
+		return;
+	}
+
+	atomic_inc(&notifications);
+	atomic_add(&notified_bytes, ret);
+}
+
+static const char *const sensors_path[] = {"sensors", NULL};
+
+COAP_RESOURCE_DEFINE(coap_sensors, thingy_coap,
+		     {
+			     .get = coap_sensors_get,
+			     .notify = coap_sensors_notify,
+			     .path = sensors_path,
+		     });
+
+//////////////////////////////////////// Location //////////////////////////////////////////
+
+static int coap_location_get(struct coap_resource *resource, struct coap_packet *request,
+			     struct sockaddr *addr, socklen_t addr_len)
+{
+	uint8_t payload[COAP_PAYLOAD_LEN];
+	int ret;
+
+	ret = coap_encode_location(payload, sizeof(payload));
+
+	return coap_get(resource, request, addr, addr_len, payload, MAX(ret, 0));
+}
+
+static void coap_location_notify(struct coap_resource *resource, struct coap_observer *observer)
+{
+	(void)coap_send(resource, NULL, &observer->addr, sizeof(observer->addr), observer->token,
+			observer->tkl, COAP_RESPONSE_CODE_CONTENT, resource->age, location_payload,
+			location_payload_len);
+}
+
+static const char *const location_path[] = {"location", NULL};
+
+COAP_RESOURCE_DEFINE(coap_location, thingy_coap,
+		     {
+			     .get = coap_location_get,
+			     .notify = coap_location_notify,
+			     .path = location_path,
+		     });
+
+//////////////////////////////////////// LED //////////////////////////////////////////
+
+static int coap_led_put(struct coap_resource *resource, struct coap_packet *request,
+			struct sockaddr *addr, socklen_t addr_len)
+{
+	uint8_t token[COAP_TOKEN_MAX_LEN];
+	const uint8_t *payload;
+	uint32_t rgb[3];
+	uint16_t len;
+	uint8_t code;
+	uint8_t tkl;
+	bool ok;
+
+	tkl = coap_header_get_token(request, token);
+	payload = coap_packet_get_payload(request, &len);
+
+	ZCBOR_STATE_D(state, 1, payload, len, 1, 0);
+
+	ok = payload != NULL && zcbor_list_start_decode(state) &&
+	     zcbor_uint32_decode(state, &rgb[0]) && zcbor_uint32_decode(state, &rgb[1]) &&
+	     zcbor_uint32_decode(state, &rgb[2]) && zcbor_list_end_decode(state) &&
+	     rgb[0] <= UINT8_MAX && rgb[1] <= UINT8_MAX && rgb[2] <= UINT8_MAX;
+
+	if (!ok) {
+		code = COAP_RESPONSE_CODE_BAD_REQUEST;
+	} else if (pwm_set_color(rgb[0], rgb[1], rgb[2])) {
+		code = COAP_RESPONSE_CODE_INTERNAL_ERROR;
+	} else {
+		code = COAP_RESPONSE_CODE_CHANGED;
+	}
+
+	return MIN(coap_send(resource, request, addr, addr_len, token, tkl, code, -1, NULL, 0), 0);
+}
+
+static const char *const led_path[] = {"led", NULL};
+
+COAP_RESOURCE_DEFINE(coap_led, thingy_coap,
+		     {
+			     .put = coap_led_put,
+			     .post = coap_led_put,
+			     .path = led_path,
+		     });
+
+//////////////////////////////////////// Notifications //////////////////////////////////////////
+
+static void coap_notify_work_handler(struct k_work *work)
+{
+	struct sensor_sample sample;
+	int ret;
+
+	if (!sys_slist_is_empty(&coap_sensors.observers) && sensors_get_latest(&sample) == 0 &&
+	    sample.timestamp_us > notified_us) {
+		ret = coap_encode_sample(&sample, sensors_payload, sizeof(sensors_payload));
+		if (ret > 0) {
+			sensors_payload_len = ret;
+			notified_us = sample.timestamp_us;
+			coap_resource_notify(&coap_sensors);
+		}
+	}
+
+	// The location changes rarely, so only a new encoding is notified
+	if (!sys_slist_is_empty(&coap_location.observers)) {
+		uint8_t payload[COAP_PAYLOAD_LEN];
+
+		ret = coap_encode_location(payload, sizeof(payload));
+		if (ret > 0 && (ret != location_payload_len ||
+				memcmp(payload, location_payload, ret) != 0)) {
+			memcpy(location_payload, payload, ret);
+			location_payload_len = ret;
+			coap_resource_notify(&coap_location);
+		}
+	}
+
+	k_work_reschedule(&coap_notify_work, K_MSEC(CONFIG_APP_COAP_NOTIFY_INTERVAL_MS));
+}
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void coap_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_coap_observers", "gauge", "Observers of the CoAP resources");
+	metrics_printf(w, "thingy_coap_observers{resource=\"sensors\"} %zu\n",
+		       sys_slist_len(&coap_sensors.observers));
+	metrics_printf(w, "thingy_coap_observers{resource=\"location\"} %zu\n",
+		       sys_slist_len(&coap_location.observers));
+
+	metrics_header(w, "thingy_coap_notifications_total", "counter",
+		       "Sensor notifications sent to the CoAP observers");
+	metrics_printf(w, "thingy_coap_notifications_total %u\n",
+		       (uint32_t)atomic_get(&notifications));
+
+	metrics_header(w, "thingy_coap_notified_bytes_total", "counter",
+		       "Bytes of the sensor notifications, CoAP header included");
+	metrics_printf(w, "thingy_coap_notified_bytes_total %u\n",
+		       (uint32_t)atomic_get(&notified_bytes));
+}
+
+static struct metrics_collector coap_collector = {
+	.collect = coap_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int coap_resources_init(void)
+{
+	k_work_schedule(&coap_notify_work, K_MSEC(CONFIG_APP_COAP_NOTIFY_INTERVAL_MS));
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&coap_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(coap_resources_init, APPLICATION, 0);
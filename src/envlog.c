@@ -0,0 +1,565 @@
+#include "envlog.h"
+#include "http_resources.h"
+#include "metrics.h"
+#include "sensors.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/fs/fcb.h>
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(ENVLOG, CONFIG_ENVLOG_LOG_LEVEL);
+
+// The environmental log keeps the BME680 temperature, pressure and humidity across reboots. It is
+// a round robin database with two tiers, each a flash circular buffer (FCB) on its own range of
+// sectors in the envlog_storage partition. FCB only appends and erases the oldest sector when the
+// buffer is full, so the wear is spread evenly over the sectors of a tier.
+//
+// The sensor listener only sums up samples. When a fine window closes it queues one record, and
+// the envlog thread writes it to flash and folds it into the coarse window. Neither the flash
+// writes nor the sector erases ever run on the acquisition thread.
+//
+// There is no wall clock, so a record is stamped with the boot number and the uptime at the start
+// of its window. The boot number is one more than the newest record found at startup. A window
+// that is open when the device resets is lost.
+
+#define ENVLOG_PARTITION_ID FIXED_PARTITION_ID(envlog_storage)
+
+#define ENVLOG_NUM_SECTORS (CONFIG_APP_ENVLOG_FINE_SECTORS + CONFIG_APP_ENVLOG_COARSE_SECTORS)
+#define ENVLOG_FCB_VERSION 1
+
+BUILD_ASSERT(CONFIG_APP_ENVLOG_COARSE_RESOLUTION_S % CONFIG_APP_ENVLOG_FINE_RESOLUTION_S == 0,
+	     "The coarse resolution must be a multiple of the fine resolution");
+
+struct envlog_record {
+	uint16_t boot;
+	uint16_t samples;
+	uint32_t uptime_s;   // Start of the window
+	int16_t temperature; // 0.01 °C
+	uint16_t pressure;   // 0.01 kPa
+	uint16_t humidity;   // 0.01 %RH
+} __packed;
+
+struct envlog_tier {
+	const char *name;
+	uint32_t magic;
+	uint32_t resolution_s;
+	struct fcb fcb;
+	atomic_t records_written;
+};
+
+enum {
+	TIER_FINE,
+	TIER_COARSE,
+	NUM_TIERS,
+};
+
+static struct envlog_tier tiers[NUM_TIERS] = {
+	[TIER_FINE] =
+		{
+			.name = "fine",
+			.magic = 0x454e5646, // "ENVF"
+			.resolution_s = CONFIG_APP_ENVLOG_FINE_RESOLUTION_S,
+		},
+	[TIER_COARSE] =
+		{
+			.name = "coarse",
+			.magic = 0x454e5643, // "ENVC"
+			.resolution_s = CONFIG_APP_ENVLOG_COARSE_RESOLUTION_S,
+		},
+};
+
+static struct flash_sector sectors[ENVLOG_NUM_SECTORS];
+
+/* Serializes flash access between the envlog thread, HTTP queries and the shell */
+static K_MUTEX_DEFINE(envlog_lock);
+static bool envlog_ready;
+static uint16_t boot_number;
+
+K_MSGQ_DEFINE(envlog_msgq, sizeof(struct envlog_record), CONFIG_APP_ENVLOG_QUEUE_SIZE, 4);
+
+K_THREAD_STACK_DEFINE(envlog_stack_area, CONFIG_APP_ENVLOG_THREAD_STACK_SIZE);
+struct k_thread envlog_thread_data;
+k_tid_t envlog_thread_id;
+
+static atomic_t records_dropped;
+
+/* Running sums of the window being accumulated, in the stored units */
+struct envlog_window {
+	uint32_t start_s;
+	uint32_t samples;
+	double temperature;
+	double pressure;
+	double humidity;
+};
+
+static uint16_t quantize(double value)
+{
+	return (uint16_t)CLAMP(round(value), 0, UINT16_MAX);
+}
+
+static void window_to_record(const struct envlog_window *window, struct envlog_record *record)
+{
+	record->boot = boot_number;
+	record->samples = MIN(window->samples, UINT16_MAX);
+	record->uptime_s = window->start_s;
+	record->temperature =
+		(int16_t)CLAMP(round(window->temperature / window->samples), INT16_MIN, INT16_MAX);
+	record->pressure = quantize(window->pressure / window->samples);
+	record->humidity = quantize(window->humidity / window->samples);
+}
+
+////////////////////////////////////////// Sampling ////////////////////////////////////////////
+
+static struct envlog_window fine_window;
+
+static void envlog_on_sample(const struct sensor_sample *sample)
+{
+	uint32_t now_s = (uint32_t)(sample->timestamp_us / USEC_PER_SEC);
+	uint32_t start_s = now_s - now_s % CONFIG_APP_ENVLOG_FINE_RESOLUTION_S;
+
+	if ((sample->valid & SENSORS_VALID_BME680) != SENSORS_VALID_BME680) {
+		return;
+	}
+
+	if (fine_window.samples > 0 && start_s != fine_window.start_s) {
+		struct envlog_record record;
+
+		window_to_record(&fine_window, &record);
+		if (k_msgq_put(&envlog_msgq, &record, K_NO_WAIT) != 0) {
+			atomic_inc(&records_dropped);
+		}
+		fine_window.samples = 0;
+	}
+
+	if (fine_window.samples == 0) {
+		memset(&fine_window, 0, sizeof(fine_window));
+		fine_window.start_s = start_s;
+	}
+
+	fine_window.temperature += sample->data[SENSOR_CH_BME680_TEMPERATURE] * 100.0;
+	fine_window.pressure += sample->data[SENSOR_CH_BME680_PRESSURE] * 100.0;
+	fine_window.humidity += sample->data[SENSOR_CH_BME680_HUMIDITY] * 100.0;
+	fine_window.samples++;
+}
+
+static struct sensors_listener envlog_listener = {
+	.on_sample = envlog_on_sample,
+};
+
+////////////////////////////////////////// Storage /////////////////////////////////////////////
+
+static int tier_append(struct envlog_tier *tier, const struct envlog_record *record)
+{
+	struct fcb_entry loc;
+	int ret;
+
+	k_mutex_lock(&envlog_lock, K_FOREVER);
+
+	ret = fcb_append(&tier->fcb, sizeof(*record), &loc);
+	if (ret == -ENOSPC) {
+		// Full, drop the oldest sector and retry
+		ret = fcb_rotate(&tier->fcb);
+		if (ret == 0) {
+			ret = fcb_append(&tier->fcb, sizeof(*record), &loc);
+		}
+	}
+
+	if (ret == 0) {
+		ret = flash_area_write(tier->fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), record,
+				       sizeof(*record));
+	}
+
+	if (ret == 0) {
+		ret = fcb_append_finish(&tier->fcb, &loc);
+	}
+
+	k_mutex_unlock(&envlog_lock);
+
+	if (ret == 0) {
+		atomic_inc(&tier->records_written);
+	} else {
+		LOG_ERR("Failed to append to the %s tier, err %d", tier->name, ret);
+	}
+
+	return ret;
+}
+
+static int tier_read(struct envlog_tier *tier, struct fcb_entry *loc, struct envlog_record *record)
+{
+	if (loc->fe_data_len != sizeof(*record)) {
+		return -EINVAL;
+	}
+
+	return flash_area_read(tier->fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), record, sizeof(*record));
+}
+
+/* Find the highest boot number stored in a tier */
+static uint16_t tier_last_boot(struct envlog_tier *tier)
+{
+	struct fcb_entry loc = {0};
+	struct envlog_record record;
+	uint16_t boot = 0;
+
+	while (fcb_getnext(&tier->fcb, &loc) == 0) {
+		if (tier_read(tier, &loc, &record) == 0) {
+			boot = MAX(boot, record.boot);
+		}
+	}
+
+	return boot;
+}
+
+static int envlog_storage_init(void)
+{
+	uint32_t sector_cnt = ARRAY_SIZE(sectors);
+	uint16_t last_boot = 0;
+	int ret;
+
+	ret = flash_area_get_sectors(ENVLOG_PARTITION_ID, &sector_cnt, sectors);
+	if (ret && ret != -ENOMEM) {
+		LOG_ERR("Failed to get the envlog sectors, err %d", ret);
+		return ret;
+	}
+
+	if (sector_cnt < ENVLOG_NUM_SECTORS) {
+		LOG_ERR("The envlog partition has %u sectors, %u are needed", sector_cnt,
+			ENVLOG_NUM_SECTORS);
+		return -ENOSPC;
+	}
+
+	tiers[TIER_FINE].fcb.f_sectors = &sectors[0];
+	tiers[TIER_FINE].fcb.f_sector_cnt = CONFIG_APP_ENVLOG_FINE_SECTORS;
+	tiers[TIER_COARSE].fcb.f_sectors = &sectors[CONFIG_APP_ENVLOG_FINE_SECTORS];
+	tiers[TIER_COARSE].fcb.f_sector_cnt = CONFIG_APP_ENVLOG_COARSE_SECTORS;
+
+	for (int i = 0; i < NUM_TIERS; i++) {
+		struct envlog_tier *tier = &tiers[i];
+
+		tier->fcb.f_magic = tier->magic;
+		tier->fcb.f_version = ENVLOG_FCB_VERSION;
+		tier->fcb.f_scratch_cnt = 0;
+
+		ret = fcb_init(ENVLOG_PARTITION_ID, &tier->fcb);
+		if (ret && tier->fcb.fap == NULL) {
+			LOG_ERR("Failed to open the envlog partition, err %d", ret);
+			return ret;
+		}
+
+		// A log of another layout, or sectors that still hold other data, are erased so
+		// that appends always land on erased flash
+		if (ret || fcb_is_empty(&tier->fcb)) {
+			LOG_INF("Erasing the %s tier", tier->name);
+			ret = fcb_clear(&tier->fcb);
+			if (ret) {
+				LOG_ERR("Failed to clear the %s tier, err %d", tier->name, ret);
+				return ret;
+			}
+		}
+
+		last_boot = MAX(last_boot, tier_last_boot(tier));
+	}
+
+	boot_number = last_boot + 1;
+	LOG_INF("Environmental log ready, boot %u", boot_number);
+
+	return 0;
+}
+
+static void envlog_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct envlog_window coarse_window = {0};
+	struct envlog_record record;
+
+	// Scanning the log for the boot number reads the whole partition, so it is done here rather
+	// than at init
+	if (envlog_storage_init() != 0) {
+		return;
+	}
+
+	k_mutex_lock(&envlog_lock, K_FOREVER);
+	envlog_ready = true;
+	k_mutex_unlock(&envlog_lock);
+
+	sensors_add_listener(&envlog_listener);
+
+	while (true) {
+		k_msgq_get(&envlog_msgq, &record, K_FOREVER);
+
+		tier_append(&tiers[TIER_FINE], &record);
+
+		// Fold the fine record into the coarse window, weighted by its number of samples
+		uint32_t start_s =
+			record.uptime_s - record.uptime_s % CONFIG_APP_ENVLOG_COARSE_RESOLUTION_S;
+
+		if (coarse_window.samples > 0 && start_s != coarse_window.start_s) {
+			struct envlog_record coarse;
+
+			window_to_record(&coarse_window, &coarse);
+			tier_append(&tiers[TIER_COARSE], &coarse);
+			coarse_window.samples = 0;
+		}
+
+		if (coarse_window.samples == 0) {
+			memset(&coarse_window, 0, sizeof(coarse_window));
+			coarse_window.start_s = start_s;
+		}
+
+		coarse_window.temperature += (double)record.temperature * record.samples;
+		coarse_window.pressure += (double)record.pressure * record.samples;
+		coarse_window.humidity += (double)record.humidity * record.samples;
+		coarse_window.samples += record.samples;
+	}
+}
+
+//////////////////////////////////////// GET /envlog //////////////////////////////////////////
+
+// The response holds the records of one tier, oldest first, as [boot, uptime s, temperature °C,
+// pressure kPa, humidity %RH]:
+// {"resolution":10,"boot":3,"records":[[2,120,23.51,101.32,41.20],[3,0,23.60,101.33,41.10]]}
+// The log is read from flash one record at a time while the response is being sent.
+
+struct envlog_request {
+	struct envlog_tier *tier;
+	struct fcb_entry loc;
+	uint16_t min_boot;
+	bool started;
+	bool header_sent;
+	bool record_sent;
+	bool done;
+};
+
+/* Parse "tier=fine|coarse&boot=<n>" from the query string of the request URL */
+static void parse_query(const char *url, struct envlog_request *req)
+{
+	const char *query = strchr(url, '?');
+
+	req->tier = &tiers[TIER_FINE];
+	req->min_boot = 0;
+
+	while (query != NULL && *query != '\0') {
+		query++;
+
+		if (strncmp(query, "tier=", strlen("tier=")) == 0) {
+			const char *name = query + strlen("tier=");
+			size_t name_len = strcspn(name, "&");
+
+			for (int i = 0; i < NUM_TIERS; i++) {
+				if (strlen(tiers[i].name) == name_len &&
+				    strncmp(name, tiers[i].name, name_len) == 0) {
+					req->tier = &tiers[i];
+				}
+			}
+		} else if (strncmp(query, "boot=", strlen("boot=")) == 0) {
+			req->min_boot = strtoul(query + strlen("boot="), NULL, 10);
+		}
+
+		query = strchr(query, '&');
+	}
+}
+
+/* Render the next token of the response and advance the request state */
+static int render_token(struct envlog_request *req, char *token, size_t size)
+{
+	struct envlog_record record;
+
+	if (!req->header_sent) {
+		req->header_sent = true;
+		return snprintf(token, size, "{\"resolution\":%u,\"boot\":%u,\"records\":[",
+				req->tier->resolution_s, boot_number);
+	}
+
+	do {
+		if (fcb_getnext(&req->tier->fcb, &req->loc) != 0) {
+			req->done = true;
+			return snprintf(token, size, "]}");
+		}
+	} while (tier_read(req->tier, &req->loc, &record) != 0 || record.boot < req->min_boot);
+
+	bool first_record = !req->record_sent;
+
+	req->record_sent = true;
+
+	return snprintf(token, size, "%s[%u,%u,%.2f,%.2f,%.2f]", first_record ? "" : ",",
+			record.boot, record.uptime_s, record.temperature / 100.0,
+			record.pressure / 100.0, record.humidity / 100.0);
+}
+
+/* Append at most len bytes of the response, returns the number of bytes written */
+static size_t envlog_render(struct envlog_request *req, char *buf, size_t len)
+{
+	struct envlog_request next;
+	size_t off = 0;
+	char token[64];
+	int ret;
+
+	k_mutex_lock(&envlog_lock, K_FOREVER);
+
+	while (!req->done) {
+		next = *req;
+		ret = render_token(&next, token, sizeof(token));
+
+		// The state only advances if the token fits, otherwise it goes in the next chunk
+		if (off + ret > len) {
+			break;
+		}
+
+		memcpy(buf + off, token, ret);
+		off += ret;
+		*req = next;
+	}
+
+	k_mutex_unlock(&envlog_lock);
+
+	return off;
+}
+
+HTTP_REQ_POOL_DEFINE(envlog_http_reqs, struct envlog_request);
+
+int envlog_handler(struct http_client_ctx *client, enum http_data_status status, uint8_t *buffer,
+		   size_t len, void *user_data)
+{
+	ARG_UNUSED(len);
+
+	struct envlog_request *req = user_data;
+
+	switch (status) {
+	case HTTP_SERVER_DATA_ABORTED: {
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_MORE: {
+		/* A payload is not expected with the GET request */
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_FINAL: {
+		if (!req->started) {
+			parse_query(client->url_buffer, req);
+			req->started = true;
+
+			if (!envlog_ready) {
+				req->header_sent = true;
+				req->done = true;
+				return snprintf(buffer, ENVLOG_BUF_LEN, "{\"records\":[]}");
+			}
+		}
+
+		if (req->done) {
+			/* Response complete, return 0 to end the chunked transfer */
+			return 0;
+		}
+
+		return envlog_render(req, buffer, ENVLOG_BUF_LEN);
+	}
+	default: {
+		LOG_WRN("Unexpected status %d", status);
+		return -1;
+	}
+	}
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_envlog_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	if (!envlog_ready) {
+		shell_print(sh, "Environmental log not ready");
+		return -ENODEV;
+	}
+
+	shell_print(sh, "Boot %u, %u records dropped", boot_number,
+		    (uint32_t)atomic_get(&records_dropped));
+
+	k_mutex_lock(&envlog_lock, K_FOREVER);
+	for (int i = 0; i < NUM_TIERS; i++) {
+		shell_print(sh, "%-6s %4u s  %u/%u sectors free  %u records written since boot",
+			    tiers[i].name, tiers[i].resolution_s, fcb_free_sector_cnt(&tiers[i].fcb),
+			    tiers[i].fcb.f_sector_cnt, (uint32_t)atomic_get(&tiers[i].records_written));
+	}
+	k_mutex_unlock(&envlog_lock);
+
+	return 0;
+}
+
+static int cmd_envlog_erase(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+	int ret = 0;
+
+	if (!envlog_ready) {
+		shell_print(sh, "Environmental log not ready");
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&envlog_lock, K_FOREVER);
+	for (int i = 0; i < NUM_TIERS && ret == 0; i++) {
+		ret = fcb_clear(&tiers[i].fcb);
+	}
+	k_mutex_unlock(&envlog_lock);
+
+	if (ret) {
+		shell_error(sh, "Failed to erase the environmental log, err %d", ret);
+		return ret;
+	}
+
+	shell_print(sh, "Environmental log erased");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(envlog_cmds,
+			       SHELL_CMD(status, NULL, "Show the log tiers", cmd_envlog_status),
+			       SHELL_CMD(erase, NULL, "Erase all records", cmd_envlog_erase),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(envlog, &envlog_cmds, "Environmental log on flash", NULL);
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void envlog_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_envlog_records_written_total", "counter",
+		       "Environmental log records written since boot");
+	for (int i = 0; i < NUM_TIERS; i++) {
+		metrics_printf(w, "thingy_envlog_records_written_total{tier=\"%s\"} %u\n",
+			       tiers[i].name, (uint32_t)atomic_get(&tiers[i].records_written));
+	}
+
+	metrics_header(w, "thingy_envlog_records_dropped_total", "counter",
+		       "Environmental log records dropped because the write queue was full");
+	metrics_printf(w, "thingy_envlog_records_dropped_total %u\n",
+		       (uint32_t)atomic_get(&records_dropped));
+}
+
+static struct metrics_collector envlog_collector = {
+	.collect = envlog_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int envlog_init(void)
+{
+	envlog_thread_id = k_thread_create(&envlog_thread_data, envlog_stack_area,
+					   K_THREAD_STACK_SIZEOF(envlog_stack_area), envlog_thread,
+					   NULL, NULL, NULL, 10, 0, K_NO_WAIT);
+	k_thread_name_set(envlog_thread_id, "envlog");
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&envlog_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(envlog_init, APPLICATION, 0);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/http/server.h>
+
+int envlog_handler(struct http_client_ctx *client, enum http_data_status status, uint8_t *buffer,
+		   size_t len, void *user_data);
+extern struct http_req_pool envlog_http_reqs;
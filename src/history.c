@@ -0,0 +1,392 @@
+#include "history.h"
+#include "http_resources.h"
+#include "sensors.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(HISTORY, CONFIG_HISTORY_LOG_LEVEL);
+
+// The history keeps the last minutes of the charted channels in RAM so that a newly opened page
+// can draw them at once. Channels that are sampled at the same resolution share a group, and
+// each group stores rows of one timestamp and one int16 value per channel. A row is the average of
+// all samples within one resolution period.
+//
+// A group whose channels are not measured, e.g. the BMI270 while the sensors are suspended, stops
+// getting rows. Its first unmeasured sample writes a gap row of HISTORY_GAP values, sent as null,
+// so the charts do not draw a line across the pause.
+
+#define HISTORY_GAP INT16_MIN
+
+struct history_channel {
+	const char *name;
+	uint8_t index;   // Index in sensor_sample.data
+	uint8_t group;   // Index in groups[]
+	uint8_t column;  // Column within the group's rows
+	uint16_t scale;  // Stored value = SI value * scale
+};
+
+enum {
+	GROUP_IMU,
+	GROUP_ENV,
+	NUM_GROUPS,
+};
+
+#define IMU_COLUMNS 6
+#define ENV_COLUMNS 3
+
+static const struct history_channel channels[] = {
+	{"bmi270_ax", SENSOR_CH_BMI270_AX, GROUP_IMU, 0, 1000},
+	{"bmi270_ay", SENSOR_CH_BMI270_AY, GROUP_IMU, 1, 1000},
+	{"bmi270_az", SENSOR_CH_BMI270_AZ, GROUP_IMU, 2, 1000},
+	{"bmi270_gx", SENSOR_CH_BMI270_GX, GROUP_IMU, 3, 1000},
+	{"bmi270_gy", SENSOR_CH_BMI270_GY, GROUP_IMU, 4, 1000},
+	{"bmi270_gz", SENSOR_CH_BMI270_GZ, GROUP_IMU, 5, 1000},
+	{"bme680_temperature", SENSOR_CH_BME680_TEMPERATURE, GROUP_ENV, 0, 100},
+	{"bme680_pressure", SENSOR_CH_BME680_PRESSURE, GROUP_ENV, 1, 100},
+	{"bme680_humidity", SENSOR_CH_BME680_HUMIDITY, GROUP_ENV, 2, 100},
+};
+
+struct history_group {
+	uint32_t resolution_ms;
+	uint16_t depth;
+	uint8_t columns;
+
+	// Ring of rows. Row number n (counting from boot) is stored at n % depth.
+	uint32_t *t_ms;
+	int16_t *values;
+	uint32_t rows_written;
+
+	// Running average for the row being accumulated
+	uint32_t window_start_ms;
+	uint32_t window_count;
+	double window_sum[IMU_COLUMNS];
+
+	bool gap; // The last row is a gap row
+};
+
+static uint32_t imu_t_ms[CONFIG_APP_HISTORY_IMU_DEPTH];
+static int16_t imu_values[CONFIG_APP_HISTORY_IMU_DEPTH * IMU_COLUMNS];
+static uint32_t env_t_ms[CONFIG_APP_HISTORY_ENV_DEPTH];
+static int16_t env_values[CONFIG_APP_HISTORY_ENV_DEPTH * ENV_COLUMNS];
+
+static struct history_group groups[NUM_GROUPS] = {
+	[GROUP_IMU] =
+		{
+			.resolution_ms = CONFIG_APP_HISTORY_IMU_RESOLUTION_MS,
+			.depth = CONFIG_APP_HISTORY_IMU_DEPTH,
+			.columns = IMU_COLUMNS,
+			.t_ms = imu_t_ms,
+			.values = imu_values,
+		},
+	[GROUP_ENV] =
+		{
+			.resolution_ms = CONFIG_APP_HISTORY_ENV_RESOLUTION_MS,
+			.depth = CONFIG_APP_HISTORY_ENV_DEPTH,
+			.columns = ENV_COLUMNS,
+			.t_ms = env_t_ms,
+			.values = env_values,
+		},
+};
+
+static K_MUTEX_DEFINE(history_lock);
+
+static int16_t quantize(double value, uint16_t scale)
+{
+	double scaled = round(value * scale);
+
+	return (int16_t)CLAMP(scaled, HISTORY_GAP + 1, INT16_MAX);
+}
+
+/* Append a row with the average of the window, or a gap row without it */
+static void history_write_row(struct history_group *group, int g, uint32_t t_ms, bool gap)
+{
+	uint32_t row = group->rows_written % group->depth;
+
+	group->t_ms[row] = t_ms;
+	for (int i = 0; i < ARRAY_SIZE(channels); i++) {
+		if (channels[i].group != g) {
+			continue;
+		}
+
+		group->values[row * group->columns + channels[i].column] =
+			gap ? HISTORY_GAP
+			    : quantize(group->window_sum[channels[i].column] / group->window_count,
+				       channels[i].scale);
+	}
+
+	group->rows_written++;
+	group->window_count = 0;
+	group->gap = gap;
+}
+
+static void history_on_sample(const struct sensor_sample *sample)
+{
+	uint32_t now_ms = (uint32_t)(sample->timestamp_us / USEC_PER_MSEC);
+
+	k_mutex_lock(&history_lock, K_FOREVER);
+
+	for (int g = 0; g < NUM_GROUPS; g++) {
+		struct history_group *group = &groups[g];
+		bool valid = true;
+
+		for (int i = 0; i < ARRAY_SIZE(channels); i++) {
+			if (channels[i].group == g && !(sample->valid & BIT(channels[i].index))) {
+				valid = false;
+			}
+		}
+
+		// Rows are only built from measured values
+		if (!valid) {
+			if (group->window_count > 0) {
+				history_write_row(group, g, group->window_start_ms, false);
+			}
+			if (group->rows_written > 0 && !group->gap) {
+				history_write_row(group, g, now_ms, true);
+			}
+			continue;
+		}
+
+		if (group->window_count > 0 &&
+		    now_ms - group->window_start_ms >= group->resolution_ms) {
+			history_write_row(group, g, group->window_start_ms, false);
+		}
+
+		if (group->window_count == 0) {
+			group->window_start_ms = now_ms;
+			memset(group->window_sum, 0, sizeof(group->window_sum));
+		}
+
+		for (int i = 0; i < ARRAY_SIZE(channels); i++) {
+			if (channels[i].group == g) {
+				group->window_sum[channels[i].column] += sample->data[channels[i].index];
+			}
+		}
+		group->window_count++;
+	}
+
+	k_mutex_unlock(&history_lock);
+}
+
+static struct sensors_listener history_listener = {
+	.on_sample = history_on_sample,
+};
+
+static int history_init(void)
+{
+	sensors_add_listener(&history_listener);
+
+	return 0;
+}
+SYS_INIT(history_init, APPLICATION, 0);
+
+//////////////////////////////////////// GET /history //////////////////////////////////////////
+
+// The response is a JSON object with one array of [seconds, value] points per channel, in the same
+// units and time base as the websocket frames:
+// {"bme680_temperature":[[12.000,23.51],[13.000,23.52]],"bmi270_ax":[...]}
+
+struct history_request {
+	uint32_t channel_mask;
+	uint32_t since_ms;
+	int channel;  // Channel being sent, -1 before the opening brace
+	uint32_t row; // Next row number of the channel being sent
+	bool started;
+	bool first_point;
+	bool row_sent;
+	bool done;
+};
+
+static int find_channel(const char *name, size_t len)
+{
+	for (int i = 0; i < ARRAY_SIZE(channels); i++) {
+		if (strlen(channels[i].name) == len && strncmp(channels[i].name, name, len) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/* Parse "channels=a,b,c&since=<us>" from the query string of the request URL */
+static void parse_query(const char *url, struct history_request *req)
+{
+	const char *query = strchr(url, '?');
+
+	req->channel_mask = BIT_MASK(ARRAY_SIZE(channels));
+	req->since_ms = 0;
+
+	while (query != NULL && *query != '\0') {
+		query++;
+
+		if (strncmp(query, "channels=", strlen("channels=")) == 0) {
+			const char *name = query + strlen("channels=");
+
+			req->channel_mask = 0;
+			while (*name != '\0' && *name != '&') {
+				size_t name_len = strcspn(name, ",&");
+				int channel = find_channel(name, name_len);
+
+				if (channel >= 0) {
+					req->channel_mask |= BIT(channel);
+				}
+
+				name += name_len;
+				if (*name == ',') {
+					name++;
+				}
+			}
+		} else if (strncmp(query, "since=", strlen("since=")) == 0) {
+			req->since_ms = strtoull(query + strlen("since="), NULL, 10) / USEC_PER_MSEC;
+		}
+
+		query = strchr(query, '&');
+	}
+}
+
+/* Find the next channel in the request and the oldest row to send for it */
+static void next_channel(struct history_request *req)
+{
+	do {
+		req->channel++;
+	} while (req->channel < ARRAY_SIZE(channels) && !(req->channel_mask & BIT(req->channel)));
+
+	if (req->channel >= ARRAY_SIZE(channels)) {
+		return;
+	}
+
+	struct history_group *group = &groups[channels[req->channel].group];
+
+	req->row = group->rows_written > group->depth ? group->rows_written - group->depth : 0;
+	while (req->row < group->rows_written &&
+	       group->t_ms[req->row % group->depth] < req->since_ms) {
+		req->row++;
+	}
+	req->first_point = true;
+	req->row_sent = false;
+}
+
+/* Render the next token of the response and advance the request state */
+static int render_token(struct history_request *req, char *token, size_t size)
+{
+	int ret;
+
+	if (req->channel < 0) {
+		next_channel(req);
+		return snprintf(token, size, "{");
+	}
+
+	if (req->channel >= ARRAY_SIZE(channels)) {
+		req->done = true;
+		return snprintf(token, size, "}");
+	}
+
+	const struct history_channel *ch = &channels[req->channel];
+	struct history_group *group = &groups[ch->group];
+
+	// Rows overwritten while the response was being sent are skipped
+	if (group->rows_written > group->depth && req->row < group->rows_written - group->depth) {
+		req->row = group->rows_written - group->depth;
+	}
+
+	if (req->first_point) {
+		bool first_channel = (req->channel_mask & BIT_MASK(req->channel)) == 0;
+
+		req->first_point = false;
+		return snprintf(token, size, "%s\"%s\":[", first_channel ? "" : ",", ch->name);
+	}
+
+	if (req->row >= group->rows_written) {
+		next_channel(req);
+		return snprintf(token, size, "]");
+	}
+
+	uint32_t row = req->row % group->depth;
+	int16_t value = group->values[row * group->columns + ch->column];
+
+	if (value == HISTORY_GAP) {
+		ret = snprintf(token, size, "%s[%u.%03u,null]", req->row_sent ? "," : "",
+			       group->t_ms[row] / MSEC_PER_SEC, group->t_ms[row] % MSEC_PER_SEC);
+	} else {
+		ret = snprintf(token, size, "%s[%u.%03u,%.3f]", req->row_sent ? "," : "",
+			       group->t_ms[row] / MSEC_PER_SEC, group->t_ms[row] % MSEC_PER_SEC,
+			       (double)value / ch->scale);
+	}
+	req->row++;
+	req->row_sent = true;
+
+	return ret;
+}
+
+/* Append at most len bytes of the response, returns the number of bytes written */
+static size_t history_render(struct history_request *req, char *buf, size_t len)
+{
+	struct history_request next;
+	size_t off = 0;
+	char token[48];
+	int ret;
+
+	k_mutex_lock(&history_lock, K_FOREVER);
+
+	while (!req->done) {
+		next = *req;
+		ret = render_token(&next, token, sizeof(token));
+
+		// The state only advances if the token fits, otherwise it goes in the next chunk
+		if (off + ret > len) {
+			break;
+		}
+
+		memcpy(buf + off, token, ret);
+		off += ret;
+		*req = next;
+	}
+
+	k_mutex_unlock(&history_lock);
+
+	return off;
+}
+
+HTTP_REQ_POOL_DEFINE(history_http_reqs, struct history_request);
+
+int history_handler(struct http_client_ctx *client, enum http_data_status status, uint8_t *buffer,
+		    size_t len, void *user_data)
+{
+	ARG_UNUSED(len);
+
+	struct history_request *req = user_data;
+
+	switch (status) {
+	case HTTP_SERVER_DATA_ABORTED: {
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_MORE: {
+		/* A payload is not expected with the GET request */
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_FINAL: {
+		if (!req->started) {
+			req->channel = -1;
+			parse_query(client->url_buffer, req);
+			req->started = true;
+		}
+
+		if (req->done) {
+			/* Response complete, return 0 to end the chunked transfer */
+			return 0;
+		}
+
+		return history_render(req, buffer, HISTORY_BUF_LEN);
+	}
+	default: {
+		LOG_WRN("Unexpected status %d", status);
+		return -1;
+	}
+	}
+}
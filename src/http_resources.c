@@ -1,11 +1,119 @@
 
 #include "http_resources.h"
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(http_resources, CONFIG_LOG_DEFAULT_LEVEL);
+
 //////////////////////////////////////// HTTP Service //////////////////////////////////////////
 
 static uint16_t test_http_service_port = CONFIG_NET_SAMPLE_HTTP_SERVER_SERVICE_PORT;
 HTTP_SERVICE_DEFINE(test_http_service, NULL, &test_http_service_port, 1, 10, NULL);
 
+//////////////////////////////////////// Request States //////////////////////////////////////////
+// Every dynamic resource is served by http_resources_dynamic_cb(), which finds the request of the
+// calling client in the pool of the resource and hands its state to the handler. The server holds
+// a dynamic resource for the client whose request it started and answers the others with 409
+// Conflict until that request is complete, so the callbacks of one resource only come from one
+// client at a time and the pools hold a single request.
+
+/* Handler of a dynamic resource and the states of its requests */
+struct http_dynamic {
+	struct http_resource_detail_dynamic *detail;
+	http_resource_dynamic_cb_t handler;
+	struct http_req_pool *reqs;
+};
+
+/**
+ * @brief Find the request of a client, or start one.
+ *
+ * A request whose client went away without an abort keeps its state until another request needs
+ * the slot. Only the client that holds the resource calls in, so when no slot is free the least
+ * recently used one is taken over, its client is no longer served.
+ *
+ * @return The request, NULL if the client has none and start is false.
+ */
+static struct http_req *http_req_get(struct http_req_pool *pool, struct http_client_ctx *client,
+				     bool start)
+{
+	int64_t now = k_uptime_get();
+	struct http_req *reuse = NULL;
+	struct http_req *oldest = NULL;
+
+	for (int i = 0; i < pool->count; i++) {
+		struct http_req *req = &pool->reqs[i];
+
+		if (req->client == client && req->fd == client->fd) {
+			req->used_ms = now;
+			return req;
+		}
+
+		// A free slot, or one left behind on this client context by an earlier connection
+		if (req->client == NULL || req->client == client) {
+			reuse = reuse ? reuse : req;
+		} else if (oldest == NULL || req->used_ms < oldest->used_ms) {
+			oldest = req;
+		}
+	}
+
+	if (!start) {
+		return NULL;
+	}
+
+	if (reuse == NULL) {
+		reuse = oldest;
+		LOG_DBG("Taking over the request of socket %d, idle for %lld ms", reuse->fd,
+			now - reuse->used_ms);
+	}
+
+	reuse->client = client;
+	reuse->fd = client->fd;
+	reuse->used_ms = now;
+	memset(pool->states + (reuse - pool->reqs) * pool->size, 0, pool->size);
+
+	return reuse;
+}
+
+static int http_resources_dynamic_cb(struct http_client_ctx *client, enum http_data_status status,
+				     uint8_t *buffer, size_t len, void *user_data)
+{
+	struct http_dynamic *dynamic = user_data;
+	struct http_req_pool *pool = dynamic->reqs;
+	struct http_req *req;
+	int ret;
+
+	req = http_req_get(pool, client, status != HTTP_SERVER_DATA_ABORTED);
+	if (req == NULL) {
+		return 0;
+	}
+
+	ret = dynamic->handler(client, status, buffer, len,
+			       pool->states + (req - pool->reqs) * pool->size);
+
+	// The server calls a GET again with HTTP_SERVER_DATA_FINAL for every chunk of the response,
+	// until the handler returns 0. The response of any other method is sent without another
+	// call. The next request on the connection starts with a zeroed state.
+	if (status == HTTP_SERVER_DATA_ABORTED || ret < 0 ||
+	    (status == HTTP_SERVER_DATA_FINAL && (client->method != HTTP_GET || ret == 0))) {
+		req->client = NULL;
+	}
+
+	return ret;
+}
+
+static void http_resources_set_dynamic(struct http_dynamic *dynamic,
+				       http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs)
+{
+	dynamic->handler = handler;
+	dynamic->reqs = reqs;
+	dynamic->detail->user_data = dynamic;
+	dynamic->detail->cb = http_resources_dynamic_cb;
+}
+
 //////////////////////////////////////// HTTP Resources //////////////////////////////////////////
 
 ////////////////// Index HTML //////////////////
@@ -162,14 +270,22 @@ static struct http_resource_detail_dynamic led_resource_detail = {
 
 HTTP_RESOURCE_DEFINE(led_resource, test_http_service, "/led", &led_resource_detail);
 
-void http_resources_set_led_handler(http_resource_dynamic_cb_t handler)
+static struct http_dynamic led_dynamic = {
+	.detail = &led_resource_detail,
+};
+
+void http_resources_set_led_handler(http_resource_dynamic_cb_t handler,
+				    struct http_req_pool *reqs)
 {
-	led_resource_detail.cb = handler;
+	http_resources_set_dynamic(&led_dynamic, handler, reqs);
 }
 
 ///////////////////// JWT Resource //////////////////
 // This is the resource that is used to get the JWT token from the server.
 // It is a dynamic resource that accepts POST requests with JSON payloads.
+// Only registered with Wi-Fi, the location lookup needs the scan results.
+
+#ifdef CONFIG_WIFI
 
 static uint8_t jwt_buf[512]; // Buffer to store the JSON payload
 static struct http_resource_detail_dynamic jwt_resource_detail = {
@@ -187,10 +303,16 @@ static struct http_resource_detail_dynamic jwt_resource_detail = {
 
 HTTP_RESOURCE_DEFINE(jwt_resource, test_http_service, "/jwt", &jwt_resource_detail);
 
-void http_resources_set_jwt_handler(http_resource_dynamic_cb_t handler)
+static struct http_dynamic jwt_dynamic = {
+	.detail = &jwt_resource_detail,
+};
+
+void http_resources_set_jwt_handler(http_resource_dynamic_cb_t handler,
+				    struct http_req_pool *reqs)
 {
-	jwt_resource_detail.cb = handler;
+	http_resources_set_dynamic(&jwt_dynamic, handler, reqs);
 }
+#endif // CONFIG_WIFI
 
 ////////////////// WebSocket Resource //////////////////
 // This is the resource that is used to send sensor data over a WebSocket connection.
@@ -246,12 +368,276 @@ static struct http_resource_detail_dynamic location_resource_detail = {
 
 HTTP_RESOURCE_DEFINE(location_resource, test_http_service, "/location", &location_resource_detail);
 
-void http_resources_set_location_handler(http_resource_dynamic_cb_t handler)
+static struct http_dynamic location_dynamic = {
+	.detail = &location_resource_detail,
+};
+
+void http_resources_set_location_handler(http_resource_dynamic_cb_t handler,
+					 struct http_req_pool *reqs)
 {
-	location_resource_detail.cb = handler;
+	http_resources_set_dynamic(&location_dynamic, handler, reqs);
 }
 
 void http_resources_set_location(const char *location)
 {
 	strncpy(location_buf, location, sizeof(location_buf));
-}
\ No newline at end of file
+}
+
+////////////////// Metrics Resource //////////////////
+// GET /metrics
+// This is a dynamic resource that returns runtime statistics in the Prometheus text format.
+
+static uint8_t metrics_buf[METRICS_BUF_LEN];
+
+static struct http_resource_detail_dynamic metrics_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET),
+			.content_type = "text/plain; version=0.0.4",
+		},
+	.cb = NULL, // This is set by the http_resources_set_metrics_handler function
+	.data_buffer = metrics_buf,
+	.data_buffer_len = sizeof(metrics_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(metrics_resource, test_http_service, "/metrics", &metrics_resource_detail);
+
+static struct http_dynamic metrics_dynamic = {
+	.detail = &metrics_resource_detail,
+};
+
+void http_resources_set_metrics_handler(http_resource_dynamic_cb_t handler,
+					struct http_req_pool *reqs)
+{
+	http_resources_set_dynamic(&metrics_dynamic, handler, reqs);
+}
+
+////////////////// History Resource //////////////////
+// GET /history?channels=<name>,<name>&since=<us>
+// This is a dynamic resource that returns the recent history of the charted sensor channels.
+
+static uint8_t history_buf[HISTORY_BUF_LEN];
+
+static struct http_resource_detail_dynamic history_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET),
+			.content_type = "application/json",
+		},
+	.cb = NULL, // This is set by the http_resources_set_history_handler function
+	.data_buffer = history_buf,
+	.data_buffer_len = sizeof(history_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(history_resource, test_http_service, "/history", &history_resource_detail);
+
+static struct http_dynamic history_dynamic = {
+	.detail = &history_resource_detail,
+};
+
+void http_resources_set_history_handler(http_resource_dynamic_cb_t handler,
+					struct http_req_pool *reqs)
+{
+	http_resources_set_dynamic(&history_dynamic, handler, reqs);
+}
+
+////////////////// Environmental Log Resource //////////////////
+// GET /envlog?tier=fine|coarse&boot=<n>
+// This is a dynamic resource that streams the environmental log stored on flash.
+
+static uint8_t envlog_buf[ENVLOG_BUF_LEN];
+
+static struct http_resource_detail_dynamic envlog_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET),
+			.content_type = "application/json",
+		},
+	.cb = NULL, // This is set by the http_resources_set_envlog_handler function
+	.data_buffer = envlog_buf,
+	.data_buffer_len = sizeof(envlog_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(envlog_resource, test_http_service, "/envlog", &envlog_resource_detail);
+
+static struct http_dynamic envlog_dynamic = {
+	.detail = &envlog_resource_detail,
+};
+
+void http_resources_set_envlog_handler(http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs)
+{
+	http_resources_set_dynamic(&envlog_dynamic, handler, reqs);
+}
+
+////////////////// Capture Resources //////////////////
+// GET /capture returns the capture status, POST /capture starts or stops a capture with
+// {"action":"start","seconds":30} or {"action":"stop"}.
+// GET /capture/<id>.csv and /capture/<id>.bin download a completed capture.
+//
+// The download paths hold the id of the completed capture and are empty while there is none, so
+// the server itself answers 404 for a capture that does not exist.
+
+static uint8_t capture_buf[CAPTURE_BUF_LEN];
+static char capture_csv_path[sizeof("/capture/4294967295.csv")];
+static char capture_bin_path[sizeof("/capture/4294967295.bin")];
+
+static struct http_resource_detail_dynamic capture_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET) | BIT(HTTP_POST),
+			.content_type = "application/json",
+		},
+	.cb = NULL, // This is set by the http_resources_set_capture_handlers function
+	.data_buffer = capture_buf,
+	.data_buffer_len = sizeof(capture_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(capture_resource, test_http_service, "/capture", &capture_resource_detail);
+
+static struct http_resource_detail_dynamic capture_csv_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET),
+			.content_type = "text/csv",
+		},
+	.cb = NULL, // This is set by the http_resources_set_capture_handlers function
+	.data_buffer = capture_buf,
+	.data_buffer_len = sizeof(capture_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(capture_csv_resource, test_http_service, capture_csv_path,
+		     &capture_csv_resource_detail);
+
+static struct http_resource_detail_dynamic capture_bin_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET),
+			.content_type = "application/octet-stream",
+		},
+	.cb = NULL, // This is set by the http_resources_set_capture_handlers function
+	.data_buffer = capture_buf,
+	.data_buffer_len = sizeof(capture_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(capture_bin_resource, test_http_service, capture_bin_path,
+		     &capture_bin_resource_detail);
+
+static struct http_dynamic capture_dynamic = {
+	.detail = &capture_resource_detail,
+};
+
+static struct http_dynamic capture_csv_dynamic = {
+	.detail = &capture_csv_resource_detail,
+};
+
+static struct http_dynamic capture_bin_dynamic = {
+	.detail = &capture_bin_resource_detail,
+};
+
+void http_resources_set_capture_handlers(http_resource_dynamic_cb_t control,
+					 struct http_req_pool *control_reqs,
+					 http_resource_dynamic_cb_t csv, http_resource_dynamic_cb_t bin,
+					 struct http_req_pool *download_reqs)
+{
+	http_resources_set_dynamic(&capture_dynamic, control, control_reqs);
+	http_resources_set_dynamic(&capture_csv_dynamic, csv, download_reqs);
+	http_resources_set_dynamic(&capture_bin_dynamic, bin, download_reqs);
+}
+
+/* Point a download path at a capture, or empty it for id 0 */
+static void set_capture_path(char *path, size_t size, uint32_t id, const char *ext)
+{
+	// The server thread compares the path without a lock. It stays empty until the rest is
+	// written, and matches nothing while the id changes.
+	path[0] = '\0';
+	compiler_barrier();
+
+	if (id == 0) {
+		return;
+	}
+
+	snprintf(path + 1, size - 1, "capture/%u.%s", id, ext);
+	compiler_barrier();
+	path[0] = '/';
+}
+
+void http_resources_set_capture_id(uint32_t id)
+{
+	set_capture_path(capture_csv_path, sizeof(capture_csv_path), id, "csv");
+	set_capture_path(capture_bin_path, sizeof(capture_bin_path), id, "bin");
+}
+
+////////////////// Config Resource //////////////////
+// GET /config returns the runtime settings, POST /config changes any of them with e.g.
+// {"stream_interval_ms":20,"bmi270_odr_hz":400}. See app_config.h.
+
+static uint8_t config_buf[APP_CONFIG_BUF_LEN];
+
+static struct http_resource_detail_dynamic config_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET) | BIT(HTTP_POST),
+			.content_type = "application/json",
+		},
+	.cb = NULL, // This is set by the http_resources_set_config_handler function
+	.data_buffer = config_buf,
+	.data_buffer_len = sizeof(config_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(config_resource, test_http_service, "/config", &config_resource_detail);
+
+static struct http_dynamic config_dynamic = {
+	.detail = &config_resource_detail,
+};
+
+void http_resources_set_config_handler(http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs)
+{
+	http_resources_set_dynamic(&config_dynamic, handler, reqs);
+}
+
+////////////////// Schema Resource //////////////////
+// GET /schema returns the names, units and precision of the channels in the sensor frames, in
+// the order of their values and valid bits. See sensor_channels.h.
+
+static uint8_t schema_buf[SCHEMA_BUF_LEN];
+
+static struct http_resource_detail_dynamic schema_resource_detail = {
+	.common =
+		{
+			.type = HTTP_RESOURCE_TYPE_DYNAMIC,
+			.bitmask_of_supported_http_methods = BIT(HTTP_GET),
+			.content_type = "application/json",
+		},
+	.cb = NULL, // This is set by the http_resources_set_schema_handler function
+	.data_buffer = schema_buf,
+	.data_buffer_len = sizeof(schema_buf),
+	.user_data = NULL,
+};
+
+HTTP_RESOURCE_DEFINE(schema_resource, test_http_service, "/schema", &schema_resource_detail);
+
+static struct http_dynamic schema_dynamic = {
+	.detail = &schema_resource_detail,
+};
+
+void http_resources_set_schema_handler(http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs)
+{
+	http_resources_set_dynamic(&schema_dynamic, handler, reqs);
+}
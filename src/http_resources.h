@@ -4,9 +4,47 @@
 #include <zephyr/net/http/service.h>
 #include <zephyr/data/json.h>
 
+#ifdef CONFIG_APP_SENSOR_DELTA
+#include "sensor_delta.h"
+#endif // CONFIG_APP_SENSOR_DELTA
+
+#define METRICS_BUF_LEN 512
+#define HISTORY_BUF_LEN 1024
+#define ENVLOG_BUF_LEN 1024
+#define CAPTURE_BUF_LEN 1024
+#define APP_CONFIG_BUF_LEN 512
+#define SCHEMA_BUF_LEN 128
+
+/* Streams a websocket client can subscribe to */
+#define WS_STREAM_SENSORS  BIT(0)
+#define WS_STREAM_SPECTRUM BIT(1)
+#define WS_STREAM_EVENTS   BIT(2)
+#define WS_STREAM_ADXL367  BIT(3)
+
+/* Encodings of the sensor stream */
+#define WS_ENCODING_JSON  0
+#define WS_ENCODING_DELTA 1 // Binary messages of sensor_delta.h records
+
+/* Viewer slot, served by the streaming thread in ws_stream.c */
 struct ws_sensors_ctx {
-	int sock;
-	struct k_work_delayable work;
+	int sock;                  // -1 while the slot is free
+	uint32_t streams;          // WS_STREAM_* the client is subscribed to
+	uint32_t next_seq;         // Sequence number of the next sample to send to the client
+	uint16_t batch;            // Samples per message, 1 for a plain frame per sample
+	uint16_t batch_latency_ms; // Longest time a sample waits for its batch to fill
+	uint32_t samples_sent;     // Samples and wire bytes sent since the client connected
+	uint64_t sample_bytes;
+	uint8_t encoding; // WS_ENCODING_*
+#ifdef CONFIG_APP_SENSOR_DELTA
+	struct sensor_delta_state delta;
+#endif // CONFIG_APP_SENSOR_DELTA
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+	uint16_t rate_hz;      // Sensor messages per second allowed by the rate controller
+	uint16_t blocked;      // Rounds in the control period the socket was not writable when due
+	uint32_t send_us_max;  // Longest send of a sensor message in the control period
+	uint32_t rate_cuts;    // Times the rate was lowered since the client connected
+	int64_t last_msg_us;   // Uptime of the last sensor message
+#endif // CONFIG_APP_WS_RATE_CONTROL
 };
 
 struct led_command {
@@ -21,6 +59,65 @@ static const struct json_obj_descr led_command_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct led_command, b, JSON_TOK_NUMBER),
 };
 
+/* Clock sync probe sent by the web page, answered with {"pong":<ping>,"dev":<uptime us>} */
+struct ws_ping_command {
+	int ping;
+};
+
+static const struct json_obj_descr ws_ping_command_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct ws_ping_command, ping, JSON_TOK_NUMBER),
+};
+
+/* Sample batching requested by a viewer, {"batch":10,"latency_ms":100}. A message is sent when it
+ * holds "batch" samples or its first sample is "latency_ms" old, "batch":1 goes back to a frame per
+ * sample. Answered with {"batching":<batch>,"latency_ms":<latency>} after clamping.
+ */
+struct ws_batch_command {
+	int batch;
+	int latency_ms;
+};
+
+static const struct json_obj_descr ws_batch_command_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct ws_batch_command, batch, JSON_TOK_NUMBER),
+	JSON_OBJ_DESCR_PRIM(struct ws_batch_command, latency_ms, JSON_TOK_NUMBER),
+};
+
+/* Sensor stream encoding requested by a viewer, {"encoding":"delta"} or {"encoding":"json"}. Asking
+ * for "delta" again restarts the stream with a keyframe, for a decoder that lost track. Answered
+ * with {"encoding":<name>}.
+ */
+struct ws_encoding_command {
+	char *encoding;
+};
+
+static const struct json_obj_descr ws_encoding_command_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct ws_encoding_command, encoding, JSON_TOK_STRING),
+};
+
+/* Capture control, {"action":"start","seconds":30} or {"action":"stop"} */
+struct capture_command {
+	char *action;
+	int seconds;
+};
+
+static const struct json_obj_descr capture_command_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct capture_command, action, JSON_TOK_STRING),
+	JSON_OBJ_DESCR_PRIM(struct capture_command, seconds, JSON_TOK_NUMBER),
+};
+
+/* Stream subscription sent by the web page, {"subscribe":"spectrum"} or {"unsubscribe":"spectrum"}.
+ * The streams are "sensors", "spectrum", "events" and "adxl367".
+ */
+struct ws_stream_command {
+	char *subscribe;
+	char *unsubscribe;
+};
+
+static const struct json_obj_descr ws_stream_command_descr[] = {
+	JSON_OBJ_DESCR_PRIM(struct ws_stream_command, subscribe, JSON_TOK_STRING),
+	JSON_OBJ_DESCR_PRIM(struct ws_stream_command, unsubscribe, JSON_TOK_STRING),
+};
+
 struct jwt_command {
 	char jwt[512];
 };
@@ -29,9 +126,66 @@ static const struct json_obj_descr jwt_command_descr[] = {
 	JSON_OBJ_DESCR_PRIM(struct jwt_command, jwt, JSON_TOK_STRING),
 };
 
-void http_resources_set_led_handler(http_resource_dynamic_cb_t handler);
-void http_resources_set_jwt_handler(http_resource_dynamic_cb_t handler);
+/* Request of one client on a dynamic resource */
+struct http_req {
+	struct http_client_ctx *client; // NULL while free
+	int fd;                         // Socket of the client, a reused client context has another
+	int64_t used_ms;                // Uptime of the last callback of the request
+};
+
+/* Requests of a dynamic resource, with their states, see HTTP_REQ_POOL_DEFINE() */
+struct http_req_pool {
+	struct http_req *reqs;
+	uint8_t *states;
+	size_t size;   // Bytes of state per request
+	uint8_t count; // States kept
+};
+
+/**
+ * @brief Define the request states of a dynamic resource.
+ *
+ * The handler of a resource registered with a pool gets the state of the calling client as
+ * user_data, a _type zeroed at the start of every request, instead of static variables that
+ * outlive the request. The HTTP server serves a dynamic resource to one client at a time and
+ * answers the others with 409 Conflict, so one state is enough. The state of a client that went
+ * away without an abort is taken over by the next request.
+ */
+#define HTTP_REQ_POOL_DEFINE(_name, _type)                                                         \
+	static struct http_req _name##_reqs[1];                                                    \
+	static _type _name##_states[1];                                                            \
+	struct http_req_pool _name = {                                                             \
+		.reqs = _name##_reqs,                                                              \
+		.states = (uint8_t *)_name##_states,                                               \
+		.size = sizeof(_type),                                                             \
+		.count = 1,                                                                        \
+	}
+
+void http_resources_set_led_handler(http_resource_dynamic_cb_t handler,
+				    struct http_req_pool *reqs);
+#ifdef CONFIG_WIFI
+void http_resources_set_jwt_handler(http_resource_dynamic_cb_t handler,
+				    struct http_req_pool *reqs);
+#endif // CONFIG_WIFI
 void http_resources_set_ws_handler(http_resource_websocket_cb_t handler);
 void http_resources_get_ws_ctx(struct ws_sensors_ctx **ctx);
-void http_resources_set_location_handler(http_resource_dynamic_cb_t handler);
+void http_resources_set_location_handler(http_resource_dynamic_cb_t handler,
+					 struct http_req_pool *reqs);
 void http_resources_set_location(const char *location);
+
+/* Last location reply of nRF Cloud, a NUL-terminated JSON object, empty until the first one */
+extern uint8_t location_buf[256];
+void http_resources_set_metrics_handler(http_resource_dynamic_cb_t handler,
+					struct http_req_pool *reqs);
+void http_resources_set_history_handler(http_resource_dynamic_cb_t handler,
+					struct http_req_pool *reqs);
+void http_resources_set_envlog_handler(http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs);
+void http_resources_set_capture_handlers(http_resource_dynamic_cb_t control,
+					 struct http_req_pool *control_reqs,
+					 http_resource_dynamic_cb_t csv, http_resource_dynamic_cb_t bin,
+					 struct http_req_pool *download_reqs);
+void http_resources_set_capture_id(uint32_t id);
+void http_resources_set_config_handler(http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs);
+void http_resources_set_schema_handler(http_resource_dynamic_cb_t handler,
+				       struct http_req_pool *reqs);
@@ -1,4 +1,6 @@
 #include "https_request.h"
+#include "location_api.h"
+#include "profiler.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(HTTPS_REQUEST, CONFIG_WIFI_STA_LOG_LEVEL);
@@ -82,8 +84,8 @@ int tls_setup(int fd)
 	return 0;
 }
 
-void send_http_request(char *location_str, size_t location_str_len, char *api_str,
-		       size_t api_str_len, char *auth_token)
+int send_http_request(char *location_str, size_t location_str_len, char *api_str,
+		      size_t api_str_len, char *auth_token)
 {
 	int err;
 	int fd;
@@ -107,7 +109,7 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 		if (err) {
 			if (i == CONFIG_DNS_ATTEMPTS - 1) {
 				LOG_ERR("getaddrinfo() failed, errno %d, err %d\n", errno, err);
-				return;
+				return -EHOSTUNREACH;
 			}
 			LOG_WRN("getaddrinfo() failed, errno %d, err %d\n", errno, err);
 		} else {
@@ -126,6 +128,7 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 	}
 	if (fd == -1) {
 		LOG_ERR("Failed to open socket!\n");
+		err = -errno;
 		goto clean_up;
 	}
 
@@ -137,9 +140,13 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 
 	LOG_INF("Connecting to %s:%d\n", CONFIG_HTTPS_HOSTNAME,
 		ntohs(((struct sockaddr_in *)(res->ai_addr))->sin_port));
+	timing_t span = profiler_span_begin();
+
 	err = connect(fd, res->ai_addr, res->ai_addrlen);
+	profiler_span_end(PROFILER_SPAN_TLS_CONNECT, span);
 	if (err) {
 		LOG_ERR("connect() failed, err: %d\n", errno);
+		err = -errno;
 		goto clean_up;
 	}
 
@@ -170,7 +177,8 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 	// Check for truncation
 	if (header_len < 0 || header_len >= sizeof(send_buf)) {
 		LOG_ERR("Error: HTTP request buffer too small!\n");
-		return;
+		err = -ENOMEM;
+		goto clean_up;
 	}
 
 	// Debug: Print HTTP request content
@@ -182,7 +190,8 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 			     0); // Send dynamically formatted buffer
 		if (bytes < 0) {
 			LOG_ERR("send() failed, err %d\n", errno);
-			return;
+			err = -errno;
+			goto clean_up;
 		}
 		off += bytes;
 	} while (off < header_len);
@@ -194,6 +203,7 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 		bytes = recv(fd, &recv_buf[off], RECV_BUF_SIZE - off, 0);
 		if (bytes < 0) {
 			LOG_ERR("recv() failed, err %d\n", errno);
+			err = -errno;
 			goto clean_up;
 		}
 		off += bytes;
@@ -209,37 +219,26 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 		recv_buf[sizeof(recv_buf) - 1] = '\0';
 	}
 
-	// Get the HTTP response code
-	char *response_code = strstr(recv_buf, "HTTP/1.1 ");
-	int http_response_code = 0;
-	if (response_code) {
-		response_code += strlen("HTTP/1.1 ");
-		char *end_of_code = strstr(response_code, " ");
-		if (end_of_code) {
-			*end_of_code = '\0'; // Temporarily terminate the string
-			LOG_WRN("HTTP Response Code: %s\n", response_code);
-			http_response_code = atoi(response_code);
-			*end_of_code = ' '; // Restore the space
-		} else {
-			LOG_ERR("Could not find end of HTTP response code.\n");
-		}
+	span = profiler_span_begin();
+
+	const char *body;
+	int http_response_code = location_api_parse_response(recv_buf, &body);
+
+	if (http_response_code) {
+		LOG_WRN("HTTP Response Code: %d\n", http_response_code);
 	} else {
 		LOG_ERR("Could not find HTTP response code.\n");
 	}
 
-	char *header_end = strstr(recv_buf, "\r\n\r\n"); // Locate the end of headers
-	if (header_end) {
-		LOG_INF("========================================");
-		LOG_INF("HTTP Headers:");
-		*header_end = '\0';        // Temporarily terminate at the end of headers
-		LOG_INF("\n%s\n", recv_buf); // Print headers
-		LOG_INF("========================================");
-		LOG_INF("HTTP Body:");
-		LOG_INF("\n%s\n", header_end + 4); // Print the body after separating headers
-		LOG_INF("========================================");
-	} else {
-		LOG_WRN("Could not find end of headers.\n");
-	}
+	LOG_INF("========================================");
+	LOG_INF("HTTP Headers:");
+	LOG_INF("\n%s\n", recv_buf);
+	LOG_INF("========================================");
+	LOG_INF("HTTP Body:");
+	LOG_INF("\n%s\n", body);
+	LOG_INF("========================================");
+
+	profiler_span_end(PROFILER_SPAN_HTTP_PARSE, span);
 
 	LOG_INF("Finished, closing socket.\n");
 
@@ -247,34 +246,34 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 
 	switch (http_response_code) {
 	case 200:
-		ret = snprintf(location_str, location_str_len, "%s", header_end + 4);
+		ret = snprintf(location_str, location_str_len, "%s", body);
 		break;
 	case 400:
-		LOG_ERR("Bad Request: %s", header_end + 4);
+		LOG_ERR("Bad Request: %s", body);
 		memcpy(location_str, "{\"message\": \"Bad Request\"}",
 		       sizeof("{\"message\": \"Bad Request\"}"));
 		break;
 	case 401:
-		LOG_ERR("Unauthorized: %s", header_end + 4);
-		ret = snprintf(location_str, location_str_len, "%s", header_end + 4);
+		LOG_ERR("Unauthorized: %s", body);
+		ret = snprintf(location_str, location_str_len, "%s", body);
 		break;
 	case 403:
-		LOG_ERR("Forbidden: %s", header_end + 4);
+		LOG_ERR("Forbidden: %s", body);
 		memcpy(location_str, "{\"message\": \"Forbidden\"}",
 		       sizeof("{\"message\": \"Forbidden\"}"));
 		break;
 	case 404:
-		LOG_ERR("Not Found: %s", header_end + 4);
+		LOG_ERR("Not Found: %s", body);
 		memcpy(location_str, "{\"message\": \"Location not found\"}",
 		       sizeof("{\"message\": \"Location not found\"}"));
 		break;
 	case 500:
-		LOG_ERR("Internal Server Error: %s", header_end + 4);
+		LOG_ERR("Internal Server Error: %s", body);
 		memcpy(location_str, "{\"message\": \"Internal Server Error\"}",
 		       sizeof("{\"message\": \"Internal Server Error\"}"));
 		break;
 	case 503:
-		LOG_ERR("Service Unavailable: %s", header_end + 4);
+		LOG_ERR("Service Unavailable: %s", body);
 		memcpy(location_str, "{\"message\": \"Service Unavailable\"}",
 		       sizeof("{\"message\": \"Service Unavailable\"}"));
 		break;
@@ -286,10 +285,15 @@ void send_http_request(char *location_str, size_t location_str_len, char *api_st
 	}
 	if (ret < 0) {
 		LOG_ERR("Failed to format location string\n");
+		err = ret;
 		goto clean_up;
 	}
 
+	err = http_response_code;
+
 clean_up:
 	freeaddrinfo(res);
 	(void)close(fd);
+
+	return err;
 }
\ No newline at end of file
@@ -6,5 +6,10 @@
 
 int cert_provision(void);
 // void send_http_request(char *location_str, char *api_str, size_t api_str_len);
-void send_http_request(char *location_str, size_t location_str_len, char *api_str,
-		       size_t api_str_len, char *auth_token);
\ No newline at end of file
+/**
+ * @brief Request the location of the device from nRF Cloud.
+ *
+ * @return HTTP response code if a response was received, negative error code otherwise.
+ */
+int send_http_request(char *location_str, size_t location_str_len, char *api_str,
+		      size_t api_str_len, char *auth_token);
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include "app_config.h"
+#include "imu.h"
+#include "metrics.h"
+
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/init.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(IMU, CONFIG_IMU_LOG_LEVEL);
+
+// The acquisition thread samples all sensors at the live stream rate. Consumers that need every
+// sample the accelerometers produce register here instead, and this thread reads the BMI270 and
+// the ADXL367 at their output data rates for as long as anyone listens.
+//
+// When the BMI270 has its interrupt wired, the thread reads every sample on its data-ready
+// interrupt, and a sample that is overwritten before the thread gets to it is counted. The
+// ADXL367 is read on every ADXL367_DIV-th BMI270 sample. Without the interrupt, e.g. on
+// native_sim, the thread polls on its own clock instead.
+
+#define IMU_PERIOD_US (USEC_PER_SEC / SENSORS_BMI270_RATE_HZ)
+#define ADXL367_DIV   (SENSORS_BMI270_RATE_HZ / SENSORS_ADXL367_RATE_HZ)
+
+BUILD_ASSERT(SENSORS_BMI270_RATE_HZ % SENSORS_ADXL367_RATE_HZ == 0,
+	     "The ADXL367 rate must divide the BMI270 rate");
+
+K_THREAD_STACK_DEFINE(imu_stack_area, CONFIG_APP_IMU_THREAD_STACK_SIZE);
+struct k_thread imu_thread_data;
+k_tid_t imu_thread_id;
+
+static sys_slist_t listeners = SYS_SLIST_STATIC_INIT(&listeners);
+static K_MUTEX_DEFINE(listeners_lock);
+static atomic_t listener_count;
+static K_SEM_DEFINE(imu_wake, 0, 1);
+
+static const struct device *const imu_dev = DEVICE_DT_GET(DT_ALIAS(accel0));
+static const struct sensor_trigger drdy_trigger = {
+	.type = SENSOR_TRIG_DATA_READY,
+	.chan = SENSOR_CHAN_ALL,
+};
+static K_SEM_DEFINE(imu_drdy, 0, 1);
+static atomic_t drdy_overruns;
+
+void imu_add_listener(struct imu_listener *listener)
+{
+	k_mutex_lock(&listeners_lock, K_FOREVER);
+	sys_slist_append(&listeners, &listener->node);
+	k_mutex_unlock(&listeners_lock);
+
+	if (atomic_inc(&listener_count) == 0) {
+		k_sem_give(&imu_wake);
+	}
+}
+
+void imu_remove_listener(struct imu_listener *listener)
+{
+	bool removed;
+
+	k_mutex_lock(&listeners_lock, K_FOREVER);
+	removed = sys_slist_find_and_remove(&listeners, &listener->node);
+	k_mutex_unlock(&listeners_lock);
+
+	if (removed) {
+		atomic_dec(&listener_count);
+	}
+}
+
+static void imu_publish(enum imu_source source)
+{
+	struct imu_sample sample;
+	struct imu_listener *listener;
+	int ret;
+
+	ret = sensors_fetch_imu(source, &sample);
+	if (ret) {
+		LOG_DBG("sensors_fetch_imu(%d) failed ret %d", source, ret);
+		return;
+	}
+
+	k_mutex_lock(&listeners_lock, K_FOREVER);
+	SYS_SLIST_FOR_EACH_CONTAINER(&listeners, listener, node) {
+		listener->on_sample(&sample);
+	}
+	k_mutex_unlock(&listeners_lock);
+}
+
+static void imu_drdy_handler(const struct device *dev, const struct sensor_trigger *trigger)
+{
+	// The thread has not taken the previous sample, which the BMI270 has now overwritten
+	if (k_sem_count_get(&imu_drdy) > 0) {
+		atomic_inc(&drdy_overruns);
+	}
+
+	k_sem_give(&imu_drdy);
+}
+
+/* Wait for the next BMI270 sample to publish */
+static void imu_wait(bool drdy, int64_t *next)
+{
+	int32_t div;
+
+	if (!drdy) {
+		// Absolute deadlines in ticks, so the period does not drift with the fetch time. If
+		// the thread falls behind it catches up without sleeping.
+		*next += k_us_to_ticks_floor64(IMU_PERIOD_US);
+		k_sleep(K_TIMEOUT_ABS_TICKS(*next));
+		return;
+	}
+
+	// The BMI270 may run faster than the listeners expect, only every div-th sample is
+	// published. A missed interrupt, e.g. while the BMI270 is configured again, ends in a timeout
+	// and a read of the current sample.
+	div = MAX(app_config_get(APP_CONFIG_BMI270_ODR_HZ) / SENSORS_BMI270_RATE_HZ, 1);
+	for (int32_t i = 0; i < div; i++) {
+		(void)k_sem_take(&imu_drdy, K_USEC(2 * IMU_PERIOD_US));
+	}
+}
+
+static void imu_thread(void *arg1, void *arg2, void *arg3)
+{
+	int64_t next = 0;
+	uint32_t tick = 0;
+	bool drdy = false;
+
+	while (1) {
+		if (atomic_get(&listener_count) == 0) {
+			if (drdy) {
+				(void)sensor_trigger_set(imu_dev, &drdy_trigger, NULL);
+				drdy = false;
+			}
+
+			k_sem_take(&imu_wake, K_FOREVER);
+
+			// Fall back to polling when the driver has no data-ready interrupt
+			k_sem_reset(&imu_drdy);
+			drdy = sensor_trigger_set(imu_dev, &drdy_trigger, imu_drdy_handler) == 0;
+			LOG_DBG("Sampling on the %s", drdy ? "data-ready interrupt" : "timer");
+
+			next = k_uptime_ticks();
+			tick = 0;
+			continue;
+		}
+
+		imu_publish(IMU_SOURCE_BMI270);
+		if (tick % ADXL367_DIV == 0) {
+			imu_publish(IMU_SOURCE_ADXL367);
+		}
+		tick++;
+
+		imu_wait(drdy, &next);
+	}
+}
+
+#ifdef CONFIG_APP_METRICS
+static void imu_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_imu_overruns_total", "counter",
+		       "BMI270 samples overwritten before the IMU thread read them");
+	metrics_printf(w, "thingy_imu_overruns_total %u\n", (uint32_t)atomic_get(&drdy_overruns));
+}
+
+static struct metrics_collector imu_collector = {
+	.collect = imu_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int imu_init(void)
+{
+	imu_thread_id = k_thread_create(&imu_thread_data, imu_stack_area,
+					K_THREAD_STACK_SIZEOF(imu_stack_area), imu_thread, NULL,
+					NULL, NULL, 5, 0, K_NO_WAIT);
+	k_thread_name_set(imu_thread_id, "imu");
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&imu_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(imu_init, APPLICATION, 0);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#include "sensors.h"
+
+/**
+ * @brief Consumer of the high-rate accelerometer and gyroscope samples.
+ *
+ * The callback runs in the IMU thread for every BMI270 sample at SENSORS_BMI270_RATE_HZ and every
+ * ADXL367 sample at SENSORS_ADXL367_RATE_HZ. It must not block, or the next samples are late.
+ */
+struct imu_listener {
+	sys_snode_t node;
+	void (*on_sample)(const struct imu_sample *sample);
+};
+
+/**
+ * @brief Start delivering samples to a listener.
+ *
+ * The IMU thread only samples while it has listeners.
+ */
+void imu_add_listener(struct imu_listener *listener);
+void imu_remove_listener(struct imu_listener *listener);
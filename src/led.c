@@ -0,0 +1,95 @@
+#include "led.h"
+#include "http_resources.h"
+
+#include <errno.h>
+#include <math.h>
+
+#include <zephyr/data/json.h>
+#include <zephyr/drivers/pwm.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(LED, CONFIG_LED_LOG_LEVEL);
+
+static const struct pwm_dt_spec red_pwm_led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0));
+static const struct pwm_dt_spec green_pwm_led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led1));
+static const struct pwm_dt_spec blue_pwm_led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led2));
+
+static uint8_t apply_gamma(uint8_t value, float gamma)
+{
+	/* (value/255)^gamma * 255 */
+	return (uint8_t)(pow(value / 255.0, gamma) * 255);
+}
+
+int pwm_set_color(int red, int green, int blue)
+{
+	int ret;
+
+	/* Parameters to adjust intensity of each color */
+	float red_gamma = 2.2;
+	float green_gamma = 2.2;
+	float blue_gamma = 2.2;
+
+	float red_intensity_scale = 1.0;
+	float green_intensity_scale = 1.0;
+	float blue_intensity_scale = 0.8;
+
+	// LOG_DBG("PWM_Color: Red: %d, Green: %d, Blue: %d \n", red, green, blue);
+
+	// Apply gamma correction
+	int corrected_red = apply_gamma(red * red_intensity_scale, red_gamma);
+	int corrected_green = apply_gamma(green * green_intensity_scale, green_gamma);
+	int corrected_blue = apply_gamma(blue * blue_intensity_scale, blue_gamma);
+
+	// uint32_t period = red_pwm_led.period;
+	int pwm_red = (corrected_red * red_pwm_led.period) / 255;
+	int pwm_green = (corrected_green * green_pwm_led.period) / 255;
+	int pwm_blue = (corrected_blue * blue_pwm_led.period) / 255;
+
+	ret = pwm_set_pulse_dt(&red_pwm_led, pwm_red);
+	if (ret != 0) {
+		LOG_ERR("Error %d: red write failed\n", ret);
+		return ret;
+	}
+
+	ret = pwm_set_pulse_dt(&green_pwm_led, pwm_green);
+	if (ret != 0) {
+		LOG_ERR("Error %d: green write failed\n", ret);
+		return ret;
+	}
+
+	ret = pwm_set_pulse_dt(&blue_pwm_led, pwm_blue);
+	if (ret != 0) {
+		LOG_ERR("Error %d: blue write failed\n", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+bool led_is_ready(void)
+{
+	return pwm_is_ready_dt(&red_pwm_led) && pwm_is_ready_dt(&green_pwm_led) &&
+	       pwm_is_ready_dt(&blue_pwm_led);
+}
+
+int parse_led_post(uint8_t *buf, size_t len)
+{
+	int ret;
+	struct led_command cmd;
+	const int expected_return_code = BIT_MASK(ARRAY_SIZE(led_command_descr));
+
+	LOG_DBG("Got POST request with payload: %.*s", (int)len, buf);
+
+	ret = json_obj_parse(buf, len, led_command_descr, ARRAY_SIZE(led_command_descr), &cmd);
+	if (ret != expected_return_code) {
+		LOG_WRN("Failed to fully parse JSON payload, ret=%d", ret);
+		return -EINVAL;
+	}
+
+	ret = pwm_set_color(cmd.r, cmd.g, cmd.b);
+	if (ret) {
+		LOG_ERR("Failed to set LED color");
+	}
+
+	return ret;
+}
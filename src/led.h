@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* True when the PWM channels of the three colors are ready */
+bool led_is_ready(void);
+
+/**
+ * @brief Set the color of the RGB LED.
+ *
+ * The components go from 0 to 255 and are gamma corrected, blue is dimmed to balance the white.
+ *
+ * @return 0 on success, the error of the first PWM channel that failed otherwise.
+ */
+int pwm_set_color(int red, int green, int blue);
+
+/**
+ * @brief Set the LED from the payload of a POST /led, {"r":<0-255>,"g":<0-255>,"b":<0-255>}.
+ *
+ * The JSON parser works in place, so buf is modified.
+ *
+ * @return 0 on success, -EINVAL for a payload without all three components, the error of the PWM
+ *         otherwise.
+ */
+int parse_led_post(uint8_t *buf, size_t len);
@@ -0,0 +1,49 @@
+#include "location_api.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Kept apart from wifi.c and https_request.c so that the string handling can be built and
+// benchmarked without the Wi-Fi and TLS stacks, see tests/benchmarks.
+
+#define STATUS_LINE "HTTP/1.1 "
+
+int location_api_aps_append(struct location_api_aps *aps, const char *mac, int rssi)
+{
+	size_t space = aps->size - aps->len;
+	int ret;
+
+	ret = snprintf(aps->buf + aps->len, space, "{\"macAddress\":\"%s\",\"signalStrength\":%-4d},",
+		       mac, rssi);
+	if (ret < 0 || ret >= space) {
+		aps->buf[aps->len] = '\0';
+		return -ENOSPC;
+	}
+
+	aps->len += ret;
+	aps->count++;
+
+	return 0;
+}
+
+int location_api_parse_response(char *response, const char **body)
+{
+	char *status = strstr(response, STATUS_LINE);
+	char *header_end = strstr(response, "\r\n\r\n");
+	int code = 0;
+
+	if (status != NULL) {
+		code = atoi(status + strlen(STATUS_LINE));
+	}
+
+	if (header_end != NULL) {
+		*header_end = '\0';
+		*body = header_end + 4;
+	} else {
+		*body = "";
+	}
+
+	return code;
+}
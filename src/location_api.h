@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Access point list of a nRF Cloud Wi-Fi location request, built from the scan results */
+struct location_api_aps {
+	char *buf;
+	size_t size;
+	size_t len; // Kept so that an append does not walk the list again
+	uint16_t count;
+};
+
+#define LOCATION_API_APS_INIT(_buf) {.buf = (_buf), .size = sizeof(_buf), .len = 0, .count = 0}
+
+/**
+ * @brief Append {"macAddress":"<mac>","signalStrength":<rssi>}, to the list.
+ *
+ * @return 0 if successful, -ENOSPC if the entry does not fit, the list is left unchanged.
+ */
+int location_api_aps_append(struct location_api_aps *aps, const char *mac, int rssi);
+
+/**
+ * @brief Split a HTTP/1.1 response into its status code and body.
+ *
+ * The headers are terminated in place. The body is an empty string if the end of the headers is
+ * missing.
+ *
+ * @return The status code, or 0 if there is no status line.
+ */
+int location_api_parse_response(char *response, const char **body);
@@ -24,14 +24,23 @@ LOG_MODULE_REGISTER(http_server, CONFIG_LOG_DEFAULT_LEVEL);
 #include <zephyr/data/json.h>
 
 #include <zephyr/net/socket.h>
-#include <zephyr/net/websocket.h>
 
 #include <zephyr/sys/reboot.h>
 
 #include "sensors.h"
 #include "http_resources.h"
+#ifdef CONFIG_WIFI
 #include "wifi.h"
 #include "https_request.h"
+#endif // CONFIG_WIFI
+#include "metrics.h"
+#include "profiler.h"
+#include "history.h"
+#include "envlog.h"
+#include "capture.h"
+#include "ws_stream.h"
+#include "app_config.h"
+#include "led.h"
 
 #ifdef CONFIG_SYS_HEAP_LISTENER
 #include <zephyr/sys/heap_listener.h>
@@ -77,191 +86,28 @@ HEAP_LISTENER_FREE_DEFINE(system_heap_listener_free, HEAP_ID_FROM_POINTER(&_syst
 			  on_system_heap_free);
 #endif // CONFIG_SYS_HEAP_LISTENER
 
-static const struct pwm_dt_spec red_pwm_led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led0));
-static const struct pwm_dt_spec green_pwm_led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led1));
-static const struct pwm_dt_spec blue_pwm_led = PWM_DT_SPEC_GET(DT_ALIAS(pwm_led2));
+/* State of a POST request, the payload collected so far */
+struct led_request {
+	uint8_t post_payload_buf[32];
+	size_t cursor;
+};
 
-uint8_t apply_gamma(uint8_t value, float gamma)
-{
-	/* (value/255)^gamma * 255 */
-	return (uint8_t)(pow(value / 255.0, gamma) * 255);
-}
-
-int pwm_set_color(int red, int green, int blue)
-{
-	int ret;
-
-	/* Parameters to adjust intensity of each color */
-	float red_gamma = 2.2;
-	float green_gamma = 2.2;
-	float blue_gamma = 2.2;
-
-	float red_intensity_scale = 1.0;
-	float green_intensity_scale = 1.0;
-	float blue_intensity_scale = 0.8;
-
-	// LOG_DBG("PWM_Color: Red: %d, Green: %d, Blue: %d \n", red, green, blue);
-
-	// Apply gamma correction
-	int corrected_red = apply_gamma(red * red_intensity_scale, red_gamma);
-	int corrected_green = apply_gamma(green * green_intensity_scale, green_gamma);
-	int corrected_blue = apply_gamma(blue * blue_intensity_scale, blue_gamma);
-
-	// uint32_t period = red_pwm_led.period;
-	int pwm_red = (corrected_red * red_pwm_led.period) / 255;
-	int pwm_green = (corrected_green * green_pwm_led.period) / 255;
-	int pwm_blue = (corrected_blue * blue_pwm_led.period) / 255;
-
-	ret = pwm_set_pulse_dt(&red_pwm_led, pwm_red);
-	if (ret != 0) {
-		LOG_ERR("Error %d: red write failed\n", ret);
-		return ret;
-	}
-
-	ret = pwm_set_pulse_dt(&green_pwm_led, pwm_green);
-	if (ret != 0) {
-		LOG_ERR("Error %d: green write failed\n", ret);
-		return ret;
-	}
-
-	ret = pwm_set_pulse_dt(&blue_pwm_led, pwm_blue);
-	if (ret != 0) {
-		LOG_ERR("Error %d: blue write failed\n", ret);
-		return ret;
-	}
-
-	return 0;
-}
-
-static void sensor_handler(struct k_work *work)
-{
-	int ret;
-	static char tx_buf[1024];
-	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
-	struct ws_sensors_ctx *ctx = CONTAINER_OF(dwork, struct ws_sensors_ctx, work);
-
-	// ret = sensors_collect(tx_buf, sizeof(tx_buf));
-	ret = sensors_get_json(tx_buf, sizeof(tx_buf));
-	if (ret < 0) {
-		LOG_ERR("Unable to collect sensor data, err %d", ret);
-		goto unregister;
-	}
-
-	ret = websocket_send_msg(ctx->sock, tx_buf, ret, WEBSOCKET_OPCODE_DATA_TEXT, false, true,
-				 SYS_FOREVER_MS);
-	if (ret < 0) {
-		LOG_INF("Couldn't send websocket msg (%d), closing connection", ret);
-		goto unregister;
-	}
-
-	ret = k_work_reschedule(&ctx->work, K_MSEC(CONFIG_NET_SAMPLE_WEBSOCKET_SENSOR_INTERVAL));
-	if (ret < 0) {
-		LOG_ERR("Failed to schedule sensor work, err %d", ret);
-		goto unregister;
-	}
-
-	return;
-
-unregister:
-	(void)websocket_unregister(ctx->sock);
-	ctx->sock = -1;
-}
-
-int ws_sensors_init(void)
-{
-	struct ws_sensors_ctx *ctx = NULL;
-	http_resources_get_ws_ctx(&ctx);
-
-	for (int i = 0; i < CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS; i++) {
-		ctx[i].sock = -1;
-		k_work_init_delayable(&ctx[i].work, sensor_handler);
-	}
-
-	return 0;
-}
-SYS_INIT(ws_sensors_init, APPLICATION, 0);
-
-static int get_free_sensor_slot(void)
-{
-	struct ws_sensors_ctx *ctx = NULL;
-	http_resources_get_ws_ctx(&ctx);
-
-	for (int i = 0; i < CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS; i++) {
-		if (ctx[i].sock < 0) {
-			return i;
-		}
-	}
-
-	return -1;
-}
-
-int ws_sensors_setup(int ws_socket, void *user_data)
-{
-	ARG_UNUSED(user_data);
-
-	struct ws_sensors_ctx *ctx = NULL;
-	http_resources_get_ws_ctx(&ctx);
-
-	int slot = get_free_sensor_slot();
-	if (slot < 0) {
-		LOG_ERR("No free slot for sensor websocket");
-		return -ENOMEM;
-	}
-	LOG_INF("Setting up sensor websocket on slot %d", slot);
-
-	ctx[slot].sock = ws_socket;
-
-	LOG_INF("Using socket %d for sensor websocket", ws_socket);
-
-	int ret = k_work_reschedule(&ctx[slot].work, K_NO_WAIT);
-	if (ret < 0) {
-		LOG_ERR("Failed to reschedule sensor work");
-		return ret;
-	}
-
-	LOG_INF("Sensor websocket setup on slot %d", slot);
-
-	return 0;
-}
-
-static void parse_led_post(uint8_t *buf, size_t len)
-{
-	int ret;
-	struct led_command cmd;
-	const int expected_return_code = BIT_MASK(ARRAY_SIZE(led_command_descr));
-
-	LOG_DBG("Got POST request with payload: %s", buf);
-
-	ret = json_obj_parse(buf, len, led_command_descr, ARRAY_SIZE(led_command_descr), &cmd);
-	if (ret != expected_return_code) {
-		LOG_WRN("Failed to fully parse JSON payload, ret=%d", ret);
-		return;
-	}
-
-	ret = pwm_set_color(cmd.r, cmd.g, cmd.b);
-	if (ret) {
-		LOG_ERR("Failed to set LED color");
-	}
-}
+HTTP_REQ_POOL_DEFINE(led_http_reqs, struct led_request);
 
 static int led_handler(struct http_client_ctx *client, enum http_data_status status,
 		       uint8_t *buffer, size_t len, void *user_data)
 {
 	ARG_UNUSED(client);
-	ARG_UNUSED(user_data);
 
-	static uint8_t post_payload_buf[32];
-	static size_t cursor;
+	struct led_request *req = user_data;
 
 	LOG_DBG("LED handler status %d, size %zu", status, len);
 
 	if (status == HTTP_SERVER_DATA_ABORTED) {
-		cursor = 0;
 		return 0;
 	}
 
-	if (len + cursor > sizeof(post_payload_buf)) {
-		cursor = 0;
+	if (len + req->cursor > sizeof(req->post_payload_buf)) {
 		return -ENOMEM;
 	}
 
@@ -269,17 +115,17 @@ static int led_handler(struct http_client_ctx *client, enum http_data_status sta
 	 * chunks (e.g. if the header size was such that the whole HTTP request exceeds the size of
 	 * the client buffer).
 	 */
-	memcpy(post_payload_buf + cursor, buffer, len);
-	cursor += len;
+	memcpy(req->post_payload_buf + req->cursor, buffer, len);
+	req->cursor += len;
 
 	if (status == HTTP_SERVER_DATA_FINAL) {
-		parse_led_post(post_payload_buf, cursor);
-		cursor = 0;
+		(void)parse_led_post(req->post_payload_buf, req->cursor);
 	}
 
 	return 0;
 }
 
+#ifdef CONFIG_WIFI
 static void parse_jwt_post(uint8_t *buf, size_t len)
 {
 	ARG_UNUSED((len));
@@ -309,7 +155,11 @@ static void parse_jwt_post(uint8_t *buf, size_t len)
 
 	get_nrfcloud_api_str(api_str, sizeof(api_str));
 
-	send_http_request(location_str, sizeof(location_str), api_str, sizeof(api_str), temp_buff);
+	int64_t start = k_uptime_get();
+
+	ret = send_http_request(location_str, sizeof(location_str), api_str, sizeof(api_str),
+				temp_buff);
+	metrics_location_request(k_uptime_delta(&start), ret == 200);
 
 	http_resources_set_location(location_str);
 
@@ -319,23 +169,27 @@ static void parse_jwt_post(uint8_t *buf, size_t len)
 	}
 }
 
+/* State of a POST request, the payload collected so far */
+struct jwt_request {
+	uint8_t post_payload_buf[512];
+	size_t cursor;
+};
+
+HTTP_REQ_POOL_DEFINE(jwt_http_reqs, struct jwt_request);
+
 static int jwt_handler(struct http_client_ctx *client, enum http_data_status status,
 		       uint8_t *buffer, size_t len, void *user_data)
 {
 
 	ARG_UNUSED(client);
-	ARG_UNUSED(user_data);
 
-	static uint8_t post_payload_buf[512];
-	static size_t cursor;
+	struct jwt_request *req = user_data;
 
 	if (status == HTTP_SERVER_DATA_ABORTED) {
-		cursor = 0;
 		return 0;
 	}
 
-	if (len + cursor > sizeof(post_payload_buf)) {
-		cursor = 0;
+	if (len + req->cursor > sizeof(req->post_payload_buf)) {
 		LOG_ERR("Buffer overflow");
 		return -ENOMEM;
 	}
@@ -344,17 +198,17 @@ static int jwt_handler(struct http_client_ctx *client, enum http_data_status sta
 	 * chunks (e.g. if the header size was such that the whole HTTP request exceeds the size of
 	 * the client buffer).
 	 */
-	memcpy(post_payload_buf + cursor, buffer, len);
-	cursor += len;
-	LOG_INF("JWT handler cursor %zu", cursor);
+	memcpy(req->post_payload_buf + req->cursor, buffer, len);
+	req->cursor += len;
+	LOG_INF("JWT handler cursor %zu", req->cursor);
 
 	if (status == HTTP_SERVER_DATA_FINAL) {
-		parse_jwt_post(post_payload_buf, cursor);
-		cursor = 0;
+		parse_jwt_post(req->post_payload_buf, req->cursor);
 	}
 
 	return 0;
 }
+#endif // CONFIG_WIFI
 
 /**
  * @brief Function called when buttons are pressed.
@@ -370,12 +224,10 @@ static void button_handler(uint32_t button_state, uint32_t has_changed)
 }
 
 /**
- * @brief Function called when Wi-Fi is connected.
+ * @brief Start the HTTP server once the network is up.
  */
-static void wifi_connected_handler(void)
+static void network_ready(void)
 {
-	LOG_INF("Wi-Fi connected");
-
 	LOG_INF("HTTP server staring");
 	http_server_start();
 
@@ -385,19 +237,35 @@ static void wifi_connected_handler(void)
 	}
 }
 
+#ifdef CONFIG_WIFI
+/**
+ * @brief Function called when Wi-Fi is connected.
+ */
+static void wifi_connected_handler(void)
+{
+	LOG_INF("Wi-Fi connected");
+
+	network_ready();
+}
+#endif // CONFIG_WIFI
+
+/* State of a GET request */
+struct location_request {
+	bool response_sent;
+};
+
+HTTP_REQ_POOL_DEFINE(location_http_reqs, struct location_request);
+
 static int location_handler(struct http_client_ctx *client, enum http_data_status status,
 			    uint8_t *buffer, size_t len, void *user_data)
 {
 	ARG_UNUSED(client);
 	ARG_UNUSED(len);
-	ARG_UNUSED(user_data);
 
-	static bool response_sent;
-	extern char location_buf[256];
+	struct location_request *req = user_data;
 
 	switch (status) {
 	case HTTP_SERVER_DATA_ABORTED: {
-		response_sent = false;
 		return 0;
 	}
 
@@ -409,16 +277,15 @@ static int location_handler(struct http_client_ctx *client, enum http_data_statu
 	}
 
 	case HTTP_SERVER_DATA_FINAL: {
-		if (response_sent) {
+		if (req->response_sent) {
 			/* Response already sent, return 0 to indicate to server that the callback
 			 * does not need to be called again.
 			 */
-			response_sent = false;
 			return 0;
 		}
 
-		response_sent = true;
-		return snprintf(buffer, sizeof(location_buf), "%s", location_buf);
+		req->response_sent = true;
+		return snprintf(buffer, sizeof(location_buf), "%s", (const char *)location_buf);
 	}
 	default: {
 		LOG_WRN("Unexpected status %d", status);
@@ -437,8 +304,7 @@ int main(void)
 	// 	return -1;
 	// }
 
-	if (!pwm_is_ready_dt(&red_pwm_led) || !pwm_is_ready_dt(&green_pwm_led) ||
-	    !pwm_is_ready_dt(&blue_pwm_led)) {
+	if (!led_is_ready()) {
 		LOG_ERR("Error: one or more PWM devices not ready\n");
 		return 0;
 	}
@@ -460,23 +326,42 @@ int main(void)
 		return ret;
 	}
 
+#ifdef CONFIG_WIFI
 	/* Provision certificates before connecting to the network */
 	ret = cert_provision();
 	if (ret) {
 		return 0;
 	}
 
-	http_resources_set_led_handler(led_handler);
-	http_resources_set_jwt_handler(jwt_handler);
-	http_resources_set_ws_handler(ws_sensors_setup);
+	http_resources_set_jwt_handler(jwt_handler, &jwt_http_reqs);
 	wifi_sta_set_wifi_connected_cb(wifi_connected_handler);
-	http_resources_set_location_handler(location_handler);
+#endif // CONFIG_WIFI
+	http_resources_set_led_handler(led_handler, &led_http_reqs);
+	http_resources_set_ws_handler(ws_stream_setup);
+	http_resources_set_location_handler(location_handler, &location_http_reqs);
+	http_resources_set_config_handler(app_config_handler, &app_config_http_reqs);
+	http_resources_set_schema_handler(sensors_schema_handler, &sensors_schema_http_reqs);
+#ifdef CONFIG_APP_METRICS
+	http_resources_set_metrics_handler(metrics_handler, &metrics_http_reqs);
+#endif // CONFIG_APP_METRICS
+#ifdef CONFIG_APP_HISTORY
+	http_resources_set_history_handler(history_handler, &history_http_reqs);
+#endif // CONFIG_APP_HISTORY
+#ifdef CONFIG_APP_ENVLOG
+	http_resources_set_envlog_handler(envlog_handler, &envlog_http_reqs);
+#endif // CONFIG_APP_ENVLOG
+#ifdef CONFIG_APP_CAPTURE
+	http_resources_set_capture_handlers(capture_handler, &capture_http_reqs,
+					    capture_csv_handler, capture_bin_handler,
+					    &capture_download_http_reqs);
+#endif // CONFIG_APP_CAPTURE
 
 #ifdef CONFIG_SYS_HEAP_LISTENER
 	heap_listener_register(&system_heap_listener_alloc);
 	heap_listener_register(&system_heap_listener_free);
 #endif // CONFIG_SYS_HEAP_LISTENER
 
+#ifdef CONFIG_WIFI
 	net_mgmt_callback_init();
 
 	ret = wifi_scan();
@@ -494,6 +379,10 @@ int main(void)
 #else
 	start_app();
 #endif /* CONFIG_WIFI_READY_LIB */
+#else
+	// Without Wi-Fi the network is configured at boot, e.g. the TAP interface of native_sim
+	network_ready();
+#endif // CONFIG_WIFI
 
 	return ret;
 }
@@ -0,0 +1,416 @@
+#include "metrics.h"
+#include "http_resources.h"
+#ifdef CONFIG_WIFI
+#include "wifi.h"
+#endif // CONFIG_WIFI
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/sys_heap.h>
+#include <zephyr/net/net_pkt.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(METRICS, CONFIG_METRICS_LOG_LEVEL);
+
+// All counters are plain atomics so that the hot paths only pay for a single atomic add. The
+// Prometheus text is rendered on demand when /metrics is scraped.
+
+static atomic_t ws_frames_sent[CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS];
+static atomic_t ws_frames_dropped[CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS];
+static atomic_t ws_bytes_sent[CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS];
+
+static atomic_t sensor_fetch_errors[METRICS_DEV_COUNT];
+static const char *const sensor_dev_names[METRICS_DEV_COUNT] = {
+	[METRICS_DEV_BMI270] = "bmi270",
+	[METRICS_DEV_ADXL367] = "adxl367",
+	[METRICS_DEV_BME680] = "bme680",
+};
+
+static atomic_t location_requests;
+static atomic_t location_failures;
+static atomic_t location_latency_ms_sum;
+static atomic_t location_latency_ms_last;
+
+static atomic_t wifi_rssi;
+static atomic_t wifi_connects;
+
+void metrics_ws_frame_sent(int slot, size_t bytes)
+{
+	if (slot < 0 || slot >= CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS) {
+		return;
+	}
+
+	atomic_inc(&ws_frames_sent[slot]);
+	atomic_add(&ws_bytes_sent[slot], (atomic_val_t)bytes);
+}
+
+void metrics_ws_frame_dropped(int slot)
+{
+	if (slot < 0 || slot >= CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS) {
+		return;
+	}
+
+	atomic_inc(&ws_frames_dropped[slot]);
+}
+
+void metrics_sensor_fetch_error(enum metrics_sensor_dev dev)
+{
+	if (dev >= METRICS_DEV_COUNT) {
+		return;
+	}
+
+	atomic_inc(&sensor_fetch_errors[dev]);
+}
+
+void metrics_location_request(int64_t latency_ms, bool success)
+{
+	atomic_inc(&location_requests);
+	if (!success) {
+		atomic_inc(&location_failures);
+	}
+
+	atomic_add(&location_latency_ms_sum, (atomic_val_t)latency_ms);
+	atomic_set(&location_latency_ms_last, (atomic_val_t)latency_ms);
+}
+
+void metrics_wifi_rssi_set(int rssi)
+{
+	atomic_set(&wifi_rssi, rssi);
+}
+
+void metrics_wifi_connected(void)
+{
+	atomic_inc(&wifi_connects);
+}
+
+//////////////////////////////////////// Rendering //////////////////////////////////////////
+
+/* Room kept at the end of the text for the thingy_metrics_* trailer */
+#define METRICS_TRAILER_LEN 384
+
+BUILD_ASSERT(CONFIG_APP_METRICS_TEXT_SIZE > 2 * METRICS_TRAILER_LEN,
+	     "CONFIG_APP_METRICS_TEXT_SIZE leaves no room for the metrics");
+
+static sys_slist_t collectors = SYS_SLIST_STATIC_INIT(&collectors);
+
+struct metrics_writer {
+	char *buf;
+	size_t size;
+	size_t len;
+	size_t needed; // Length of the complete text, also counting what was left out
+	bool truncated;
+};
+
+void metrics_printf(struct metrics_writer *w, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	// Once truncated, the lines are only measured
+	va_start(args, fmt);
+	if (w->truncated) {
+		ret = vsnprintf(NULL, 0, fmt, args);
+	} else {
+		ret = vsnprintf(w->buf + w->len, w->size - w->len, fmt, args);
+	}
+	va_end(args);
+
+	if (ret < 0) {
+		return;
+	}
+
+	w->needed += ret;
+
+	if (w->truncated) {
+		return;
+	}
+
+	if (ret >= w->size - w->len) {
+		// Drop the partial line so the output stays parsable
+		w->buf[w->len] = '\0';
+		w->truncated = true;
+		return;
+	}
+
+	w->len += ret;
+}
+
+void metrics_header(struct metrics_writer *w, const char *name, const char *type,
+		    const char *help)
+{
+	metrics_printf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void render_heap(struct metrics_writer *w)
+{
+#if K_HEAP_MEM_POOL_SIZE > 0
+	extern struct k_heap _system_heap;
+	struct sys_memory_stats stats;
+
+	if (sys_heap_runtime_stats_get(&_system_heap.heap, &stats)) {
+		return;
+	}
+
+	metrics_header(w, "thingy_heap_used_bytes", "gauge", "System heap bytes allocated");
+	metrics_printf(w, "thingy_heap_used_bytes %zu\n", stats.allocated_bytes);
+	metrics_header(w, "thingy_heap_free_bytes", "gauge", "System heap bytes free");
+	metrics_printf(w, "thingy_heap_free_bytes %zu\n", stats.free_bytes);
+	metrics_header(w, "thingy_heap_peak_bytes", "gauge", "System heap high-water mark");
+	metrics_printf(w, "thingy_heap_peak_bytes %zu\n", stats.max_allocated_bytes);
+#endif
+}
+
+struct thread_render_ctx {
+	struct metrics_writer *w;
+	bool unused;
+};
+
+static void render_thread_cb(const struct k_thread *cthread, void *user_data)
+{
+	struct k_thread *thread = (struct k_thread *)cthread;
+	struct thread_render_ctx *ctx = user_data;
+	const char *name = k_thread_name_get(thread);
+	char addr[sizeof("0x0000000000000000")];
+	size_t unused;
+
+	if (name == NULL || name[0] == '\0') {
+		snprintf(addr, sizeof(addr), "%p", (void *)thread);
+		name = addr;
+	}
+
+	if (!ctx->unused) {
+		metrics_printf(ctx->w, "thingy_thread_stack_size_bytes{thread=\"%s\"} %zu\n", name,
+			       thread->stack_info.size);
+		return;
+	}
+
+	if (k_thread_stack_space_get(thread, &unused)) {
+		return;
+	}
+
+	metrics_printf(ctx->w, "thingy_thread_stack_unused_bytes{thread=\"%s\"} %zu\n", name,
+		       unused);
+}
+
+static void render_threads(struct metrics_writer *w)
+{
+	struct thread_render_ctx ctx = {.w = w};
+
+	metrics_header(w, "thingy_thread_stack_size_bytes", "gauge", "Thread stack size");
+	k_thread_foreach_unlocked(render_thread_cb, &ctx);
+
+	// Stack high-water mark, derived from the untouched part of the stack (CONFIG_INIT_STACKS)
+	ctx.unused = true;
+	metrics_header(w, "thingy_thread_stack_unused_bytes", "gauge",
+		       "Thread stack bytes never used");
+	k_thread_foreach_unlocked(render_thread_cb, &ctx);
+}
+
+static void render_net_bufs(struct metrics_writer *w)
+{
+	struct k_mem_slab *rx, *tx;
+	struct net_buf_pool *rx_data, *tx_data;
+
+	net_pkt_get_info(&rx, &tx, &rx_data, &tx_data);
+
+	metrics_header(w, "thingy_net_pkt_used", "gauge", "Network packets in use");
+	metrics_printf(w, "thingy_net_pkt_used{pool=\"rx\"} %u\n", k_mem_slab_num_used_get(rx));
+	metrics_printf(w, "thingy_net_pkt_used{pool=\"tx\"} %u\n", k_mem_slab_num_used_get(tx));
+	metrics_header(w, "thingy_net_pkt_total", "gauge", "Network packets in pool");
+	metrics_printf(w, "thingy_net_pkt_total{pool=\"rx\"} %u\n", rx->info.num_blocks);
+	metrics_printf(w, "thingy_net_pkt_total{pool=\"tx\"} %u\n", tx->info.num_blocks);
+
+#ifdef CONFIG_NET_BUF_POOL_USAGE
+	metrics_header(w, "thingy_net_buf_used", "gauge", "Network buffers in use");
+	metrics_printf(w, "thingy_net_buf_used{pool=\"rx_data\"} %ld\n",
+		       (long)(rx_data->buf_count - atomic_get(&rx_data->avail_count)));
+	metrics_printf(w, "thingy_net_buf_used{pool=\"tx_data\"} %ld\n",
+		       (long)(tx_data->buf_count - atomic_get(&tx_data->avail_count)));
+#endif
+	metrics_header(w, "thingy_net_buf_total", "gauge", "Network buffers in pool");
+	metrics_printf(w, "thingy_net_buf_total{pool=\"rx_data\"} %u\n", rx_data->buf_count);
+	metrics_printf(w, "thingy_net_buf_total{pool=\"tx_data\"} %u\n", tx_data->buf_count);
+}
+
+static void render_websockets(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_ws_frames_sent_total", "counter",
+		       "Sensor frames sent per websocket slot");
+	for (int i = 0; i < CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS; i++) {
+		metrics_printf(w, "thingy_ws_frames_sent_total{slot=\"%d\"} %lu\n", i,
+			       (unsigned long)atomic_get(&ws_frames_sent[i]));
+	}
+
+	metrics_header(w, "thingy_ws_frames_dropped_total", "counter",
+		       "Sensor frames that could not be sent per websocket slot");
+	for (int i = 0; i < CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS; i++) {
+		metrics_printf(w, "thingy_ws_frames_dropped_total{slot=\"%d\"} %lu\n", i,
+			       (unsigned long)atomic_get(&ws_frames_dropped[i]));
+	}
+
+	metrics_header(w, "thingy_ws_bytes_sent_total", "counter",
+		       "Sensor payload bytes sent per websocket slot");
+	for (int i = 0; i < CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS; i++) {
+		metrics_printf(w, "thingy_ws_bytes_sent_total{slot=\"%d\"} %lu\n", i,
+			       (unsigned long)atomic_get(&ws_bytes_sent[i]));
+	}
+}
+
+static void render_sensors(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_sensor_fetch_errors_total", "counter",
+		       "Failed sensor fetches per device");
+	for (int i = 0; i < METRICS_DEV_COUNT; i++) {
+		metrics_printf(w, "thingy_sensor_fetch_errors_total{device=\"%s\"} %lu\n",
+			       sensor_dev_names[i],
+			       (unsigned long)atomic_get(&sensor_fetch_errors[i]));
+	}
+}
+
+static void render_location(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_location_requests_total", "counter",
+		       "Wi-Fi location requests sent to nRF Cloud");
+	metrics_printf(w, "thingy_location_requests_total %lu\n",
+		       (unsigned long)atomic_get(&location_requests));
+	metrics_header(w, "thingy_location_failures_total", "counter",
+		       "Wi-Fi location requests without a location in the response");
+	metrics_printf(w, "thingy_location_failures_total %lu\n",
+		       (unsigned long)atomic_get(&location_failures));
+	metrics_header(w, "thingy_location_latency_ms", "summary",
+		       "Wi-Fi location request latency");
+	metrics_printf(w, "thingy_location_latency_ms_sum %lu\n",
+		       (unsigned long)atomic_get(&location_latency_ms_sum));
+	metrics_printf(w, "thingy_location_latency_ms_count %lu\n",
+		       (unsigned long)atomic_get(&location_requests));
+	metrics_header(w, "thingy_location_latency_last_ms", "gauge",
+		       "Latency of the most recent location request");
+	metrics_printf(w, "thingy_location_latency_last_ms %ld\n",
+		       (long)atomic_get(&location_latency_ms_last));
+}
+
+static void render_wifi(struct metrics_writer *w)
+{
+#ifdef CONFIG_WIFI
+	int rssi;
+
+	if (wifi_sta_get_rssi(&rssi) == 0) {
+		metrics_wifi_rssi_set(rssi);
+	}
+#endif // CONFIG_WIFI
+
+	metrics_header(w, "thingy_wifi_rssi_dbm", "gauge", "Station RSSI");
+	metrics_printf(w, "thingy_wifi_rssi_dbm %ld\n", (long)atomic_get(&wifi_rssi));
+
+	// The first connection after boot is not a reconnect
+	atomic_val_t connects = atomic_get(&wifi_connects);
+
+	metrics_header(w, "thingy_wifi_reconnects_total", "counter", "Wi-Fi reconnections");
+	metrics_printf(w, "thingy_wifi_reconnects_total %ld\n", (long)MAX(connects - 1, 0));
+}
+
+void metrics_register_collector(struct metrics_collector *collector)
+{
+	sys_slist_append(&collectors, &collector->node);
+}
+
+static size_t metrics_render(char *buf, size_t size)
+{
+	struct metrics_writer w = {
+		.buf = buf,
+		.size = size - METRICS_TRAILER_LEN,
+	};
+	bool truncated;
+	size_t needed;
+
+	metrics_header(&w, "thingy_uptime_seconds", "counter", "Time since boot");
+	metrics_printf(&w, "thingy_uptime_seconds %lld\n", k_uptime_get() / MSEC_PER_SEC);
+
+	render_heap(&w);
+	render_threads(&w);
+	render_net_bufs(&w);
+	render_websockets(&w);
+	render_sensors(&w);
+	render_location(&w);
+	render_wifi(&w);
+
+	struct metrics_collector *collector;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&collectors, collector, node) {
+		collector->collect(&w);
+	}
+
+	truncated = w.truncated;
+	needed = w.needed;
+	if (truncated) {
+		LOG_WRN("Metrics truncated at %zu of %zu bytes, increase CONFIG_APP_METRICS_TEXT_SIZE",
+			w.len, needed);
+	}
+
+	// The trailer goes in the room kept for it, so a scraper sees the truncation too
+	w.size = size;
+	w.truncated = false;
+	metrics_header(&w, "thingy_metrics_truncated", "gauge",
+		       "1 if metrics were left out, CONFIG_APP_METRICS_TEXT_SIZE is too small");
+	metrics_printf(&w, "thingy_metrics_truncated %d\n", truncated);
+	metrics_header(&w, "thingy_metrics_text_bytes", "gauge",
+		       "Length of the complete metrics text before this trailer");
+	metrics_printf(&w, "thingy_metrics_text_bytes %zu\n", needed);
+
+	return w.len;
+}
+
+/* State of a scrape, the text rendered at its start */
+struct metrics_request {
+	char text[CONFIG_APP_METRICS_TEXT_SIZE];
+	size_t text_len;
+	size_t cursor;
+};
+
+HTTP_REQ_POOL_DEFINE(metrics_http_reqs, struct metrics_request);
+
+int metrics_handler(struct http_client_ctx *client, enum http_data_status status,
+		    uint8_t *buffer, size_t len, void *user_data)
+{
+	ARG_UNUSED(client);
+	ARG_UNUSED(len);
+
+	struct metrics_request *req = user_data;
+
+	switch (status) {
+	case HTTP_SERVER_DATA_ABORTED: {
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_MORE: {
+		/* A payload is not expected with the GET request */
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_FINAL: {
+		if (req->text_len == 0) {
+			req->text_len = metrics_render(req->text, sizeof(req->text));
+			req->cursor = 0;
+		}
+
+		/* The response is sent in chunks of at most the resource buffer size. Returning 0
+		 * tells the server that the response is complete.
+		 */
+		size_t chunk = MIN(req->text_len - req->cursor, METRICS_BUF_LEN);
+
+		if (chunk == 0) {
+			return 0;
+		}
+
+		memcpy(buffer, req->text + req->cursor, chunk);
+		req->cursor += chunk;
+
+		return chunk;
+	}
+	default: {
+		LOG_WRN("Unexpected status %d", status);
+		return -1;
+	}
+	}
+}
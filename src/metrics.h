@@ -0,0 +1,74 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/http/server.h>
+
+enum metrics_sensor_dev {
+	METRICS_DEV_BMI270,
+	METRICS_DEV_ADXL367,
+	METRICS_DEV_BME680,
+	METRICS_DEV_COUNT,
+};
+
+struct metrics_writer;
+
+/**
+ * @brief Collector called for every scrape to render module specific metrics.
+ *
+ * Collectors are registered once at init and render their metrics with metrics_header() and
+ * metrics_printf().
+ */
+struct metrics_collector {
+	sys_snode_t node;
+	void (*collect)(struct metrics_writer *w);
+};
+
+#ifdef CONFIG_APP_METRICS
+
+void metrics_register_collector(struct metrics_collector *collector);
+void metrics_header(struct metrics_writer *w, const char *name, const char *type,
+		    const char *help);
+void metrics_printf(struct metrics_writer *w, const char *fmt, ...);
+
+void metrics_ws_frame_sent(int slot, size_t bytes);
+void metrics_ws_frame_dropped(int slot);
+void metrics_sensor_fetch_error(enum metrics_sensor_dev dev);
+void metrics_location_request(int64_t latency_ms, bool success);
+void metrics_wifi_rssi_set(int rssi);
+void metrics_wifi_connected(void);
+
+int metrics_handler(struct http_client_ctx *client, enum http_data_status status,
+		    uint8_t *buffer, size_t len, void *user_data);
+extern struct http_req_pool metrics_http_reqs;
+
+#else
+
+static inline void metrics_register_collector(struct metrics_collector *collector)
+{
+}
+
+static inline void metrics_ws_frame_sent(int slot, size_t bytes)
+{
+}
+
+static inline void metrics_ws_frame_dropped(int slot)
+{
+}
+
+static inline void metrics_sensor_fetch_error(enum metrics_sensor_dev dev)
+{
+}
+
+static inline void metrics_location_request(int64_t latency_ms, bool success)
+{
+}
+
+static inline void metrics_wifi_rssi_set(int rssi)
+{
+}
+
+static inline void metrics_wifi_connected(void)
+{
+}
+
+#endif // CONFIG_APP_METRICS
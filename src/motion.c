@@ -0,0 +1,260 @@
+#include "imu.h"
+#include "motion.h"
+#include "metrics.h"
+#include "power.h"
+#include "sensors.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <zephyr/init.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(MOTION, CONFIG_MOTION_LOG_LEVEL);
+
+// Motion events from the activity and inactivity detection of the ADXL367. The accelerometer
+// compares its samples with the thresholds itself and raises its interrupt pin, so nothing is
+// polled while the device lies still. The trigger handler runs in the driver's trigger thread: it
+// timestamps the interrupt, reads one sample to tell a start from a stop, and queues the events
+// for a work item that renders them as JSON for the listeners.
+//
+// The driver reports activity and inactivity through the same threshold trigger, so the state and
+// the sample tell them apart. Any interrupt while still is a motion start. While moving, an
+// interrupt with the magnitude back near 1 g is the inactivity detection and stops the motion.
+//
+// One sample per interrupt says little about a fall or an impact, so while moving the module
+// listens to the IMU sampler and classifies every sample. A free fall is the 100 Hz ADXL367
+// magnitude below the free-fall threshold for CONFIG_APP_MOTION_FREE_FALL_MS, which the always on
+// ADXL367 sees from the first sample. A shock is a 200 Hz BMI270 sample above the shock threshold,
+// as the ADXL367 saturates at its +-2 g range. The BMI270 range is kept above the threshold, see
+// APP_CONFIG_BMI270_ACCEL_RANGE_MIN. Each event is raised once, and again only after the magnitude
+// was back inside the threshold.
+
+#define FREE_FALL_SAMPLES                                                                          \
+	DIV_ROUND_UP(CONFIG_APP_MOTION_FREE_FALL_MS * SENSORS_ADXL367_RATE_HZ, MSEC_PER_SEC)
+
+static const struct device *const motion_dev = DEVICE_DT_GET(DT_ALIAS(accel1));
+
+static const struct sensor_trigger motion_trigger = {
+	.type = SENSOR_TRIG_THRESHOLD,
+	.chan = SENSOR_CHAN_ACCEL_XYZ,
+};
+
+static const char *const event_names[MOTION_EVENT_COUNT] = {
+	[MOTION_EVENT_START] = "motion_start",
+	[MOTION_EVENT_STOP] = "motion_stop",
+	[MOTION_EVENT_SHOCK] = "shock",
+	[MOTION_EVENT_FREE_FALL] = "free_fall",
+};
+
+static sys_slist_t listeners = SYS_SLIST_STATIC_INIT(&listeners);
+static K_MUTEX_DEFINE(listeners_lock);
+static bool moving;
+
+// Classification state, only touched by the IMU thread
+static uint32_t free_fall_samples;
+static bool in_shock;
+
+static atomic_t event_count[MOTION_EVENT_COUNT];
+static atomic_t events_dropped;
+
+K_MSGQ_DEFINE(motion_msgq, sizeof(struct motion_event), CONFIG_APP_MOTION_QUEUE_SIZE, 4);
+
+static void motion_work_handler(struct k_work *work);
+static K_WORK_DEFINE(motion_work, motion_work_handler);
+
+const char *motion_event_name(enum motion_event_type type)
+{
+	return type < MOTION_EVENT_COUNT ? event_names[type] : "unknown";
+}
+
+void motion_add_listener(struct motion_listener *listener)
+{
+	k_mutex_lock(&listeners_lock, K_FOREVER);
+	sys_slist_append(&listeners, &listener->node);
+	k_mutex_unlock(&listeners_lock);
+}
+
+/* Render the queued events as {"event":"shock","ts":<us>,"g":3.21} and hand them to the listeners */
+static void motion_work_handler(struct k_work *work)
+{
+	struct motion_listener *listener;
+	struct motion_event event;
+	char json[96];
+	int ret;
+
+	while (k_msgq_get(&motion_msgq, &event, K_NO_WAIT) == 0) {
+		ret = snprintf(json, sizeof(json), "{\"event\":\"%s\",\"ts\":%lld,\"g\":%.2f}",
+			       motion_event_name(event.type), event.timestamp_us,
+			       (double)event.magnitude_g);
+
+		k_mutex_lock(&listeners_lock, K_FOREVER);
+		SYS_SLIST_FOR_EACH_CONTAINER(&listeners, listener, node) {
+			listener->on_event(json, ret);
+		}
+		k_mutex_unlock(&listeners_lock);
+	}
+}
+
+static void motion_raise(enum motion_event_type type, int64_t timestamp_us, float magnitude_g)
+{
+	struct motion_event event = {
+		.timestamp_us = timestamp_us,
+		.type = type,
+		.magnitude_g = magnitude_g,
+	};
+
+	LOG_INF("%s at %.2f g", motion_event_name(type), (double)magnitude_g);
+	atomic_inc(&event_count[type]);
+
+	if (k_msgq_put(&motion_msgq, &event, K_NO_WAIT)) {
+		atomic_inc(&events_dropped);
+		return;
+	}
+
+	k_work_submit(&motion_work);
+}
+
+static float motion_magnitude_g(const struct imu_sample *sample)
+{
+	return sqrtf(sample->data[0] * sample->data[0] + sample->data[1] * sample->data[1] +
+		     sample->data[2] * sample->data[2]) /
+	       (float)GRAVITY;
+}
+
+static void motion_on_sample(const struct imu_sample *sample)
+{
+	float magnitude_g = motion_magnitude_g(sample);
+
+	if (sample->source == IMU_SOURCE_ADXL367) {
+		if (magnitude_g >= CONFIG_APP_MOTION_FREE_FALL_MG / 1000.0f) {
+			free_fall_samples = 0;
+		} else if (++free_fall_samples == FREE_FALL_SAMPLES) {
+			motion_raise(MOTION_EVENT_FREE_FALL, sample->timestamp_us, magnitude_g);
+		}
+		return;
+	}
+
+	if (magnitude_g <= CONFIG_APP_MOTION_SHOCK_MG / 1000.0f) {
+		in_shock = false;
+	} else if (!in_shock) {
+		in_shock = true;
+		motion_raise(MOTION_EVENT_SHOCK, sample->timestamp_us, magnitude_g);
+	}
+}
+
+static struct imu_listener motion_imu_listener = {
+	.on_sample = motion_on_sample,
+};
+
+/* Classify the IMU samples, with the BMI270 resumed, from a motion start to its stop */
+static void motion_set_moving(bool start)
+{
+	moving = start;
+
+	if (start) {
+		free_fall_samples = 0;
+		in_shock = false;
+		power_demand_get();
+		imu_add_listener(&motion_imu_listener);
+	} else {
+		imu_remove_listener(&motion_imu_listener);
+		power_demand_put();
+	}
+}
+
+static void motion_trigger_handler(const struct device *dev, const struct sensor_trigger *trigger)
+{
+	ARG_UNUSED(dev);
+	ARG_UNUSED(trigger);
+
+	int64_t now_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	struct imu_sample sample;
+	float magnitude_g = 0.0f;
+	bool out_of_band = false;
+
+	// Without the sample the interrupt still toggles the state
+	if (sensors_fetch_imu(IMU_SOURCE_ADXL367, &sample) == 0) {
+		magnitude_g = motion_magnitude_g(&sample);
+		out_of_band = magnitude_g < CONFIG_APP_MOTION_FREE_FALL_MG / 1000.0f ||
+			      magnitude_g > CONFIG_APP_MOTION_SHOCK_MG / 1000.0f;
+	}
+
+	if (!moving) {
+		motion_set_moving(true);
+		motion_raise(MOTION_EVENT_START, now_us, magnitude_g);
+#ifdef CONFIG_APP_POWER_WAKE_ON_MOTION
+		power_wake_on_motion();
+#endif // CONFIG_APP_POWER_WAKE_ON_MOTION
+	} else if (!out_of_band) {
+		motion_set_moving(false);
+		motion_raise(MOTION_EVENT_STOP, now_us, magnitude_g);
+	}
+}
+
+/* Set a detection threshold of the accelerometer, given in mg */
+static void motion_set_threshold(enum sensor_attribute attr, int threshold_mg)
+{
+	struct sensor_value val;
+	int ret;
+
+	sensor_value_from_double(&val, threshold_mg / 1000.0 * GRAVITY);
+
+	ret = sensor_attr_set(motion_dev, SENSOR_CHAN_ACCEL_XYZ, attr, &val);
+	if (ret) {
+		LOG_WRN("Failed to set threshold %d mg, err %d, using the driver default",
+			threshold_mg, ret);
+	}
+}
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void motion_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_motion_events_total", "counter",
+		       "Motion events detected by the ADXL367 and the BMI270");
+	for (int i = 0; i < MOTION_EVENT_COUNT; i++) {
+		metrics_printf(w, "thingy_motion_events_total{type=\"%s\"} %u\n", event_names[i],
+			       (uint32_t)atomic_get(&event_count[i]));
+	}
+
+	metrics_header(w, "thingy_motion_events_dropped_total", "counter",
+		       "Motion events dropped because the queue was full");
+	metrics_printf(w, "thingy_motion_events_dropped_total %u\n",
+		       (uint32_t)atomic_get(&events_dropped));
+}
+
+static struct metrics_collector motion_collector = {
+	.collect = motion_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int motion_init(void)
+{
+	int ret;
+
+	if (!device_is_ready(motion_dev)) {
+		LOG_ERR("Device %s is not ready", motion_dev->name);
+		return 0;
+	}
+
+	motion_set_threshold(SENSOR_ATTR_UPPER_THRESH, CONFIG_APP_MOTION_ACTIVITY_MG);
+	motion_set_threshold(SENSOR_ATTR_LOWER_THRESH, CONFIG_APP_MOTION_INACTIVITY_MG);
+
+	ret = sensor_trigger_set(motion_dev, &motion_trigger, motion_trigger_handler);
+	if (ret) {
+		LOG_ERR("Failed to set the motion trigger, err %d", ret);
+		return 0;
+	}
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&motion_collector);
+#endif // CONFIG_APP_METRICS
+
+	LOG_INF("Motion detection started");
+
+	return 0;
+}
+SYS_INIT(motion_init, APPLICATION, 0);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+enum motion_event_type {
+	MOTION_EVENT_START,
+	MOTION_EVENT_STOP,
+	MOTION_EVENT_SHOCK,
+	MOTION_EVENT_FREE_FALL,
+	MOTION_EVENT_COUNT,
+};
+
+struct motion_event {
+	int64_t timestamp_us; // Uptime in microseconds of the interrupt or the sample
+	enum motion_event_type type;
+	float magnitude_g; // Acceleration magnitude of the sample that raised the event
+};
+
+/**
+ * @brief Consumer of the motion events, as JSON strings.
+ *
+ * The callback runs on the system work queue, the buffer may be reused once it returns.
+ */
+struct motion_listener {
+	sys_snode_t node;
+	void (*on_event)(const char *json, size_t len);
+};
+
+void motion_add_listener(struct motion_listener *listener);
+const char *motion_event_name(enum motion_event_type type);
@@ -0,0 +1,515 @@
+#include "metrics.h"
+#include "motion.h"
+#include "power.h"
+#include "sensors.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/init.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/zvfs/eventfd.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(MQTT_PUB, CONFIG_MQTT_PUB_LOG_LEVEL);
+
+// Publishes the sensor frames and the motion events to an MQTT broker, for telemetry systems that
+// do not run a browser. The samples come from the same acquisition listener as every other
+// stream. The listener packs them as binary struct sensor_frame into batches of
+// CONFIG_APP_MQTT_BATCH_SIZE, and a batch is also closed when its first sample is older than
+// CONFIG_APP_MQTT_BATCH_TIMEOUT_MS. Closed batches and events wait in bounded queues, which also
+// hold them while the broker is unreachable. When a queue is full the new entry is dropped.
+//
+// One thread owns the connection. It reconnects with an exponential backoff, and publishes the head
+// of each queue. With QoS 1 the head stays queued until its PUBACK, and is published again with
+// the DUP flag after a reconnect, so the queues are also the retransmission buffers.
+//
+// The subscribers of the broker are not known, so the sensors are held at full rate while the
+// publisher is connected. While the broker is unreachable they follow the other consumers.
+
+#define TOPIC_SENSORS CONFIG_APP_MQTT_TOPIC_PREFIX "/sensors"
+#define TOPIC_EVENTS  CONFIG_APP_MQTT_TOPIC_PREFIX "/events"
+
+#define EVENT_JSON_LEN 96
+
+struct mqtt_batch {
+	int64_t opened_ms; // Uptime when the first sample was added
+	uint16_t count;
+	struct sensor_frame frames[CONFIG_APP_MQTT_BATCH_SIZE];
+};
+
+struct mqtt_event_msg {
+	uint16_t len;
+	char json[EVENT_JSON_LEN];
+};
+
+/* A queue of messages for one topic, of which the head is being published */
+struct pub_queue {
+	struct k_msgq *msgq;
+	const char *topic;
+	uint16_t message_id; // Of the head while it waits for its PUBACK
+	bool in_flight;
+	atomic_t published;
+	atomic_t dropped;
+	atomic_t bytes;
+};
+
+K_MSGQ_DEFINE(batch_msgq, sizeof(struct mqtt_batch), CONFIG_APP_MQTT_QUEUE_SIZE, 8);
+K_MSGQ_DEFINE(event_msgq, sizeof(struct mqtt_event_msg), CONFIG_APP_MQTT_EVENT_QUEUE_SIZE, 4);
+
+static struct pub_queue queues[] = {
+	{.msgq = &batch_msgq, .topic = TOPIC_SENSORS},
+	{.msgq = &event_msgq, .topic = TOPIC_EVENTS},
+};
+
+K_THREAD_STACK_DEFINE(mqtt_stack_area, CONFIG_APP_MQTT_THREAD_STACK_SIZE);
+static struct k_thread mqtt_thread_data;
+
+static struct mqtt_client client;
+static struct sockaddr_storage broker;
+static uint8_t rx_buf[256];
+static uint8_t tx_buf[256];
+static atomic_t connected;
+static uint16_t next_message_id = 1;
+static int wake_fd = -1;
+
+// Batch being filled by the acquisition thread
+static struct k_spinlock batch_lock;
+static struct mqtt_batch batch;
+static uint32_t next_seq;
+
+// Scratch copy of a queue head, only used by the MQTT thread
+static union {
+	struct mqtt_batch batch;
+	struct mqtt_event_msg event;
+} head;
+
+static atomic_t samples_published;
+static uint32_t reconnects;
+
+static void mqtt_pub_wake(void)
+{
+	if (wake_fd >= 0) {
+		(void)zvfs_eventfd_write(wake_fd, 1);
+	}
+}
+
+/* Queue the batch being filled, with batch_lock held */
+static void mqtt_pub_close_batch(void)
+{
+	if (batch.count == 0) {
+		return;
+	}
+
+	if (k_msgq_put(&batch_msgq, &batch, K_NO_WAIT)) {
+		atomic_inc(&queues[0].dropped);
+	}
+	batch.count = 0;
+}
+
+/* Called by the acquisition thread for every new sample */
+static void mqtt_pub_on_sample(const struct sensor_sample *sample)
+{
+	struct sensor_frame frame;
+	k_spinlock_key_t key;
+	bool closed = false;
+
+	// Converted outside of the lock, next_seq is only written by the acquisition thread
+	sensors_sample_to_frame(sample, next_seq++, &frame);
+
+	key = k_spin_lock(&batch_lock);
+	if (batch.count == 0) {
+		batch.opened_ms = k_uptime_get();
+	}
+	batch.frames[batch.count++] = frame;
+	if (batch.count == CONFIG_APP_MQTT_BATCH_SIZE) {
+		mqtt_pub_close_batch();
+		closed = true;
+	}
+	k_spin_unlock(&batch_lock, key);
+
+	if (closed) {
+		mqtt_pub_wake();
+	}
+}
+
+static struct sensors_listener mqtt_pub_listener = {
+	.on_sample = mqtt_pub_on_sample,
+};
+
+#ifdef CONFIG_APP_MOTION
+static void mqtt_pub_on_event(const char *json, size_t len)
+{
+	struct mqtt_event_msg msg;
+
+	msg.len = MIN(len, sizeof(msg.json));
+	memcpy(msg.json, json, msg.len);
+
+	if (k_msgq_put(&event_msgq, &msg, K_NO_WAIT)) {
+		atomic_inc(&queues[1].dropped);
+		return;
+	}
+
+	mqtt_pub_wake();
+}
+
+static struct motion_listener mqtt_pub_motion_listener = {
+	.on_event = mqtt_pub_on_event,
+};
+#endif // CONFIG_APP_MOTION
+
+/* Close the batch being filled if its first sample is too old, returns the time left otherwise */
+static int mqtt_pub_batch_timeout(void)
+{
+	k_spinlock_key_t key;
+	int left_ms = SYS_FOREVER_MS;
+
+	key = k_spin_lock(&batch_lock);
+	if (batch.count > 0) {
+		left_ms = batch.opened_ms + CONFIG_APP_MQTT_BATCH_TIMEOUT_MS - k_uptime_get();
+		if (left_ms <= 0) {
+			mqtt_pub_close_batch();
+			left_ms = SYS_FOREVER_MS;
+		}
+	}
+	k_spin_unlock(&batch_lock, key);
+
+	return left_ms;
+}
+
+/* Hold the sensors at full rate from the CONNACK until the connection is lost */
+static void mqtt_pub_set_connected(bool state)
+{
+	if (!atomic_cas(&connected, !state, state)) {
+		return;
+	}
+
+	if (state) {
+		power_demand_get();
+	} else {
+		power_demand_put();
+	}
+}
+
+static void mqtt_pub_evt_handler(struct mqtt_client *const c, const struct mqtt_evt *evt)
+{
+	switch (evt->type) {
+	case MQTT_EVT_CONNACK:
+		if (evt->result == 0) {
+			mqtt_pub_set_connected(true);
+			LOG_INF("Connected to %s:%d", CONFIG_APP_MQTT_BROKER_HOSTNAME,
+				CONFIG_APP_MQTT_BROKER_PORT);
+		} else {
+			LOG_ERR("Connection refused by the broker, err %d", evt->result);
+		}
+		break;
+
+	case MQTT_EVT_DISCONNECT:
+		mqtt_pub_set_connected(false);
+		LOG_INF("Disconnected, err %d", evt->result);
+		break;
+
+	case MQTT_EVT_PUBACK:
+		for (int i = 0; i < ARRAY_SIZE(queues); i++) {
+			if (queues[i].in_flight &&
+			    queues[i].message_id == evt->param.puback.message_id) {
+				(void)k_msgq_get(queues[i].msgq, &head, K_NO_WAIT);
+				queues[i].message_id = 0;
+				queues[i].in_flight = false;
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* Publish the head of a queue, returns true if the next one can follow at once */
+static bool mqtt_pub_send_head(struct pub_queue *q)
+{
+	struct mqtt_publish_param param = {0};
+	int ret;
+
+	if (q->in_flight || k_msgq_peek(q->msgq, &head) != 0) {
+		return false;
+	}
+
+	if (q->msgq == &batch_msgq) {
+		param.message.payload.data = (uint8_t *)head.batch.frames;
+		param.message.payload.len = head.batch.count * sizeof(struct sensor_frame);
+	} else {
+		param.message.payload.data = (uint8_t *)head.event.json;
+		param.message.payload.len = head.event.len;
+	}
+
+	param.message.topic.topic.utf8 = (const uint8_t *)q->topic;
+	param.message.topic.topic.size = strlen(q->topic);
+	param.message.topic.qos = CONFIG_APP_MQTT_QOS;
+	param.message_id = q->message_id;
+	// A message id is only set once the head was sent, so this is a retransmission
+	param.dup_flag = CONFIG_APP_MQTT_QOS > 0 && q->message_id != 0;
+
+	if (!param.dup_flag) {
+		param.message_id = next_message_id++;
+		if (next_message_id == 0) {
+			next_message_id = 1;
+		}
+	}
+
+	ret = mqtt_publish(&client, &param);
+	if (ret) {
+		LOG_WRN("Failed to publish to %s, err %d", q->topic, ret);
+		return false;
+	}
+
+	atomic_inc(&q->published);
+	atomic_add(&q->bytes, param.message.payload.len);
+	if (q->msgq == &batch_msgq) {
+		atomic_add(&samples_published, head.batch.count);
+	}
+
+	if (CONFIG_APP_MQTT_QOS == 0) {
+		(void)k_msgq_get(q->msgq, &head, K_NO_WAIT);
+		return true;
+	}
+
+	q->message_id = param.message_id;
+	q->in_flight = true;
+
+	return false;
+}
+
+static void mqtt_pub_abort(void)
+{
+	(void)mqtt_abort(&client);
+	mqtt_pub_set_connected(false);
+}
+
+static int mqtt_pub_connect(void)
+{
+	struct zsock_addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct zsock_addrinfo *res;
+	struct zsock_pollfd fds;
+	char port[8];
+	int ret;
+
+	snprintf(port, sizeof(port), "%d", CONFIG_APP_MQTT_BROKER_PORT);
+	ret = zsock_getaddrinfo(CONFIG_APP_MQTT_BROKER_HOSTNAME, port, &hints, &res);
+	if (ret) {
+		LOG_DBG("Failed to resolve the broker, err %d", ret);
+		return -EHOSTUNREACH;
+	}
+	memcpy(&broker, res->ai_addr, MIN(res->ai_addrlen, sizeof(broker)));
+	zsock_freeaddrinfo(res);
+
+	mqtt_client_init(&client);
+	client.broker = &broker;
+	client.evt_cb = mqtt_pub_evt_handler;
+	client.client_id.utf8 = (const uint8_t *)CONFIG_APP_MQTT_CLIENT_ID;
+	client.client_id.size = strlen(CONFIG_APP_MQTT_CLIENT_ID);
+	client.protocol_version = MQTT_VERSION_3_1_1;
+	client.rx_buf = rx_buf;
+	client.rx_buf_size = sizeof(rx_buf);
+	client.tx_buf = tx_buf;
+	client.tx_buf_size = sizeof(tx_buf);
+	client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+
+	ret = mqtt_connect(&client);
+	if (ret) {
+		return ret;
+	}
+
+	fds.fd = client.transport.tcp.sock;
+	fds.events = ZSOCK_POLLIN;
+	ret = zsock_poll(&fds, 1, CONFIG_APP_MQTT_CONNECT_TIMEOUT_MS);
+	if (ret > 0) {
+		(void)mqtt_input(&client);
+	}
+
+	if (!atomic_get(&connected)) {
+		mqtt_pub_abort();
+		return -ETIMEDOUT;
+	}
+
+	// The heads that were not acknowledged are published again, with the DUP flag
+	for (int i = 0; i < ARRAY_SIZE(queues); i++) {
+		queues[i].in_flight = false;
+	}
+
+	return 0;
+}
+
+static void mqtt_pub_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct zsock_pollfd fds[2];
+	int backoff_ms = CONFIG_APP_MQTT_RECONNECT_MIN_MS;
+	zvfs_eventfd_t value;
+	int timeout_ms;
+	int ret;
+
+	while (true) {
+		if (!atomic_get(&connected)) {
+			ret = mqtt_pub_connect();
+			if (ret) {
+				LOG_DBG("Failed to connect, err %d, retry in %d ms", ret, backoff_ms);
+				(void)mqtt_pub_batch_timeout();
+				k_sleep(K_MSEC(backoff_ms));
+				backoff_ms = MIN(backoff_ms * 2, CONFIG_APP_MQTT_RECONNECT_MAX_MS);
+				continue;
+			}
+			backoff_ms = CONFIG_APP_MQTT_RECONNECT_MIN_MS;
+			reconnects++;
+		}
+
+		for (int i = 0; i < ARRAY_SIZE(queues); i++) {
+			while (atomic_get(&connected) && mqtt_pub_send_head(&queues[i])) {
+			}
+		}
+
+		timeout_ms = mqtt_keepalive_time_left(&client);
+		ret = mqtt_pub_batch_timeout();
+		if (ret != SYS_FOREVER_MS && (timeout_ms < 0 || ret < timeout_ms)) {
+			timeout_ms = ret;
+		}
+
+		fds[0].fd = client.transport.tcp.sock;
+		fds[0].events = ZSOCK_POLLIN;
+		fds[1].fd = wake_fd;
+		fds[1].events = ZSOCK_POLLIN;
+
+		ret = zsock_poll(fds, ARRAY_SIZE(fds), timeout_ms);
+		if (ret < 0) {
+			LOG_ERR("Poll failed, errno %d", errno);
+			mqtt_pub_abort();
+			continue;
+		}
+
+		if (fds[1].revents & ZSOCK_POLLIN) {
+			(void)zvfs_eventfd_read(wake_fd, &value);
+		}
+
+		if (fds[0].revents & ZSOCK_POLLIN) {
+			ret = mqtt_input(&client);
+			if (ret) {
+				LOG_INF("Connection lost, err %d", ret);
+				mqtt_pub_abort();
+				continue;
+			}
+		}
+
+		if (fds[0].revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP | ZSOCK_POLLNVAL)) {
+			mqtt_pub_abort();
+			continue;
+		}
+
+		ret = mqtt_live(&client);
+		if (ret && ret != -EAGAIN) {
+			LOG_INF("Keep-alive failed, err %d", ret);
+			mqtt_pub_abort();
+		}
+	}
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_mqtt_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	shell_print(sh, "%s %s:%d, %u connections",
+		    atomic_get(&connected) ? "Connected to" : "Connecting to",
+		    CONFIG_APP_MQTT_BROKER_HOSTNAME, CONFIG_APP_MQTT_BROKER_PORT, reconnects);
+
+	for (int i = 0; i < ARRAY_SIZE(queues); i++) {
+		shell_print(sh, "%s: %u published, %u queued, %u dropped", queues[i].topic,
+			    (uint32_t)atomic_get(&queues[i].published),
+			    k_msgq_num_used_get(queues[i].msgq),
+			    (uint32_t)atomic_get(&queues[i].dropped));
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(mqtt_cmds,
+			       SHELL_CMD(status, NULL, "Show the publisher status", cmd_mqtt_status),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(mqtt_pub, &mqtt_cmds, "MQTT sensor publisher", NULL);
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void mqtt_pub_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_mqtt_connected", "gauge", "1 while connected to the broker");
+	metrics_printf(w, "thingy_mqtt_connected %d\n", (int)atomic_get(&connected));
+
+	metrics_header(w, "thingy_mqtt_connections_total", "counter",
+		       "Successful connections to the broker");
+	metrics_printf(w, "thingy_mqtt_connections_total %u\n", reconnects);
+
+	metrics_header(w, "thingy_mqtt_samples_published_total", "counter",
+		       "Sensor samples published, in batches");
+	metrics_printf(w, "thingy_mqtt_samples_published_total %u\n",
+		       (uint32_t)atomic_get(&samples_published));
+
+	metrics_header(w, "thingy_mqtt_messages_total", "counter", "PUBLISH messages sent");
+	metrics_header(w, "thingy_mqtt_bytes_total", "counter", "Payload bytes published");
+	metrics_header(w, "thingy_mqtt_queued", "gauge", "Messages waiting to be published");
+	metrics_header(w, "thingy_mqtt_dropped_total", "counter",
+		       "Messages dropped because the queue was full");
+	for (int i = 0; i < ARRAY_SIZE(queues); i++) {
+		const char *topic = queues[i].msgq == &batch_msgq ? "sensors" : "events";
+
+		metrics_printf(w, "thingy_mqtt_messages_total{topic=\"%s\"} %u\n", topic,
+			       (uint32_t)atomic_get(&queues[i].published));
+		metrics_printf(w, "thingy_mqtt_bytes_total{topic=\"%s\"} %u\n", topic,
+			       (uint32_t)atomic_get(&queues[i].bytes));
+		metrics_printf(w, "thingy_mqtt_queued{topic=\"%s\"} %u\n", topic,
+			       k_msgq_num_used_get(queues[i].msgq));
+		metrics_printf(w, "thingy_mqtt_dropped_total{topic=\"%s\"} %u\n", topic,
+			       (uint32_t)atomic_get(&queues[i].dropped));
+	}
+}
+
+static struct metrics_collector mqtt_pub_collector = {
+	.collect = mqtt_pub_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int mqtt_pub_init(void)
+{
+	k_tid_t tid;
+
+	wake_fd = zvfs_eventfd(0, ZVFS_EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		LOG_ERR("Failed to create the eventfd, errno %d", errno);
+		return 0;
+	}
+
+	sensors_add_listener(&mqtt_pub_listener);
+#ifdef CONFIG_APP_MOTION
+	motion_add_listener(&mqtt_pub_motion_listener);
+#endif // CONFIG_APP_MOTION
+
+	tid = k_thread_create(&mqtt_thread_data, mqtt_stack_area,
+			      K_THREAD_STACK_SIZEOF(mqtt_stack_area), mqtt_pub_thread, NULL, NULL,
+			      NULL, 9, 0, K_NO_WAIT);
+	k_thread_name_set(tid, "mqtt_pub");
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&mqtt_pub_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(mqtt_pub_init, APPLICATION, 0);
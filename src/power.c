@@ -0,0 +1,225 @@
+#include "power.h"
+#include "metrics.h"
+#include "sensors.h"
+
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(POWER, CONFIG_POWER_LOG_LEVEL);
+
+// Demand-driven sampling. Websocket viewers, captures and recent motion hold a demand on the
+// sensors. When the last demand is released the sensors are suspended after a short delay, so a
+// page reload does not bounce them, and the first new demand resumes them with a bounded warm-up.
+// The time spent in each state is kept for the duty cycle metrics.
+
+static K_MUTEX_DEFINE(power_lock);
+static int demand;
+static bool motion_held;
+static bool idle;
+
+static int64_t state_since_ms;
+static int64_t active_ms;
+static int64_t idle_ms;
+static uint32_t resumes;
+static uint32_t motion_wakeups;
+
+static void power_idle_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(power_idle_work, power_idle_work_handler);
+
+static void power_motion_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(power_motion_work, power_motion_work_handler);
+
+/* Account the time spent in the current state, with power_lock held */
+static void power_account(void)
+{
+	int64_t now_ms = k_uptime_get();
+
+	if (idle) {
+		idle_ms += now_ms - state_since_ms;
+	} else {
+		active_ms += now_ms - state_since_ms;
+	}
+	state_since_ms = now_ms;
+}
+
+static void power_idle_work_handler(struct k_work *work)
+{
+	int ret;
+
+	k_mutex_lock(&power_lock, K_FOREVER);
+
+	if (demand == 0 && !idle) {
+		ret = sensors_suspend(CONFIG_APP_POWER_IDLE_INTERVAL_MS,
+				      CONFIG_APP_POWER_IDLE_ENV_INTERVAL_MS);
+		if (ret) {
+			// Stay active and try again later
+			LOG_ERR("Failed to suspend the sensors, err %d", ret);
+			k_work_reschedule(&power_idle_work, K_MSEC(CONFIG_APP_POWER_IDLE_DELAY_MS));
+		} else {
+			power_account();
+			idle = true;
+			LOG_INF("No demand, sensors suspended");
+		}
+	}
+
+	k_mutex_unlock(&power_lock);
+}
+
+void power_demand_get(void)
+{
+	int ret;
+
+	k_mutex_lock(&power_lock, K_FOREVER);
+
+	demand++;
+	k_work_cancel_delayable(&power_idle_work);
+
+	if (idle) {
+		ret = sensors_resume(CONFIG_APP_POWER_WARMUP_MS);
+		if (ret) {
+			LOG_ERR("Failed to resume the sensors, err %d", ret);
+		} else {
+			power_account();
+			idle = false;
+			resumes++;
+			LOG_INF("Sensors resumed");
+		}
+	}
+
+	k_mutex_unlock(&power_lock);
+}
+
+void power_demand_put(void)
+{
+	k_mutex_lock(&power_lock, K_FOREVER);
+
+	if (demand > 0 && --demand == 0) {
+		k_work_reschedule(&power_idle_work, K_MSEC(CONFIG_APP_POWER_IDLE_DELAY_MS));
+	}
+
+	k_mutex_unlock(&power_lock);
+}
+
+static void power_motion_work_handler(struct k_work *work)
+{
+	bool held;
+
+	// A motion that came in while this run waited for the lock rescheduled the work and keeps
+	// the hold. A run after a release has no hold to put.
+	k_mutex_lock(&power_lock, K_FOREVER);
+	held = motion_held && !k_work_delayable_is_pending(&power_motion_work);
+	if (held) {
+		motion_held = false;
+	}
+	k_mutex_unlock(&power_lock);
+
+	if (held) {
+		power_demand_put();
+	}
+}
+
+void power_wake_on_motion(void)
+{
+	bool hold;
+
+	k_mutex_lock(&power_lock, K_FOREVER);
+	hold = !motion_held;
+	if (hold) {
+		motion_held = true;
+		if (idle) {
+			motion_wakeups++;
+		}
+	}
+
+	// Every motion extends the hold. Under the lock, so the hold work sees it.
+	k_work_reschedule(&power_motion_work, K_SECONDS(CONFIG_APP_POWER_MOTION_HOLD_S));
+	k_mutex_unlock(&power_lock);
+
+	if (hold) {
+		power_demand_get();
+	}
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_power_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	k_mutex_lock(&power_lock, K_FOREVER);
+	power_account();
+	shell_print(sh, "State: %s, demand %d%s", idle ? "idle" : "active", demand,
+		    motion_held ? " (motion)" : "");
+	shell_print(sh, "Active %lld s, idle %lld s, %u resumes, %u motion wake-ups",
+		    active_ms / MSEC_PER_SEC, idle_ms / MSEC_PER_SEC, resumes, motion_wakeups);
+	shell_print(sh, "BME680 measurements: %u", sensors_env_measurements());
+	k_mutex_unlock(&power_lock);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(power_cmds,
+			       SHELL_CMD(status, NULL, "Show the sensor power state",
+					 cmd_power_status),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(power, &power_cmds, "Demand-driven sensor power", NULL);
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void power_collect(struct metrics_writer *w)
+{
+	k_mutex_lock(&power_lock, K_FOREVER);
+	power_account();
+
+	metrics_header(w, "thingy_power_active", "gauge",
+		       "1 while the sensors run at full rate, 0 while suspended");
+	metrics_printf(w, "thingy_power_active %d\n", idle ? 0 : 1);
+
+	metrics_header(w, "thingy_power_demand", "gauge",
+		       "Viewers, captures and motion holding the sensors");
+	metrics_printf(w, "thingy_power_demand %d\n", demand);
+
+	metrics_header(w, "thingy_power_state_seconds_total", "counter",
+		       "Time spent per sensor power state");
+	metrics_printf(w, "thingy_power_state_seconds_total{state=\"active\"} %lld.%03lld\n",
+		       active_ms / MSEC_PER_SEC, active_ms % MSEC_PER_SEC);
+	metrics_printf(w, "thingy_power_state_seconds_total{state=\"idle\"} %lld.%03lld\n",
+		       idle_ms / MSEC_PER_SEC, idle_ms % MSEC_PER_SEC);
+
+	metrics_header(w, "thingy_power_resumes_total", "counter", "Resumes from idle");
+	metrics_printf(w, "thingy_power_resumes_total %u\n", resumes);
+
+	metrics_header(w, "thingy_power_motion_wakeups_total", "counter",
+		       "Resumes from idle caused by motion");
+	metrics_printf(w, "thingy_power_motion_wakeups_total %u\n", motion_wakeups);
+
+	k_mutex_unlock(&power_lock);
+
+	metrics_header(w, "thingy_bme680_measurements_total", "counter",
+		       "BME680 measurements, each one runs the gas heater");
+	metrics_printf(w, "thingy_bme680_measurements_total %u\n", sensors_env_measurements());
+}
+
+static struct metrics_collector power_collector = {
+	.collect = power_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int power_init(void)
+{
+	state_since_ms = k_uptime_get();
+
+	// Nobody is connected at boot, so idle once the startup is over
+	k_work_schedule(&power_idle_work, K_MSEC(CONFIG_APP_POWER_IDLE_DELAY_MS));
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&power_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(power_init, APPLICATION, 0);
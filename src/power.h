@@ -0,0 +1,35 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#ifdef CONFIG_APP_POWER
+
+/**
+ * @brief Hold the sensors at full rate, for a websocket viewer or a capture.
+ *
+ * Each call must be paired with power_demand_put(). The sensors are suspended some time after the
+ * last demand is released, and resumed by the next one.
+ */
+void power_demand_get(void);
+void power_demand_put(void);
+
+/**
+ * @brief Hold the sensors at full rate for a while after a motion, from the motion events.
+ */
+void power_wake_on_motion(void);
+
+#else
+
+static inline void power_demand_get(void)
+{
+}
+
+static inline void power_demand_put(void)
+{
+}
+
+static inline void power_wake_on_motion(void)
+{
+}
+
+#endif // CONFIG_APP_POWER
@@ -0,0 +1,217 @@
+#include "profiler.h"
+#include "metrics.h"
+
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+// Each span keeps a log2 histogram of its duration in timing cycles (DWT cycle counter on the
+// nRF5340). Recording a span is a count-leading-zeros and a few atomic operations, so it can stay
+// enabled in the sensor path. Cycles are converted to time only when the histograms are shown.
+
+struct span_stats {
+	atomic_t buckets[PROFILER_NUM_BUCKETS];
+	atomic_t count;
+	atomic_t max_cycles;
+	uint64_t sum_cycles;
+};
+
+static struct span_stats spans[PROFILER_SPAN_COUNT];
+static struct k_spinlock sum_lock;
+
+static const char *const span_names[PROFILER_SPAN_COUNT] = {
+	[PROFILER_SPAN_FETCH_BMI270] = "fetch_bmi270",
+	[PROFILER_SPAN_FETCH_ADXL367] = "fetch_adxl367",
+	[PROFILER_SPAN_FETCH_BME680] = "fetch_bme680",
+	[PROFILER_SPAN_SERIALIZE] = "serialize",
+	[PROFILER_SPAN_WS_SEND] = "ws_send",
+	[PROFILER_SPAN_TLS_CONNECT] = "tls_connect",
+	[PROFILER_SPAN_HTTP_PARSE] = "http_parse",
+	[PROFILER_SPAN_SPECTRUM] = "spectrum",
+};
+
+static inline int cycles_to_bucket(uint32_t cycles)
+{
+	return cycles == 0 ? 0 : 32 - __builtin_clz(cycles);
+}
+
+/* Upper bound (exclusive) of a bucket in nanoseconds */
+static uint64_t bucket_upper_ns(int bucket)
+{
+	return timing_cycles_to_ns(BIT64(bucket));
+}
+
+void profiler_span_end(enum profiler_span span, timing_t start)
+{
+	timing_t end = timing_counter_get();
+	uint64_t cycles64 = timing_cycles_get(&start, &end);
+	uint32_t cycles = (uint32_t)MIN(cycles64, UINT32_MAX);
+	struct span_stats *stats = &spans[span];
+	atomic_val_t max;
+
+	atomic_inc(&stats->buckets[cycles_to_bucket(cycles)]);
+	atomic_inc(&stats->count);
+
+	do {
+		max = atomic_get(&stats->max_cycles);
+		if ((uint32_t)max >= cycles) {
+			break;
+		}
+	} while (!atomic_cas(&stats->max_cycles, max, (atomic_val_t)cycles));
+
+	K_SPINLOCK(&sum_lock) {
+		stats->sum_cycles += cycles;
+	}
+}
+
+void profiler_reset(void)
+{
+	K_SPINLOCK(&sum_lock) {
+		memset(spans, 0, sizeof(spans));
+	}
+}
+
+static void span_snapshot(enum profiler_span span, struct span_stats *out)
+{
+	struct span_stats *stats = &spans[span];
+
+	for (int i = 0; i < PROFILER_NUM_BUCKETS; i++) {
+		atomic_set(&out->buckets[i], atomic_get(&stats->buckets[i]));
+	}
+	atomic_set(&out->count, atomic_get(&stats->count));
+	atomic_set(&out->max_cycles, atomic_get(&stats->max_cycles));
+
+	K_SPINLOCK(&sum_lock) {
+		out->sum_cycles = stats->sum_cycles;
+	}
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static void print_span(const struct shell *sh, enum profiler_span span, bool verbose)
+{
+	struct span_stats snap;
+	uint32_t count;
+
+	span_snapshot(span, &snap);
+	count = atomic_get(&snap.count);
+
+	if (count == 0) {
+		shell_print(sh, "%-14s      -", span_names[span]);
+		return;
+	}
+
+	shell_print(sh, "%-14s %6u  avg %8llu us  max %8llu us", span_names[span], count,
+		    timing_cycles_to_ns(snap.sum_cycles / count) / NSEC_PER_USEC,
+		    timing_cycles_to_ns((uint32_t)atomic_get(&snap.max_cycles)) / NSEC_PER_USEC);
+
+	if (!verbose) {
+		return;
+	}
+
+	for (int i = 0; i < PROFILER_NUM_BUCKETS; i++) {
+		uint32_t n = atomic_get(&snap.buckets[i]);
+
+		if (n == 0) {
+			continue;
+		}
+
+		shell_print(sh, "    < %10llu ns  %6u  %3u%%", bucket_upper_ns(i), n,
+			    (n * 100U) / count);
+	}
+}
+
+static int cmd_prof_show(const struct shell *sh, size_t argc, char **argv)
+{
+	bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+	shell_print(sh, "%-14s %6s", "span", "count");
+	for (int i = 0; i < PROFILER_SPAN_COUNT; i++) {
+		print_span(sh, i, verbose);
+	}
+
+	return 0;
+}
+
+static int cmd_prof_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	profiler_reset();
+	shell_print(sh, "Profiler histograms cleared");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(prof_cmds,
+			       SHELL_CMD_ARG(show, NULL, "Show span latencies [-v for histograms]",
+					     cmd_prof_show, 1, 1),
+			       SHELL_CMD(reset, NULL, "Clear all span histograms", cmd_prof_reset),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(prof, &prof_cmds, "Hot path stage timing", NULL);
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+/* Fixed Prometheus bucket bounds in microseconds, so the series stay stable between scrapes */
+static const uint32_t metrics_bounds_us[] = {1, 4, 16, 64, 256, 1024, 4096, 16384, 65536, 262144};
+
+static void profiler_collect(struct metrics_writer *w)
+{
+	struct span_stats snap;
+
+	metrics_header(w, "thingy_span_duration_us", "histogram", "Hot path stage duration");
+
+	for (int span = 0; span < PROFILER_SPAN_COUNT; span++) {
+		uint32_t cumulative = 0;
+		uint32_t total = 0;
+		int bucket = 0;
+
+		span_snapshot(span, &snap);
+
+		for (int i = 0; i < ARRAY_SIZE(metrics_bounds_us); i++) {
+			uint64_t bound_ns = (uint64_t)metrics_bounds_us[i] * NSEC_PER_USEC;
+
+			while (bucket < PROFILER_NUM_BUCKETS && bucket_upper_ns(bucket) <= bound_ns) {
+				cumulative += atomic_get(&snap.buckets[bucket]);
+				bucket++;
+			}
+
+			metrics_printf(w,
+				       "thingy_span_duration_us_bucket{span=\"%s\",le=\"%u\"} %u\n",
+				       span_names[span], metrics_bounds_us[i], cumulative);
+		}
+
+		for (int i = 0; i < PROFILER_NUM_BUCKETS; i++) {
+			total += atomic_get(&snap.buckets[i]);
+		}
+
+		metrics_printf(w, "thingy_span_duration_us_bucket{span=\"%s\",le=\"+Inf\"} %u\n",
+			       span_names[span], total);
+		metrics_printf(w, "thingy_span_duration_us_sum{span=\"%s\"} %llu\n", span_names[span],
+			       timing_cycles_to_ns(snap.sum_cycles) / NSEC_PER_USEC);
+		metrics_printf(w, "thingy_span_duration_us_count{span=\"%s\"} %u\n",
+			       span_names[span], total);
+	}
+}
+
+static struct metrics_collector profiler_collector = {
+	.collect = profiler_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int profiler_init(void)
+{
+	timing_init();
+	timing_start();
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&profiler_collector);
+#endif // CONFIG_APP_METRICS
+
+	return 0;
+}
+SYS_INIT(profiler_init, APPLICATION, 0);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+#include <zephyr/timing/timing.h>
+
+/* Stages of the sensor, streaming, DSP and location hot paths that can be timed */
+enum profiler_span {
+	PROFILER_SPAN_FETCH_BMI270,
+	PROFILER_SPAN_FETCH_ADXL367,
+	PROFILER_SPAN_FETCH_BME680,
+	PROFILER_SPAN_SERIALIZE,
+	PROFILER_SPAN_WS_SEND,
+	PROFILER_SPAN_TLS_CONNECT,
+	PROFILER_SPAN_HTTP_PARSE,
+	PROFILER_SPAN_SPECTRUM,
+	PROFILER_SPAN_COUNT,
+};
+
+/* One bucket per power of two cycles, bucket 0 holds zero length spans */
+#define PROFILER_NUM_BUCKETS 33
+
+#ifdef CONFIG_APP_PROFILER
+
+/**
+ * @brief Start timing a span.
+ *
+ * @return Start timestamp to hand to profiler_span_end().
+ */
+static inline timing_t profiler_span_begin(void)
+{
+	return timing_counter_get();
+}
+
+/**
+ * @brief Stop timing a span and record its duration in the span's histogram.
+ *
+ * @param span Span to record.
+ * @param start Timestamp returned by profiler_span_begin().
+ */
+void profiler_span_end(enum profiler_span span, timing_t start);
+
+void profiler_reset(void);
+
+#else
+
+static inline timing_t profiler_span_begin(void)
+{
+	return 0;
+}
+
+static inline void profiler_span_end(enum profiler_span span, timing_t start)
+{
+}
+
+static inline void profiler_reset(void)
+{
+}
+
+#endif // CONFIG_APP_PROFILER
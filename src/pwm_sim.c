@@ -0,0 +1,87 @@
+#define DT_DRV_COMPAT nordic_thingy_sim_pwm
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/pwm.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(PWM_SIM, CONFIG_PWM_SIM_LOG_LEVEL);
+
+// PWM controller of the RGB LED on the native_sim board. It only records the pulse widths, so that
+// the LED handlers can be checked from the shell or the log.
+
+#define PWM_SIM_CHANNELS 3
+
+struct pwm_sim_data {
+	uint32_t period_cycles[PWM_SIM_CHANNELS];
+	uint32_t pulse_cycles[PWM_SIM_CHANNELS];
+	uint32_t updates;
+};
+
+static int pwm_sim_set_cycles(const struct device *dev, uint32_t channel, uint32_t period_cycles,
+			      uint32_t pulse_cycles, pwm_flags_t flags)
+{
+	ARG_UNUSED(flags);
+
+	struct pwm_sim_data *data = dev->data;
+
+	if (channel >= PWM_SIM_CHANNELS) {
+		return -EINVAL;
+	}
+
+	data->period_cycles[channel] = period_cycles;
+	data->pulse_cycles[channel] = pulse_cycles;
+	data->updates++;
+
+	LOG_DBG("Channel %u: %u/%u", channel, pulse_cycles, period_cycles);
+
+	return 0;
+}
+
+/* One cycle per nanosecond, so the periods of the devicetree are kept exactly */
+static int pwm_sim_get_cycles_per_sec(const struct device *dev, uint32_t channel, uint64_t *cycles)
+{
+	ARG_UNUSED(dev);
+	ARG_UNUSED(channel);
+
+	*cycles = NSEC_PER_SEC;
+
+	return 0;
+}
+
+static const struct pwm_driver_api pwm_sim_api = {
+	.set_cycles = pwm_sim_set_cycles,
+	.get_cycles_per_sec = pwm_sim_get_cycles_per_sec,
+};
+
+#define PWM_SIM_DEFINE(inst)                                                                       \
+	static struct pwm_sim_data pwm_sim_data_##inst;                                            \
+	DEVICE_DT_INST_DEFINE(inst, NULL, NULL, &pwm_sim_data_##inst, NULL, POST_KERNEL,           \
+			      CONFIG_KERNEL_INIT_PRIORITY_DEVICE, &pwm_sim_api);
+
+DT_INST_FOREACH_STATUS_OKAY(PWM_SIM_DEFINE)
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_pwm_sim(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	const struct device *dev = DEVICE_DT_INST_GET(0);
+	struct pwm_sim_data *data = dev->data;
+
+	for (int i = 0; i < PWM_SIM_CHANNELS; i++) {
+		shell_print(sh, "Channel %d: %3u %%", i,
+			    data->period_cycles[i]
+				    ? (uint32_t)(100ULL * data->pulse_cycles[i] /
+						 data->period_cycles[i])
+				    : 0);
+	}
+	shell_print(sh, "%u updates", data->updates);
+
+	return 0;
+}
+
+SHELL_CMD_REGISTER(pwm_sim, NULL, "Show the recorded LED duty cycles", cmd_pwm_sim);
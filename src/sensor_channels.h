@@ -0,0 +1,65 @@
+#pragma once
+
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/util.h>
+
+/*
+ * Channels of struct sensor_sample, in the order of its data array:
+ * X(id, name, unit, sensor channel, sign, precision, step). Every device has its own list, read by
+ * sensor_measure() after one fetch of the device. The sign turns the BMI270 to the orientation of
+ * the Thingy, 180 degrees around z. The precision is the number of decimals in the JSON frames,
+ * the step the resolution of the delta encoded stream, about one LSB of the sensor: the BMI270 at
+ * +-2 g and +-1000 dps, the ADXL367 at +-2 g, the BME680 pressure at 0.18 Pa. A channel disabled
+ * in Kconfig is not in the table at all, so it is not read, sent or stored.
+ */
+#define SENSOR_CHANNELS_BMI270(X)                                                                  \
+	X(BMI270_AX, bmi270_ax, "m/s^2", SENSOR_CHAN_ACCEL_X, -1, 6, 0.0006)                       \
+	X(BMI270_AY, bmi270_ay, "m/s^2", SENSOR_CHAN_ACCEL_Y, -1, 6, 0.0006)                       \
+	X(BMI270_AZ, bmi270_az, "m/s^2", SENSOR_CHAN_ACCEL_Z, 1, 6, 0.0006)                        \
+	X(BMI270_GX, bmi270_gx, "rad/s", SENSOR_CHAN_GYRO_X, -1, 6, 0.0005)                        \
+	X(BMI270_GY, bmi270_gy, "rad/s", SENSOR_CHAN_GYRO_Y, -1, 6, 0.0005)                        \
+	X(BMI270_GZ, bmi270_gz, "rad/s", SENSOR_CHAN_GYRO_Z, 1, 6, 0.0005)
+
+#define SENSOR_CHANNELS_ADXL367(X)                                                                 \
+	IF_ENABLED(CONFIG_SENSORS_CHANNELS_ADXL367,                                                \
+		   (X(ADXL_AX, adxl_ax, "m/s^2", SENSOR_CHAN_ACCEL_X, 1, 6, 0.0025)                \
+		    X(ADXL_AY, adxl_ay, "m/s^2", SENSOR_CHAN_ACCEL_Y, 1, 6, 0.0025)                \
+		    X(ADXL_AZ, adxl_az, "m/s^2", SENSOR_CHAN_ACCEL_Z, 1, 6, 0.0025)))
+
+#define SENSOR_CHANNELS_BME680(X)                                                                  \
+	X(BME680_TEMPERATURE, bme680_temperature, "C", SENSOR_CHAN_AMBIENT_TEMP, 1, 3, 0.01)       \
+	X(BME680_PRESSURE, bme680_pressure, "kPa", SENSOR_CHAN_PRESS, 1, 3, 0.0002)                \
+	X(BME680_HUMIDITY, bme680_humidity, "%RH", SENSOR_CHAN_HUMIDITY, 1, 3, 0.01)               \
+	IF_ENABLED(CONFIG_SENSORS_CHANNELS_BME680_GAS,                                             \
+		   (X(BME680_GAS, bme680_gas, "ohm", SENSOR_CHAN_GAS_RES, 1, 3, 1)))
+
+// There is no Zephyr driver for the BMM350 yet, its channels are never measured
+#define SENSOR_CHANNELS_BMM350(X)                                                                  \
+	IF_ENABLED(CONFIG_SENSORS_CHANNELS_BMM350,                                                 \
+		   (X(BMM350_MAGN_X, bmm350_magn_x, "uT", SENSOR_CHAN_MAGN_X, 1, 3, 0.1)           \
+		    X(BMM350_MAGN_Y, bmm350_magn_y, "uT", SENSOR_CHAN_MAGN_Y, 1, 3, 0.1)           \
+		    X(BMM350_MAGN_Z, bmm350_magn_z, "uT", SENSOR_CHAN_MAGN_Z, 1, 3, 0.1)))
+
+#define SENSOR_CHANNELS(X)                                                                         \
+	SENSOR_CHANNELS_BMI270(X)                                                                  \
+	SENSOR_CHANNELS_ADXL367(X)                                                                 \
+	SENSOR_CHANNELS_BME680(X)                                                                  \
+	SENSOR_CHANNELS_BMM350(X)
+
+/* Index of every channel in sensor_sample.data, and bit in sensor_sample.valid */
+enum sensor_channel_id {
+#define SENSOR_CH_ID(_id, ...) SENSOR_CH_##_id,
+	SENSOR_CHANNELS(SENSOR_CH_ID)
+#undef SENSOR_CH_ID
+	SENSOR_CH_COUNT,
+};
+
+#define SENSOR_CH_BIT(_id, ...) | BIT(SENSOR_CH_##_id)
+
+/* Bits of sensor_sample.valid for each device */
+#define SENSORS_VALID_BMI270  (0 SENSOR_CHANNELS_BMI270(SENSOR_CH_BIT))
+#define SENSORS_VALID_ADXL367 (0 SENSOR_CHANNELS_ADXL367(SENSOR_CH_BIT))
+#define SENSORS_VALID_BME680  (0 SENSOR_CHANNELS_BME680(SENSOR_CH_BIT))
+#define SENSORS_VALID_BMM350  (0 SENSOR_CHANNELS_BMM350(SENSOR_CH_BIT))
+
+BUILD_ASSERT(SENSOR_CH_COUNT <= 32, "The valid bits are a uint32_t");
@@ -0,0 +1,189 @@
+#include "sensor_delta.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#define SENSOR_CH_STEP(_id, _name, _unit, _chan, _sign, _prec, _step) [SENSOR_CH_##_id] = _step,
+#define SENSOR_CH_SCALE(_id, _name, _unit, _chan, _sign, _prec, _step)                             \
+	[SENSOR_CH_##_id] = 1.0 / (_step),
+
+static const double steps[] = {SENSOR_CHANNELS(SENSOR_CH_STEP)};
+static const double scales[] = {SENSOR_CHANNELS(SENSOR_CH_SCALE)};
+
+static inline uint64_t zigzag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* Read a varint, returns false if the buffer ends before it does */
+static bool get_varint(const uint8_t *buf, size_t len, size_t *off, uint64_t *value)
+{
+	*value = 0;
+
+	for (int shift = 0; shift < 64 && *off < len; shift += 7) {
+		uint8_t byte = buf[(*off)++];
+
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void sensor_delta_resync(struct sensor_delta_state *state)
+{
+	state->synced = false;
+}
+
+size_t sensor_delta_put_varint(uint8_t *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+
+	return len;
+}
+
+int sensor_delta_encode(struct sensor_delta_state *state, const struct sensor_sample *sample,
+			uint32_t seq, uint8_t *buf, size_t len)
+{
+	uint8_t record[SENSOR_DELTA_MAX_RECORD];
+	int32_t values[NUM_SENSOR_MEASUREMENTS];
+	uint32_t valid = sample->valid & BIT_MASK(NUM_SENSOR_MEASUREMENTS);
+	size_t off = 1;
+	bool key;
+
+	key = !state->synced || seq != state->seq + 1 || sample->timestamp_us < state->ts_us ||
+	      state->since_key + 1 >= CONFIG_APP_SENSOR_DELTA_KEYFRAME_INTERVAL;
+
+	if (key) {
+		record[0] = SENSOR_DELTA_KEY | SENSOR_DELTA_VALID;
+		off += sensor_delta_put_varint(record + off, seq);
+		off += sensor_delta_put_varint(record + off, sample->timestamp_us);
+	} else {
+		record[0] = valid != state->valid ? SENSOR_DELTA_VALID : 0;
+		off += sensor_delta_put_varint(record + off, sample->timestamp_us - state->ts_us);
+	}
+
+	if (record[0] & SENSOR_DELTA_VALID) {
+		off += sensor_delta_put_varint(record + off, valid);
+	}
+
+	for (int i = 0; i < NUM_SENSOR_MEASUREMENTS; i++) {
+		if ((valid & BIT(i)) == 0) {
+			continue;
+		}
+
+		values[i] = (int32_t)lround(sample->data[i] * scales[i]);
+		off += sensor_delta_put_varint(
+			record + off, zigzag(key ? values[i] : (int64_t)values[i] - state->last[i]));
+	}
+
+	if (off > len) {
+		return -ENOSPC;
+	}
+
+	memcpy(buf, record, off);
+
+	// A channel that is not in a keyframe starts from 0 when it comes back
+	for (int i = 0; i < NUM_SENSOR_MEASUREMENTS; i++) {
+		if (valid & BIT(i)) {
+			state->last[i] = values[i];
+		} else if (key) {
+			state->last[i] = 0;
+		}
+	}
+	state->ts_us = sample->timestamp_us;
+	state->valid = valid;
+	state->seq = seq;
+	state->since_key = key ? 0 : state->since_key + 1;
+	state->synced = true;
+
+	return off;
+}
+
+int sensor_delta_decode(struct sensor_delta_state *state, const uint8_t *buf, size_t len,
+			struct sensor_sample *sample, uint32_t *seq)
+{
+	int32_t values[NUM_SENSOR_MEASUREMENTS];
+	uint64_t value;
+	uint8_t flags;
+	size_t off = 1;
+	bool key;
+
+	if (len == 0) {
+		return -EINVAL;
+	}
+
+	flags = buf[0];
+	key = flags & SENSOR_DELTA_KEY;
+	if (!key && !state->synced) {
+		return -EAGAIN;
+	}
+
+	if (key) {
+		if (!get_varint(buf, len, &off, &value)) {
+			return -EINVAL;
+		}
+		*seq = value;
+		if (!get_varint(buf, len, &off, &value)) {
+			return -EINVAL;
+		}
+		sample->timestamp_us = value;
+	} else {
+		if (!get_varint(buf, len, &off, &value)) {
+			return -EINVAL;
+		}
+		*seq = state->seq + 1;
+		sample->timestamp_us = state->ts_us + value;
+	}
+
+	sample->valid = state->valid;
+	if (flags & SENSOR_DELTA_VALID) {
+		if (!get_varint(buf, len, &off, &value) ||
+		    (value & ~(uint64_t)BIT_MASK(NUM_SENSOR_MEASUREMENTS))) {
+			return -EINVAL;
+		}
+		sample->valid = value;
+	}
+
+	for (int i = 0; i < NUM_SENSOR_MEASUREMENTS; i++) {
+		sample->data[i] = 0.0;
+		if ((sample->valid & BIT(i)) == 0) {
+			continue;
+		}
+
+		if (!get_varint(buf, len, &off, &value)) {
+			return -EINVAL;
+		}
+		values[i] = key ? unzigzag(value) : state->last[i] + unzigzag(value);
+		sample->data[i] = values[i] * steps[i];
+	}
+
+	for (int i = 0; i < NUM_SENSOR_MEASUREMENTS; i++) {
+		if (sample->valid & BIT(i)) {
+			state->last[i] = values[i];
+		} else if (key) {
+			state->last[i] = 0;
+		}
+	}
+	state->ts_us = sample->timestamp_us;
+	state->valid = sample->valid;
+	state->seq = *seq;
+	state->since_key = key ? 0 : state->since_key + 1;
+	state->synced = true;
+
+	return off;
+}
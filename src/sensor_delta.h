@@ -0,0 +1,78 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+#include "sensors.h"
+
+// Delta encoded sensor stream, several times smaller than struct sensor_frame for the correlated
+// samples of a sensor at rest or in smooth motion. Every value is quantized to the step of its
+// channel in sensor_channels.h. A keyframe carries the sequence number, the timestamp and the
+// quantized values of a sample. The records that follow carry the time since the previous sample
+// and the difference of every value from the last one of its channel, all as zig-zag varints.
+// Deltas follow each other one sample at a time, so the encoder starts over with a keyframe after
+// a gap in the samples, every CONFIG_APP_SENSOR_DELTA_KEYFRAME_INTERVAL samples and after
+// sensor_delta_resync().
+//
+// Record, little endian base 128 varints:
+//   flags                 SENSOR_DELTA_KEY, SENSOR_DELTA_VALID
+//   keyframe              seq, ts_us, valid, then the value of every valid channel
+//   delta                 dt_us, valid if SENSOR_DELTA_VALID, then the difference of every valid
+//                         channel
+// The values and differences are zig-zag encoded, in the order of the channels.
+
+#define SENSOR_DELTA_VERSION 1
+
+#define SENSOR_DELTA_KEY   BIT(0) // Keyframe
+#define SENSOR_DELTA_VALID BIT(1) // The valid bits follow, set when they changed and in keyframes
+
+/* Longest record, a keyframe with every channel at the end of the int32 range */
+#define SENSOR_DELTA_MAX_RECORD (1 + 5 + 10 + 5 + 5 * NUM_SENSOR_MEASUREMENTS)
+
+/* State of one end of a delta stream, zero initialized. Both ends keep the same state */
+struct sensor_delta_state {
+	int32_t last[NUM_SENSOR_MEASUREMENTS]; // Last quantized value of every channel
+	int64_t ts_us;                         // Timestamp of the last sample
+	uint32_t valid;                        // Valid bits of the last sample
+	uint32_t seq;                          // Sequence number of the last sample
+	uint16_t since_key;                    // Samples since the last keyframe
+	bool synced;                           // Set by the first keyframe
+};
+
+/**
+ * @brief Start a stream over, the next record is a keyframe.
+ */
+void sensor_delta_resync(struct sensor_delta_state *state);
+
+/**
+ * @brief Write a varint.
+ *
+ * @return Number of bytes written, at most 10.
+ */
+size_t sensor_delta_put_varint(uint8_t *buf, uint64_t value);
+
+/**
+ * @brief Encode a sample as a record.
+ *
+ * @param state State of the stream, only updated if the record fits.
+ * @param sample Sample to encode.
+ * @param seq Sequence number of the sample, a delta needs the one after the previous sample.
+ * @param buf Buffer for the record.
+ * @param len Length of the buffer.
+ * @return Length of the record, -ENOSPC if it does not fit.
+ */
+int sensor_delta_encode(struct sensor_delta_state *state, const struct sensor_sample *sample,
+			uint32_t seq, uint8_t *buf, size_t len);
+
+/**
+ * @brief Decode a record.
+ *
+ * @param state State of the stream, only updated if the record is decoded.
+ * @param buf Start of the record.
+ * @param len Bytes left in the message.
+ * @param sample Decoded sample, the values are multiples of the steps of their channels.
+ * @param seq Sequence number of the sample.
+ * @return Length of the record, -EAGAIN for a delta before the first keyframe, the rest of the
+ *         message can't be decoded then, -EINVAL if the record is malformed.
+ */
+int sensor_delta_decode(struct sensor_delta_state *state, const uint8_t *buf, size_t len,
+			struct sensor_sample *sample, uint32_t *seq);
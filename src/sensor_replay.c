@@ -0,0 +1,211 @@
+#include "sensor_replay.h"
+
+#include <string.h>
+
+#include <zephyr/arch/posix/posix_trace.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "cmdline.h"
+#include "soc.h"
+
+// Replay of a recorded session through the simulated sensors. The file is read into memory
+// before the kernel starts, and checked as a whole so that a bad file stops the simulator instead
+// of returning garbage. Every sensor keeps its own cursor and walks the records forward as the
+// uptime advances, to the latest one that has its values.
+
+void *sensor_replay_host_load(const char *path, size_t *size);
+void sensor_replay_host_free(void *data);
+
+static char *replay_path;
+static bool replay_loop;
+
+static uint8_t *session;
+static size_t session_size;
+static uint32_t session_duration_us;
+
+static size_t record_size(uint32_t valid)
+{
+	return sizeof(struct sensor_session_record) + __builtin_popcount(valid) * sizeof(float);
+}
+
+/* Check the header and that the records fit the file and are in time order */
+static const char *sensor_replay_check(uint32_t *records)
+{
+	const struct sensor_session_header *header = (const struct sensor_session_header *)session;
+	uint16_t channels;
+	size_t off = sizeof(*header);
+	uint32_t last_t_us = 0;
+
+	if (session_size < sizeof(*header) ||
+	    sys_le32_to_cpu(header->magic) != SENSOR_SESSION_MAGIC) {
+		return "not a sensor session";
+	}
+	if (sys_le16_to_cpu(header->version) != SENSOR_SESSION_VERSION) {
+		return "unsupported version";
+	}
+
+	channels = sys_le16_to_cpu(header->channels);
+	*records = 0;
+
+	while (off < session_size) {
+		const struct sensor_session_record *record = (const void *)(session + off);
+		uint32_t t_us, valid;
+
+		if (session_size - off < sizeof(*record)) {
+			return "truncated record";
+		}
+
+		t_us = sys_le32_to_cpu(record->t_us);
+		valid = sys_le32_to_cpu(record->valid);
+
+		if (channels < 32 && (valid & ~BIT_MASK(channels))) {
+			return "unknown channel";
+		}
+		if (session_size - off < record_size(valid)) {
+			return "truncated record";
+		}
+		if (t_us < last_t_us) {
+			return "records out of order";
+		}
+
+		last_t_us = t_us;
+		off += record_size(valid);
+		(*records)++;
+	}
+
+	if (*records != sys_le32_to_cpu(header->records)) {
+		return "wrong record count";
+	}
+
+	session_duration_us = MAX(sys_le32_to_cpu(header->duration_us), last_t_us + 1);
+
+	return NULL;
+}
+
+static void sensor_replay_load(void)
+{
+	const char *err;
+	uint32_t records;
+
+	if (replay_path == NULL && CONFIG_APP_SENSOR_REPLAY_FILE[0] != '\0') {
+		replay_path = (char *)CONFIG_APP_SENSOR_REPLAY_FILE;
+	}
+
+	if (replay_path == NULL) {
+		return;
+	}
+
+	replay_loop = replay_loop || IS_ENABLED(CONFIG_APP_SENSOR_REPLAY_LOOP);
+
+	session = sensor_replay_host_load(replay_path, &session_size);
+	if (session == NULL) {
+		posix_print_error_and_exit("Can't read the session %s\n", replay_path);
+	}
+
+	err = sensor_replay_check(&records);
+	if (err != NULL) {
+		posix_print_error_and_exit("Can't replay %s: %s\n", replay_path, err);
+	}
+
+	posix_print_trace("Replaying %s, %u records in %u ms%s\n", replay_path, records,
+			  session_duration_us / USEC_PER_MSEC, replay_loop ? ", looping" : "");
+}
+
+static void sensor_replay_options(void)
+{
+	static struct args_struct_t replay_options[] = {
+		{
+			.option = "replay",
+			.name = "path",
+			.type = 's',
+			.dest = (void *)&replay_path,
+			.descript = "Session recorded with tools/record_session.py, returned by the "
+				    "simulated sensors",
+		},
+		{
+			.is_switch = true,
+			.option = "replay-loop",
+			.type = 'b',
+			.dest = (void *)&replay_loop,
+			.descript = "Start the session again when it ends, instead of holding the "
+				    "last values",
+		},
+		ARG_TABLE_ENDMARKER,
+	};
+
+	native_add_command_line_opts(replay_options);
+}
+
+static void sensor_replay_cleanup(void)
+{
+	sensor_replay_host_free(session);
+	session = NULL;
+}
+
+NATIVE_TASK(sensor_replay_options, PRE_BOOT_1, 1);
+NATIVE_TASK(sensor_replay_load, PRE_BOOT_2, 1);
+NATIVE_TASK(sensor_replay_cleanup, ON_EXIT, 1);
+
+bool sensor_replay_active(void)
+{
+	return session != NULL;
+}
+
+int sensor_replay_read(struct sensor_replay_cursor *cursor, uint8_t first, uint8_t count,
+		       double *values)
+{
+	uint32_t mask = BIT_MASK(count) << first;
+	int64_t now_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	const struct sensor_session_record *record;
+	int64_t loop = 0;
+	uint32_t t_us;
+	uint32_t valid;
+	const uint8_t *value;
+
+	if (replay_loop) {
+		loop = now_us / session_duration_us;
+		t_us = now_us % session_duration_us;
+	} else {
+		t_us = MIN(now_us, UINT32_MAX);
+	}
+
+	if (cursor->next == 0 || cursor->loop != loop) {
+		cursor->next = sizeof(struct sensor_session_header);
+		cursor->match = 0;
+		cursor->loop = loop;
+	}
+
+	while (cursor->next < session_size) {
+		record = (const void *)(session + cursor->next);
+		if (sys_le32_to_cpu(record->t_us) > t_us) {
+			break;
+		}
+
+		valid = sys_le32_to_cpu(record->valid);
+		if ((valid & mask) == mask) {
+			cursor->match = cursor->next;
+		}
+		cursor->next += record_size(valid);
+	}
+
+	if (cursor->match == 0) {
+		return -ENODATA;
+	}
+
+	// The values of the lower bits come first
+	record = (const void *)(session + cursor->match);
+	valid = sys_le32_to_cpu(record->valid);
+	value = (const uint8_t *)(record + 1) +
+		__builtin_popcount(valid & BIT_MASK(first)) * sizeof(float);
+
+	for (int i = 0; i < count; i++) {
+		uint32_t bits = sys_get_le32(value + i * sizeof(float));
+		float f;
+
+		memcpy(&f, &bits, sizeof(f));
+		values[i] = f;
+	}
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+// Recorded sensor session, as written by tools/record_session.py. Little endian: a header, then
+// the records in time order. A record holds the values of the sensors that were sampled at its
+// time, one float for every bit set in valid, lowest bit first. The bits and units are those of
+// struct sensor_sample with every channel of sensor_channels.h enabled, but the values are as the
+// drivers return them, before the BMI270 is turned to the orientation of the Thingy.
+
+#define SENSOR_SESSION_MAGIC   0x53455354 // "TSES"
+#define SENSOR_SESSION_VERSION 1
+
+struct sensor_session_header {
+	uint32_t magic;       // SENSOR_SESSION_MAGIC
+	uint16_t version;     // SENSOR_SESSION_VERSION
+	uint16_t channels;    // Bits that may be set in valid
+	uint32_t records;
+	uint32_t duration_us; // Length of the session, the period when it loops
+} __packed;
+
+struct sensor_session_record {
+	uint32_t t_us; // Time since the start of the session
+	uint32_t valid;
+	// Followed by the values
+} __packed;
+
+/* Position of one sensor in the session, zero initialized */
+struct sensor_replay_cursor {
+	size_t next;  // Offset of the first record that has not been reached yet
+	size_t match; // Offset of the latest record with the values of the sensor, 0 if none
+	int64_t loop;
+};
+
+/**
+ * @brief Check if a session was given with --replay.
+ */
+bool sensor_replay_active(void);
+
+/**
+ * @brief Get the latest recorded values of a sensor.
+ *
+ * The session starts at uptime 0 and is replayed in real time, or as fast as possible with the
+ * --no-rt option of native_sim. Only with --no-rt the simulated time does not depend on the host,
+ * so that the same run always gets the same values. In real time the load of the host and the
+ * network input move the reads, and a run may get other records.
+ *
+ * @param cursor Position of the sensor, only moves forward in time.
+ * @param first Bit of the first value of the sensor in valid.
+ * @param count Number of values of the sensor.
+ * @param values The values, as the driver would return them.
+ * @return 0 if successful, -ENODATA if the sensor has not been recorded yet.
+ */
+int sensor_replay_read(struct sensor_replay_cursor *cursor, uint8_t first, uint8_t count,
+		       double *values);
@@ -0,0 +1,38 @@
+/*
+ * Built against the host C library, into the native simulator runner, to read the session file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Read a whole file into memory, returns NULL if it can't be read */
+void *sensor_replay_host_load(const char *path, size_t *size)
+{
+	FILE *file;
+	void *data = NULL;
+	long len;
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) > 0 &&
+	    fseek(file, 0, SEEK_SET) == 0) {
+		data = malloc(len);
+		if (data != NULL && fread(data, 1, len, file) != (size_t)len) {
+			free(data);
+			data = NULL;
+		}
+		*size = len;
+	}
+
+	fclose(file);
+
+	return data;
+}
+
+void sensor_replay_host_free(void *data)
+{
+	free(data);
+}
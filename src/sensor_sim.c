@@ -0,0 +1,347 @@
+#define DT_DRV_COMPAT nordic_thingy_sim_sensor
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#ifdef CONFIG_APP_SENSOR_REPLAY
+#include "sensor_replay.h"
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(SENSOR_SIM, CONFIG_SENSOR_SIM_LOG_LEVEL);
+
+// Stand-in for the BMI270, ADXL367 and BME680 on the native_sim board, so that the sensor
+// pipeline, the web server and the streams can be load tested from Linux. The values are a
+// function of the uptime: the accelerometers see 1 g and a small vibration, the gyroscope a slow
+// rotation and the BME680 a slow drift. "sensor_sim shake <ms>" adds a burst of strong motion and
+// raises the threshold trigger at its start and end, for the motion events. With --replay=<file>
+// the values come from a recorded session instead, see src/sensor_replay.c.
+
+#define SIM_TWO_PI       (2.0 * 3.14159265359)
+#define SIM_GRAVITY      9.80665
+#define SIM_VIBRATION_HZ 23.0
+#define SIM_VIBRATION_G  0.05
+#define SIM_SHAKE_HZ     3.0
+#define SIM_SHAKE_G      2.5
+#define SIM_ROTATION_HZ  0.2
+#define SIM_ROTATION_RAD 0.5
+#define SIM_DRIFT_S      600.0
+
+struct sensor_sim_config {
+	bool accel;
+	bool gyro;
+	bool env;
+	uint32_t phase_ms;
+	uint8_t replay_offset;
+};
+
+struct sensor_sim_data {
+	const struct device *dev;
+	struct k_spinlock lock;
+	// Latched by sample_fetch, like the real drivers
+	double accel[3]; // m/s^2
+	double gyro[3];  // rad/s
+	double env[4];   // °C, kPa, %RH, ohm
+	int32_t odr_hz;
+	uint32_t fetches;
+	int64_t shake_until_ms;
+	sensor_trigger_handler_t handler;
+	const struct sensor_trigger *trigger;
+	struct k_work_delayable shake_work;
+#ifdef CONFIG_APP_SENSOR_REPLAY
+	struct sensor_replay_cursor replay;
+#endif
+};
+
+#ifdef CONFIG_APP_SENSOR_REPLAY
+/* Latch the recorded values, accelerometer first, then gyroscope, or environment */
+static int sensor_sim_replay_fetch(const struct device *dev)
+{
+	const struct sensor_sim_config *config = dev->config;
+	struct sensor_sim_data *data = dev->data;
+	double values[6];
+	int count = 0;
+	int ret;
+
+	count += config->accel ? 3 : 0;
+	count += config->gyro ? 3 : 0;
+	count = config->env ? 4 : count;
+
+	ret = sensor_replay_read(&data->replay, config->replay_offset, count, values);
+	if (ret) {
+		return ret;
+	}
+
+	K_SPINLOCK(&data->lock) {
+		if (config->env) {
+			memcpy(data->env, values, sizeof(data->env));
+		} else if (config->accel) {
+			memcpy(data->accel, values, sizeof(data->accel));
+			if (config->gyro) {
+				memcpy(data->gyro, &values[3], sizeof(data->gyro));
+			}
+		} else {
+			memcpy(data->gyro, values, sizeof(data->gyro));
+		}
+		data->fetches++;
+	}
+
+	return 0;
+}
+#endif // CONFIG_APP_SENSOR_REPLAY
+
+static int sensor_sim_sample_fetch(const struct device *dev, enum sensor_channel chan)
+{
+	ARG_UNUSED(chan);
+
+	const struct sensor_sim_config *config = dev->config;
+	struct sensor_sim_data *data = dev->data;
+	int64_t now_ms = k_uptime_get();
+	double t = (now_ms + config->phase_ms) / 1000.0;
+	double vibration = SIM_VIBRATION_G * sin(SIM_TWO_PI * SIM_VIBRATION_HZ * t);
+	double rotation = SIM_ROTATION_RAD * sin(SIM_TWO_PI * SIM_ROTATION_HZ * t);
+	double drift = sin(SIM_TWO_PI * t / SIM_DRIFT_S);
+	double shake = 0.0;
+
+#ifdef CONFIG_APP_SENSOR_REPLAY
+	if (sensor_replay_active()) {
+		return sensor_sim_replay_fetch(dev);
+	}
+#endif
+
+	K_SPINLOCK(&data->lock) {
+		if (now_ms < data->shake_until_ms) {
+			shake = SIM_SHAKE_G * sin(SIM_TWO_PI * SIM_SHAKE_HZ * t);
+		}
+
+		data->accel[0] = (vibration + shake) * SIM_GRAVITY;
+		data->accel[1] = 0.5 * (vibration - shake) * SIM_GRAVITY;
+		data->accel[2] = (1.0 + vibration) * SIM_GRAVITY;
+
+		data->gyro[0] = rotation;
+		data->gyro[1] = 0.5 * rotation;
+		data->gyro[2] = 0.25 * rotation;
+
+		data->env[0] = 22.0 + 0.5 * drift;
+		data->env[1] = 101.325 + 0.05 * drift;
+		data->env[2] = 40.0 + 2.0 * drift;
+		data->env[3] = 50000.0 + 5000.0 * drift;
+
+		data->fetches++;
+	}
+
+	return 0;
+}
+
+static int sensor_sim_channel_get(const struct device *dev, enum sensor_channel chan,
+				  struct sensor_value *val)
+{
+	const struct sensor_sim_config *config = dev->config;
+	struct sensor_sim_data *data = dev->data;
+	const double *src;
+	int count;
+
+	switch (chan) {
+	case SENSOR_CHAN_ACCEL_X:
+	case SENSOR_CHAN_ACCEL_Y:
+	case SENSOR_CHAN_ACCEL_Z:
+		src = config->accel ? &data->accel[chan - SENSOR_CHAN_ACCEL_X] : NULL;
+		count = 1;
+		break;
+	case SENSOR_CHAN_ACCEL_XYZ:
+		src = config->accel ? data->accel : NULL;
+		count = 3;
+		break;
+	case SENSOR_CHAN_GYRO_X:
+	case SENSOR_CHAN_GYRO_Y:
+	case SENSOR_CHAN_GYRO_Z:
+		src = config->gyro ? &data->gyro[chan - SENSOR_CHAN_GYRO_X] : NULL;
+		count = 1;
+		break;
+	case SENSOR_CHAN_GYRO_XYZ:
+		src = config->gyro ? data->gyro : NULL;
+		count = 3;
+		break;
+	case SENSOR_CHAN_AMBIENT_TEMP:
+		src = config->env ? &data->env[0] : NULL;
+		count = 1;
+		break;
+	case SENSOR_CHAN_PRESS:
+		src = config->env ? &data->env[1] : NULL;
+		count = 1;
+		break;
+	case SENSOR_CHAN_HUMIDITY:
+		src = config->env ? &data->env[2] : NULL;
+		count = 1;
+		break;
+	case SENSOR_CHAN_GAS_RES:
+		src = config->env ? &data->env[3] : NULL;
+		count = 1;
+		break;
+	default:
+		src = NULL;
+		count = 0;
+		break;
+	}
+
+	if (src == NULL) {
+		return -ENOTSUP;
+	}
+
+	K_SPINLOCK(&data->lock) {
+		for (int i = 0; i < count; i++) {
+			sensor_value_from_double(&val[i], src[i]);
+		}
+	}
+
+	return 0;
+}
+
+/* Every attribute is accepted, only the output data rate is kept for the status */
+static int sensor_sim_attr_set(const struct device *dev, enum sensor_channel chan,
+			       enum sensor_attribute attr, const struct sensor_value *val)
+{
+	ARG_UNUSED(chan);
+
+	struct sensor_sim_data *data = dev->data;
+
+	if (attr == SENSOR_ATTR_SAMPLING_FREQUENCY) {
+		data->odr_hz = val->val1;
+	}
+
+	return 0;
+}
+
+static int sensor_sim_trigger_set(const struct device *dev, const struct sensor_trigger *trig,
+				  sensor_trigger_handler_t handler)
+{
+	const struct sensor_sim_config *config = dev->config;
+	struct sensor_sim_data *data = dev->data;
+
+	if (!config->accel || trig->type != SENSOR_TRIG_THRESHOLD) {
+		return -ENOTSUP;
+	}
+
+	data->trigger = trig;
+	data->handler = handler;
+
+	return 0;
+}
+
+/* Raise the threshold trigger at the start of a shake, and again at its end */
+static void sensor_sim_shake_work_handler(struct k_work *work)
+{
+	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+	struct sensor_sim_data *data = CONTAINER_OF(dwork, struct sensor_sim_data, shake_work);
+	int64_t shake_until_ms;
+
+	K_SPINLOCK(&data->lock) {
+		shake_until_ms = data->shake_until_ms;
+	}
+
+	if (data->handler != NULL) {
+		data->handler(data->dev, data->trigger);
+	}
+
+	if (k_uptime_get() < shake_until_ms) {
+		k_work_reschedule(dwork, K_TIMEOUT_ABS_MS(shake_until_ms));
+	}
+}
+
+static int sensor_sim_init(const struct device *dev)
+{
+	struct sensor_sim_data *data = dev->data;
+
+	data->dev = dev;
+	k_work_init_delayable(&data->shake_work, sensor_sim_shake_work_handler);
+
+	return 0;
+}
+
+static const struct sensor_driver_api sensor_sim_api = {
+	.sample_fetch = sensor_sim_sample_fetch,
+	.channel_get = sensor_sim_channel_get,
+	.attr_set = sensor_sim_attr_set,
+	.trigger_set = sensor_sim_trigger_set,
+};
+
+#define SENSOR_SIM_DEFINE(inst)                                                                    \
+	static struct sensor_sim_data sensor_sim_data_##inst;                                      \
+	static const struct sensor_sim_config sensor_sim_config_##inst = {                         \
+		.accel = DT_INST_PROP(inst, accel),                                                \
+		.gyro = DT_INST_PROP(inst, gyro),                                                  \
+		.env = DT_INST_PROP(inst, env),                                                    \
+		.phase_ms = DT_INST_PROP(inst, phase_ms),                                          \
+		.replay_offset = DT_INST_PROP(inst, replay_offset),                                \
+	};                                                                                         \
+	SENSOR_DEVICE_DT_INST_DEFINE(inst, sensor_sim_init, NULL, &sensor_sim_data_##inst,         \
+				     &sensor_sim_config_##inst, POST_KERNEL,                       \
+				     CONFIG_SENSOR_INIT_PRIORITY, &sensor_sim_api);
+
+DT_INST_FOREACH_STATUS_OKAY(SENSOR_SIM_DEFINE)
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+#define SENSOR_SIM_DEVICE(inst) DEVICE_DT_INST_GET(inst),
+
+static const struct device *const sensor_sim_devs[] = {
+	DT_INST_FOREACH_STATUS_OKAY(SENSOR_SIM_DEVICE)};
+
+static int cmd_sensor_sim_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	for (int i = 0; i < ARRAY_SIZE(sensor_sim_devs); i++) {
+		struct sensor_sim_data *data = sensor_sim_devs[i]->data;
+
+		shell_print(sh, "%-10s %4d Hz  %u fetches%s", sensor_sim_devs[i]->name,
+			    data->odr_hz, data->fetches,
+			    k_uptime_get() < data->shake_until_ms ? "  shaking" : "");
+	}
+
+	return 0;
+}
+
+static int cmd_sensor_sim_shake(const struct shell *sh, size_t argc, char **argv)
+{
+	int duration_ms = argc > 1 ? atoi(argv[1]) : 2000;
+
+	if (duration_ms <= 0) {
+		shell_error(sh, "Invalid duration %s", argv[1]);
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < ARRAY_SIZE(sensor_sim_devs); i++) {
+		const struct sensor_sim_config *config = sensor_sim_devs[i]->config;
+		struct sensor_sim_data *data = sensor_sim_devs[i]->data;
+
+		if (!config->accel) {
+			continue;
+		}
+
+		K_SPINLOCK(&data->lock) {
+			data->shake_until_ms = k_uptime_get() + duration_ms;
+		}
+		k_work_reschedule(&data->shake_work, K_NO_WAIT);
+	}
+
+	shell_print(sh, "Shaking for %d ms", duration_ms);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sensor_sim_cmds,
+			       SHELL_CMD(status, NULL, "Show the simulated sensors",
+					 cmd_sensor_sim_status),
+			       SHELL_CMD_ARG(shake, NULL, "Shake the accelerometers [ms]",
+					     cmd_sensor_sim_shake, 1, 1),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(sensor_sim, &sensor_sim_cmds, "Simulated sensors", NULL);
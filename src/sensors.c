@@ -1,136 +1,379 @@
 #include "sensors.h"
+#include "app_config.h"
+#include "http_resources.h"
+#include "metrics.h"
+#include "profiler.h"
+
+#include <string.h>
+
+#include <zephyr/pm/device.h>
+#include <zephyr/pm/device_runtime.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(SENSORS, CONFIG_SENSORS_LOG_LEVEL);
 
 void sensor_gas_thread();
+void sensor_acq_thread();
 
 K_THREAD_STACK_DEFINE(gas_stack_area, 1024);
 struct k_thread gas_thread_data;
 k_tid_t gas_thread_id;
 
+K_THREAD_STACK_DEFINE(acq_stack_area, CONFIG_SENSORS_ACQ_THREAD_STACK_SIZE);
+struct k_thread acq_thread_data;
+k_tid_t acq_thread_id;
+
+// Latest sample from the acquisition thread, shared by all consumers
+static struct sensor_sample latest_sample;
+static bool latest_sample_valid;
+static struct k_spinlock latest_sample_lock;
+
+static sys_slist_t listeners = SYS_SLIST_STATIC_INIT(&listeners);
+static K_MUTEX_DEFINE(listeners_lock);
+
+// Acquisition interval set by sensors_set_interval() while a high-rate sampler shares the buses,
+// 0 for the configured stream_interval_ms
+static atomic_t acq_interval_ms;
+
+// The ADXL367 repeats the BMI270 acceleration on the page, so the acquisition thread only reads it
+// for clients that subscribe to it
+static atomic_t adxl367_subscribers;
+
+// Idle state set by the power module with sensors_suspend() and sensors_resume(). The intervals
+// and the warm-up are written before the flags change.
+static atomic_t suspended;
+static atomic_t warmup_pending;
+static int idle_acq_interval_ms;
+static int idle_env_interval_ms;
+static int resume_warmup_ms;
+static K_SEM_DEFINE(gas_resume_sem, 0, 1);
+static atomic_t env_measurements;
+
+// Set when the BMI270 settings changed while it was suspended, applied by sensors_resume()
+static atomic_t bmi270_reconfigure_pending;
+
+// The drivers keep the last fetched sample in their data, so a fetch and the channel reads that
+// follow must not interleave with another thread fetching the same device
+static K_MUTEX_DEFINE(imu_lock);
+
 const struct device *dev_bmi270 = DEVICE_DT_GET(DT_ALIAS(accel0));
 const struct device *dev_adxl367 = DEVICE_DT_GET(DT_ALIAS(accel1));
 const struct device *dev_bme680 = DEVICE_DT_GET(DT_ALIAS(env0));
 // const struct device *dev_bmm350 = DEVICE_DT_GET(DT_ALIAS(mag0)); // NOTE: The bmm350 device have
 // no zephyr drivers yet
 
-/**
- * @brief Rotate a measurement around an axis.
- *
- * @param val pointer to the sensor value.
- * @param angle angle to rotate in degrees.
- * @param axis axis to rotate around (0 = x, 1 = y, 2 = z).
- *
- * @return int 0 if successful, negative errno otherwise.
- */
-int rotate_measurement(struct sensor_value *val, int angle, int axis)
-{
-	double angle_rad = angle * PI / 180.0;
-	double cos_angle = cos(angle_rad);
-	double sin_angle = sin(angle_rad);
-
-	double x = sensor_value_to_double(&val[0]);
-	double y = sensor_value_to_double(&val[1]);
-	double z = sensor_value_to_double(&val[2]);
-
-	double x_new = 0.0;
-	double y_new = 0.0;
-	double z_new = 0.0;
-
-	if (axis == 0) {
-		// Rotate around x-axis
-		x_new = x;
-		y_new = y * cos_angle - z * sin_angle;
-		z_new = y * sin_angle + z * cos_angle;
-	} else if (axis == 1) {
-		// Rotate around y-axis
-		x_new = x * cos_angle + z * sin_angle;
-		y_new = y;
-		z_new = -x * sin_angle + z * cos_angle;
-	} else if (axis == 2) {
-		// Rotate around z-axis
-		x_new = x * cos_angle - y * sin_angle;
-		y_new = x * sin_angle + y * cos_angle;
-		z_new = z;
-	} else {
-		LOG_ERR("Invalid axis for rotation");
-		return -EINVAL;
-	}
-
-	sensor_value_from_double(&val[0], x_new);
-	sensor_value_from_double(&val[1], y_new);
-	sensor_value_from_double(&val[2], z_new);
+/* Where sensor_measure() reads a channel of sensor_channels.h from, and how it turns it */
+struct sensor_channel_source {
+	uint8_t index; // Index in sensor_sample.data
+	int8_t sign;
+	enum sensor_channel chan;
+};
 
-	return 0;
-}
+#define SENSOR_CH_SOURCE(_id, _name, _unit, _chan, _sign, _prec, _step)                            \
+	{.index = SENSOR_CH_##_id, .sign = _sign, .chan = _chan},
 
-/**
- * @brief Initialize the sensors
- *
- * @return int 0 if successful, negative error code otherwise.
- */
-int sensors_init(void)
+static const struct sensor_channel_source bmi270_channels[] = {
+	SENSOR_CHANNELS_BMI270(SENSOR_CH_SOURCE)};
+static const struct sensor_channel_source adxl367_channels[] = {
+	SENSOR_CHANNELS_ADXL367(SENSOR_CH_SOURCE)};
+static const struct sensor_channel_source bme680_channels[] = {
+	SENSOR_CHANNELS_BME680(SENSOR_CH_SOURCE)};
+
+/* Names and units of the channels, for GET /schema */
+struct sensor_channel_info {
+	const char *name;
+	const char *unit;
+	uint8_t precision;
+	double step;
+};
+
+#define SENSOR_CH_INFO(_id, _name, _unit, _chan, _sign, _prec, _step)                              \
+	[SENSOR_CH_##_id] = {.name = #_name, .unit = _unit, .precision = _prec, .step = _step},
+
+static const struct sensor_channel_info channel_info[] = {SENSOR_CHANNELS(SENSOR_CH_INFO)};
+
+/* Read the channels of a fetched device into data, they are all left 0 if one can't be read */
+static int sensors_read_channels(const struct device *dev,
+				 const struct sensor_channel_source *channels, size_t count,
+				 double *data)
 {
+	struct sensor_value val;
 	int ret;
-	//////////////////////BMI270//////////////////////
 
-	if (!device_is_ready(dev_bmi270)) {
-		LOG_ERR("Device %s is not ready", dev_bmi270->name);
-		return -1;
+	for (size_t i = 0; i < count; i++) {
+		ret = sensor_channel_get(dev, channels[i].chan, &val);
+		if (ret) {
+			for (size_t j = 0; j < i; j++) {
+				data[channels[j].index] = 0.0;
+			}
+			return ret;
+		}
+		data[channels[i].index] = channels[i].sign * sensor_value_to_double(&val);
 	}
-	LOG_INF("Device %s is ready", dev_bmi270->name);
+
+	return 0;
+}
+
+/* Configure the BMI270 ranges and output data rates, also used to reinitialize it */
+static int bmi270_configure(void)
+{
+	int ret = 0;
 
 	struct sensor_value ful_scale, sampling_freq, oversampling;
-	ful_scale.val1 = 2; /* G */
+	ful_scale.val1 = app_config_get(APP_CONFIG_BMI270_ACCEL_RANGE_G); /* G */
 	ful_scale.val2 = 0;
-	sampling_freq.val1 = 200; /* Hz */
+	sampling_freq.val1 = app_config_get(APP_CONFIG_BMI270_ODR_HZ); /* Hz */
 	sampling_freq.val2 = 0;
-	oversampling.val1 = 1; /* Normal mode */
+	oversampling.val1 = app_config_get(APP_CONFIG_BMI270_ACCEL_OSR); /* 1 is normal mode */
 	oversampling.val2 = 0;
 
+	k_mutex_lock(&imu_lock, K_FOREVER);
+
 	/* Set sampling frequency last as this also sets the appropriate
 	 * power mode. If already sampling, change to 0.0Hz before changing
 	 * other attributes
 	 */
-	sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_FULL_SCALE, &ful_scale);
-	sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_OVERSAMPLING, &oversampling);
-	sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
-			&sampling_freq);
+	ret |= sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_FULL_SCALE,
+			       &ful_scale);
+	ret |= sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_OVERSAMPLING,
+			       &oversampling);
+	ret |= sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
+			       &sampling_freq);
 
-	ful_scale.val1 = 1000; /* dps */
+	ful_scale.val1 = app_config_get(APP_CONFIG_BMI270_GYRO_RANGE_DPS); /* dps */
 	ful_scale.val2 = 0;
-	sampling_freq.val1 = 200; /* Hz. */
+	sampling_freq.val1 = app_config_get(APP_CONFIG_BMI270_ODR_HZ); /* Hz. */
 	sampling_freq.val2 = 0;
-	oversampling.val1 = 2; /* Normal mode */
+	oversampling.val1 = app_config_get(APP_CONFIG_BMI270_GYRO_OSR); /* 2 is normal mode */
 	oversampling.val2 = 0;
 
 	/* Set sampling frequency last as this also sets the appropriate
 	 * power mode. If already sampling, change to 0.0Hz before changing
 	 * other attributes
 	 */
-	sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, SENSOR_ATTR_FULL_SCALE, &ful_scale);
-	sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, SENSOR_ATTR_OVERSAMPLING, &oversampling);
-	sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
-			&sampling_freq);
+	ret |= sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, SENSOR_ATTR_FULL_SCALE,
+			       &ful_scale);
+	ret |= sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, SENSOR_ATTR_OVERSAMPLING,
+			       &oversampling);
+	ret |= sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
+			       &sampling_freq);
 
-	//////////////////////ADXL367/////////////////////
+	k_mutex_unlock(&imu_lock);
 
-	if (!device_is_ready(dev_adxl367)) {
-		LOG_ERR("Device %s is not ready", dev_adxl367->name);
-		return -1;
-	}
-	LOG_INF("Device %s is ready", dev_adxl367->name);
+	return ret ? -EIO : 0;
+}
 
+/* Configure the ADXL367 output data rate, also used to reinitialize it */
+static int adxl367_configure(void)
+{
 	struct sensor_value sampling_freq2;
-	sampling_freq2.val1 = 100; /* Hz */
+	int ret;
+
+	sampling_freq2.val1 = app_config_get(APP_CONFIG_ADXL367_ODR_HZ); /* Hz */
 	sampling_freq2.val2 = 0;
 
+	k_mutex_lock(&imu_lock, K_FOREVER);
 	ret = sensor_attr_set(dev_adxl367, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
 			      &sampling_freq2);
+	k_mutex_unlock(&imu_lock);
 	if (ret) {
 		LOG_ERR("sensor_attr_set failed ret %d", ret);
-		return ret;
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////// Supervisor //////////////////////////////////////////
+
+// Every access to a device is reported to its health. After a failure the device is left alone for
+// a backoff that doubles with every failure in a row, up to CONFIG_SENSORS_RETRY_MAX_MS, and its
+// channels are flagged invalid while the other sensors keep streaming. Every
+// CONFIG_SENSORS_REINIT_AFTER failures in a row the device is power cycled, when its driver
+// supports device PM, and configured again. A flaky bus transaction costs one sample.
+
+struct sensor_health {
+	const struct device *dev;
+	int (*configure)(void);
+	struct k_mutex *lock; // Held by the readers of the device, if any
+	uint32_t failures; // In a row
+	uint32_t backoff_ms;
+	int64_t retry_at_ms;
+	uint32_t reinits;
+};
+
+static struct sensor_health health[METRICS_DEV_COUNT] = {
+	[METRICS_DEV_BMI270] = {.dev = DEVICE_DT_GET(DT_ALIAS(accel0)),
+				.configure = bmi270_configure,
+				.lock = &imu_lock},
+	[METRICS_DEV_ADXL367] = {.dev = DEVICE_DT_GET(DT_ALIAS(accel1)),
+				 .configure = adxl367_configure,
+				 .lock = &imu_lock},
+	[METRICS_DEV_BME680] = {.dev = DEVICE_DT_GET(DT_ALIAS(env0))},
+};
+static struct k_spinlock health_lock;
+
+/* Whether a device may be accessed now, false while it backs off after a failure */
+static bool sensor_health_ready(enum metrics_sensor_dev id)
+{
+	bool ready;
+
+	K_SPINLOCK(&health_lock) {
+		ready = k_uptime_get() >= health[id].retry_at_ms;
+	}
+
+	return ready;
+}
+
+static void sensor_reinit(struct sensor_health *h)
+{
+	int ret;
+
+	LOG_WRN("Reinitializing %s", h->dev->name);
+
+	// No other thread may fetch the device between the power cycle and its configuration. The
+	// configure functions take the same lock again, Zephyr mutexes nest.
+	if (h->lock != NULL) {
+		k_mutex_lock(h->lock, K_FOREVER);
+	}
+
+	// Drivers without device PM return -ENOSYS or -ENOTSUP, they are only configured again
+	ret = pm_device_action_run(h->dev, PM_DEVICE_ACTION_SUSPEND);
+	if (ret == 0) {
+		ret = pm_device_action_run(h->dev, PM_DEVICE_ACTION_RESUME);
+		if (ret) {
+			LOG_ERR("Failed to resume %s, err %d", h->dev->name, ret);
+		}
+	}
+
+	if (h->configure != NULL) {
+		ret = h->configure();
+		if (ret) {
+			LOG_ERR("Failed to configure %s, err %d", h->dev->name, ret);
+		}
+	}
+
+	if (h->lock != NULL) {
+		k_mutex_unlock(h->lock);
+	}
+
+	K_SPINLOCK(&health_lock) {
+		h->reinits++;
+	}
+}
+
+/* Report the result of an access, which schedules the next retry after a failure */
+static void sensor_health_report(enum metrics_sensor_dev id, int err)
+{
+	struct sensor_health *h = &health[id];
+	uint32_t failures = 0;
+	uint32_t backoff_ms = 0;
+
+	K_SPINLOCK(&health_lock) {
+		if (err == 0) {
+			failures = h->failures;
+			h->failures = 0;
+			h->backoff_ms = 0;
+			h->retry_at_ms = 0;
+			K_SPINLOCK_BREAK;
+		}
+
+		h->failures++;
+		h->backoff_ms = CLAMP(h->backoff_ms * 2, CONFIG_SENSORS_RETRY_MIN_MS,
+				      CONFIG_SENSORS_RETRY_MAX_MS);
+		h->retry_at_ms = k_uptime_get() + h->backoff_ms;
+		failures = h->failures;
+		backoff_ms = h->backoff_ms;
+	}
+
+	if (err == 0) {
+		if (failures > 0) {
+			LOG_INF("%s recovered after %u failures", h->dev->name, failures);
+		}
+		return;
+	}
+
+	metrics_sensor_fetch_error(id);
+	LOG_WRN("%s failed (%d), %u in a row, retry in %u ms", h->dev->name, err, failures,
+		backoff_ms);
+
+	if (failures % CONFIG_SENSORS_REINIT_AFTER == 0) {
+		sensor_reinit(h);
+	}
+}
+
+#ifdef CONFIG_APP_METRICS
+static void sensors_collect(struct metrics_writer *w)
+{
+	struct sensor_health copy[METRICS_DEV_COUNT];
+
+	K_SPINLOCK(&health_lock) {
+		memcpy(copy, health, sizeof(copy));
+	}
+
+	metrics_header(w, "thingy_sensor_healthy", "gauge",
+		       "1 if the last access to the sensor succeeded");
+	for (int i = 0; i < METRICS_DEV_COUNT; i++) {
+		metrics_printf(w, "thingy_sensor_healthy{dev=\"%s\"} %d\n", copy[i].dev->name,
+			       copy[i].failures == 0);
+	}
+
+	metrics_header(w, "thingy_sensor_reinits_total", "counter",
+		       "Sensor reinitializations after repeated failures");
+	for (int i = 0; i < METRICS_DEV_COUNT; i++) {
+		metrics_printf(w, "thingy_sensor_reinits_total{dev=\"%s\"} %u\n", copy[i].dev->name,
+			       copy[i].reinits);
+	}
+}
+
+static struct metrics_collector sensors_collector = {
+	.collect = sensors_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+/**
+ * @brief Initialize the sensors
+ *
+ * @return int 0 if successful, negative error code otherwise.
+ */
+int sensors_init(void)
+{
+	int ret;
+	//////////////////////BMI270//////////////////////
+
+	if (!device_is_ready(dev_bmi270)) {
+		LOG_ERR("Device %s is not ready", dev_bmi270->name);
+		return -1;
+	}
+	LOG_INF("Device %s is ready", dev_bmi270->name);
+
+	// Hold the BMI270 active until sensors_suspend() releases it
+	if (pm_device_runtime_is_enabled(dev_bmi270)) {
+		ret = pm_device_runtime_get(dev_bmi270);
+		if (ret) {
+			LOG_ERR("Failed to resume %s, err %d", dev_bmi270->name, ret);
+		}
+	}
+
+	// A device that fails to configure is left to the supervisor, like a failed fetch
+	ret = bmi270_configure();
+	if (ret) {
+		LOG_ERR("Failed to configure %s, ret %d", dev_bmi270->name, ret);
+		sensor_health_report(METRICS_DEV_BMI270, ret);
+	}
+
+	//////////////////////ADXL367/////////////////////
+
+	if (!device_is_ready(dev_adxl367)) {
+		LOG_ERR("Device %s is not ready", dev_adxl367->name);
+		return -1;
+	}
+	LOG_INF("Device %s is ready", dev_adxl367->name);
+
+	ret = adxl367_configure();
+	if (ret) {
+		sensor_health_report(METRICS_DEV_ADXL367, ret);
 	}
 
 	//////////////////////BME680//////////////////////
@@ -149,267 +392,518 @@ int sensors_init(void)
 	// }
 	// LOG_INF("Device %s is ready", dev_bmm350->name);
 
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&sensors_collector);
+#endif // CONFIG_APP_METRICS
+
 	// Start the gas sensor thread
 
 	gas_thread_id = k_thread_create(&gas_thread_data, gas_stack_area,
 					K_THREAD_STACK_SIZEOF(gas_stack_area), sensor_gas_thread,
 					NULL, NULL, NULL, 7, 0, K_NO_WAIT);
+	k_thread_name_set(gas_thread_id, "sensor_gas");
+
+	// Start the acquisition thread, which samples all sensors once per interval no matter how
+	// many clients are connected
+	acq_thread_id = k_thread_create(&acq_thread_data, acq_stack_area,
+					K_THREAD_STACK_SIZEOF(acq_stack_area), sensor_acq_thread,
+					NULL, NULL, NULL, 7, 0, K_NO_WAIT);
+	k_thread_name_set(acq_thread_id, "sensor_acq");
 
 	return 0;
 }
 
-struct sensor_value temp, press, hum, gas;
-// Thread to measure the gas sensor continuously and update a global variable as the gas measurement
-// are slow
-void sensor_gas_thread()
+void sensors_add_listener(struct sensors_listener *listener)
 {
-	int ret;
-	while (1) {
-		//////////////////////BME680//////////////////////
-		LOG_DBG("BME680");
-		ret = sensor_sample_fetch(dev_bme680);
-		if (ret) {
-			LOG_ERR("sensor_sample_fetch failed ret %d", ret);
-			return;
-		}
+	k_mutex_lock(&listeners_lock, K_FOREVER);
+	sys_slist_append(&listeners, &listener->node);
+	k_mutex_unlock(&listeners_lock);
+}
 
-		ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_AMBIENT_TEMP, &temp);
-		if (ret) {
-			LOG_ERR("sensor_channel_get failed ret %d", ret);
-			return;
-		}
+/**
+ * @brief Read the ADXL367 in the acquisition thread, for one more subscriber.
+ *
+ * Each call must be paired with sensors_adxl367_unsubscribe(). Without subscribers the ADXL367
+ * values of the samples are 0.
+ */
+void sensors_adxl367_subscribe(void)
+{
+	atomic_inc(&adxl367_subscribers);
+}
 
-		ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_PRESS, &press);
-		if (ret) {
-			LOG_ERR("sensor_channel_get failed ret %d", ret);
-			return;
-		}
+void sensors_adxl367_unsubscribe(void)
+{
+	atomic_dec(&adxl367_subscribers);
+}
 
-		ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_HUMIDITY, &hum);
-		if (ret) {
-			LOG_ERR("sensor_channel_get failed ret %d", ret);
-			return;
-		}
+/*
+ * Suspend or resume the BMI270, with device runtime PM when the driver supports it. sensors_init()
+ * takes the first runtime PM reference, so every suspend releases one that a resume took.
+ */
+static int bmi270_set_suspended(bool suspend)
+{
+	struct sensor_value odr = {.val1 = suspend ? 0 : app_config_get(APP_CONFIG_BMI270_ODR_HZ),
+				   .val2 = 0};
+	int ret;
 
-		ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_GAS_RES, &gas);
-		if (ret) {
-			LOG_ERR("sensor_channel_get failed ret %d", ret);
-			return;
-		}
+	if (pm_device_runtime_is_enabled(dev_bmi270)) {
+		return suspend ? pm_device_runtime_put(dev_bmi270) : pm_device_runtime_get(dev_bmi270);
+	}
 
-		k_sleep(K_MSEC(250));
+	// Otherwise an output data rate of 0 Hz turns the accelerometer and the gyroscope off
+	k_mutex_lock(&imu_lock, K_FOREVER);
+	ret = sensor_attr_set(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, SENSOR_ATTR_SAMPLING_FREQUENCY,
+			      &odr);
+	if (ret == 0) {
+		ret = sensor_attr_set(dev_bmi270, SENSOR_CHAN_GYRO_XYZ,
+				      SENSOR_ATTR_SAMPLING_FREQUENCY, &odr);
 	}
+	k_mutex_unlock(&imu_lock);
+
+	return ret;
 }
 
 /**
- * @brief Meassure the sensor data
+ * @brief Suspend the BMI270 and slow down the sampling threads while nobody watches.
  *
- * @param data Pointer to the data array
- *       [timestamp,                                            \
- *       BMI270_accel_x, BMI270_accel_y, BMI270_accel_z,    \
- *       BMI270_gyro_x, BMI270_gyro_y, BMI270_gyro_z,       \
- *       ADXL367_accel_x, ADXL367_accel_y, ADXL367_accel_z, \
- *       BME680_temp, BME680_press, BME680_hum, BME680_gas, \
- *       BMM350_magn_x, BMM350_magn_y, BMM350_magn_z]
+ * The acquisition thread keeps running at acq_interval_ms for the history and the log, with the
+ * BMI270 channels not valid. The gas thread measures every env_interval_ms, or parks if it is 0.
  *
- * All values are in SI units.
- *      Acceleration in m/s^2
- *      Gyroscope in rad/s
- *      Temperature in Celsius
- *      Pressure in Pascal
- *      Humidity in %
- *      Gas resistance in Ohm
- *      Magnetometer in uT // NOTE: The bmm350 device have no zephyr drivers yet, data will be 0
+ * @return 0 if successful, negative error code if the BMI270 could not be suspended. The sensors
+ *         then stay active.
+ */
+int sensors_suspend(int acq_interval_ms, int env_interval_ms)
+{
+	int ret;
+
+	if (atomic_get(&suspended)) {
+		return 0;
+	}
+
+	idle_acq_interval_ms = acq_interval_ms;
+	idle_env_interval_ms = env_interval_ms;
+	k_sem_reset(&gas_resume_sem);
+	atomic_set(&suspended, 1);
+
+	ret = bmi270_set_suspended(true);
+	if (ret) {
+		// The BMI270 still runs, keep sampling it at full rate
+		LOG_ERR("Failed to suspend %s, err %d", dev_bmi270->name, ret);
+		atomic_clear(&suspended);
+		k_sem_give(&gas_resume_sem);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Resume the sensors, the next sample is taken after warmup_ms.
  *
  * @return 0 if successful, negative error code otherwise.
  */
-int sensor_measure(double *data)
+int sensors_resume(int warmup_ms)
 {
 	int ret;
-	struct sensor_value accel0[3], gyr[3];
-	struct sensor_value accel1[3];
-	// struct sensor_value temp, press, hum, gas;
-	// struct sensor_value mag[3]; // NOTE: The bmm350 device have no zephyr drivers yet
 
-	//////////////////////BMI270//////////////////////
-	LOG_DBG("BMI270");
-	ret = sensor_sample_fetch(dev_bmi270);
-	if (ret) {
-		LOG_ERR("sensor_sample_fetch failed ret %d", ret);
-		return -1;
+	if (!atomic_get(&suspended)) {
+		return 0;
 	}
 
-	ret = sensor_channel_get(dev_bmi270, SENSOR_CHAN_ACCEL_XYZ, accel0);
+	ret = bmi270_set_suspended(false);
 	if (ret) {
-		LOG_ERR("sensor_channel_get failed ret %d", ret);
-		return -1;
+		LOG_ERR("Failed to resume %s, err %d", dev_bmi270->name, ret);
+		return ret;
 	}
 
-	ret = sensor_channel_get(dev_bmi270, SENSOR_CHAN_GYRO_XYZ, gyr);
-	if (ret) {
-		LOG_ERR("sensor_channel_get failed ret %d", ret);
-		return -1;
+	if (atomic_cas(&bmi270_reconfigure_pending, 1, 0)) {
+		ret = bmi270_configure();
+		sensor_health_report(METRICS_DEV_BMI270, ret);
 	}
 
-	// Rotate the BMI270 data to match the orientation of the thingy
-	ret = rotate_measurement(accel0, 180, 2);
-	if (ret) {
-		LOG_ERR("rotate_measurement failed ret %d", ret);
-		return -1;
+	resume_warmup_ms = warmup_ms;
+	atomic_set(&warmup_pending, 1);
+	atomic_clear(&suspended);
+
+	// Cut the idle sleeps short
+	if (acq_thread_id != NULL) {
+		k_wakeup(acq_thread_id);
+	}
+	if (gas_thread_id != NULL) {
+		k_sem_give(&gas_resume_sem);
+		k_wakeup(gas_thread_id);
+	}
+
+	return 0;
+}
+
+/* Number of BME680 measurements since boot, to follow its duty cycle */
+uint32_t sensors_env_measurements(void)
+{
+	return (uint32_t)atomic_get(&env_measurements);
+}
+
+/**
+ * @brief Set the interval of the acquisition thread, from the next sample on.
+ *
+ * @param interval_ms Interval, or 0 to go back to the configured stream_interval_ms.
+ */
+void sensors_set_interval(int interval_ms)
+{
+	atomic_set(&acq_interval_ms, interval_ms);
+}
+
+/**
+ * @brief Configure a device again after its settings changed.
+ *
+ * A suspended BMI270 is configured when it resumes.
+ *
+ * @return 0 if successful, negative error code otherwise.
+ */
+int sensors_reconfigure(enum metrics_sensor_dev id)
+{
+	int ret;
+
+	if (id == METRICS_DEV_BMI270 && atomic_get(&suspended)) {
+		atomic_set(&bmi270_reconfigure_pending, 1);
+		return 0;
 	}
 
-	ret = rotate_measurement(gyr, 180, 2);
+	ret = health[id].configure();
 	if (ret) {
-		LOG_ERR("rotate_measurement failed ret %d", ret);
-		return -1;
+		LOG_ERR("Failed to configure %s, err %d", health[id].dev->name, ret);
 	}
 
-	//////////////////////ADXL367/////////////////////
-	LOG_DBG("ADXL367");
-	ret = sensor_sample_fetch(dev_adxl367);
+	return ret;
+}
+
+/**
+ * @brief Cut the sleeps of the sampling threads short, to use new intervals right away.
+ */
+void sensors_wake(void)
+{
+	if (acq_thread_id != NULL) {
+		k_wakeup(acq_thread_id);
+	}
+	if (gas_thread_id != NULL) {
+		k_wakeup(gas_thread_id);
+	}
+}
+
+/**
+ * @brief Fetch one sample from one of the accelerometers, for high-rate sampling.
+ *
+ * The BMI270 data is rotated to the orientation of the thingy like in sensor_measure().
+ *
+ * @return 0 if successful, negative error code otherwise.
+ */
+int sensors_fetch_imu(enum imu_source source, struct imu_sample *sample)
+{
+	const struct device *dev = source == IMU_SOURCE_BMI270 ? dev_bmi270 : dev_adxl367;
+	enum metrics_sensor_dev id = source == IMU_SOURCE_BMI270 ? METRICS_DEV_BMI270
+								 : METRICS_DEV_ADXL367;
+	// In the order of the values, x, y and z of the acceleration, then of the rotation
+	const struct sensor_channel_source *channels =
+		source == IMU_SOURCE_BMI270 ? bmi270_channels : adxl367_channels;
+	size_t count = source == IMU_SOURCE_BMI270 ? ARRAY_SIZE(bmi270_channels)
+						   : ARRAY_SIZE(adxl367_channels);
+	struct sensor_value val[6];
+	int ret;
+
+	if (!sensor_health_ready(id)) {
+		return -EAGAIN;
+	}
+
+	k_mutex_lock(&imu_lock, K_FOREVER);
+
+	sample->timestamp_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	sample->source = source;
+
+	ret = sensor_sample_fetch(dev);
+	if (ret == 0) {
+		ret = sensor_channel_get(dev, SENSOR_CHAN_ACCEL_XYZ, &val[0]);
+	}
+	if (ret == 0 && source == IMU_SOURCE_BMI270) {
+		ret = sensor_channel_get(dev, SENSOR_CHAN_GYRO_XYZ, &val[3]);
+	}
+
+	k_mutex_unlock(&imu_lock);
+
+	sensor_health_report(id, ret);
 	if (ret) {
-		LOG_ERR("sensor_sample_fetch failed ret %d", ret);
-		return -1;
+		return ret;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		sample->data[i] = sensor_value_to_double(&val[i]);
+		sample->data[i + 3] = source == IMU_SOURCE_BMI270 ? sensor_value_to_double(&val[i + 3])
+								  : 0.0f;
+	}
+
+	// The signs of sensor_channels.h, as in sensor_measure(). Without its channels in the frames
+	// the ADXL367 has no table, its signs are all 1.
+	for (size_t i = 0; i < count; i++) {
+		sample->data[i] *= channels[i].sign;
 	}
 
-	ret = sensor_channel_get(dev_adxl367, SENSOR_CHAN_ACCEL_XYZ, accel1);
+	return 0;
+}
+
+int sensors_get_latest(struct sensor_sample *sample)
+{
+	int ret = 0;
+
+	K_SPINLOCK(&latest_sample_lock) {
+		if (!latest_sample_valid) {
+			ret = -ENODATA;
+			K_SPINLOCK_BREAK;
+		}
+
+		*sample = latest_sample;
+	}
+
+	return ret;
+}
+
+/* Interval of the acquisition thread while the sensors are not suspended */
+static int sensors_acq_interval_ms(void)
+{
+	// A high-rate sampler only ever slows the live stream down
+	return MAX(atomic_get(&acq_interval_ms), app_config_get(APP_CONFIG_STREAM_INTERVAL_MS));
+}
+
+// Thread to sample the sensors at a fixed rate and hand each sample to the listeners
+void sensor_acq_thread()
+{
+	struct sensor_sample sample;
+	struct sensors_listener *listener;
+	int64_t next = k_uptime_get();
+	int ret;
+
+	while (1) {
+		if (atomic_clear(&warmup_pending)) {
+			// The first samples after a resume are not settled yet
+			k_sleep(K_MSEC(resume_warmup_ms));
+			next = k_uptime_get();
+		}
+
+		ret = sensor_measure(&sample);
+		if (ret) {
+			LOG_DBG("sensor_measure failed ret %d", ret);
+		} else {
+			K_SPINLOCK(&latest_sample_lock) {
+				latest_sample = sample;
+				latest_sample_valid = true;
+			}
+
+			k_mutex_lock(&listeners_lock, K_FOREVER);
+			SYS_SLIST_FOR_EACH_CONTAINER(&listeners, listener, node) {
+				listener->on_sample(&sample);
+			}
+			k_mutex_unlock(&listeners_lock);
+		}
+
+		// Sleep until an absolute deadline so the rate does not drift with the fetch time
+		next += atomic_get(&suspended) ? idle_acq_interval_ms : sensors_acq_interval_ms();
+		if (next < k_uptime_get()) {
+			next = k_uptime_get();
+		}
+		k_sleep(K_TIMEOUT_ABS_MS(next));
+	}
+}
+
+// Last BME680 measurement at the indices of its channels, valid while env_valid is set
+static double env_data[NUM_SENSOR_MEASUREMENTS];
+static bool env_valid;
+static struct k_spinlock env_lock;
+
+/* Measure the BME680 once, returns 0 if successful */
+static int bme680_measure(void)
+{
+	double data[NUM_SENSOR_MEASUREMENTS];
+	int ret;
+
+	LOG_DBG("BME680");
+	timing_t span = profiler_span_begin();
+
+	ret = sensor_sample_fetch(dev_bme680);
+	profiler_span_end(PROFILER_SPAN_FETCH_BME680, span);
+	if (ret == 0) {
+		ret = sensors_read_channels(dev_bme680, bme680_channels,
+					    ARRAY_SIZE(bme680_channels), data);
+	}
 	if (ret) {
-		LOG_ERR("sensor_channel_get SENSOR_CHAN_ACCEL_XYZ failed ret %d", ret);
-		return -1;
+		return ret;
 	}
 
-	// //////////////////////BME680//////////////////////
-	// LOG_DBG("BME680");
-	// ret = sensor_sample_fetch(dev_bme680);
-	// if (ret) {
-	// 	LOG_ERR("sensor_sample_fetch failed ret %d", ret);
-	// 	return -1;
-	// }
+	K_SPINLOCK(&env_lock) {
+		for (int i = 0; i < ARRAY_SIZE(bme680_channels); i++) {
+			env_data[bme680_channels[i].index] = data[bme680_channels[i].index];
+		}
+	}
 
-	// ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_AMBIENT_TEMP, &temp);
-	// if (ret) {
-	// 	LOG_ERR("sensor_channel_get failed ret %d", ret);
-	// 	return -1;
-	// }
+	return 0;
+}
 
-	// ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_PRESS, &press);
-	// if (ret) {
-	// 	LOG_ERR("sensor_channel_get failed ret %d", ret);
-	// 	return -1;
-	// }
+// Thread to measure the gas sensor continuously and update a global variable as the gas measurement
+// are slow. Failures are left to the supervisor, the thread keeps running.
+void sensor_gas_thread()
+{
+	int ret;
+	while (1) {
+		//////////////////////BME680//////////////////////
+		if (sensor_health_ready(METRICS_DEV_BME680)) {
+			ret = bme680_measure();
+			sensor_health_report(METRICS_DEV_BME680, ret);
 
-	// ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_HUMIDITY, &hum);
-	// if (ret) {
-	// 	LOG_ERR("sensor_channel_get failed ret %d", ret);
-	// 	return -1;
-	// }
+			K_SPINLOCK(&env_lock) {
+				env_valid = ret == 0;
+			}
+			if (ret == 0) {
+				atomic_inc(&env_measurements);
+			}
+		}
 
-	// ret = sensor_channel_get(dev_bme680, SENSOR_CHAN_GAS_RES, &gas);
-	// if (ret) {
-	// 	LOG_ERR("sensor_channel_get failed ret %d", ret);
-	// 	return -1;
-	// }
+		if (!atomic_get(&suspended)) {
+			k_sleep(K_MSEC(app_config_get(APP_CONFIG_ENV_INTERVAL_MS)));
+		} else if (idle_env_interval_ms > 0) {
+			k_sleep(K_MSEC(idle_env_interval_ms));
+		} else {
+			// Parked until sensors_resume()
+			k_sem_take(&gas_resume_sem, K_FOREVER);
+		}
+	}
+}
 
-	// current_time = k_cycle_get_32();
-	// diff = current_time - measure_start_time;
-	// LOG_INF("BME680: %d us", k_cyc_to_us_floor32(diff));
+/**
+ * @brief Meassure the sensor data
+ *
+ * @param sample Pointer to the sample. The timestamp is the uptime in microseconds when the
+ *               measurement started, the data array holds the channels of sensor_channels.h,
+ *               with the BMI270 turned to the orientation of the thingy.
+ *
+ * All values are in SI units.
+ *      Acceleration in m/s^2
+ *      Gyroscope in rad/s
+ *      Temperature in Celsius
+ *      Pressure in kPa
+ *      Humidity in %
+ *      Gas resistance in Ohm
+ *      Magnetometer in uT // NOTE: The bmm350 device have no zephyr drivers yet, never measured
+ *
+ * The valid field flags the channels that were measured. Channels of suspended, unsubscribed or
+ * failing devices are 0 and not flagged.
+ *
+ * @return 0 if at least one channel is valid, negative error code otherwise.
+ */
+int sensor_measure(struct sensor_sample *sample)
+{
+	int ret;
+	timing_t span;
 
-	// NOTE: The bmm350 device have no zephyr drivers yet
-	////////////////////BMM350//////////////////////
-	// LOG_DBG("BMM350");
-	// ret = sensor_sample_fetch(dev_bmm350);
-	// if(ret) {
-	//     LOG_ERR("sensor_sample_fetch failed ret %d", ret);
-	//     return -1;
-	// }
+	// Monotonic 64-bit timestamp, does not wrap like k_cycle_get_32()
+	sample->timestamp_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	sample->valid = 0;
+	memset(sample->data, 0, sizeof(sample->data));
 
-	// ret = sensor_channel_get(dev_bmm350, SENSOR_CHAN_MAGN_XYZ, mag);
-	// if(ret) {
-	//     LOG_ERR("sensor_channel_get failed ret %d", ret);
-	//     return -1;
-	// }
+	// A failing device only invalidates its own channels, see the supervisor
+
+	//////////////////////BMI270//////////////////////
+	if (!atomic_get(&suspended) && sensor_health_ready(METRICS_DEV_BMI270)) {
+		LOG_DBG("BMI270");
+		k_mutex_lock(&imu_lock, K_FOREVER);
+		span = profiler_span_begin();
+		ret = sensor_sample_fetch(dev_bmi270);
+		profiler_span_end(PROFILER_SPAN_FETCH_BMI270, span);
+		if (ret == 0) {
+			ret = sensors_read_channels(dev_bmi270, bmi270_channels,
+						    ARRAY_SIZE(bmi270_channels), sample->data);
+		}
+		k_mutex_unlock(&imu_lock);
+		sensor_health_report(METRICS_DEV_BMI270, ret);
+
+		if (ret == 0) {
+			sample->valid |= SENSORS_VALID_BMI270;
+		}
+	}
+
+	//////////////////////ADXL367/////////////////////
+	if (ARRAY_SIZE(adxl367_channels) > 0 && atomic_get(&adxl367_subscribers) > 0 &&
+	    sensor_health_ready(METRICS_DEV_ADXL367)) {
+		LOG_DBG("ADXL367");
+		k_mutex_lock(&imu_lock, K_FOREVER);
+		span = profiler_span_begin();
+		ret = sensor_sample_fetch(dev_adxl367);
+		profiler_span_end(PROFILER_SPAN_FETCH_ADXL367, span);
+		if (ret == 0) {
+			ret = sensors_read_channels(dev_adxl367, adxl367_channels,
+						    ARRAY_SIZE(adxl367_channels), sample->data);
+		}
+		k_mutex_unlock(&imu_lock);
+		sensor_health_report(METRICS_DEV_ADXL367, ret);
+
+		if (ret == 0) {
+			sample->valid |= SENSORS_VALID_ADXL367;
+		}
+	}
+
+	//////////////////////BME680//////////////////////
+	// Measured by the gas thread
+	K_SPINLOCK(&env_lock) {
+		if (env_valid) {
+			for (int i = 0; i < ARRAY_SIZE(bme680_channels); i++) {
+				sample->data[bme680_channels[i].index] =
+					env_data[bme680_channels[i].index];
+			}
+			sample->valid |= SENSORS_VALID_BME680;
+		}
+	}
+
+	// NOTE: The bmm350 device have no zephyr drivers yet, its channels stay 0 and invalid
 
 	LOG_DBG("Sensor data fetched");
-	float32_t runtime = (float32_t)k_cycle_get_32() / (float32_t)sys_clock_hw_cycles_per_sec();
-
-	// LOG_INF("Runtime: %f", runtime);
-
-	//////////////////////Set output//////////////////////
-	LOG_DBG("Set output");
-	data[0] = runtime;
-	data[1] = sensor_value_to_double(&accel0[0]);
-	data[2] = sensor_value_to_double(&accel0[1]);
-	data[3] = sensor_value_to_double(&accel0[2]);
-	data[4] = sensor_value_to_double(&gyr[0]);
-	data[5] = sensor_value_to_double(&gyr[1]);
-	data[6] = sensor_value_to_double(&gyr[2]);
-	data[7] = sensor_value_to_double(&accel1[0]);
-	data[8] = sensor_value_to_double(&accel1[1]);
-	data[9] = sensor_value_to_double(&accel1[2]);
-	data[10] = sensor_value_to_double(&temp);
-	data[11] = sensor_value_to_double(&press);
-	data[12] = sensor_value_to_double(&hum);
-	data[13] = sensor_value_to_double(&gas);
-	// data[14] = sensor_value_to_double(&mag[0]);
-	// data[15] = sensor_value_to_double(&mag[1]);
-	// data[16] = sensor_value_to_double(&mag[2]);
-	data[14] = 0.0;
-	data[15] = 0.0;
-	data[16] = 0.0;
 
-	return 0;
+	return sample->valid ? 0 : -EIO;
 }
 
+// The JSON frame is generated from the channel table, a disabled channel is not in the format
+#define SENSOR_CH_JSON_FORMAT(_id, _name, _unit, _chan, _sign, _prec, _step)                       \
+	",\"" #_name "\":%." #_prec "f"
+#define SENSOR_CH_JSON_ARG(_id, ...) , data[SENSOR_CH_##_id]
+
 /**
- * @brief Get the sensor data as a JSON string
+ * @brief Render a sample as a JSON string
  *      The JSON string will look like this:
- *      { "timestamp": 0.0, "bmi270_ax": 0.0, "bmi270_ay": 0.0, "bmi270_az": 0.0, "bmi270_gx": 0.0,
+ *      { "ts": 0, "tx": 0, "valid": 0, "bmi270_ax": 0.0, "bmi270_ay": 0.0, "bmi270_az": 0.0, "bmi270_gx": 0.0,
  *      "bmi270_gy": 0.0, "bmi270_gz": 0.0, "adxl_ax": 0.0, "adxl_ay": 0.0, "adxl_az": 0.0,
  *      "bme680_temperature": 0.0, "bme680_pressure": 0.0, "bme680_humidity": 0.0, "bme680_gas":
- * 0.0, "bmm350_magn_x": 0.0, "bmm350_magn_y": 0.0, "bmm350_magn_z": 0.0 }
+ * 0.0 }, with a value for every channel of sensor_channels.h.
  *
+ *      "ts" is the device uptime in microseconds when the sample was taken and "tx" when the
+ *      frame was serialized for sending. Bit n of "valid" is set if the n-th value was measured,
+ *      in the order of GET /schema.
+ *
+ * @param sample Sample to render
  * @param buf Pointer to the buffer
  * @param len Length of the buffer
- * @return int Length of the JSON string if successful, negative error code otherwise.
+ * @return int Length of the JSON string if successful, -ENOSPC if it does not fit.
  */
-int sensors_get_json(char *buf, size_t len)
+int sensors_sample_to_json(const struct sensor_sample *sample, char *buf, size_t len)
 {
 	int ret;
 
 	const char *sensors_json_template = "{"
-					    "\"timestamp\":%.06f,"
-					    "\"bmi270_ax\":%.06f,"
-					    "\"bmi270_ay\":%.06f,"
-					    "\"bmi270_az\":%.06f,"
-					    "\"bmi270_gx\":%.06f,"
-					    "\"bmi270_gy\":%.06f,"
-					    "\"bmi270_gz\":%.06f,"
-					    "\"adxl_ax\":%.06f,"
-					    "\"adxl_ay\":%.06f,"
-					    "\"adxl_az\":%.06f,"
-					    "\"bme680_temperature\":%.03f,"
-					    "\"bme680_pressure\":%.03f,"
-					    "\"bme680_humidity\":%.03f,"
-					    "\"bme680_gas\":%.03f,"
-					    "\"bmm350_magn_x\":%.03f,"
-					    "\"bmm350_magn_y\":%.03f,"
-					    "\"bmm350_magn_z\":%.03f"
-					    "}";
-
-	LOG_DBG("Getting sensor data");
-
-	double data[NUM_SENSOR_MEASUREMENTS];
-	ret = sensor_measure(data);
-	if (ret) {
-		LOG_ERR("sensor_measure failed ret %d", ret);
-		return ret;
-	}
+					    "\"ts\":%lld,"
+					    "\"tx\":%lld,"
+					    "\"valid\":%u" SENSOR_CHANNELS(SENSOR_CH_JSON_FORMAT) "}";
 
-	LOG_DBG("Got sensor data");
+	const double *data = sample->data;
+	int64_t tx_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	timing_t span = profiler_span_begin();
 
-	ret = snprintf(buf, len, sensors_json_template, data[0], data[1], data[2], data[3], data[4],
-		       data[5], data[6], data[7], data[8], data[9], data[10], data[11], data[12],
-		       data[13], data[14], data[15], data[16]);
+	ret = snprintf(buf, len, sensors_json_template, sample->timestamp_us, tx_us,
+		       sample->valid SENSOR_CHANNELS(SENSOR_CH_JSON_ARG));
+	profiler_span_end(PROFILER_SPAN_SERIALIZE, span);
 
 	LOG_DBG("JSON-ified sensor data");
 	// LOG_INF("JSON: %s", buf);
@@ -420,4 +914,145 @@ int sensors_get_json(char *buf, size_t len)
 	}
 
 	return ret;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Render a sample as an entry of a websocket batch
+ *      {"dt":0,"valid":0,"bmi270_ax":0.0,...}, with the channels of sensors_sample_to_json().
+ *      "dt" is the timestamp of the sample in microseconds after the "ts" of the batch.
+ *
+ * @param sample Sample to render
+ * @param base_us Timestamp of the batch
+ * @param buf Pointer to the buffer
+ * @param len Length of the buffer
+ * @return int Length of the JSON string if successful, -ENOSPC if it does not fit.
+ */
+int sensors_sample_to_batch_json(const struct sensor_sample *sample, int64_t base_us, char *buf,
+				 size_t len)
+{
+	int ret;
+
+	const char *entry_json_template = "{"
+					  "\"dt\":%u,"
+					  "\"valid\":%u" SENSOR_CHANNELS(SENSOR_CH_JSON_FORMAT) "}";
+
+	const double *data = sample->data;
+	timing_t span = profiler_span_begin();
+
+	ret = snprintf(buf, len, entry_json_template, (uint32_t)(sample->timestamp_us - base_us),
+		       sample->valid SENSOR_CHANNELS(SENSOR_CH_JSON_ARG));
+	profiler_span_end(PROFILER_SPAN_SERIALIZE, span);
+
+	if (ret >= len) {
+		return -ENOSPC;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Render a sample as a binary frame, see struct sensor_frame.
+ *
+ * @param sample Sample to render
+ * @param seq Sequence number of the frame
+ * @param frame Frame to fill
+ */
+void sensors_sample_to_frame(const struct sensor_sample *sample, uint32_t seq,
+			     struct sensor_frame *frame)
+{
+	frame->magic = sys_cpu_to_le16(SENSOR_FRAME_MAGIC);
+	frame->version = SENSOR_FRAME_VERSION;
+	frame->channels = NUM_SENSOR_MEASUREMENTS;
+	frame->seq = sys_cpu_to_le32(seq);
+	frame->ts_us = sys_cpu_to_le64(sample->timestamp_us);
+	frame->valid = sys_cpu_to_le32(sample->valid);
+
+	for (int i = 0; i < NUM_SENSOR_MEASUREMENTS; i++) {
+		frame->data[i] = (float)sample->data[i];
+	}
+}
+
+/**
+ * @brief Get the latest sample as a JSON string, see sensors_sample_to_json().
+ *
+ * @return int Length of the JSON string if successful, -ENODATA if no sample has been taken yet,
+ *         negative error code otherwise.
+ */
+int sensors_get_json(char *buf, size_t len)
+{
+	struct sensor_sample sample;
+	int ret;
+
+	ret = sensors_get_latest(&sample);
+	if (ret) {
+		return ret;
+	}
+
+	return sensors_sample_to_json(&sample, buf, len);
+}
+
+/**
+ * @brief Serve the channels of the frames on GET /schema.
+ *
+ * {"frame_version":2,"channels":[{"name":"bmi270_ax","unit":"m/s^2","precision":6,"step":0.01},
+ * ...]}, the n-th channel is the n-th value of the frames and bit n of "valid". "step" is the
+ * resolution of the channel in the delta encoded stream. The response is sent in chunks, one
+ * channel at a time.
+ */
+/* State of a GET request */
+struct sensors_schema_request {
+	int sent; // Chunks sent
+};
+
+HTTP_REQ_POOL_DEFINE(sensors_schema_http_reqs, struct sensors_schema_request);
+
+int sensors_schema_handler(struct http_client_ctx *client, enum http_data_status status,
+			   uint8_t *buffer, size_t len, void *user_data)
+{
+	ARG_UNUSED(client);
+	ARG_UNUSED(len);
+
+	struct sensors_schema_request *req = user_data;
+	// The next chunk, -1 for the start of the object and SENSOR_CH_COUNT for its end
+	int next = req->sent - 1;
+	char *buf = (char *)buffer;
+	int ret;
+
+	switch (status) {
+	case HTTP_SERVER_DATA_ABORTED: {
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_MORE: {
+		/* A payload is not expected with the GET request */
+		return 0;
+	}
+
+	case HTTP_SERVER_DATA_FINAL: {
+		if (next < 0) {
+			ret = snprintf(buf, SCHEMA_BUF_LEN, "{\"frame_version\":%d,\"channels\":[",
+				       SENSOR_FRAME_VERSION);
+		} else if (next < SENSOR_CH_COUNT) {
+			ret = snprintf(buf, SCHEMA_BUF_LEN,
+				       "%s{\"name\":\"%s\",\"unit\":\"%s\",\"precision\":%u,"
+				       "\"step\":%g}",
+				       next > 0 ? "," : "", channel_info[next].name,
+				       channel_info[next].unit, channel_info[next].precision,
+				       channel_info[next].step);
+		} else if (next == SENSOR_CH_COUNT) {
+			ret = snprintf(buf, SCHEMA_BUF_LEN, "]}");
+		} else {
+			/* Response complete, return 0 to end the chunked transfer */
+			return 0;
+		}
+
+		req->sent++;
+
+		return MIN(ret, SCHEMA_BUF_LEN - 1);
+	}
+	default: {
+		LOG_WRN("Unexpected status %d", status);
+		return -1;
+	}
+	}
+}
@@ -3,15 +3,87 @@
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/net/http/server.h>
 #include <math.h>
 
+#include "metrics.h"
+#include "sensor_channels.h"
+
 #define GRAVITY 9.80665
 #define PI      3.14159265359
 
-// Number of sensor measurements (timestamp, 6x bmi270, 3x adxl367, 4x bme680, 3x bmm350)
-#define NUM_SENSOR_MEASUREMENTS 17
+// Number of sensor measurements, the enabled channels of sensor_channels.h
+#define NUM_SENSOR_MEASUREMENTS SENSOR_CH_COUNT
+
+struct sensor_sample {
+	int64_t timestamp_us; // Uptime in microseconds when the sample was taken
+	uint32_t valid;       // Bit n is set if data[n] was measured
+	double data[NUM_SENSOR_MEASUREMENTS];
+};
+
+/**
+ * @brief Binary sensor frame, little endian, as sent by the UDP publisher.
+ *
+ * The values are in the order of sensor_channels.h, with the units of the JSON frames. Which
+ * channels a build has is served on GET /schema.
+ */
+struct sensor_frame {
+	uint16_t magic;   // SENSOR_FRAME_MAGIC
+	uint8_t version;  // SENSOR_FRAME_VERSION
+	uint8_t channels; // Number of values in data[]
+	uint32_t seq;     // Incremented for every sample, a gap shows a lost frame
+	int64_t ts_us;    // Uptime in microseconds when the sample was taken
+	uint32_t valid;   // Bit n is set if data[n] was measured
+	float data[NUM_SENSOR_MEASUREMENTS];
+} __packed;
+
+#define SENSOR_FRAME_MAGIC   0x5354 // "TS"
+#define SENSOR_FRAME_VERSION 2
+
+/**
+ * @brief Consumer of the samples taken by the acquisition thread.
+ *
+ * The callback runs in the acquisition thread for every sample and must not block.
+ */
+struct sensors_listener {
+	sys_snode_t node;
+	void (*on_sample)(const struct sensor_sample *sample);
+};
+
+/* Rates the IMU sampler polls at, and the default output data rates of app_config.h */
+#define SENSORS_BMI270_RATE_HZ  200
+#define SENSORS_ADXL367_RATE_HZ 100
+
+enum imu_source {
+	IMU_SOURCE_BMI270,
+	IMU_SOURCE_ADXL367,
+};
+
+struct imu_sample {
+	int64_t timestamp_us;
+	enum imu_source source;
+	float data[6]; // Acceleration xyz in m/s^2, then gyroscope xyz in rad/s for the BMI270
+};
 
 int sensors_init(void);
-int sensors_measure(void);
+void sensors_set_interval(int interval_ms);
+int sensors_suspend(int acq_interval_ms, int env_interval_ms);
+int sensors_resume(int warmup_ms);
+int sensors_reconfigure(enum metrics_sensor_dev id);
+void sensors_wake(void);
+uint32_t sensors_env_measurements(void);
+void sensors_adxl367_subscribe(void);
+void sensors_adxl367_unsubscribe(void);
+int sensors_fetch_imu(enum imu_source source, struct imu_sample *sample);
+void sensors_add_listener(struct sensors_listener *listener);
+int sensors_get_latest(struct sensor_sample *sample);
+int sensor_measure(struct sensor_sample *sample);
+int sensors_sample_to_json(const struct sensor_sample *sample, char *buf, size_t len);
+int sensors_sample_to_batch_json(const struct sensor_sample *sample, int64_t base_us, char *buf,
+				 size_t len);
+void sensors_sample_to_frame(const struct sensor_sample *sample, uint32_t seq,
+			     struct sensor_frame *frame);
 int sensors_get_json(char *buf, size_t len);
-int sensor_rotate_measurement(struct sensor_value *data, int x, int y, int z);
\ No newline at end of file
+int sensors_schema_handler(struct http_client_ctx *client, enum http_data_status status,
+			   uint8_t *buffer, size_t len, void *user_data);
+extern struct http_req_pool sensors_schema_http_reqs;
@@ -0,0 +1,407 @@
+#include "spectrum.h"
+#include "imu.h"
+#include "profiler.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/sys/atomic.h>
+
+#if defined(CONFIG_CMSIS_DSP_TRANSFORM)
+#include <arm_math.h>
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(SPECTRUM, CONFIG_SPECTRUM_LOG_LEVEL);
+
+// Vibration spectrum of the BMI270 acceleration. The IMU listener keeps the magnitude of the
+// acceleration vector in a ring, and every hop it copies the last SPECTRUM_SIZE samples out and
+// submits a work item. The work removes the mean, applies a Hann window, runs a real FFT and sends
+// the amplitude spectrum and its strongest peaks to the frame callback as JSON. A frame at 50 %
+// overlap is a few hundred bytes every 0.64 s, against 200 raw samples per second.
+
+#define SPECTRUM_SIZE CONFIG_APP_SPECTRUM_SIZE
+#define SPECTRUM_BINS (SPECTRUM_SIZE / 2 + 1)
+#define SPECTRUM_HOP  (SPECTRUM_SIZE * (100 - CONFIG_APP_SPECTRUM_OVERLAP_PERCENT) / 100)
+#define SPECTRUM_DF   ((float)SENSORS_BMI270_RATE_HZ / SPECTRUM_SIZE)
+
+BUILD_ASSERT(IS_POWER_OF_TWO(SPECTRUM_SIZE), "The FFT size must be a power of two");
+BUILD_ASSERT(SPECTRUM_HOP > 0, "The overlap must leave a hop of at least one sample");
+
+static spectrum_frame_cb_t frame_cb;
+static atomic_t subscribers;
+
+// Ring of acceleration magnitudes, written by the IMU thread only
+static float ring[SPECTRUM_SIZE];
+static uint32_t ring_pos;
+static uint32_t since_last;
+
+// Input of the work, only written by the listener while the work is not busy
+static float frame_in[SPECTRUM_SIZE];
+static int64_t frame_ts_us;
+static atomic_t frame_busy;
+static atomic_t frames_skipped;
+
+static float window[SPECTRUM_SIZE];
+static float window_gain; // Sum of the window, to scale the FFT to amplitudes
+static float fft_out[SPECTRUM_SIZE];
+static float magnitude[SPECTRUM_BINS];
+
+#if CONFIG_APP_SPECTRUM_LOG_BINS > 0
+static uint16_t log_edges[CONFIG_APP_SPECTRUM_LOG_BINS + 1];
+#endif
+
+static char frame_json[CONFIG_APP_SPECTRUM_FRAME_SIZE];
+
+static void spectrum_work_handler(struct k_work *work);
+static K_WORK_DEFINE(spectrum_work, spectrum_work_handler);
+
+////////////////////////////////////////// FFT ////////////////////////////////////////////
+
+#if defined(CONFIG_CMSIS_DSP_TRANSFORM)
+
+static arm_rfft_fast_instance_f32 rfft;
+
+static void fft_init(void)
+{
+	arm_rfft_fast_init_f32(&rfft, SPECTRUM_SIZE);
+}
+
+/* Real FFT, in is clobbered. out holds [re(0), re(N/2), re(1), im(1), ..., re(N/2-1), im(N/2-1)] */
+static void fft_real(float *in, float *out)
+{
+	arm_rfft_fast_f32(&rfft, in, out, 0);
+}
+
+#else
+
+// Portable radix-2 fallback for targets without CMSIS-DSP, such as native_sim. The N point real
+// FFT is computed as an N/2 point complex FFT of the even and odd samples, followed by the split
+// step, and returns the same packed layout as arm_rfft_fast_f32().
+
+#define HALF_SIZE (SPECTRUM_SIZE / 2)
+
+static float twiddle_re[HALF_SIZE];
+static float twiddle_im[HALF_SIZE];
+
+static void fft_init(void)
+{
+	for (int k = 0; k < HALF_SIZE; k++) {
+		twiddle_re[k] = cosf(2.0f * (float)PI * k / SPECTRUM_SIZE);
+		twiddle_im[k] = -sinf(2.0f * (float)PI * k / SPECTRUM_SIZE);
+	}
+}
+
+/* In place complex FFT of HALF_SIZE points stored as interleaved re, im */
+static void fft_complex(float *z)
+{
+	// Bit reversal permutation
+	for (uint32_t i = 1, j = 0; i < HALF_SIZE; i++) {
+		uint32_t bit = HALF_SIZE >> 1;
+
+		for (; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+
+		if (i < j) {
+			float re = z[2 * i];
+			float im = z[2 * i + 1];
+
+			z[2 * i] = z[2 * j];
+			z[2 * i + 1] = z[2 * j + 1];
+			z[2 * j] = re;
+			z[2 * j + 1] = im;
+		}
+	}
+
+	for (uint32_t len = 2; len <= HALF_SIZE; len <<= 1) {
+		// The HALF_SIZE point twiddles are every second of the N point ones
+		uint32_t step = SPECTRUM_SIZE / len;
+
+		for (uint32_t i = 0; i < HALF_SIZE; i += len) {
+			for (uint32_t k = 0; k < len / 2; k++) {
+				float w_re = twiddle_re[k * step];
+				float w_im = twiddle_im[k * step];
+				float *a = &z[2 * (i + k)];
+				float *b = &z[2 * (i + k + len / 2)];
+				float t_re = b[0] * w_re - b[1] * w_im;
+				float t_im = b[0] * w_im + b[1] * w_re;
+
+				b[0] = a[0] - t_re;
+				b[1] = a[1] - t_im;
+				a[0] += t_re;
+				a[1] += t_im;
+			}
+		}
+	}
+}
+
+static void fft_real(float *in, float *out)
+{
+	// Interpreting the real input as HALF_SIZE complex values packs the even samples into re
+	// and the odd samples into im
+	fft_complex(in);
+
+	out[0] = in[0] + in[1];
+	out[1] = in[0] - in[1];
+
+	for (int k = 1; k < HALF_SIZE; k++) {
+		float zk_re = in[2 * k];
+		float zk_im = in[2 * k + 1];
+		float zn_re = in[2 * (HALF_SIZE - k)];
+		float zn_im = -in[2 * (HALF_SIZE - k) + 1];
+
+		// Even and odd parts
+		float e_re = 0.5f * (zk_re + zn_re);
+		float e_im = 0.5f * (zk_im + zn_im);
+		float o_re = 0.5f * (zk_im - zn_im);
+		float o_im = -0.5f * (zk_re - zn_re);
+
+		out[2 * k] = e_re + twiddle_re[k] * o_re - twiddle_im[k] * o_im;
+		out[2 * k + 1] = e_im + twiddle_re[k] * o_im + twiddle_im[k] * o_re;
+	}
+}
+
+#endif // CONFIG_CMSIS_DSP_TRANSFORM
+
+////////////////////////////////////////// Spectrum ////////////////////////////////////////////
+
+struct spectrum_peak {
+	float frequency;
+	float amplitude;
+};
+
+static void compute_magnitude(void)
+{
+	float mean = 0.0f;
+
+	for (int i = 0; i < SPECTRUM_SIZE; i++) {
+		mean += frame_in[i];
+	}
+	mean /= SPECTRUM_SIZE;
+
+	for (int i = 0; i < SPECTRUM_SIZE; i++) {
+		frame_in[i] = (frame_in[i] - mean) * window[i];
+	}
+
+	fft_real(frame_in, fft_out);
+
+	// Single sided amplitude spectrum in m/s^2
+	magnitude[0] = fabsf(fft_out[0]) / window_gain;
+	magnitude[SPECTRUM_BINS - 1] = fabsf(fft_out[1]) / window_gain;
+	for (int k = 1; k < SPECTRUM_BINS - 1; k++) {
+		float re = fft_out[2 * k];
+		float im = fft_out[2 * k + 1];
+
+		magnitude[k] = 2.0f * sqrtf(re * re + im * im) / window_gain;
+	}
+}
+
+/* Find the strongest local maxima, with the frequency refined by a parabola through 3 bins */
+static int find_peaks(struct spectrum_peak *peaks, int max_peaks)
+{
+	int count = 0;
+
+	for (int k = 1; k < SPECTRUM_BINS - 1; k++) {
+		float a = magnitude[k - 1];
+		float b = magnitude[k];
+		float c = magnitude[k + 1];
+		int pos;
+
+		if (b <= a || b < c) {
+			continue;
+		}
+
+		// Insertion into the list sorted by amplitude
+		for (pos = count; pos > 0 && peaks[pos - 1].amplitude < b; pos--) {
+			if (pos < max_peaks) {
+				peaks[pos] = peaks[pos - 1];
+			}
+		}
+
+		if (pos >= max_peaks) {
+			continue;
+		}
+
+		float denom = a - 2.0f * b + c;
+		float offset = denom != 0.0f ? 0.5f * (a - c) / denom : 0.0f;
+
+		peaks[pos].frequency = (k + offset) * SPECTRUM_DF;
+		peaks[pos].amplitude = b - 0.25f * (a - c) * offset;
+		count = MIN(count + 1, max_peaks);
+	}
+
+	return count;
+}
+
+/* Append to the frame, returns false when it is full */
+static bool frame_append(size_t *off, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	va_start(args, fmt);
+	ret = vsnprintf(frame_json + *off, sizeof(frame_json) - *off, fmt, args);
+	va_end(args);
+
+	if (ret < 0 || *off + ret >= sizeof(frame_json)) {
+		return false;
+	}
+
+	*off += ret;
+
+	return true;
+}
+
+/* Render the frame, {"spectrum":[...],"ts":<us>,"df":<Hz>,"peaks":[[Hz,m/s^2],...]} */
+static int render_frame(const struct spectrum_peak *peaks, int num_peaks)
+{
+	size_t off = 0;
+	bool ok = frame_append(&off, "{\"spectrum\":[");
+
+#if CONFIG_APP_SPECTRUM_LOG_BINS > 0
+	// Logarithmic bins keep the maximum of their linear bins, so narrow peaks survive
+	for (int b = 0; ok && b < CONFIG_APP_SPECTRUM_LOG_BINS; b++) {
+		float max = 0.0f;
+
+		for (int k = log_edges[b]; k < log_edges[b + 1]; k++) {
+			max = MAX(max, magnitude[k]);
+		}
+		ok = frame_append(&off, "%s%.4f", b ? "," : "", (double)max);
+	}
+
+	ok = ok && frame_append(&off, "],\"f\":[");
+	for (int b = 0; ok && b < CONFIG_APP_SPECTRUM_LOG_BINS; b++) {
+		// Geometric centre of the bin
+		float f = sqrtf((float)log_edges[b] * (log_edges[b + 1] - 1)) * SPECTRUM_DF;
+
+		ok = frame_append(&off, "%s%.2f", b ? "," : "", (double)f);
+	}
+#else
+	for (int k = 0; ok && k < SPECTRUM_BINS; k++) {
+		ok = frame_append(&off, "%s%.4f", k ? "," : "", (double)magnitude[k]);
+	}
+#endif
+
+	ok = ok && frame_append(&off, "],\"ts\":%lld,\"df\":%.4f,\"peaks\":[", frame_ts_us,
+				(double)SPECTRUM_DF);
+	for (int i = 0; ok && i < num_peaks; i++) {
+		ok = frame_append(&off, "%s[%.2f,%.4f]", i ? "," : "", (double)peaks[i].frequency,
+				  (double)peaks[i].amplitude);
+	}
+	ok = ok && frame_append(&off, "]}");
+
+	if (!ok) {
+		LOG_ERR("Spectrum frame does not fit in %zu bytes", sizeof(frame_json));
+		return -ENOSPC;
+	}
+
+	return off;
+}
+
+static void spectrum_work_handler(struct k_work *work)
+{
+	struct spectrum_peak peaks[CONFIG_APP_SPECTRUM_PEAKS];
+	int num_peaks;
+	int ret;
+
+	timing_t span = profiler_span_begin();
+
+	compute_magnitude();
+	num_peaks = find_peaks(peaks, ARRAY_SIZE(peaks));
+	ret = render_frame(peaks, num_peaks);
+
+	profiler_span_end(PROFILER_SPAN_SPECTRUM, span);
+
+	// The input may be overwritten from here on
+	atomic_clear(&frame_busy);
+
+	if (ret > 0 && frame_cb != NULL) {
+		frame_cb(frame_json, ret);
+	}
+}
+
+static void spectrum_on_sample(const struct imu_sample *sample)
+{
+	if (sample->source != IMU_SOURCE_BMI270) {
+		return;
+	}
+
+	ring[ring_pos] = sqrtf(sample->data[0] * sample->data[0] +
+			       sample->data[1] * sample->data[1] +
+			       sample->data[2] * sample->data[2]);
+	ring_pos = (ring_pos + 1) % SPECTRUM_SIZE;
+
+	if (++since_last < SPECTRUM_HOP) {
+		return;
+	}
+	since_last = 0;
+
+	if (!atomic_cas(&frame_busy, 0, 1)) {
+		// The previous spectrum is still being computed or sent
+		atomic_inc(&frames_skipped);
+		return;
+	}
+
+	// Oldest sample first
+	memcpy(frame_in, &ring[ring_pos], (SPECTRUM_SIZE - ring_pos) * sizeof(float));
+	memcpy(&frame_in[SPECTRUM_SIZE - ring_pos], ring, ring_pos * sizeof(float));
+	frame_ts_us = sample->timestamp_us;
+
+	k_work_submit(&spectrum_work);
+}
+
+static struct imu_listener spectrum_listener = {
+	.on_sample = spectrum_on_sample,
+};
+
+void spectrum_set_frame_cb(spectrum_frame_cb_t cb)
+{
+	frame_cb = cb;
+}
+
+void spectrum_subscribe(void)
+{
+	if (atomic_inc(&subscribers) == 0) {
+		LOG_INF("Spectrum started");
+		imu_add_listener(&spectrum_listener);
+	}
+}
+
+void spectrum_unsubscribe(void)
+{
+	if (atomic_dec(&subscribers) == 1) {
+		imu_remove_listener(&spectrum_listener);
+		LOG_INF("Spectrum stopped, %u frames skipped", (uint32_t)atomic_get(&frames_skipped));
+	}
+}
+
+static int spectrum_init(void)
+{
+	window_gain = 0.0f;
+	for (int i = 0; i < SPECTRUM_SIZE; i++) {
+		window[i] = 0.5f - 0.5f * cosf(2.0f * (float)PI * i / SPECTRUM_SIZE);
+		window_gain += window[i];
+	}
+
+#if CONFIG_APP_SPECTRUM_LOG_BINS > 0
+	// Geometric bin edges from the first bin above DC to Nyquist, at least one bin wide
+	float ratio = powf(SPECTRUM_BINS - 1, 1.0f / CONFIG_APP_SPECTRUM_LOG_BINS);
+
+	log_edges[0] = 1;
+	for (int b = 1; b <= CONFIG_APP_SPECTRUM_LOG_BINS; b++) {
+		uint16_t edge = (uint16_t)roundf(powf(ratio, b));
+
+		log_edges[b] = CLAMP(edge, log_edges[b - 1] + 1, SPECTRUM_BINS);
+	}
+	log_edges[CONFIG_APP_SPECTRUM_LOG_BINS] = SPECTRUM_BINS;
+#endif
+
+	fft_init();
+
+	return 0;
+}
+SYS_INIT(spectrum_init, APPLICATION, 0);
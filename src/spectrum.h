@@ -0,0 +1,21 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Called with every new spectrum frame, as a JSON string.
+ *
+ * Runs on the system work queue, the buffer may be reused once the callback returns.
+ */
+typedef void (*spectrum_frame_cb_t)(const char *json, size_t len);
+
+void spectrum_set_frame_cb(spectrum_frame_cb_t cb);
+
+/**
+ * @brief Start computing spectra, for one more subscriber.
+ *
+ * The spectrum is only computed while it has subscribers, and each call must be paired with
+ * spectrum_unsubscribe().
+ */
+void spectrum_subscribe(void);
+void spectrum_unsubscribe(void);
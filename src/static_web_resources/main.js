@@ -152,6 +152,35 @@ let gyro0_chart = new Highcharts.Chart({
     }
 });
 
+let spectrum_chart = new Highcharts.Chart({
+    accessibility: {
+        enabled: false
+    },
+    chart: {
+        renderTo: 'chart_spectrum',
+        animation: false
+    },
+    title: {
+        text: 'Acceleration spectrum'
+    },
+    series: [{
+        name: 'Amplitude',
+        color: 'purple',
+        data: [],
+        marker: { enabled: false }
+    }],
+    xAxis: {
+        title: {
+            text: 'Frequency (Hz)'
+        }
+    },
+    yAxis: {
+        title: {
+            text: 'Amplitude (m/s^2)'
+        }
+    }
+});
+
 // NOTE: bmm350 is not plotted as it has no drivers in zephyr yet
 // let mag0_chart = new Highcharts.Chart({
 //     chart: {
@@ -288,354 +317,194 @@ let press_chart = new Highcharts.Chart({
 //     }
 // });
 
-function updatePlots(data) {
-    // let x = (new Date()).getTime();
-    let x = parseFloat(data.timestamp);
-    let y = parseFloat(data.bmi270_ax);
-    if (accel0_chart.series[0].data.length > 100) {
-        accel0_chart.series[0].addPoint([x, y], true, true, false);
-    } else {
-        accel0_chart.series[0].addPoint([x, y], true, false, false);
-    }
-    y = parseFloat(data.bmi270_ay);
-    if (accel0_chart.series[1].data.length > 100) {
-        accel0_chart.series[1].addPoint([x, y], true, true, false);
-    } else {
-        accel0_chart.series[1].addPoint([x, y], true, false, false);
-    }
-    y = parseFloat(data.bmi270_az);
-    if (accel0_chart.series[2].data.length > 100) {
-        accel0_chart.series[2].addPoint([x, y], true, true, false);
-    } else {
-        accel0_chart.series[2].addPoint([x, y], true, false, false);
-    }
-
-    //NOTE: The accelerometer ADXL367 is not plotted in the web interface as this is the same data as the BMI270
-    // y = parseFloat(data.adxl_ax);
-    // if (accel1_chart.series[0].data.length > 1000) {
-    //     accel1_chart.series[0].addPoint([x, y], true, true, false);
-    // } else {
-    //     accel1_chart.series[0].addPoint([x, y], true, false, false);
-    // }
-    // y = parseFloat(data.adxl_ay);
-    // if (accel1_chart.series[1].data.length > 1000) {
-    //     accel1_chart.series[1].addPoint([x, y], true, true, false);
-    // } else {
-    //     accel1_chart.series[1].addPoint([x, y], true, false, false);
-    // }
-    // y = parseFloat(data.adxl_az);
-    // if (accel1_chart.series[2].data.length > 1000) {
-    //     accel1_chart.series[2].addPoint([x, y], true, true, false);
-    // } else {
-    //     accel1_chart.series[2].addPoint([x, y], true, false, false);
-    // }
-
-    y = parseFloat(data.bmi270_gx);
-    if (gyro0_chart.series[0].data.length > 100) {
-        gyro0_chart.series[0].addPoint([x, y], true, true, false);
-    } else {
-        gyro0_chart.series[0].addPoint([x, y], true, false, false);
-    }
-    y = parseFloat(data.bmi270_gy);
-    if (gyro0_chart.series[1].data.length > 100) {
-        gyro0_chart.series[1].addPoint([x, y], true, true, false);
-    } else {
-        gyro0_chart.series[1].addPoint([x, y], true, false, false);
-    }
-    y = parseFloat(data.bmi270_gz);
-    if (gyro0_chart.series[2].data.length > 100) {
-        gyro0_chart.series[2].addPoint([x, y], true, true, false);
-    } else {
-        gyro0_chart.series[2].addPoint([x, y], true, false, false);
-    }
+////////////////////////////////////////////////////////////////
+// Chart rendering
+////////////////////////////////////////////////////////////////
 
-    //NOTE: bmm350 is not plotted as it has no drivers in zephyr yet
-    // y = parseFloat(data.bmm350_magn_x);
-    // if (mag0_chart.series[0].data.length > 100) {
-    //     mag0_chart.series[0].addPoint([x, y], true, true, false);
-    // } else {
-    //     mag0_chart.series[0].addPoint([x, y], true, false, false);
-    // }
-    // y = parseFloat(data.bmm350_magn_y);
-    // if (mag0_chart.series[1].data.length > 100) {
-    //     mag0_chart.series[1].addPoint([x, y], true, true, false);
-    // } else {
-    //     mag0_chart.series[1].addPoint([x, y], true, false, false);
-    // }
-    // y = parseFloat(data.bmm350_magn_z);
-    // if (mag0_chart.series[2].data.length > 100) {
-    //     mag0_chart.series[2].addPoint([x, y], true, true, false);
-    // } else {
-    //     mag0_chart.series[2].addPoint([x, y], true, false, false);
-    // }
-
-    y = parseFloat(data.bme680_temperature);
-    if (temp_chart.series[0].data.length > 1000) {
-        temp_chart.series[0].addPoint([x, y], true, true, false);
-    } else {
-        temp_chart.series[0].addPoint([x, y], true, false, false);
-    }
+// The sensor worker keeps the window of every plotted channel and sends it, thinned to at most
+// maxRenderPoints, when the page asks for a frame. The charts are redrawn once per animation frame
+// with the latest of these snapshots, instead of a full redraw for every point. The IMU window can
+// be made longer with /?window=<points>.
+const maxRenderPoints = 500;
+const imuWindow = Math.max(parseInt(new URLSearchParams(window.location.search).get("window")) || 100, 2);
+
+// The series of the plotted channels, with the number of samples each window keeps
+//NOTE: The accelerometer ADXL367 is not plotted in the web interface as this is the same data as the BMI270
+//NOTE: bmm350 is not plotted as it has no drivers in zephyr yet
+//NOTE: The gas resistance is not plotted in the web interface as this value seems to be incorrect
+const plotSeries = {
+    bmi270_ax: { series: accel0_chart.series[0], window: imuWindow },
+    bmi270_ay: { series: accel0_chart.series[1], window: imuWindow },
+    bmi270_az: { series: accel0_chart.series[2], window: imuWindow },
+    bmi270_gx: { series: gyro0_chart.series[0], window: imuWindow },
+    bmi270_gy: { series: gyro0_chart.series[1], window: imuWindow },
+    bmi270_gz: { series: gyro0_chart.series[2], window: imuWindow },
+    bme680_temperature: { series: temp_chart.series[0], window: 1000 },
+    bme680_pressure: { series: press_chart.series[0], window: 1000 },
+    bme680_humidity: { series: hum_chart.series[0], window: 1000 },
+};
+
+// The snapshot to draw at the next animation frame, and the redraw rate and time shown with the
+// latencies
+let render = {
+    pending: false,
+    next: null,
+    frames: 0,
+    framesSince: performance.now(),
+    fps: null,
+    drawMs: null,
+};
+
+// Milliseconds since the epoch, the clock shared with the worker
+function clockMs() {
+    return performance.timeOrigin + performance.now();
+}
 
-    y = parseFloat(data.bme680_humidity);
-    if (hum_chart.series[0].data.length > 1000) {
-        hum_chart.series[0].addPoint([x, y], true, true, false);
-    } else {
-        hum_chart.series[0].addPoint([x, y], true, false, false);
+function scheduleRender(snapshot) {
+    render.next = snapshot;
+    if (!render.pending) {
+        render.pending = true;
+        requestAnimationFrame(renderFrame);
     }
+}
 
-    y = parseFloat(data.bme680_pressure);
-    if (press_chart.series[0].data.length > 1000) {
-        press_chart.series[0].addPoint([x, y], true, true, false);
-    } else {
-        press_chart.series[0].addPoint([x, y], true, false, false);
+// Highcharts points from the typed arrays of a snapshot, NaN is a gap
+function toChartPoints(points) {
+    const chartPoints = new Array(points.x.length);
+    for (let i = 0; i < points.x.length; i++) {
+        chartPoints[i] = [points.x[i], isNaN(points.y[i]) ? null : points.y[i]];
     }
-
-    //NOTE: The gas resistance is not plotted in the web interface as this value seems to be incorrect
-    // y = parseFloat(data.bme680_gas);
-    // if (gas_chart.series[0].data.length > 1000) {
-    //     gas_chart.series[0].addPoint([x, y], true, true, false);
-    // } else {
-    //     gas_chart.series[0].addPoint([x, y], true, false, false);
-    // }
+    return chartPoints;
 }
 
-function setSensorData(json_data, sensor_name) {
-    // document.getElementById(sensor_name).innerHTML = json_data[sensor_name];
-    document.getElementById(sensor_name).innerHTML = json_data[sensor_name].toFixed(3);
-}
+function renderFrame() {
+    const snapshot = render.next;
+    const start = performance.now();
+    const charts = new Set();
 
-////////////////////////////////////////////////////////////////
-// 3D Model
-////////////////////////////////////////////////////////////////
+    render.pending = false;
+    render.next = null;
 
-class MovingAverageFilter {
-    constructor(windowSize) {
-        this.windowSize = windowSize;
-        this.values = [];
-        this.sum = 0;
+    for (const [name, points] of Object.entries(snapshot.series)) {
+        const series = plotSeries[name].series;
+        series.setData(toChartPoints(points), false, false, false);
+        charts.add(series.chart);
     }
+    charts.forEach(chart => chart.redraw(false));
 
-    add(value) {
-        this.values.push(value);
-        this.sum += value;
-
-        if (this.values.length > this.windowSize) {
-            this.sum -= this.values.shift();
-        }
+    if (snapshot.latest !== null) {
+        showSensorValues(snapshot.latest);
     }
-
-    getAverage() {
-        let result = this.sum / this.values.length;
-        if (isNaN(result)) {
-            return 0;
-        }
-        return result;
+    if (snapshot.orientation !== null) {
+        plotOrientation(snapshot.orientation.roll, snapshot.orientation.pitch, snapshot.orientation.yaw);
     }
-}
+    Object.assign(latency, snapshot.latency);
 
-const windowSize = 100; // Adjust the window size as needed
-const maFilterGx = new MovingAverageFilter(windowSize, 0.01);
-const maFilterGy = new MovingAverageFilter(windowSize, 0.01);
-const maFilterGz = new MovingAverageFilter(windowSize, 0.01);
-
-let old_time = 0;
-let orientationQuat = { w: 1, x: 0, y: 0, z: 0 };
-
-// Convert radians to degrees
-function radToDeg(radians) {
-    return radians * 180 / Math.PI;
-}
-
-// Convert degrees to radians
-function degToRad(degrees) {
-    return degrees * Math.PI / 180;
-}
+    const end = performance.now();
+    render.drawMs = smooth(render.drawMs, end - start);
+    if (snapshot.receivedAt !== null) {
+        latency.receiveToRender = smooth(latency.receiveToRender, clockMs() - snapshot.receivedAt);
+    }
 
-// Normalize a quaternion
-function normalizeQuaternion(q) {
-    const length = Math.sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
-    return {
-        w: q.w / length,
-        x: q.x / length,
-        y: q.y / length,
-        z: q.z / length
-    };
-}
+    render.frames++;
+    if (end - render.framesSince >= 1000) {
+        render.fps = render.frames * 1000 / (end - render.framesSince);
+        render.frames = 0;
+        render.framesSince = end;
+    }
 
-// Multiply two quaternions
-function multiplyQuaternions(q1, q2) {
-    return {
-        w: q1.w * q2.w - q1.x * q2.x - q1.y * q2.y - q1.z * q2.z,
-        x: q1.w * q2.x + q1.x * q2.w + q1.y * q2.z - q1.z * q2.y,
-        y: q1.w * q2.y - q1.x * q2.z + q1.y * q2.w + q1.z * q2.x,
-        z: q1.w * q2.z + q1.x * q2.y - q1.y * q2.x + q1.z * q2.w
-    };
+    // The worker sends the next snapshot once it has new samples
+    worker.postMessage({ type: "frame" });
 }
 
-// Convert gyroscope delta (deg/s) to a quaternion
-function toDeltaQuaternion(gyroX, gyroY, gyroZ, deltaTime) {
+// Spectrum frames carry the amplitudes with either the bin spacing "df" or the bin centres "f"
+function updateSpectrum(data) {
+    const points = data.spectrum.map((amplitude, i) => [data.f ? data.f[i] : i * data.df, amplitude]);
 
-    const halfDeltaX = gyroX * deltaTime / 2;
-    const halfDeltaY = gyroY * deltaTime / 2;
-    const halfDeltaZ = gyroZ * deltaTime / 2;
+    spectrum_chart.xAxis[0].update({ type: data.f ? 'logarithmic' : 'linear' }, false);
+    spectrum_chart.series[0].setData(points, true, false, false);
 
-    return normalizeQuaternion({
-        w: Math.cos(halfDeltaX) * Math.cos(halfDeltaY) * Math.cos(halfDeltaZ) + Math.sin(halfDeltaX) * Math.sin(halfDeltaY) * Math.sin(halfDeltaZ),
-        x: Math.sin(halfDeltaX) * Math.cos(halfDeltaY) * Math.cos(halfDeltaZ) - Math.cos(halfDeltaX) * Math.sin(halfDeltaY) * Math.sin(halfDeltaZ),
-        y: Math.cos(halfDeltaX) * Math.sin(halfDeltaY) * Math.cos(halfDeltaZ) + Math.sin(halfDeltaX) * Math.cos(halfDeltaY) * Math.sin(halfDeltaZ),
-        z: Math.cos(halfDeltaX) * Math.cos(halfDeltaY) * Math.sin(halfDeltaZ) - Math.sin(halfDeltaX) * Math.sin(halfDeltaY) * Math.cos(halfDeltaZ)
-    });
+    if (data.peaks.length > 0) {
+        document.getElementById('spectrum_peak').textContent = data.peaks[0][0].toFixed(1);
+    }
 }
 
-// Convert a quaternion to intrinsic Roll (Z), Pitch (X), Yaw (Y) Euler angles
-function quaternionToEuler(q) {
-    const sinPitch = -2 * (q.x * q.z - q.w * q.y);
-    const pitch = Math.asin(Math.min(Math.max(sinPitch, -1), 1)); // Clamping for numerical stability
-
-    const yaw = Math.atan2(2 * (q.x * q.y + q.w * q.z), q.w * q.w + q.x * q.x - q.y * q.y - q.z * q.z);
-    const roll = Math.atan2(2 * (q.y * q.z + q.w * q.x), q.w * q.w - q.x * q.x - q.y * q.y + q.z * q.z);
-
-    return {
-        roll: radToDeg(roll),
-        pitch: radToDeg(pitch),
-        yaw: radToDeg(yaw)
-    };
-}
+// Motion events, newest first. The timestamps are converted to the page clock once a pong has
+// given the offset, and shown as device uptime until then.
+const maxMotionEvents = 10;
+const motionEventNames = {
+    motion_start: 'Motion started',
+    motion_stop: 'Motion stopped',
+    shock: 'Shock',
+    free_fall: 'Free fall',
+};
+
+function addMotionEvent(data) {
+    const list = document.getElementById('motion_events');
+    const item = document.createElement('li');
+    let when;
+
+    if (latency.offsetMs !== null) {
+        when = new Date(data.ts / 1000 - latency.offsetMs).toLocaleTimeString();
+    } else {
+        when = (data.ts / 1e6).toFixed(3) + ' s';
+    }
+    item.textContent = when + ': ' + (motionEventNames[data.event] || data.event) + ' (' +
+        data.g.toFixed(2) + ' g)';
 
-// Construct a quaternion from Euler angles
-function eulerToQuaternion(roll, pitch, yaw) {
-    const halfRoll = degToRad(roll) / 2;
-    const halfPitch = degToRad(pitch) / 2;
-    const halfYaw = degToRad(yaw) / 2;
-
-    const sinRoll = Math.sin(halfRoll);
-    const cosRoll = Math.cos(halfRoll);
-    const sinPitch = Math.sin(halfPitch);
-    const cosPitch = Math.cos(halfPitch);
-    const sinYaw = Math.sin(halfYaw);
-    const cosYaw = Math.cos(halfYaw);
-
-    return normalizeQuaternion({
-        w: cosRoll * cosPitch * cosYaw + sinRoll * sinPitch * sinYaw,
-        x: sinRoll * cosPitch * cosYaw - cosRoll * sinPitch * sinYaw,
-        y: cosRoll * sinPitch * cosYaw + sinRoll * cosPitch * sinYaw,
-        z: cosRoll * cosPitch * sinYaw - sinRoll * sinPitch * cosYaw
-    });
+    list.insertBefore(item, list.firstChild);
+    while (list.children.length > maxMotionEvents) {
+        list.removeChild(list.lastChild);
+    }
 }
 
-function rollPitchQuatFromAcc(accelX, accelY, accelZ) {
-
-    // Normalize the accelerometer data
-    const norm = Math.sqrt(accelX * accelX + accelY * accelY + accelZ * accelZ);
-    accelX /= norm;
-    accelY /= norm;
-    accelZ /= norm;
-
-    accelZ = -accelZ; 
+// Channels of the sensor frames by name, with their bit in the "valid" mask, from GET /schema.
+// A channel the device was built without is never valid. channelList has them in the order of
+// the bits, for the delta decoder of the worker.
+let channels = {};
+let channelList = [];
 
-    // Pitch quaternion
-    const s_theta = Math.min(Math.max(accelX, -1), 1);
-    const c_theta = Math.sqrt(1 - s_theta * s_theta);
-    const s_theta_half = Math.sign(s_theta) * Math.sqrt((1 - c_theta) / 2);
-    const c_theta_half = Math.sqrt((1 + c_theta) / 2);
-
-    let pitchQuat = {
-        w: c_theta_half,
-        x: 0,
-        y: s_theta_half,
-        z: 0
-    };
-
-    pitchQuat = normalizeQuaternion(pitchQuat);
-
-    // Roll quaternion
-    const is_singular = (c_theta == 0);
-    const s_phi = is_singular ? 0 : (-1 * accelY / c_theta);
-    let c_phi = is_singular ? 0 : (-1 * accelZ / c_theta);
-    c_phi = Math.min(Math.max(c_phi, -1), 1);
-    let sign_s_phi = Math.sign(s_phi);
-    if(c_phi == -1.0 && s_phi == 0.0) {
-        sign_s_phi = 1.0;
-    }
-    const s_phi_half = sign_s_phi * Math.sqrt((1 - c_phi) / 2);
-    const c_phi_half = Math.sqrt((1 + c_phi) / 2);
-
-    let rollQuat = {
-        w: c_phi_half,
-        x: s_phi_half,
-        y: 0,
-        z: 0
-    };
-    rollQuat = normalizeQuaternion(rollQuat);
+async function loadSchema() {
+    try {
+        const response = await fetch("/schema");
+        if (!response.ok) {
+            throw new Error(`Response status: ${response.status}`);
+        }
+        const schema = await response.json();
 
-    // Combine the pitch and roll quaternions
-    const combinedQuat = multiplyQuaternions(pitchQuat, rollQuat);
-    return normalizeQuaternion(combinedQuat);
+        schema.channels.forEach((channel, bit) => {
+            channels[channel.name] = { bit: bit, unit: channel.unit, precision: channel.precision };
+            channelList.push({ name: channel.name, step: channel.step });
+        });
+    }
+    catch (error) {
+        console.error(error.message);
+    }
 }
 
-function updateOrientation(data) {
-    let time = parseFloat(data.timestamp);
-    if (old_time == 0) {
-        old_time = time;
+function isChannelValid(data, name) {
+    const channel = channels[name];
+    if (channel === undefined) {
+        return false;
     }
-    let delta_time = time - old_time;
-    old_time = time;
-
-    let gx = parseFloat(data.bmi270_gx);
-    let gy = parseFloat(data.bmi270_gy);
-    let gz = parseFloat(data.bmi270_gz);
-
-    let ax = parseFloat(data.bmi270_ax);
-    let ay = parseFloat(data.bmi270_ay);
-    let az = parseFloat(data.bmi270_az);
+    return data.valid === undefined || (data.valid & (1 << channel.bit)) !== 0;
+}
 
-    // Gyro offset compensation
-    if((Math.abs(gx) < 0.01) && (Math.abs(gy) < 0.01) && (Math.abs(gz) < 0.01)) {
-        maFilterGx.add(gx);
-        maFilterGy.add(gy);
-        maFilterGz.add(gz);
+function setSensorData(json_data, sensor_name) {
+    if (!isChannelValid(json_data, sensor_name)) {
+        document.getElementById(sensor_name).innerHTML = ' - - ';
+        return;
     }
-
-    gx -= maFilterGx.getAverage();
-    gy -= maFilterGy.getAverage();
-    gz -= maFilterGz.getAverage();
-
-    const deltaQuaternion = toDeltaQuaternion(-gx, -gy, gz, delta_time);
-    orientationQuat = multiplyQuaternions(orientationQuat, deltaQuaternion);
-    orientationQuat = normalizeQuaternion(orientationQuat);
-
-    accQuat = rollPitchQuatFromAcc(ax, ay, az);
-
-    // console.log("accQuat: " + accQuat.w + " " + accQuat.x + " " + accQuat.y + " " + accQuat.z);
-    // console.log("orientationQuat: " + orientationQuat.w + " " + orientationQuat.x + " " + orientationQuat.y + " " + orientationQuat.z);
-
-    // // Complementary filter
-    // const alpha = 0.8;
-    // orientationQuat.w = alpha * orientationQuat.w + (1 - alpha) * accQuat.w;
-    // orientationQuat.x = alpha * orientationQuat.x + (1 - alpha) * accQuat.x;
-    // orientationQuat.y = alpha * orientationQuat.y + (1 - alpha) * accQuat.y;
-    // orientationQuat.z = alpha * orientationQuat.z + (1 - alpha) * accQuat.z;
-    // orientationQuat = normalizeQuaternion(orientationQuat);
-
-    let euler = quaternionToEuler(orientationQuat);
-    const accEuler = quaternionToEuler(accQuat);
-
-    // console.log("euler:" + euler.roll + " " + euler.pitch + " " + euler.yaw);
-    // console.log("accEuler:" + accEuler.roll + " " + accEuler.pitch + " " + accEuler.yaw);
-
-    // complementary filter
-    const alpha = 0.8;
-    euler.roll = alpha * euler.roll + (1 - alpha) * accEuler.roll;
-    euler.pitch = alpha * euler.pitch + (1 - alpha) * accEuler.pitch;
-
-    // Feedback after the complementary filter
-    orientationQuat = eulerToQuaternion(euler.roll, euler.pitch, euler.yaw);
-
-
-    plotOrientation(euler.roll, euler.pitch, euler.yaw);
-
+    // document.getElementById(sensor_name).innerHTML = json_data[sensor_name];
+    document.getElementById(sensor_name).innerHTML =
+        json_data[sensor_name].toFixed(Math.min(channels[sensor_name].precision, 3));
 }
 
+////////////////////////////////////////////////////////////////
+// 3D Model
+////////////////////////////////////////////////////////////////
+
+// The orientation comes from the filter in the sensor worker
 function plotOrientation(roll, pitch, yaw) {
 
     // console.log("Roll: " + roll + " Pitch: " + pitch + " Yaw: " + yaw);
@@ -650,6 +519,41 @@ window.addEventListener('load', function () {
     modelViewer.setAttribute('src', modelViewer.getAttribute('data-src'));
 });
 
+////////////////////////////////////////////////////////////////////////////
+// End-to-end latency
+////////////////////////////////////////////////////////////////////////////
+
+// The latencies and payload bytes from the probe of the sensor worker, with each snapshot, and the
+// receive to render latency measured when the snapshot is drawn
+const latencyAlpha = 0.1;
+
+let latency = {
+    offsetMs: null, // device ms - ms since the epoch
+    rtt: null,
+    sampleToSend: null,
+    sendToReceive: null,
+    receiveToRender: null,
+    bytesPerSample: null,
+};
+
+function smooth(old, value) {
+    return old === null ? value : old + latencyAlpha * (value - old);
+}
+
+function formatLatency(value) {
+    return value === null ? " - - " : value.toFixed(1);
+}
+
+function showLatency() {
+    document.getElementById("latency_sample_send").innerHTML = formatLatency(latency.sampleToSend);
+    document.getElementById("latency_send_receive").innerHTML = formatLatency(latency.sendToReceive);
+    document.getElementById("latency_receive_render").innerHTML = formatLatency(latency.receiveToRender);
+    document.getElementById("latency_rtt").innerHTML = formatLatency(latency.rtt);
+    document.getElementById("bytes_per_sample").innerHTML = formatLatency(latency.bytesPerSample);
+    document.getElementById("render_fps").innerHTML = formatLatency(render.fps);
+    document.getElementById("render_ms").innerHTML = formatLatency(render.drawMs);
+}
+
 ////////////////////////////////////////////////////////////////////////////
 // Function to post RGB LED data
 ////////////////////////////////////////////////////////////////////////////
@@ -740,7 +644,7 @@ window.addEventListener("DOMContentLoaded", (ev) => {
 
     // Setup the event listeners for the buttons
     document.getElementById('reset-orientation').addEventListener('click', function () {
-        orientationQuat = { w: 1, x: 0, y: 0, z: 0 };
+        worker.postMessage({ type: "reset-orientation" });
     });
     document.getElementById('jwt-submit').addEventListener('click', async function () {
         const jwt = document.getElementById('jwt-input').value;
@@ -761,53 +665,895 @@ window.addEventListener("DOMContentLoaded", (ev) => {
 
 });
 
-// WebSocket connection
-document.addEventListener('DOMContentLoaded', (event) => {
-    /* Setup websocket for handling network stats */
-    const ws = new WebSocket("/");
-    ws.onopen = (event) => {
-        console.log("Connected to the server");
-    }
-
-    ws.onmessage = (event) => {
-        // console.log("Received data");
-
-        const data = JSON.parse(event.data);
-
-        
-        //NOTE: The accelerometer ADXL367 is not plotted in the web interface as this is the same data as the BMI270
-        // setSensorData(data, "adxl_ax");
-        // setSensorData(data, "adxl_ay");
-        // setSensorData(data, "adxl_az");
-
-        setSensorData(data, "bme680_temperature");
-        setSensorData(data, "bme680_humidity");
-        setSensorData(data, "bme680_pressure");
-        //NOTE: The gas resistance is not plotted in the web interface as this value seems to be incorrect
-        // setSensorData(data, "bme680_gas");
-
-        setSensorData(data, "bmi270_gx");
-        setSensorData(data, "bmi270_gy");
-        setSensorData(data, "bmi270_gz");
-        setSensorData(data, "bmi270_ax");
-        setSensorData(data, "bmi270_ay");
-        setSensorData(data, "bmi270_az");
-
-        //NOTE: bmm350 is not plotted as it has no drivers in zephyr yet
-        // setSensorData(data, "bmm350_magn_x");
-        // setSensorData(data, "bmm350_magn_y");
-        // setSensorData(data, "bmm350_magn_z");
-
-        updatePlots(data);
-        updateOrientation(data);
-    
+////////////////////////////////////////////////////////////////////////////
+// Sensor stream
+////////////////////////////////////////////////////////////////////////////
+
+let worker = null;
+
+function showSensorValues(data) {
+    //NOTE: The accelerometer ADXL367 is not plotted in the web interface as this is the same data as the BMI270
+    // setSensorData(data, "adxl_ax");
+    // setSensorData(data, "adxl_ay");
+    // setSensorData(data, "adxl_az");
+
+    setSensorData(data, "bme680_temperature");
+    setSensorData(data, "bme680_humidity");
+    setSensorData(data, "bme680_pressure");
+    //NOTE: The gas resistance is not plotted in the web interface as this value seems to be incorrect
+    // setSensorData(data, "bme680_gas");
+
+    setSensorData(data, "bmi270_gx");
+    setSensorData(data, "bmi270_gy");
+    setSensorData(data, "bmi270_gz");
+    setSensorData(data, "bmi270_ax");
+    setSensorData(data, "bmi270_ay");
+    setSensorData(data, "bmi270_az");
+
+    //NOTE: bmm350 is not plotted as it has no drivers in zephyr yet
+    // setSensorData(data, "bmm350_magn_x");
+    // setSensorData(data, "bmm350_magn_y");
+    // setSensorData(data, "bmm350_magn_z");
+}
+
+
+// Samples per websocket message and how long a sample may wait for its batch, from the page URL,
+// e.g. /?batch=10&latency_ms=200. Without them every sample comes in its own frame. The delta
+// encoding is asked for with /?encoding=delta.
+function batchRequest() {
+    const params = new URLSearchParams(window.location.search);
+    const batch = parseInt(params.get("batch"));
+    if (!(batch > 1)) {
+        return null;
+    }
+    const request = { "batch": batch };
+    const latencyMs = parseInt(params.get("latency_ms"));
+    if (latencyMs >= 0) {
+        request.latency_ms = latencyMs;
+    }
+    return request;
+}
+
+// Start the worker with the channels from the schema and the stream settings from the page URL
+function startSensorWorker() {
+    const source = "(" + sensorWorker.toString() + ")()";
+    const wsUrl = new URL("/", window.location.href);
+    wsUrl.protocol = wsUrl.protocol === "https:" ? "wss:" : "ws:";
+
+    worker = new Worker(URL.createObjectURL(new Blob([source], { type: "text/javascript" })));
+
+    worker.onmessage = (event) => {
+        const message = event.data;
+
+        if (message.type === "frame") {
+            scheduleRender(message);
+        } else if (message.type === "spectrum") {
+            updateSpectrum(message.data);
+        } else if (message.type === "event") {
+            addMotionEvent(message.data);
+        }
+    };
+
+    const windows = {};
+    for (const [name, plot] of Object.entries(plotSeries)) {
+        windows[name] = plot.window;
     }
-    
+
+    worker.postMessage({
+        type: "start",
+        origin: window.location.origin,
+        wsUrl: wsUrl.href,
+        channels: channelList,
+        windows: windows,
+        maxRenderPoints: maxRenderPoints,
+        batch: batchRequest(),
+        encoding: new URLSearchParams(window.location.search).get("encoding"),
+    });
+    worker.postMessage({ type: "frame" });
+}
+
+// The device computes the spectrum for its subscribers only, so the worker subscribes while the
+// chart is on screen and the page is not hidden
+function watchSpectrumVisibility() {
+    let onScreen = false;
+    const update = () => {
+        worker.postMessage({
+            type: "spectrum-visible",
+            visible: onScreen && document.visibilityState === "visible",
+        });
+    };
+
+    new IntersectionObserver((entries) => {
+        onScreen = entries[entries.length - 1].isIntersecting;
+        update();
+    }).observe(document.getElementById('chart_spectrum'));
+    document.addEventListener('visibilitychange', update);
+}
+
+document.addEventListener('DOMContentLoaded', async (event) => {
+    await loadSchema();
+    startSensorWorker();
+    watchSpectrumVisibility();
+    setInterval(showLatency, 500);
+
     window.addEventListener('beforeunload', function () {
-        ws.close();
+        worker.terminate();
     });
 });
 
+////////////////////////////////////////////////////////////////////////////
+// Sensor worker
+////////////////////////////////////////////////////////////////////////////
+
+// The websocket, the decoding of its JSON and delta messages, the chart windows with the history
+// and the orientation filter run in a Web Worker, so that a fast stream does not hold up the LED
+// picker, the map and the charts. The page asks for a frame once it has drawn the previous one,
+// and the worker answers as soon as it has new samples, with the thinned windows as transferred
+// typed arrays, the newest sample, the orientation and the latencies. The worker is built from the
+// source of sensorWorker(), so the page still comes in one file. The times that go between the
+// page and the worker are in ms since the epoch, as their performance.now() have other origins.
+function sensorWorker() {
+    let config = null; // From startSensorWorker()
+    let channels = {};
+    let socket = null; // The open websocket
+    let spectrumVisible = false; // From watchSpectrumVisibility()
+
+    function clockMs() {
+        return performance.timeOrigin + performance.now();
+    }
+
+    function isChannelValid(data, name) {
+        const channel = channels[name];
+        if (channel === undefined) {
+            return false;
+        }
+        return data.valid === undefined || (data.valid & (1 << channel.bit)) !== 0;
+    }
+
+    // The value of a channel, or NaN to leave a gap in the charts when it was not measured
+    function channelValue(data, name) {
+        return isChannelValid(data, name) ? parseFloat(data[name]) : NaN;
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Chart windows
+    ////////////////////////////////////////////////////////////////
+
+    // Every plotted channel keeps its window in a preallocated ring of typed arrays. A window
+    // longer than the points the page draws is thinned with Largest-Triangle-Three-Buckets, which
+    // keeps the peaks a plain stride would drop. A sample without the channel is NaN, a gap.
+    class SampleRing {
+        constructor(capacity) {
+            this.capacity = capacity;
+            this.x = new Float64Array(capacity);
+            this.y = new Float32Array(capacity);
+            this.start = 0;
+            this.length = 0;
+        }
+
+        push(x, y) {
+            const i = (this.start + this.length) % this.capacity;
+            this.x[i] = x;
+            this.y[i] = y;
+            if (this.length < this.capacity) {
+                this.length++;
+            } else {
+                this.start = (this.start + 1) % this.capacity;
+            }
+        }
+
+        xAt(i) {
+            return this.x[(this.start + i) % this.capacity];
+        }
+
+        yAt(i) {
+            return this.y[(this.start + i) % this.capacity];
+        }
+
+        // The points in time order, at most maxPoints of them, in new arrays to transfer
+        snapshot(maxPoints) {
+            if (this.length > maxPoints && maxPoints > 2) {
+                return lttb(this, maxPoints);
+            }
+            const points = { x: new Float64Array(this.length), y: new Float32Array(this.length) };
+            for (let i = 0; i < this.length; i++) {
+                points.x[i] = this.xAt(i);
+                points.y[i] = this.yAt(i);
+            }
+            return points;
+        }
+    }
+
+    // Largest-Triangle-Three-Buckets: the first and last points, and from every bucket in between
+    // the point that spans the largest triangle with the point kept from the previous bucket and
+    // the average of the next bucket. A bucket without a valid value stays a gap.
+    function lttb(ring, threshold) {
+        const n = ring.length;
+        const bucketSize = (n - 2) / (threshold - 2);
+        const points = { x: new Float64Array(threshold), y: new Float32Array(threshold) };
+        let a = 0;
+
+        points.x[0] = ring.xAt(0);
+        points.y[0] = ring.yAt(0);
+
+        for (let b = 0; b < threshold - 2; b++) {
+            const start = Math.floor(b * bucketSize) + 1;
+            const end = Math.floor((b + 1) * bucketSize) + 1;
+            const nextEnd = Math.min(Math.floor((b + 2) * bucketSize) + 1, n);
+            const ax = ring.xAt(a);
+            const ay = ring.yAt(a);
+
+            let avgX = 0;
+            let avgY = 0;
+            let valid = 0;
+            for (let i = end; i < nextEnd; i++) {
+                avgX += ring.xAt(i);
+                if (!isNaN(ring.yAt(i))) {
+                    avgY += ring.yAt(i);
+                    valid++;
+                }
+            }
+            avgX /= Math.max(nextEnd - end, 1);
+            avgY = valid > 0 ? avgY / valid : ay;
+
+            let maxArea = -1;
+            let next = -1;
+            for (let i = start; i < end; i++) {
+                const x = ring.xAt(i);
+                const y = ring.yAt(i);
+                if (isNaN(y)) {
+                    continue;
+                }
+                const area = Math.abs((ax - avgX) * (y - ay) - (ax - x) * (avgY - ay)) || 0;
+                if (area > maxArea) {
+                    maxArea = area;
+                    next = i;
+                }
+            }
+
+            if (next < 0) {
+                points.x[b + 1] = ring.xAt(start);
+                points.y[b + 1] = NaN;
+                continue;
+            }
+            points.x[b + 1] = ring.xAt(next);
+            points.y[b + 1] = ring.yAt(next);
+            a = next;
+        }
+
+        points.x[threshold - 1] = ring.xAt(n - 1);
+        points.y[threshold - 1] = ring.yAt(n - 1);
+        return points;
+    }
+
+    let rings = {}; // By channel name
+
+    // What changed since the last snapshot, and whether the page waits for one
+    let frame = {
+        requested: false,
+        dirty: false,
+        latest: null,
+        orientation: null,
+        receivedSum: 0, // Receive times of the samples since the last snapshot
+        received: 0,
+    };
+
+    function addSample(data, receivedAt) {
+        const x = data.ts / 1e6; // Device uptime in seconds
+
+        trackFrameLatency(data, receivedAt);
+        updateOrientation(data);
+        for (const [name, ring] of Object.entries(rings)) {
+            ring.push(x, channelValue(data, name));
+        }
+
+        frame.latest = data;
+        frame.receivedSum += receivedAt;
+        frame.received++;
+        frame.dirty = true;
+    }
+
+    function sendFrame() {
+        if (!frame.requested || !frame.dirty) {
+            return;
+        }
+
+        const series = {};
+        const transfer = [];
+        for (const [name, ring] of Object.entries(rings)) {
+            series[name] = ring.snapshot(config.maxRenderPoints);
+            transfer.push(series[name].x.buffer, series[name].y.buffer);
+        }
+
+        self.postMessage({
+            type: "frame",
+            series: series,
+            latest: frame.latest,
+            orientation: frame.orientation,
+            receivedAt: frame.received > 0 ? frame.receivedSum / frame.received : null,
+            latency: {
+                offsetMs: latency.offsetMs,
+                rtt: latency.rtt,
+                sampleToSend: latency.sampleToSend,
+                sendToReceive: latency.sendToReceive,
+                bytesPerSample: latency.bytesPerSample,
+            },
+        }, transfer);
+
+        frame.requested = false;
+        frame.dirty = false;
+        frame.latest = null;
+        frame.orientation = null;
+        frame.receivedSum = 0;
+        frame.received = 0;
+    }
+
+    // Load the recent history kept by the device, so the charts are filled before the live stream
+    // starts. The points use the same time base as the websocket frames.
+    async function prefillHistory() {
+        try {
+            const response = await fetch(config.origin + "/history?channels=" +
+                                         Object.keys(rings).join(","));
+            if (!response.ok) {
+                throw new Error(`Response status: ${response.status}`);
+            }
+            const history = await response.json();
+
+            for (const [name, points] of Object.entries(history)) {
+                const ring = rings[name];
+                if (ring === undefined) {
+                    continue;
+                }
+                points.slice(-ring.capacity).forEach(([x, y]) => ring.push(x, y === null ? NaN : y));
+            }
+
+            frame.dirty = true;
+            sendFrame();
+        }
+        catch (error) {
+            console.error(error.message);
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // End-to-end latency probe
+    ////////////////////////////////////////////////////////////////
+
+    // Every frame carries the device uptime when it was sampled ("ts") and when it was serialized for
+    // sending ("tx"), both in microseconds. The device answers {"ping": id} with
+    // {"pong": id, "dev": uptime}, which gives the round trip time and an estimate of the offset
+    // between the device clock and the epoch. The estimate from the ping with the lowest round
+    // trip time is kept, as that one has the smallest error bound.
+    const pingInterval = 2000;
+    const latencyAlpha = 0.1;
+
+    let latency = {
+        pings: new Map(),
+        nextPingId: 1,
+        bestRtt: Infinity,
+        offsetMs: null, // device ms - ms since the epoch
+        rtt: null,
+        sampleToSend: null,
+        sendToReceive: null,
+        bytesPerSample: null,
+    };
+
+    function smooth(old, value) {
+        return old === null ? value : old + latencyAlpha * (value - old);
+    }
+
+    function sendPing(ws) {
+        if (ws.readyState !== WebSocket.OPEN) {
+            return;
+        }
+        const id = latency.nextPingId++;
+        latency.pings.set(id, clockMs());
+        ws.send(JSON.stringify({ "ping": id }));
+    }
+
+    function handlePong(data) {
+        const t1 = clockMs();
+        const t0 = latency.pings.get(data.pong);
+        if (t0 === undefined) {
+            return;
+        }
+        latency.pings.delete(data.pong);
+
+        const rtt = t1 - t0;
+        latency.rtt = smooth(latency.rtt, rtt);
+        if (rtt <= latency.bestRtt) {
+            latency.bestRtt = rtt;
+            latency.offsetMs = data.dev / 1000 - (t0 + t1) / 2;
+        }
+    }
+
+    // The receive to render latency is taken by the page, when it draws the samples
+    function trackFrameLatency(data, receivedAt) {
+        latency.sampleToSend = smooth(latency.sampleToSend, (data.tx - data.ts) / 1000);
+        if (latency.offsetMs !== null) {
+            latency.sendToReceive = smooth(latency.sendToReceive,
+                                           receivedAt - (data.tx / 1000 - latency.offsetMs));
+        }
+    }
+
+    // Websocket payload bytes per sample, which batching brings down
+    function trackBytesPerSample(bytes, samples) {
+        latency.bytesPerSample = smooth(latency.bytesPerSample, bytes / samples);
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Orientation
+    ////////////////////////////////////////////////////////////////
+
+    class MovingAverageFilter {
+        constructor(windowSize) {
+            this.windowSize = windowSize;
+            this.values = [];
+            this.sum = 0;
+        }
+
+        add(value) {
+            this.values.push(value);
+            this.sum += value;
+
+            if (this.values.length > this.windowSize) {
+                this.sum -= this.values.shift();
+            }
+        }
+
+        getAverage() {
+            let result = this.sum / this.values.length;
+            if (isNaN(result)) {
+                return 0;
+            }
+            return result;
+        }
+    }
+
+    const windowSize = 100; // Adjust the window size as needed
+    const maFilterGx = new MovingAverageFilter(windowSize, 0.01);
+    const maFilterGy = new MovingAverageFilter(windowSize, 0.01);
+    const maFilterGz = new MovingAverageFilter(windowSize, 0.01);
+
+    let old_time = 0;
+    let orientationQuat = { w: 1, x: 0, y: 0, z: 0 };
+
+    // Convert radians to degrees
+    function radToDeg(radians) {
+        return radians * 180 / Math.PI;
+    }
+
+    // Convert degrees to radians
+    function degToRad(degrees) {
+        return degrees * Math.PI / 180;
+    }
+
+    // Normalize a quaternion
+    function normalizeQuaternion(q) {
+        const length = Math.sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+        return {
+            w: q.w / length,
+            x: q.x / length,
+            y: q.y / length,
+            z: q.z / length
+        };
+    }
+
+    // Multiply two quaternions
+    function multiplyQuaternions(q1, q2) {
+        return {
+            w: q1.w * q2.w - q1.x * q2.x - q1.y * q2.y - q1.z * q2.z,
+            x: q1.w * q2.x + q1.x * q2.w + q1.y * q2.z - q1.z * q2.y,
+            y: q1.w * q2.y - q1.x * q2.z + q1.y * q2.w + q1.z * q2.x,
+            z: q1.w * q2.z + q1.x * q2.y - q1.y * q2.x + q1.z * q2.w
+        };
+    }
+
+    // Convert gyroscope delta (deg/s) to a quaternion
+    function toDeltaQuaternion(gyroX, gyroY, gyroZ, deltaTime) {
+
+        const halfDeltaX = gyroX * deltaTime / 2;
+        const halfDeltaY = gyroY * deltaTime / 2;
+        const halfDeltaZ = gyroZ * deltaTime / 2;
+
+        return normalizeQuaternion({
+            w: Math.cos(halfDeltaX) * Math.cos(halfDeltaY) * Math.cos(halfDeltaZ) + Math.sin(halfDeltaX) * Math.sin(halfDeltaY) * Math.sin(halfDeltaZ),
+            x: Math.sin(halfDeltaX) * Math.cos(halfDeltaY) * Math.cos(halfDeltaZ) - Math.cos(halfDeltaX) * Math.sin(halfDeltaY) * Math.sin(halfDeltaZ),
+            y: Math.cos(halfDeltaX) * Math.sin(halfDeltaY) * Math.cos(halfDeltaZ) + Math.sin(halfDeltaX) * Math.cos(halfDeltaY) * Math.sin(halfDeltaZ),
+            z: Math.cos(halfDeltaX) * Math.cos(halfDeltaY) * Math.sin(halfDeltaZ) - Math.sin(halfDeltaX) * Math.sin(halfDeltaY) * Math.cos(halfDeltaZ)
+        });
+    }
+
+    // Convert a quaternion to intrinsic Roll (Z), Pitch (X), Yaw (Y) Euler angles
+    function quaternionToEuler(q) {
+        const sinPitch = -2 * (q.x * q.z - q.w * q.y);
+        const pitch = Math.asin(Math.min(Math.max(sinPitch, -1), 1)); // Clamping for numerical stability
+
+        const yaw = Math.atan2(2 * (q.x * q.y + q.w * q.z), q.w * q.w + q.x * q.x - q.y * q.y - q.z * q.z);
+        const roll = Math.atan2(2 * (q.y * q.z + q.w * q.x), q.w * q.w - q.x * q.x - q.y * q.y + q.z * q.z);
+
+        return {
+            roll: radToDeg(roll),
+            pitch: radToDeg(pitch),
+            yaw: radToDeg(yaw)
+        };
+    }
+
+    // Construct a quaternion from Euler angles
+    function eulerToQuaternion(roll, pitch, yaw) {
+        const halfRoll = degToRad(roll) / 2;
+        const halfPitch = degToRad(pitch) / 2;
+        const halfYaw = degToRad(yaw) / 2;
+
+        const sinRoll = Math.sin(halfRoll);
+        const cosRoll = Math.cos(halfRoll);
+        const sinPitch = Math.sin(halfPitch);
+        const cosPitch = Math.cos(halfPitch);
+        const sinYaw = Math.sin(halfYaw);
+        const cosYaw = Math.cos(halfYaw);
+
+        return normalizeQuaternion({
+            w: cosRoll * cosPitch * cosYaw + sinRoll * sinPitch * sinYaw,
+            x: sinRoll * cosPitch * cosYaw - cosRoll * sinPitch * sinYaw,
+            y: cosRoll * sinPitch * cosYaw + sinRoll * cosPitch * sinYaw,
+            z: cosRoll * cosPitch * sinYaw - sinRoll * sinPitch * cosYaw
+        });
+    }
+
+    function rollPitchQuatFromAcc(accelX, accelY, accelZ) {
+
+        // Normalize the accelerometer data
+        const norm = Math.sqrt(accelX * accelX + accelY * accelY + accelZ * accelZ);
+        accelX /= norm;
+        accelY /= norm;
+        accelZ /= norm;
+
+        accelZ = -accelZ; 
+
+        // Pitch quaternion
+        const s_theta = Math.min(Math.max(accelX, -1), 1);
+        const c_theta = Math.sqrt(1 - s_theta * s_theta);
+        const s_theta_half = Math.sign(s_theta) * Math.sqrt((1 - c_theta) / 2);
+        const c_theta_half = Math.sqrt((1 + c_theta) / 2);
+
+        let pitchQuat = {
+            w: c_theta_half,
+            x: 0,
+            y: s_theta_half,
+            z: 0
+        };
+
+        pitchQuat = normalizeQuaternion(pitchQuat);
+
+        // Roll quaternion
+        const is_singular = (c_theta == 0);
+        const s_phi = is_singular ? 0 : (-1 * accelY / c_theta);
+        let c_phi = is_singular ? 0 : (-1 * accelZ / c_theta);
+        c_phi = Math.min(Math.max(c_phi, -1), 1);
+        let sign_s_phi = Math.sign(s_phi);
+        if(c_phi == -1.0 && s_phi == 0.0) {
+            sign_s_phi = 1.0;
+        }
+        const s_phi_half = sign_s_phi * Math.sqrt((1 - c_phi) / 2);
+        const c_phi_half = Math.sqrt((1 + c_phi) / 2);
+
+        let rollQuat = {
+            w: c_phi_half,
+            x: s_phi_half,
+            y: 0,
+            z: 0
+        };
+        rollQuat = normalizeQuaternion(rollQuat);
+
+        // Combine the pitch and roll quaternions
+        const combinedQuat = multiplyQuaternions(pitchQuat, rollQuat);
+        return normalizeQuaternion(combinedQuat);
+    }
+
+    function updateOrientation(data) {
+        if (!isChannelValid(data, 'bmi270_ax') || !isChannelValid(data, 'bmi270_gx')) {
+            return;
+        }
+
+        let time = data.ts / 1e6;
+        if (old_time == 0) {
+            old_time = time;
+        }
+        let delta_time = time - old_time;
+        old_time = time;
+
+        let gx = parseFloat(data.bmi270_gx);
+        let gy = parseFloat(data.bmi270_gy);
+        let gz = parseFloat(data.bmi270_gz);
+
+        let ax = parseFloat(data.bmi270_ax);
+        let ay = parseFloat(data.bmi270_ay);
+        let az = parseFloat(data.bmi270_az);
+
+        // Gyro offset compensation
+        if((Math.abs(gx) < 0.01) && (Math.abs(gy) < 0.01) && (Math.abs(gz) < 0.01)) {
+            maFilterGx.add(gx);
+            maFilterGy.add(gy);
+            maFilterGz.add(gz);
+        }
+
+        gx -= maFilterGx.getAverage();
+        gy -= maFilterGy.getAverage();
+        gz -= maFilterGz.getAverage();
+
+        const deltaQuaternion = toDeltaQuaternion(-gx, -gy, gz, delta_time);
+        orientationQuat = multiplyQuaternions(orientationQuat, deltaQuaternion);
+        orientationQuat = normalizeQuaternion(orientationQuat);
+
+        accQuat = rollPitchQuatFromAcc(ax, ay, az);
+
+        // console.log("accQuat: " + accQuat.w + " " + accQuat.x + " " + accQuat.y + " " + accQuat.z);
+        // console.log("orientationQuat: " + orientationQuat.w + " " + orientationQuat.x + " " + orientationQuat.y + " " + orientationQuat.z);
+
+        // // Complementary filter
+        // const alpha = 0.8;
+        // orientationQuat.w = alpha * orientationQuat.w + (1 - alpha) * accQuat.w;
+        // orientationQuat.x = alpha * orientationQuat.x + (1 - alpha) * accQuat.x;
+        // orientationQuat.y = alpha * orientationQuat.y + (1 - alpha) * accQuat.y;
+        // orientationQuat.z = alpha * orientationQuat.z + (1 - alpha) * accQuat.z;
+        // orientationQuat = normalizeQuaternion(orientationQuat);
+
+        let euler = quaternionToEuler(orientationQuat);
+        const accEuler = quaternionToEuler(accQuat);
+
+        // console.log("euler:" + euler.roll + " " + euler.pitch + " " + euler.yaw);
+        // console.log("accEuler:" + accEuler.roll + " " + accEuler.pitch + " " + accEuler.yaw);
+
+        // complementary filter
+        const alpha = 0.8;
+        euler.roll = alpha * euler.roll + (1 - alpha) * accEuler.roll;
+        euler.pitch = alpha * euler.pitch + (1 - alpha) * accEuler.pitch;
+
+        // Feedback after the complementary filter
+        orientationQuat = eulerToQuaternion(euler.roll, euler.pitch, euler.yaw);
+
+
+        frame.orientation = euler;
+
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // Delta encoded stream
+    ////////////////////////////////////////////////////////////////
+
+    // Binary messages of src/sensor_delta.h: the version, the time from the first sample to the
+    // sending as a varint, then one record per sample. A keyframe has the sequence number, the
+    // timestamp, the valid bits and the quantized values, a delta the time since the previous sample,
+    // the valid bits if they changed and the difference of every value. The numbers are base 128
+    // varints, the values zig-zag encoded. A delta without a keyframe before it can't be decoded, the
+    // worker then asks the device to start over.
+    const deltaVersion = 1;
+    const deltaKey = 0x01;
+    const deltaValid = 0x02;
+
+    let delta = {
+        synced: false,
+        resyncRequested: false,
+        seq: 0,
+        ts: 0,
+        valid: 0,
+        last: [],
+    };
+
+    // Up to 2^53, far more than the timestamps need, so the bytes are not combined with bit operators
+    function readVarint(reader) {
+        let value = 0;
+        let scale = 1;
+        while (reader.off < reader.bytes.length) {
+            const byte = reader.bytes[reader.off++];
+            value += (byte & 0x7f) * scale;
+            if ((byte & 0x80) === 0) {
+                return value;
+            }
+            scale *= 128;
+        }
+        throw new Error("Truncated delta record");
+    }
+
+    function unzigzag(value) {
+        return value % 2 === 0 ? value / 2 : -(value + 1) / 2;
+    }
+
+    function decodeDeltaRecord(reader) {
+        const flags = reader.bytes[reader.off++];
+        const key = (flags & deltaKey) !== 0;
+        if (!key && !delta.synced) {
+            return null;
+        }
+
+        const sample = {};
+        if (key) {
+            delta.seq = readVarint(reader);
+            delta.ts = readVarint(reader);
+        } else {
+            delta.seq++;
+            delta.ts += readVarint(reader);
+        }
+        if (flags & deltaValid) {
+            delta.valid = readVarint(reader);
+        }
+
+        config.channels.forEach((channel, bit) => {
+            if ((delta.valid & (1 << bit)) === 0) {
+                if (key) {
+                    delta.last[bit] = 0;
+                }
+                return;
+            }
+            const value = unzigzag(readVarint(reader));
+            delta.last[bit] = key ? value : delta.last[bit] + value;
+            sample[channel.name] = delta.last[bit] * channel.step;
+        });
+
+        delta.synced = true;
+        sample.ts = delta.ts;
+        sample.valid = delta.valid;
+        return sample;
+    }
+
+    function handleDeltaMessage(ws, buffer, receivedAt) {
+        const reader = { bytes: new Uint8Array(buffer), off: 0 };
+        if (reader.bytes[reader.off++] !== deltaVersion) {
+            return;
+        }
+
+        try {
+            const lag = readVarint(reader);
+            let tx = null;
+            let count = 0;
+            while (reader.off < reader.bytes.length) {
+                const sample = decodeDeltaRecord(reader);
+                if (sample === null) {
+                    throw new Error("Delta before a keyframe");
+                }
+                if (tx === null) {
+                    tx = sample.ts + lag;
+                }
+                sample.tx = tx;
+                addSample(sample, receivedAt);
+                count++;
+            }
+            delta.resyncRequested = false;
+            if (count > 0) {
+                trackBytesPerSample(reader.bytes.length, count);
+            }
+        }
+        catch (error) {
+            // Asking for the delta encoding again starts the stream over with a keyframe
+            console.error(error.message);
+            delta.synced = false;
+            if (!delta.resyncRequested) {
+                delta.resyncRequested = true;
+                ws.send(JSON.stringify({ "encoding": "delta" }));
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////
+    // WebSocket connection
+    ////////////////////////////////////////////////////////////////
+
+    function handleMessage(ws, message, receivedAt) {
+        if (message instanceof ArrayBuffer) {
+            handleDeltaMessage(ws, message, receivedAt);
+            return;
+        }
+
+        const data = JSON.parse(message);
+
+        if (data.pong !== undefined) {
+            handlePong(data);
+            return;
+        }
+
+        if (data.spectrum !== undefined) {
+            self.postMessage({ type: "spectrum", data: data });
+            return;
+        }
+
+        if (data.event !== undefined) {
+            self.postMessage({ type: "event", data: data });
+            return;
+        }
+
+        if (data.batching !== undefined) {
+            console.log(`Batching ${data.batching} samples, ${data.latency_ms} ms`);
+            return;
+        }
+
+        if (data.encoding !== undefined) {
+            console.log(`Sensor stream encoding ${data.encoding}`);
+            delta.synced = false;
+            return;
+        }
+
+        // A batch has the timestamp of its first sample and the offsets of the others
+        if (data.batch !== undefined) {
+            for (const sample of data.batch) {
+                sample.ts = data.ts + sample.dt;
+                sample.tx = data.tx;
+                addSample(sample, receivedAt);
+            }
+            trackBytesPerSample(message.length, data.batch.length);
+            return;
+        }
+
+        addSample(data, receivedAt);
+        trackBytesPerSample(message.length, 1);
+    }
+
+    function connect() {
+        const ws = new WebSocket(config.wsUrl);
+        ws.binaryType = "arraybuffer";
+        let pingTimer = null;
+
+        ws.onopen = (event) => {
+            console.log("Connected to the server");
+            socket = ws;
+            if (spectrumVisible) {
+                ws.send(JSON.stringify({ "subscribe": "spectrum" }));
+            }
+            ws.send(JSON.stringify({ "subscribe": "events" }));
+            if (config.batch !== null) {
+                ws.send(JSON.stringify(config.batch));
+            }
+            if (config.encoding === "delta") {
+                ws.send(JSON.stringify({ "encoding": "delta" }));
+            }
+            sendPing(ws);
+            pingTimer = setInterval(() => sendPing(ws), pingInterval);
+        }
+
+        ws.onclose = (event) => {
+            clearInterval(pingTimer);
+            socket = null;
+        }
+
+        ws.onmessage = (event) => {
+            handleMessage(ws, event.data, clockMs());
+            sendFrame();
+        }
+    }
+
+    self.onmessage = async (event) => {
+        const message = event.data;
+
+        if (message.type === "start") {
+            config = message;
+            config.channels.forEach((channel, bit) => {
+                channels[channel.name] = { bit: bit };
+            });
+            for (const [name, capacity] of Object.entries(config.windows)) {
+                rings[name] = new SampleRing(capacity);
+            }
+
+            // Draw the history first, the live stream continues from there
+            await prefillHistory();
+            connect();
+        } else if (message.type === "frame") {
+            frame.requested = true;
+            sendFrame();
+        } else if (message.type === "reset-orientation") {
+            orientationQuat = { w: 1, x: 0, y: 0, z: 0 };
+        } else if (message.type === "spectrum-visible") {
+            if (message.visible === spectrumVisible) {
+                return;
+            }
+            spectrumVisible = message.visible;
+            if (socket !== null) {
+                const command = spectrumVisible ? "subscribe" : "unsubscribe";
+                socket.send(JSON.stringify({ [command]: "spectrum" }));
+            }
+        }
+    };
+}
+
+
 // Color wheel
 document.addEventListener('DOMContentLoaded', (event) => {
     const colorWheel = document.getElementById('color_wheel');
@@ -0,0 +1,234 @@
+#include "udp_stream.h"
+#include "metrics.h"
+#include "power.h"
+#include "sensors.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/init.h>
+#include <zephyr/net/dns_sd.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(UDP_STREAM, CONFIG_UDP_STREAM_LOG_LEVEL);
+
+// Publishes every sensor sample once, as a binary struct sensor_frame, to a UDP multicast group or
+// a broadcast address. The cost on the device is the same for one listener on the LAN as for a
+// hundred. The listeners find the group through DNS-SD, as the _thingy-sensors._udp service with
+// the port in its SRV record and the group in a "group=" TXT record.
+//
+// The acquisition thread only copies the sample and submits a work item that sends it, so a busy
+// network stack never delays the sampling. A sample that is replaced before the work ran is lost,
+// and the gap shows in the sequence numbers like a frame lost on the air.
+
+#define UDP_STREAM_TXT "group=" CONFIG_APP_UDP_STREAM_GROUP
+
+static int sock = -1;
+static struct sockaddr_in group_addr;
+static atomic_t running;
+
+static struct k_spinlock pending_lock;
+static struct sensor_sample pending;
+static uint32_t pending_seq;
+static uint32_t next_seq;
+
+static atomic_t frames_sent;
+static atomic_t send_errors;
+
+// Length-prefixed TXT record, filled in at init
+static char udp_stream_txt[sizeof(UDP_STREAM_TXT) + 1];
+static const uint16_t udp_stream_port = htons(CONFIG_APP_UDP_STREAM_PORT);
+
+DNS_SD_REGISTER_UDP_SERVICE(udp_stream_sd, CONFIG_NET_HOSTNAME, "_thingy-sensors", "local",
+			    udp_stream_txt, &udp_stream_port);
+
+static void udp_stream_work_handler(struct k_work *work)
+{
+	struct sensor_sample sample;
+	struct sensor_frame frame;
+	k_spinlock_key_t key;
+	uint32_t seq;
+	ssize_t ret;
+
+	key = k_spin_lock(&pending_lock);
+	sample = pending;
+	seq = pending_seq;
+	k_spin_unlock(&pending_lock, key);
+
+	sensors_sample_to_frame(&sample, seq, &frame);
+
+	ret = zsock_sendto(sock, &frame, sizeof(frame), ZSOCK_MSG_DONTWAIT,
+			   (struct sockaddr *)&group_addr, sizeof(group_addr));
+	if (ret < 0) {
+		// Expected while the Wi-Fi is down, so not worth more than a debug message
+		LOG_DBG("Failed to send frame %u, errno %d", seq, errno);
+		atomic_inc(&send_errors);
+		return;
+	}
+
+	atomic_inc(&frames_sent);
+}
+
+static K_WORK_DEFINE(udp_stream_work, udp_stream_work_handler);
+
+/* Called by the acquisition thread for every new sample */
+static void udp_stream_on_sample(const struct sensor_sample *sample)
+{
+	k_spinlock_key_t key;
+
+	if (!atomic_get(&running)) {
+		return;
+	}
+
+	key = k_spin_lock(&pending_lock);
+	pending = *sample;
+	pending_seq = next_seq++;
+	k_spin_unlock(&pending_lock, key);
+
+	k_work_submit(&udp_stream_work);
+}
+
+static struct sensors_listener udp_stream_listener = {
+	.on_sample = udp_stream_on_sample,
+};
+
+int udp_stream_start(void)
+{
+	if (sock < 0) {
+		return -ENOTCONN;
+	}
+
+	if (!atomic_cas(&running, 0, 1)) {
+		return -EALREADY;
+	}
+
+	power_demand_get();
+	LOG_INF("Publishing to %s:%d", CONFIG_APP_UDP_STREAM_GROUP, CONFIG_APP_UDP_STREAM_PORT);
+
+	return 0;
+}
+
+int udp_stream_stop(void)
+{
+	if (!atomic_cas(&running, 1, 0)) {
+		return -EALREADY;
+	}
+
+	power_demand_put();
+	LOG_INF("Publishing stopped");
+
+	return 0;
+}
+
+//////////////////////////////////////// Shell //////////////////////////////////////////
+
+static int cmd_udp_stream_start(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	int ret;
+
+	ret = udp_stream_start();
+	if (ret == -EALREADY) {
+		shell_print(sh, "Already publishing");
+	} else if (ret < 0) {
+		shell_error(sh, "Failed to start publishing, err %d", ret);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int cmd_udp_stream_stop(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	if (udp_stream_stop() != 0) {
+		shell_print(sh, "Not publishing");
+	}
+
+	return 0;
+}
+
+static int cmd_udp_stream_status(const struct shell *sh, size_t argc, char **argv)
+{
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	shell_print(sh, "%s to %s:%d, %u frames sent, %u send errors, next seq %u",
+		    atomic_get(&running) ? "Publishing" : "Stopped", CONFIG_APP_UDP_STREAM_GROUP,
+		    CONFIG_APP_UDP_STREAM_PORT, (uint32_t)atomic_get(&frames_sent),
+		    (uint32_t)atomic_get(&send_errors), next_seq);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(udp_stream_cmds,
+			       SHELL_CMD(start, NULL, "Start publishing", cmd_udp_stream_start),
+			       SHELL_CMD(stop, NULL, "Stop publishing", cmd_udp_stream_stop),
+			       SHELL_CMD(status, NULL, "Show the publisher status",
+					 cmd_udp_stream_status),
+			       SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(udp_stream, &udp_stream_cmds, "UDP multicast sensor frames", NULL);
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void udp_stream_collect(struct metrics_writer *w)
+{
+	metrics_header(w, "thingy_udp_frames_sent_total", "counter",
+		       "Sensor frames published to the UDP group");
+	metrics_printf(w, "thingy_udp_frames_sent_total %u\n",
+		       (uint32_t)atomic_get(&frames_sent));
+
+	metrics_header(w, "thingy_udp_send_errors_total", "counter",
+		       "Sensor frames the network stack did not accept");
+	metrics_printf(w, "thingy_udp_send_errors_total %u\n",
+		       (uint32_t)atomic_get(&send_errors));
+}
+
+static struct metrics_collector udp_stream_collector = {
+	.collect = udp_stream_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int udp_stream_init(void)
+{
+	int ret;
+
+	udp_stream_txt[0] = sizeof(UDP_STREAM_TXT) - 1;
+	memcpy(&udp_stream_txt[1], UDP_STREAM_TXT, sizeof(UDP_STREAM_TXT) - 1);
+
+	group_addr.sin_family = AF_INET;
+	group_addr.sin_port = htons(CONFIG_APP_UDP_STREAM_PORT);
+	ret = zsock_inet_pton(AF_INET, CONFIG_APP_UDP_STREAM_GROUP, &group_addr.sin_addr);
+	if (ret != 1) {
+		LOG_ERR("Invalid group address %s", CONFIG_APP_UDP_STREAM_GROUP);
+		return 0;
+	}
+
+	sock = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		LOG_ERR("Failed to create the socket, errno %d", errno);
+		return 0;
+	}
+
+	sensors_add_listener(&udp_stream_listener);
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&udp_stream_collector);
+#endif // CONFIG_APP_METRICS
+
+	if (IS_ENABLED(CONFIG_APP_UDP_STREAM_AUTOSTART)) {
+		(void)udp_stream_start();
+	}
+
+	return 0;
+}
+SYS_INIT(udp_stream_init, APPLICATION, 0);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Start publishing the sensor frames to the UDP group.
+ *
+ * Holds the sensors at full rate until udp_stream_stop(), as the listeners are not known.
+ *
+ * @return 0 if successful, -EALREADY if the publisher is running, negative error code otherwise.
+ */
+int udp_stream_start(void);
+
+/**
+ * @brief Stop publishing the sensor frames.
+ *
+ * @return 0 if successful, -EALREADY if the publisher is not running.
+ */
+int udp_stream_stop(void);
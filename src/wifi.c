@@ -4,6 +4,8 @@
 LOG_MODULE_REGISTER(WIFI_STA, CONFIG_WIFI_STA_LOG_LEVEL);
 
 #include "net_private.h"
+#include "metrics.h"
+#include "location_api.h"
 
 static struct net_mgmt_event_callback wifi_shell_mgmt_cb;
 static struct net_mgmt_event_callback net_shell_mgmt_cb;
@@ -40,6 +42,7 @@ void wifi_sta_set_wifi_connected_cb(void *cb)
 static uint32_t scan_result;
 
 char nrfcloud_api_str[CONFIG_WIFI_SCAN_STR_MAX_MAC_ADDR * 65] = {0};
+static struct location_api_aps scan_aps = LOCATION_API_APS_INIT(nrfcloud_api_str);
 
 void get_nrfcloud_api_str(char *buf, size_t len)
 {
@@ -91,23 +94,11 @@ static void handle_wifi_scan_result(struct net_mgmt_event_callback *cb)
 							     mac_string_buf, sizeof(mac_string_buf))
 				    : ""));
 
-	int ret;
-
-	const char *sensors_json_template = "{"                       // 1 char
-					    "\"macAddress\":\"%s\","  // 14 chars + %s (17)
-					    "\"signalStrength\":%-4d" // 18 chars + %d (4)
-					    "},";                     // 1 char
-								      // 34 + 17 + 4 = 55
-
-	if (scan_result < CONFIG_WIFI_SCAN_STR_MAX_MAC_ADDR) {
-		ret = snprintf(nrfcloud_api_str + strlen(nrfcloud_api_str),
-			       sizeof(nrfcloud_api_str) - strlen(nrfcloud_api_str),
-			       sensors_json_template, mac_string_buf, entry->rssi);
-		if (ret < 0) {
-			LOG_ERR("Failed to create JSON string");
-		}
-
-		// LOG_WRN("nrfcloud_api_str: %s", nrfcloud_api_str);
+	if (scan_result < CONFIG_WIFI_SCAN_STR_MAX_MAC_ADDR &&
+	    location_api_aps_append(&scan_aps,
+				    entry->mac_length ? (const char *)mac_string_buf : "",
+				    entry->rssi)) {
+		LOG_ERR("Failed to create JSON string");
 	}
 }
 
@@ -211,10 +202,30 @@ int cmd_wifi_status(void)
 		LOG_INF("Security: %s", wifi_security_txt(status.security));
 		LOG_INF("MFP: %s", wifi_mfp_txt(status.mfp));
 		LOG_INF("RSSI: %d", status.rssi);
+		metrics_wifi_rssi_set(status.rssi);
 	}
 	return 0;
 }
 
+int wifi_sta_get_rssi(int *rssi)
+{
+	struct net_if *iface = net_if_get_default();
+	struct wifi_iface_status status = {0};
+
+	if (net_mgmt(NET_REQUEST_WIFI_IFACE_STATUS, iface, &status,
+		     sizeof(struct wifi_iface_status))) {
+		return -ENOEXEC;
+	}
+
+	if (status.state < WIFI_STATE_ASSOCIATED) {
+		return -ENOTCONN;
+	}
+
+	*rssi = status.rssi;
+
+	return 0;
+}
+
 void handle_wifi_connect_result(struct net_mgmt_event_callback *cb)
 {
 	const struct wifi_status *status = (const struct wifi_status *)cb->info;
@@ -227,6 +238,7 @@ void handle_wifi_connect_result(struct net_mgmt_event_callback *cb)
 		LOG_ERR("Connection failed (%d)", status->status);
 	} else {
 		LOG_INF("Connected");
+		metrics_wifi_connected();
 		if (wifi_connected_cb) {
 			((void (*)(void))wifi_connected_cb)();
 		} else {
@@ -19,4 +19,5 @@ void net_mgmt_callback_init(void);
 int register_wifi_ready(void);
 
 int wifi_scan(void);
+int wifi_sta_get_rssi(int *rssi);
 void get_nrfcloud_api_str(char *buf, size_t len);
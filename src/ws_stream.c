@@ -0,0 +1,1026 @@
+#include "ws_stream.h"
+#include "http_resources.h"
+#include "metrics.h"
+#include "motion.h"
+#include "power.h"
+#include "profiler.h"
+#include "sensors.h"
+#include "spectrum.h"
+#ifdef CONFIG_WIFI
+#include "wifi.h"
+#endif // CONFIG_WIFI
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/init.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/websocket.h>
+#include <zephyr/zvfs/eventfd.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(WS_STREAM, CONFIG_WS_STREAM_LOG_LEVEL);
+
+// One thread serves all websocket viewers. A viewer is a slot with its socket, its subscriptions
+// and the sequence number of the next sample it is due, instead of a work item per connection. The
+// thread polls the sockets of all viewers together with an eventfd that is signalled for every new
+// sample, every posted frame and every new viewer. Readable sockets are drained of pings,
+// subscription, batching and encoding messages. The samples wait in a ring, and a viewer is polled
+// for writing once its batch is full or its first sample has waited the latency the viewer asked
+// for, with the poll timeout set to the next of these deadlines. A JSON message is serialized once
+// for all the viewers that are due the same samples, a delta encoded one per viewer as it depends
+// on what the viewer got before. A viewer that cannot keep up skips to its latest batch instead of
+// stalling the others, and the rate controller spaces out its messages until its link keeps up.
+// Spectrum and event frames are queued by their producers and sent to every subscriber.
+//
+// A frame is only started on a socket with room in its TCP window, and a viewer without room
+// loses the frame and stays connected. A started frame must be completed for the viewer to parse
+// the stream after it, so a viewer whose link stalls for CONFIG_APP_WS_SEND_TIMEOUT_MS in the
+// middle of a frame is closed.
+
+#define NUM_SLOTS CONFIG_NET_SAMPLE_NUM_WEBSOCKET_HANDLERS
+
+// Besides the viewers, the network stack holds the HTTP clients and the other sockets of the app:
+// the HTTP listener, mDNS, DNS, DHCP, the UDP stream, CoAP, MQTT and the nRF Cloud requests
+#define WS_OTHER_CONNS 8
+
+BUILD_ASSERT(CONFIG_WEBSOCKET_MAX_CONTEXTS >= NUM_SLOTS,
+	     "Every viewer needs a websocket context");
+BUILD_ASSERT(CONFIG_NET_MAX_CONN >= NUM_SLOTS + CONFIG_HTTP_SERVER_MAX_CLIENTS + WS_OTHER_CONNS,
+	     "Every viewer and HTTP client needs a connection");
+BUILD_ASSERT(CONFIG_NET_MAX_CONTEXTS >= NUM_SLOTS + CONFIG_HTTP_SERVER_MAX_CLIENTS + WS_OTHER_CONNS,
+	     "Every viewer and HTTP client needs a network context");
+
+// App memory per viewer: its slot, its poll entry and its metrics counters. The network stack adds
+// a TCP connection and a websocket context per viewer.
+#define WS_VIEWER_BYTES                                                                            \
+	(sizeof(struct ws_sensors_ctx) + sizeof(struct zsock_pollfd) + sizeof(int) +              \
+	 3 * sizeof(atomic_t))
+
+struct ws_frame {
+	void *fifo_reserved;
+	uint32_t stream;
+	size_t len;
+	char data[];
+};
+
+K_THREAD_STACK_DEFINE(ws_stream_stack_area, CONFIG_APP_WS_STREAM_THREAD_STACK_SIZE);
+static struct k_thread ws_stream_thread_data;
+
+static K_MUTEX_DEFINE(slots_lock);
+static struct ws_sensors_ctx *slots;
+static int wake_fd = -1;
+
+K_HEAP_DEFINE(ws_frame_heap, CONFIG_APP_WS_FRAME_HEAP_SIZE);
+static K_FIFO_DEFINE(ws_frame_fifo);
+static atomic_t frames_dropped;
+
+// Latest samples, written by the acquisition thread, with room for the samples taken while a full
+// batch is sent
+#define RING_LEN (CONFIG_APP_WS_BATCH_MAX + 2)
+static struct sensor_sample ring[RING_LEN];
+static uint32_t ring_head; // Sequence number of the next sample
+static struct k_spinlock ring_lock;
+
+// Bytes on the wire of a message besides its payload: the TCP/IPv4 headers of every segment. The
+// 802.11 framing comes on top of that.
+#define WS_TCP_MSS        1460
+#define WS_TCP_IP_HEADERS 40
+
+static char tx_buf[CONFIG_APP_WS_TX_BUF_SIZE];
+
+/* Message in tx_buf, shared by the viewers that are due the same samples in a round */
+struct ws_tx {
+	uint32_t first;    // Sequence number of the first sample
+	uint32_t count;    // Samples the viewers were due
+	uint32_t consumed; // Samples that went in the message or were skipped, from first
+	uint32_t samples;  // Samples in the message
+	uint8_t encoding;  // WS_ENCODING_*
+	bool batched;
+	size_t len; // 0 if nothing is serialized yet
+};
+
+/* Wake the streaming thread from its poll */
+static void ws_stream_wake(void)
+{
+	if (wake_fd >= 0) {
+		(void)zvfs_eventfd_write(wake_fd, 1);
+	}
+}
+
+/* Subscribe a client to the given streams and unsubscribe it from the others */
+static void ws_stream_set_streams(struct ws_sensors_ctx *ctx, uint32_t streams)
+{
+	uint32_t changed = ctx->streams ^ streams;
+
+	ctx->streams = streams;
+
+#ifdef CONFIG_APP_SPECTRUM
+	if (changed & WS_STREAM_SPECTRUM) {
+		if (streams & WS_STREAM_SPECTRUM) {
+			spectrum_subscribe();
+		} else {
+			spectrum_unsubscribe();
+		}
+	}
+#endif // CONFIG_APP_SPECTRUM
+
+	if (changed & WS_STREAM_ADXL367) {
+		if (streams & WS_STREAM_ADXL367) {
+			sensors_adxl367_subscribe();
+		} else {
+			sensors_adxl367_unsubscribe();
+		}
+	}
+}
+
+static uint32_t ws_stream_from_name(const char *name)
+{
+	if (name == NULL) {
+		return 0;
+	}
+
+	if (strcmp(name, "sensors") == 0) {
+		return WS_STREAM_SENSORS;
+	}
+
+#ifdef CONFIG_APP_SPECTRUM
+	if (strcmp(name, "spectrum") == 0) {
+		return WS_STREAM_SPECTRUM;
+	}
+#endif // CONFIG_APP_SPECTRUM
+
+#ifdef CONFIG_APP_MOTION
+	if (strcmp(name, "events") == 0) {
+		return WS_STREAM_EVENTS;
+	}
+#endif // CONFIG_APP_MOTION
+
+	if (strcmp(name, "adxl367") == 0) {
+		return WS_STREAM_ADXL367;
+	}
+
+	return 0;
+}
+
+static void ws_stream_handle_stream_command(struct ws_sensors_ctx *ctx, uint8_t *buf, size_t len)
+{
+	struct ws_stream_command cmd = {0};
+	int ret;
+
+	ret = json_obj_parse(buf, len, ws_stream_command_descr,
+			     ARRAY_SIZE(ws_stream_command_descr), &cmd);
+	if (ret <= 0) {
+		LOG_DBG("Ignoring websocket message, ret=%d", ret);
+		return;
+	}
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	ws_stream_set_streams(ctx, (ctx->streams | ws_stream_from_name(cmd.subscribe)) &
+					   ~ws_stream_from_name(cmd.unsubscribe));
+	k_mutex_unlock(&slots_lock);
+}
+
+/* Set the batching of a viewer and tell it the values that apply */
+static int ws_stream_set_batch(struct ws_sensors_ctx *ctx, const struct ws_batch_command *cmd,
+			       bool has_latency)
+{
+	char ack[64];
+	int ret;
+
+	ctx->batch = CLAMP(cmd->batch, 1, CONFIG_APP_WS_BATCH_MAX);
+	if (has_latency) {
+		ctx->batch_latency_ms = CLAMP(cmd->latency_ms, 0, UINT16_MAX);
+	}
+
+	LOG_DBG("Batching %u samples, %u ms on socket %d", ctx->batch, ctx->batch_latency_ms,
+		ctx->sock);
+
+	ret = snprintf(ack, sizeof(ack), "{\"batching\":%u,\"latency_ms\":%u}", ctx->batch,
+		       ctx->batch_latency_ms);
+
+	return websocket_send_msg(ctx->sock, ack, ret, WEBSOCKET_OPCODE_DATA_TEXT, false, true,
+				  CONFIG_APP_WS_SEND_TIMEOUT_MS);
+}
+
+/* Switch the encoding of the sensor stream of a viewer, a delta stream starts with a keyframe */
+static int ws_stream_set_encoding(struct ws_sensors_ctx *ctx, const char *name)
+{
+	char ack[32];
+	int ret;
+
+	if (strcmp(name, "json") == 0) {
+		ctx->encoding = WS_ENCODING_JSON;
+#ifdef CONFIG_APP_SENSOR_DELTA
+	} else if (strcmp(name, "delta") == 0) {
+		ctx->encoding = WS_ENCODING_DELTA;
+		sensor_delta_resync(&ctx->delta);
+#endif // CONFIG_APP_SENSOR_DELTA
+	} else {
+		LOG_DBG("Unknown encoding %s", name);
+	}
+
+	ret = snprintf(ack, sizeof(ack), "{\"encoding\":\"%s\"}",
+		       ctx->encoding == WS_ENCODING_DELTA ? "delta" : "json");
+
+	return websocket_send_msg(ctx->sock, ack, ret, WEBSOCKET_OPCODE_DATA_TEXT, false, true,
+				  CONFIG_APP_WS_SEND_TIMEOUT_MS);
+}
+
+static int ws_stream_handle_text(struct ws_sensors_ctx *ctx, uint8_t *buf, size_t len)
+{
+	struct ws_ping_command cmd;
+	struct ws_batch_command batch;
+	struct ws_encoding_command encoding;
+	char pong[64];
+	int ret;
+
+	ret = json_obj_parse(buf, len, ws_ping_command_descr, ARRAY_SIZE(ws_ping_command_descr),
+			     &cmd);
+	if (ret != BIT_MASK(ARRAY_SIZE(ws_ping_command_descr))) {
+		// Not a ping, try the batching, the encoding and then a stream subscription
+		ret = json_obj_parse(buf, len, ws_batch_command_descr,
+				     ARRAY_SIZE(ws_batch_command_descr), &batch);
+		if (ret > 0 && (ret & BIT(0))) {
+			return ws_stream_set_batch(ctx, &batch, ret & BIT(1));
+		}
+
+		ret = json_obj_parse(buf, len, ws_encoding_command_descr,
+				     ARRAY_SIZE(ws_encoding_command_descr), &encoding);
+		if (ret > 0) {
+			return ws_stream_set_encoding(ctx, encoding.encoding);
+		}
+
+		ws_stream_handle_stream_command(ctx, buf, len);
+		return 0;
+	}
+
+	ret = snprintf(pong, sizeof(pong), "{\"pong\":%d,\"dev\":%lld}", cmd.ping,
+		       k_ticks_to_us_floor64(k_uptime_ticks()));
+
+	return websocket_send_msg(ctx->sock, pong, ret, WEBSOCKET_OPCODE_DATA_TEXT, false, true,
+				  CONFIG_APP_WS_SEND_TIMEOUT_MS);
+}
+
+/**
+ * @brief Handle the messages from the web page that are waiting on the socket.
+ *
+ * @return 0 if the connection is still open, negative error code otherwise.
+ */
+static int ws_stream_recv(struct ws_sensors_ctx *ctx)
+{
+	uint8_t rx_buf[64];
+	uint32_t message_type;
+	uint64_t remaining;
+	int ret;
+
+	while (true) {
+		ret = websocket_recv_msg(ctx->sock, rx_buf, sizeof(rx_buf) - 1, &message_type,
+					 &remaining, 0);
+		if (ret == -EAGAIN) {
+			return 0;
+		}
+
+		if (ret < 0) {
+			return ret;
+		}
+
+		if (message_type & WEBSOCKET_FLAG_CLOSE) {
+			return -ECONNRESET;
+		}
+
+		if (message_type & WEBSOCKET_FLAG_PING) {
+			ret = websocket_send_msg(ctx->sock, rx_buf, ret, WEBSOCKET_OPCODE_PONG,
+						 false, true, CONFIG_APP_WS_SEND_TIMEOUT_MS);
+		} else if ((message_type & WEBSOCKET_FLAG_TEXT) && remaining == 0) {
+			rx_buf[ret] = '\0';
+			ret = ws_stream_handle_text(ctx, rx_buf, ret);
+		}
+
+		if (ret < 0) {
+			return ret;
+		}
+	}
+}
+
+/* Release the slot of a viewer, from the streaming thread */
+static void ws_stream_close(struct ws_sensors_ctx *ctx)
+{
+	int sock = ctx->sock;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	ws_stream_set_streams(ctx, 0);
+	ctx->sock = -1;
+	k_mutex_unlock(&slots_lock);
+
+	(void)websocket_unregister(sock);
+	power_demand_put();
+}
+
+/* Whether a frame can be started on a socket without waiting for its TCP window */
+static bool ws_stream_writable(int sock)
+{
+	struct zsock_pollfd fd = {.fd = sock, .events = ZSOCK_POLLOUT};
+
+	return zsock_poll(&fd, 1, 0) == 1 && (fd.revents & ZSOCK_POLLOUT);
+}
+
+/* Send the posted frames to their subscribers */
+static void ws_stream_send_posted(void)
+{
+	struct ws_frame *frame;
+	int sock;
+	int ret;
+
+	while ((frame = k_fifo_get(&ws_frame_fifo, K_NO_WAIT)) != NULL) {
+		for (int i = 0; i < NUM_SLOTS; i++) {
+			k_mutex_lock(&slots_lock, K_FOREVER);
+			sock = (slots[i].streams & frame->stream) ? slots[i].sock : -1;
+			k_mutex_unlock(&slots_lock);
+
+			if (sock < 0) {
+				continue;
+			}
+
+			if (!ws_stream_writable(sock)) {
+				metrics_ws_frame_dropped(i);
+				continue;
+			}
+
+			ret = websocket_send_msg(sock, frame->data, frame->len,
+						 WEBSOCKET_OPCODE_DATA_TEXT, false, true,
+						 CONFIG_APP_WS_SEND_TIMEOUT_MS);
+			if (ret < 0) {
+				LOG_INF("Websocket frame stalled (%d), closing connection", ret);
+				metrics_ws_frame_dropped(i);
+				ws_stream_close(&slots[i]);
+			} else {
+				metrics_ws_frame_sent(i, frame->len);
+			}
+		}
+
+		k_heap_free(&ws_frame_heap, frame);
+	}
+}
+
+/* Sequence number of the next sample the acquisition thread will put in the ring */
+static uint32_t ws_stream_ring_head(void)
+{
+	uint32_t head = 0;
+
+	K_SPINLOCK(&ring_lock) {
+		head = ring_head;
+	}
+
+	return head;
+}
+
+/* Copy a sample out of the ring, returns false if it has been overwritten already */
+static bool ws_stream_ring_get(uint32_t seq, struct sensor_sample *sample)
+{
+	bool found = false;
+
+	K_SPINLOCK(&ring_lock) {
+		found = ring_head - seq - 1 < RING_LEN;
+		if (found) {
+			*sample = ring[seq % RING_LEN];
+		}
+	}
+
+	return found;
+}
+
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+// AIMD control of the sensor message rate of every viewer. Once per control period the rate is
+// halved if the link of the viewer showed congestion: a send that blocked longer than
+// CONFIG_APP_WS_RATE_SLOW_SEND_MS, or a round in which a message was due but the socket was not
+// writable. Otherwise it grows by CONFIG_APP_WS_RATE_STEP_HZ. Zephyr has no call for the fill level
+// of the TCP send buffer behind a websocket, the writability of the socket and the time a send
+// blocks stand in for it.
+//
+// The station RSSI is shared by all viewers and says nothing about the link of each one, it only
+// caps the rates at CONFIG_APP_WS_RATE_RSSI_MAX_HZ while it is below
+// CONFIG_APP_WS_RATE_RSSI_MIN_DBM. A viewer that keeps up stays at the cap.
+static int64_t rate_update_us;
+
+static void ws_stream_rate_update(int64_t now_us)
+{
+	uint16_t max_hz = CONFIG_APP_WS_RATE_MAX_HZ;
+	uint16_t rate_hz;
+
+	if (now_us < rate_update_us) {
+		return;
+	}
+	rate_update_us = now_us + CONFIG_APP_WS_RATE_PERIOD_MS * USEC_PER_MSEC;
+
+#ifdef CONFIG_WIFI
+	int rssi;
+
+	if (wifi_sta_get_rssi(&rssi) == 0 && rssi < CONFIG_APP_WS_RATE_RSSI_MIN_DBM) {
+		max_hz = CLAMP(CONFIG_APP_WS_RATE_RSSI_MAX_HZ, CONFIG_APP_WS_RATE_MIN_HZ, max_hz);
+	}
+#endif // CONFIG_WIFI
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		struct ws_sensors_ctx *ctx = &slots[i];
+
+		if (ctx->sock < 0) {
+			continue;
+		}
+
+		if (ctx->blocked > 0 ||
+		    ctx->send_us_max > CONFIG_APP_WS_RATE_SLOW_SEND_MS * USEC_PER_MSEC) {
+			rate_hz = MAX(ctx->rate_hz / 2, CONFIG_APP_WS_RATE_MIN_HZ);
+		} else {
+			rate_hz = ctx->rate_hz + CONFIG_APP_WS_RATE_STEP_HZ;
+		}
+		rate_hz = MIN(rate_hz, max_hz);
+
+		if (rate_hz < ctx->rate_hz) {
+			LOG_DBG("Slot %d down to %u Hz, blocked %u, send %u us, cap %u Hz", i,
+				rate_hz, ctx->blocked, ctx->send_us_max, max_hz);
+			ctx->rate_cuts++;
+		}
+
+		ctx->rate_hz = rate_hz;
+		ctx->blocked = 0;
+		ctx->send_us_max = 0;
+	}
+	k_mutex_unlock(&slots_lock);
+}
+
+/* Time in ms until the rate controller lets a viewer have its next message */
+static int64_t ws_stream_rate_wait_ms(const struct ws_sensors_ctx *ctx, int64_t now_us)
+{
+	int64_t next_us = ctx->last_msg_us + USEC_PER_SEC / ctx->rate_hz;
+
+	return next_us > now_us ? DIV_ROUND_UP(next_us - now_us, USEC_PER_MSEC) : 0;
+}
+#endif // CONFIG_APP_WS_RATE_CONTROL
+
+/* Time in ms until a viewer is due a message, 0 if it is due now, -1 if it has no new sample */
+static int ws_stream_batch_due(const struct ws_sensors_ctx *ctx, uint32_t head, int64_t now_us)
+{
+	uint32_t pending = head - ctx->next_seq;
+	int64_t first_us = now_us;
+	int64_t wait_ms = 0;
+	int64_t left_ms;
+
+	if (pending == 0) {
+		return -1;
+	}
+
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+	wait_ms = ws_stream_rate_wait_ms(ctx, now_us);
+#endif // CONFIG_APP_WS_RATE_CONTROL
+
+	if (pending >= ctx->batch) {
+		return wait_ms;
+	}
+
+	K_SPINLOCK(&ring_lock) {
+		first_us = ring[ctx->next_seq % RING_LEN].timestamp_us;
+	}
+
+	left_ms = ctx->batch_latency_ms - (now_us - first_us) / USEC_PER_MSEC;
+
+	return MAX(left_ms, wait_ms);
+}
+
+/* Bytes a message of len payload bytes takes on the wire, up to the IP layer */
+static uint32_t ws_stream_wire_bytes(size_t len)
+{
+	size_t frame = len + (len < 126 ? 2 : (len <= UINT16_MAX ? 4 : 10));
+
+	return frame + DIV_ROUND_UP(frame, WS_TCP_MSS) * WS_TCP_IP_HEADERS;
+}
+
+/**
+ * @brief Serialize tx->count samples from tx->first into a batch message in tx_buf.
+ *
+ * {"ts":<first sample>,"tx":<serialized>,"batch":[{"dt":0,...},{"dt":5000,...}]}, see
+ * sensors_sample_to_batch_json() for the entries. The samples that do not fit are left for the
+ * next message.
+ *
+ * @return Length of the message, negative error code if no sample could be serialized.
+ */
+static int ws_stream_render_batch(struct ws_tx *tx)
+{
+	struct sensor_sample sample;
+	int64_t base_us = 0;
+	uint32_t i;
+	size_t off = 0;
+	size_t sep;
+	int ret = -ENODATA;
+
+	tx->samples = 0;
+
+	for (i = 0; i < tx->count; i++) {
+		// Samples overwritten since the poll are skipped
+		if (!ws_stream_ring_get(tx->first + i, &sample)) {
+			continue;
+		}
+
+		if (tx->samples == 0) {
+			base_us = sample.timestamp_us;
+			off = snprintf(tx_buf, sizeof(tx_buf), "{\"ts\":%lld,\"tx\":%lld,\"batch\":[",
+				       base_us, k_ticks_to_us_floor64(k_uptime_ticks()));
+		}
+
+		// Leave room for the separator and the closing "]}"
+		sep = tx->samples > 0;
+		ret = sensors_sample_to_batch_json(&sample, base_us, tx_buf + off + sep,
+						   sizeof(tx_buf) - off - sep - 2);
+		if (ret < 0) {
+			break;
+		}
+
+		if (sep) {
+			tx_buf[off] = ',';
+		}
+		off += sep + ret;
+		tx->samples++;
+	}
+
+	if (tx->samples == 0) {
+		// Skip a sample that does not fit at all, it never will
+		tx->consumed = MIN(i + 1, tx->count);
+		return ret;
+	}
+
+	tx->consumed = i;
+	memcpy(tx_buf + off, "]}", 2);
+
+	return off + 2;
+}
+
+#ifdef CONFIG_APP_SENSOR_DELTA
+/**
+ * @brief Encode tx->count samples from tx->first into a binary delta message in tx_buf.
+ *
+ * SENSOR_DELTA_VERSION, then the time in microseconds from the first sample to the serialization
+ * as a varint, then a record per sample, see sensor_delta.h. The samples that do not fit are left
+ * for the next message.
+ *
+ * @return Length of the message, negative error code if no sample could be encoded.
+ */
+static int ws_stream_render_delta(struct ws_sensors_ctx *ctx, struct ws_tx *tx)
+{
+	uint8_t *buf = (uint8_t *)tx_buf;
+	struct sensor_sample sample;
+	int64_t lag_us;
+	uint32_t i;
+	size_t off = 0;
+	int ret = -ENODATA;
+
+	tx->samples = 0;
+
+	for (i = 0; i < tx->count; i++) {
+		// Samples overwritten since the poll are skipped, the gap makes the next one a keyframe
+		if (!ws_stream_ring_get(tx->first + i, &sample)) {
+			continue;
+		}
+
+		if (tx->samples == 0) {
+			lag_us = k_ticks_to_us_floor64(k_uptime_ticks()) - sample.timestamp_us;
+			buf[0] = SENSOR_DELTA_VERSION;
+			off = 1 + sensor_delta_put_varint(buf + 1, MAX(lag_us, 0));
+		}
+
+		ret = sensor_delta_encode(&ctx->delta, &sample, tx->first + i, buf + off,
+					  sizeof(tx_buf) - off);
+		if (ret < 0) {
+			break;
+		}
+
+		off += ret;
+		tx->samples++;
+	}
+
+	if (tx->samples == 0) {
+		tx->consumed = MIN(i + 1, tx->count);
+		return ret;
+	}
+
+	tx->consumed = i;
+
+	return off;
+}
+#endif // CONFIG_APP_SENSOR_DELTA
+
+/* Serialize the samples a viewer is due into tx_buf, unless the round already did */
+static int ws_stream_render(struct ws_sensors_ctx *ctx, uint32_t head, struct ws_tx *tx)
+{
+	struct sensor_sample sample;
+	uint32_t first;
+	int ret = -ENOTSUP;
+
+	// A viewer that fell behind skips to the samples of its latest batch
+	first = head - MIN(head - ctx->next_seq, ctx->batch);
+
+	// A delta message only fits the viewer it was encoded for
+	if (tx->len > 0 && tx->encoding == WS_ENCODING_JSON && ctx->encoding == WS_ENCODING_JSON &&
+	    tx->first == first && tx->count == head - first && tx->batched == (ctx->batch > 1)) {
+		return 0;
+	}
+
+	tx->first = first;
+	tx->count = head - first;
+	tx->encoding = ctx->encoding;
+	tx->batched = ctx->batch > 1;
+	tx->len = 0;
+
+	if (tx->encoding == WS_ENCODING_DELTA) {
+#ifdef CONFIG_APP_SENSOR_DELTA
+		ret = ws_stream_render_delta(ctx, tx);
+#endif // CONFIG_APP_SENSOR_DELTA
+	} else if (tx->batched) {
+		ret = ws_stream_render_batch(tx);
+	} else {
+		tx->consumed = 1;
+		tx->samples = 1;
+		ret = ws_stream_ring_get(first, &sample)
+			      ? sensors_sample_to_json(&sample, tx_buf, sizeof(tx_buf))
+			      : -ENODATA;
+	}
+
+	if (ret < 0) {
+		return ret;
+	}
+
+	tx->len = ret;
+
+	return 0;
+}
+
+/* Send the samples a viewer is due, returns a negative error code if the connection broke */
+static int ws_stream_send_samples(int slot, uint32_t head, struct ws_tx *tx)
+{
+	struct ws_sensors_ctx *ctx = &slots[slot];
+	int ret;
+
+	ret = ws_stream_render(ctx, head, tx);
+	if (tx->first != ctx->next_seq) {
+		// The samples the viewer had no room for are lost
+		metrics_ws_frame_dropped(slot);
+	}
+	if (ret < 0) {
+		// Only these samples are lost, the connection stays open
+		LOG_ERR("Unable to collect sensor data, err %d", ret);
+		metrics_ws_frame_dropped(slot);
+		ctx->next_seq = tx->first + tx->consumed;
+		return 0;
+	}
+
+	timing_t span = profiler_span_begin();
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+	int64_t start_ticks = k_uptime_ticks();
+#endif // CONFIG_APP_WS_RATE_CONTROL
+
+	ret = websocket_send_msg(ctx->sock, tx_buf, tx->len,
+				 tx->encoding == WS_ENCODING_DELTA ? WEBSOCKET_OPCODE_DATA_BINARY
+								   : WEBSOCKET_OPCODE_DATA_TEXT,
+				 false, true, CONFIG_APP_WS_SEND_TIMEOUT_MS);
+	profiler_span_end(PROFILER_SPAN_WS_SEND, span);
+	if (ret < 0) {
+		// The socket was writable, so the frame started and the rest did not follow
+		LOG_INF("Websocket frame stalled (%d), closing connection", ret);
+		metrics_ws_frame_dropped(slot);
+		return ret;
+	}
+
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+	uint32_t send_us = k_ticks_to_us_ceil32(k_uptime_ticks() - start_ticks);
+
+	ctx->send_us_max = MAX(ctx->send_us_max, send_us);
+	ctx->last_msg_us = k_ticks_to_us_floor64(start_ticks);
+#endif // CONFIG_APP_WS_RATE_CONTROL
+
+	metrics_ws_frame_sent(slot, tx->len);
+	ctx->next_seq = tx->first + tx->consumed;
+	ctx->samples_sent += tx->samples;
+	ctx->sample_bytes += ws_stream_wire_bytes(tx->len);
+
+	return 0;
+}
+
+static void ws_stream_thread(void *arg1, void *arg2, void *arg3)
+{
+	struct zsock_pollfd fds[1 + NUM_SLOTS];
+	int slot_of[ARRAY_SIZE(fds)];
+	zvfs_eventfd_t value;
+	struct ws_tx tx;
+	uint32_t head;
+	int64_t now_us;
+	int timeout_ms;
+	int due_ms;
+	int nfds;
+	int ret;
+
+	while (true) {
+		head = ws_stream_ring_head();
+		now_us = k_ticks_to_us_floor64(k_uptime_ticks());
+		timeout_ms = SYS_FOREVER_MS;
+
+		fds[0].fd = wake_fd;
+		fds[0].events = ZSOCK_POLLIN;
+		nfds = 1;
+
+		k_mutex_lock(&slots_lock, K_FOREVER);
+		for (int i = 0; i < NUM_SLOTS; i++) {
+			if (slots[i].sock < 0) {
+				continue;
+			}
+
+			fds[nfds].fd = slots[i].sock;
+			fds[nfds].events = ZSOCK_POLLIN;
+			if (slots[i].streams & WS_STREAM_SENSORS) {
+				due_ms = ws_stream_batch_due(&slots[i], head, now_us);
+				if (due_ms == 0) {
+					fds[nfds].events |= ZSOCK_POLLOUT;
+				} else if (due_ms > 0 && (timeout_ms < 0 || due_ms < timeout_ms)) {
+					timeout_ms = due_ms;
+				}
+			}
+			slot_of[nfds] = i;
+			nfds++;
+		}
+		k_mutex_unlock(&slots_lock);
+
+		ret = zsock_poll(fds, nfds, timeout_ms);
+		if (ret < 0) {
+			LOG_ERR("Poll failed, errno %d", errno);
+			k_sleep(K_MSEC(100));
+			continue;
+		}
+
+		if (fds[0].revents & ZSOCK_POLLIN) {
+			(void)zvfs_eventfd_read(wake_fd, &value);
+		}
+
+		ws_stream_send_posted();
+
+		tx.len = 0;
+		for (int n = 1; n < nfds; n++) {
+			struct ws_sensors_ctx *ctx = &slots[slot_of[n]];
+
+			// Closed since the poll, by a posted frame that stalled
+			if (ctx->sock != fds[n].fd) {
+				continue;
+			}
+
+			if (fds[n].revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP | ZSOCK_POLLNVAL)) {
+				LOG_INF("Websocket on slot %d closed", slot_of[n]);
+				ws_stream_close(ctx);
+				continue;
+			}
+
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+			// The TCP send buffer is full while a due viewer's socket is not writable
+			if ((fds[n].events & ZSOCK_POLLOUT) && !(fds[n].revents & ZSOCK_POLLOUT)) {
+				ctx->blocked = MIN(ctx->blocked + 1, UINT16_MAX);
+			}
+#endif // CONFIG_APP_WS_RATE_CONTROL
+
+			if (fds[n].revents & ZSOCK_POLLIN) {
+				ret = ws_stream_recv(ctx);
+				if (ret < 0) {
+					LOG_INF("Websocket closed by peer (%d)", ret);
+					ws_stream_close(ctx);
+					continue;
+				}
+			}
+
+			if ((fds[n].revents & ZSOCK_POLLOUT) && (ctx->streams & WS_STREAM_SENSORS)) {
+				ret = ws_stream_send_samples(slot_of[n], head, &tx);
+				if (ret < 0) {
+					ws_stream_close(ctx);
+				}
+			}
+		}
+
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+		ws_stream_rate_update(k_ticks_to_us_floor64(k_uptime_ticks()));
+#endif // CONFIG_APP_WS_RATE_CONTROL
+	}
+}
+
+void ws_stream_post(uint32_t stream, const char *json, size_t len)
+{
+	struct ws_frame *frame;
+
+	frame = k_heap_alloc(&ws_frame_heap, sizeof(*frame) + len, K_NO_WAIT);
+	if (frame == NULL) {
+		atomic_inc(&frames_dropped);
+		return;
+	}
+
+	frame->stream = stream;
+	frame->len = len;
+	memcpy(frame->data, json, len);
+
+	k_fifo_put(&ws_frame_fifo, frame);
+	ws_stream_wake();
+}
+
+#ifdef CONFIG_APP_SPECTRUM
+static void ws_spectrum_on_frame(const char *json, size_t len)
+{
+	ws_stream_post(WS_STREAM_SPECTRUM, json, len);
+}
+#endif // CONFIG_APP_SPECTRUM
+
+#ifdef CONFIG_APP_MOTION
+static void ws_motion_on_event(const char *json, size_t len)
+{
+	ws_stream_post(WS_STREAM_EVENTS, json, len);
+}
+
+static struct motion_listener ws_motion_listener = {
+	.on_event = ws_motion_on_event,
+};
+#endif // CONFIG_APP_MOTION
+
+/* Called by the acquisition thread for every new sample */
+static void ws_stream_on_sample(const struct sensor_sample *sample)
+{
+	K_SPINLOCK(&ring_lock) {
+		ring[ring_head % RING_LEN] = *sample;
+		ring_head++;
+	}
+
+	ws_stream_wake();
+}
+
+static struct sensors_listener ws_stream_listener = {
+	.on_sample = ws_stream_on_sample,
+};
+
+int ws_stream_setup(int ws_socket, void *user_data)
+{
+	ARG_UNUSED(user_data);
+
+	uint32_t head;
+	int slot = -1;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		if (slots[i].sock < 0) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (slot < 0) {
+		k_mutex_unlock(&slots_lock);
+		LOG_ERR("No free slot for sensor websocket");
+		return -ENOMEM;
+	}
+
+	// Resume the sensors before the first frame is due
+	power_demand_get();
+
+	// The latest sample goes out at once, then the viewer gets a frame per sample until it asks
+	// for batches
+	head = ws_stream_ring_head();
+	slots[slot].next_seq = head > 0 ? head - 1 : 0;
+	slots[slot].batch = 1;
+	slots[slot].encoding = WS_ENCODING_JSON;
+	slots[slot].batch_latency_ms = CONFIG_APP_WS_BATCH_LATENCY_MS;
+	slots[slot].samples_sent = 0;
+	slots[slot].sample_bytes = 0;
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+	slots[slot].rate_hz = CONFIG_APP_WS_RATE_MAX_HZ;
+	slots[slot].blocked = 0;
+	slots[slot].send_us_max = 0;
+	slots[slot].rate_cuts = 0;
+	slots[slot].last_msg_us = 0;
+#endif // CONFIG_APP_WS_RATE_CONTROL
+	ws_stream_set_streams(&slots[slot], WS_STREAM_SENSORS);
+	slots[slot].sock = ws_socket;
+	k_mutex_unlock(&slots_lock);
+
+	ws_stream_wake();
+
+	LOG_INF("Sensor websocket setup on slot %d, socket %d", slot, ws_socket);
+
+	return 0;
+}
+
+//////////////////////////////////////// Metrics //////////////////////////////////////////
+
+#ifdef CONFIG_APP_METRICS
+static void ws_stream_collect(struct metrics_writer *w)
+{
+	int viewers = 0;
+
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		viewers += slots[i].sock >= 0;
+	}
+	k_mutex_unlock(&slots_lock);
+
+	metrics_header(w, "thingy_ws_viewers", "gauge", "Connected websocket viewers");
+	metrics_printf(w, "thingy_ws_viewers %d\n", viewers);
+
+	metrics_header(w, "thingy_ws_viewer_slots", "gauge", "Websocket viewer slots");
+	metrics_printf(w, "thingy_ws_viewer_slots %d\n", NUM_SLOTS);
+
+	metrics_header(w, "thingy_ws_viewer_bytes", "gauge",
+		       "Application RAM per viewer slot, without the network stack");
+	metrics_printf(w, "thingy_ws_viewer_bytes %u\n", (uint32_t)WS_VIEWER_BYTES);
+
+	metrics_header(w, "thingy_ws_samples_sent_total", "counter",
+		       "Sensor samples sent per websocket slot, since its viewer connected");
+	k_mutex_lock(&slots_lock, K_FOREVER);
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		metrics_printf(w, "thingy_ws_samples_sent_total{slot=\"%d\"} %u\n", i,
+			       slots[i].samples_sent);
+	}
+
+	metrics_header(w, "thingy_ws_bytes_per_sample", "gauge",
+		       "Bytes per sensor sample on the wire per websocket slot, with the websocket "
+		       "and TCP/IP headers");
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		metrics_printf(w, "thingy_ws_bytes_per_sample{slot=\"%d\"} %u\n", i,
+			       slots[i].samples_sent > 0
+				       ? (uint32_t)(slots[i].sample_bytes / slots[i].samples_sent)
+				       : 0);
+	}
+
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+	metrics_header(w, "thingy_ws_rate_hz", "gauge",
+		       "Sensor messages per second the rate controller allows per websocket slot");
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		metrics_printf(w, "thingy_ws_rate_hz{slot=\"%d\"} %u\n", i,
+			       slots[i].sock >= 0 ? slots[i].rate_hz : 0);
+	}
+
+	metrics_header(w, "thingy_ws_rate_cuts_total", "counter",
+		       "Times the rate controller lowered the rate per websocket slot, since its "
+		       "viewer connected");
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		metrics_printf(w, "thingy_ws_rate_cuts_total{slot=\"%d\"} %u\n", i,
+			       slots[i].rate_cuts);
+	}
+#endif // CONFIG_APP_WS_RATE_CONTROL
+	k_mutex_unlock(&slots_lock);
+
+	metrics_header(w, "thingy_ws_posted_frames_dropped_total", "counter",
+		       "Spectrum and event frames dropped because the queue was full");
+	metrics_printf(w, "thingy_ws_posted_frames_dropped_total %u\n",
+		       (uint32_t)atomic_get(&frames_dropped));
+}
+
+static struct metrics_collector ws_stream_collector = {
+	.collect = ws_stream_collect,
+};
+#endif // CONFIG_APP_METRICS
+
+static int ws_stream_init(void)
+{
+	k_tid_t tid;
+
+	http_resources_get_ws_ctx(&slots);
+
+	for (int i = 0; i < NUM_SLOTS; i++) {
+		slots[i].sock = -1;
+		slots[i].streams = 0;
+		slots[i].samples_sent = 0;
+		slots[i].sample_bytes = 0;
+#ifdef CONFIG_APP_WS_RATE_CONTROL
+		slots[i].rate_cuts = 0;
+#endif // CONFIG_APP_WS_RATE_CONTROL
+	}
+
+	wake_fd = zvfs_eventfd(0, ZVFS_EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		LOG_ERR("Failed to create the eventfd, errno %d", errno);
+		return 0;
+	}
+
+	sensors_add_listener(&ws_stream_listener);
+#ifdef CONFIG_APP_SPECTRUM
+	spectrum_set_frame_cb(ws_spectrum_on_frame);
+#endif // CONFIG_APP_SPECTRUM
+#ifdef CONFIG_APP_MOTION
+	motion_add_listener(&ws_motion_listener);
+#endif // CONFIG_APP_MOTION
+
+	tid = k_thread_create(&ws_stream_thread_data, ws_stream_stack_area,
+			      K_THREAD_STACK_SIZEOF(ws_stream_stack_area), ws_stream_thread, NULL,
+			      NULL, NULL, 8, 0, K_NO_WAIT);
+	k_thread_name_set(tid, "ws_stream");
+
+#ifdef CONFIG_APP_METRICS
+	metrics_register_collector(&ws_stream_collector);
+#endif // CONFIG_APP_METRICS
+
+	LOG_INF("Streaming to up to %d viewers, %u bytes each", NUM_SLOTS,
+		(uint32_t)WS_VIEWER_BYTES);
+
+	return 0;
+}
+SYS_INIT(ws_stream_init, APPLICATION, 0);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Websocket upgrade callback, hands a new viewer to the streaming thread.
+ *
+ * @return 0 if successful, -ENOMEM if all viewer slots are taken.
+ */
+int ws_stream_setup(int ws_socket, void *user_data);
+
+/**
+ * @brief Queue a frame for the viewers subscribed to a stream.
+ *
+ * The frame is copied, so the caller may reuse its buffer at once. Frames that do not fit in the
+ * queue are dropped.
+ *
+ * @param stream One of WS_STREAM_*.
+ */
+void ws_stream_post(uint32_t stream, const char *json, size_t len);
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""Write motion.tses, the session the delta encoding benchmark replays.
+
+A Thingy picked up from a table, carried and tilted for 5 s: the BMI270 at 200 Hz on +-4 g and
++-1000 dps, the ADXL367 at 100 Hz and the BME680 every second. The values are in the orientation
+of the drivers, quantized to the LSBs of the sensors, with the noise of their datasheets. The
+session format is described in src/sensor_replay.h.
+
+Usage: make_motion.py [<out>]
+"""
+
+import math
+import random
+import struct
+import sys
+
+SESSION_HEADER = struct.Struct("<IHHII")
+SESSION_RECORD = struct.Struct("<II")
+SESSION_MAGIC = 0x53455354
+SESSION_VERSION = 1
+CHANNELS = 16
+
+GRAVITY = 9.80665
+DURATION_US = 5_000_000
+
+BMI270_VALID = 0x3F
+ADXL367_VALID = 0x7 << 6
+BME680_VALID = 0xF << 9
+
+BMI270_ACCEL_LSB = 4 * GRAVITY / 32768
+BMI270_GYRO_LSB = math.radians(1000) / 32768
+ADXL367_LSB = 0.00025 * GRAVITY
+BMI270_ACCEL_NOISE = 0.0016 * GRAVITY  # 160 ug/sqrt(Hz) over 100 Hz
+BMI270_GYRO_NOISE = math.radians(0.1)
+ADXL367_NOISE = 0.0013 * GRAVITY
+
+
+def quantize(value, lsb):
+    return round(value / lsb) * lsb
+
+
+def motion(t):
+    """Acceleration in m/s^2 and rotation in rad/s of the board at t seconds"""
+    # At rest for 1 s, then lifted and carried with a 1.8 Hz gait, tilted back and forth
+    ramp = min(max(t - 1.0, 0.0), 0.5) / 0.5
+    tilt = ramp * 0.35 * math.sin(2 * math.pi * 0.4 * t)
+    gait = ramp * 0.15 * GRAVITY * math.sin(2 * math.pi * 1.8 * t)
+    accel = (GRAVITY * math.sin(tilt) + 0.3 * gait,
+             0.2 * gait * math.cos(2 * math.pi * 0.9 * t),
+             GRAVITY * math.cos(tilt) + gait)
+    tilt_rate = ramp * 0.35 * 2 * math.pi * 0.4 * math.cos(2 * math.pi * 0.4 * t)
+    gyro = (0.1 * tilt_rate, tilt_rate, ramp * 0.2 * math.sin(2 * math.pi * 0.25 * t))
+    return accel, gyro
+
+
+def main():
+    out = sys.argv[1] if len(sys.argv) > 1 else "motion.tses"
+    rng = random.Random(91)
+    records = []
+
+    for n in range(DURATION_US // 5000):
+        t_us = n * 5000
+        accel, gyro = motion(t_us / 1e6)
+        valid = BMI270_VALID
+        # The BMI270 is turned 180 degrees around z on the board, see src/sensor_channels.h
+        values = [quantize(-accel[0] + rng.gauss(0, BMI270_ACCEL_NOISE), BMI270_ACCEL_LSB),
+                  quantize(-accel[1] + rng.gauss(0, BMI270_ACCEL_NOISE), BMI270_ACCEL_LSB),
+                  quantize(accel[2] + rng.gauss(0, BMI270_ACCEL_NOISE), BMI270_ACCEL_LSB),
+                  quantize(-gyro[0] + rng.gauss(0, BMI270_GYRO_NOISE), BMI270_GYRO_LSB),
+                  quantize(-gyro[1] + rng.gauss(0, BMI270_GYRO_NOISE), BMI270_GYRO_LSB),
+                  quantize(gyro[2] + rng.gauss(0, BMI270_GYRO_NOISE), BMI270_GYRO_LSB)]
+
+        if n % 2 == 0:
+            valid |= ADXL367_VALID
+            values += [quantize(a + rng.gauss(0, ADXL367_NOISE), ADXL367_LSB) for a in accel]
+
+        if n % 200 == 0:
+            valid |= BME680_VALID
+            values += [23.41 + 0.01 * n / 200, 101.3252 - 0.0012 * n / 200,
+                       41.2 + 0.05 * n / 200, 85200.0 + 140 * n / 200]
+
+        records.append(SESSION_RECORD.pack(t_us, valid) + struct.pack(f"<{len(values)}f", *values))
+
+    with open(out, "wb") as f:
+        f.write(SESSION_HEADER.pack(SESSION_MAGIC, SESSION_VERSION, CHANNELS, len(records),
+                                    DURATION_US))
+        f.writelines(records)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,29 @@
+/* Host side of the benchmark clock. The simulated time of native_sim does not advance while code
+ * runs, so the benchmarks read the host clocks instead.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+uint64_t bench_host_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Host CPU cycles, or 0 where there is no cycle counter readable from user space */
+uint64_t bench_host_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
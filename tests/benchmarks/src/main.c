@@ -0,0 +1,349 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "http_resources.h"
+#include "led.h"
+#include "location_api.h"
+#include "sensor_delta.h"
+#include "sensors.h"
+
+// Micro-benchmarks of the per-frame and per-request hot paths. Every benchmark checks the result of
+// the code under test, then reports the time and host cycles per call over CONFIG_BENCH_ITERATIONS
+// calls and the stack of one call, and fails when either is over its budget.
+
+uint64_t bench_host_clock_ns(void);
+uint64_t bench_host_cycles(void);
+
+#define BENCH_PAINT 0xAA
+
+struct bench_result {
+	uint64_t ns_per_call;
+	uint64_t cycles_per_call;
+	size_t stack_bytes;
+};
+
+static uintptr_t paint_bottom;
+
+/* Fill the stack below the caller with a pattern, the frames of the next call overwrite it */
+static __noinline void bench_paint_stack(void)
+{
+	volatile uint8_t area[CONFIG_BENCH_STACK_PAINT_SIZE];
+
+	for (size_t i = 0; i < sizeof(area); i++) {
+		area[i] = BENCH_PAINT;
+	}
+	paint_bottom = (uintptr_t)&area[0];
+}
+
+/* Stack used by one call of fn, the stack grows down on all the supported hosts */
+static __noinline size_t bench_stack(void (*fn)(void))
+{
+	volatile uint8_t marker = 0;
+	const volatile uint8_t *painted;
+	size_t untouched = 0;
+
+	bench_paint_stack();
+	fn();
+
+	painted = (const volatile uint8_t *)paint_bottom;
+	while (untouched < CONFIG_BENCH_STACK_PAINT_SIZE && painted[untouched] == BENCH_PAINT) {
+		untouched++;
+	}
+
+	return (uintptr_t)&marker - (paint_bottom + untouched);
+}
+
+static void bench_run(const char *name, void (*fn)(void), uint32_t iterations, uint32_t budget_ns,
+		      struct bench_result *result)
+{
+	uint64_t start_ns, start_cycles;
+
+	// Warm the caches and the lazily initialized state first
+	fn();
+
+	start_cycles = bench_host_cycles();
+	start_ns = bench_host_clock_ns();
+	for (uint32_t i = 0; i < iterations; i++) {
+		fn();
+	}
+	result->ns_per_call = (bench_host_clock_ns() - start_ns) / iterations;
+	result->cycles_per_call = (bench_host_cycles() - start_cycles) / iterations;
+	result->stack_bytes = bench_stack(fn);
+
+	TC_PRINT("%-20s %8llu ns %10llu cycles %6zu B stack (budget %u ns, %u B)\n", name,
+		 result->ns_per_call, result->cycles_per_call, result->stack_bytes, budget_ns,
+		 CONFIG_BENCH_STACK_BUDGET);
+
+	zassert_true(result->ns_per_call <= budget_ns, "%s: %llu ns per call, budget %u ns", name,
+		     result->ns_per_call, budget_ns);
+	zassert_true(result->stack_bytes <= CONFIG_BENCH_STACK_BUDGET, "%s: %zu B of stack, budget %u B",
+		     name, result->stack_bytes, CONFIG_BENCH_STACK_BUDGET);
+}
+
+//////////////////////////////////////// Sensors //////////////////////////////////////////
+
+static struct sensor_sample json_sample;
+static char json_buf[1024];
+static int json_len;
+
+static void bench_sample_to_json(void)
+{
+	json_len = sensors_sample_to_json(&json_sample, json_buf, sizeof(json_buf));
+}
+
+ZTEST(hot_paths, test_sample_to_json)
+{
+	struct bench_result result;
+	char valid[32];
+
+	json_sample.timestamp_us = 123456789;
+	json_sample.valid = BIT_MASK(NUM_SENSOR_MEASUREMENTS);
+	for (int i = 0; i < NUM_SENSOR_MEASUREMENTS; i++) {
+		json_sample.data[i] = -9.80665 * (i + 1);
+	}
+
+	bench_run("sample_to_json", bench_sample_to_json, CONFIG_BENCH_ITERATIONS,
+		  CONFIG_BENCH_BUDGET_SAMPLE_TO_JSON_NS, &result);
+
+	zassert_true(json_len > 0 && json_len < sizeof(json_buf), "JSON length %d", json_len);
+	zassert_equal(json_buf[0], '{');
+	zassert_equal(json_buf[json_len - 1], '}');
+	zassert_not_null(strstr(json_buf, "\"bmi270_ax\":-9.806650,"));
+	snprintf(valid, sizeof(valid), "\"valid\":%u,", json_sample.valid);
+	zassert_not_null(strstr(json_buf, valid));
+}
+
+static struct sensor_sample measure_sample;
+static int measure_ret;
+
+static void bench_sensor_measure(void)
+{
+	measure_ret = sensor_measure(&measure_sample);
+}
+
+ZTEST(hot_paths, test_sensor_measure)
+{
+	struct bench_result result;
+
+	sensors_adxl367_subscribe();
+	bench_run("sensor_measure", bench_sensor_measure, CONFIG_BENCH_ITERATIONS,
+		  CONFIG_BENCH_BUDGET_SENSOR_MEASURE_NS, &result);
+	sensors_adxl367_unsubscribe();
+
+	zassert_ok(measure_ret);
+	zassert_equal(measure_sample.valid & (SENSORS_VALID_BMI270 | SENSORS_VALID_ADXL367),
+		      SENSORS_VALID_BMI270 | SENSORS_VALID_ADXL367, "valid 0x%x",
+		      measure_sample.valid);
+	// The accelerometers see gravity on z, the replayed motion adds up to 0.25 g
+	zassert_within(measure_sample.data[SENSOR_CH_BMI270_AZ], 9.81, 2.5);
+	zassert_within(measure_sample.data[SENSOR_CH_ADXL_AZ], 9.81, 2.5);
+}
+
+//////////////////////////////////////// Delta encoding //////////////////////////////////////////
+
+// Samples taken every CONFIG_BENCH_DELTA_INTERVAL_US from the motion session of sessions/, or from
+// the session given with --replay=<session>. The size is checked against the binary struct
+// sensor_frame of the UDP and MQTT streams, and reported against the JSON frames the websocket
+// stream sends for the same samples without the delta encoding.
+static struct sensor_sample delta_samples[CONFIG_BENCH_DELTA_SAMPLES];
+static uint8_t delta_buf[CONFIG_BENCH_DELTA_SAMPLES * SENSOR_DELTA_MAX_RECORD];
+static size_t delta_len;
+static char delta_json[512];
+
+#define DELTA_VALID (SENSORS_VALID_BMI270 | SENSORS_VALID_ADXL367 | SENSORS_VALID_BME680)
+
+static void bench_delta_encode(void)
+{
+	struct sensor_delta_state state = {0};
+	int ret;
+
+	delta_len = 0;
+	for (int i = 0; i < CONFIG_BENCH_DELTA_SAMPLES; i++) {
+		ret = sensor_delta_encode(&state, &delta_samples[i], i, delta_buf + delta_len,
+					  sizeof(delta_buf) - delta_len);
+		if (ret < 0) {
+			return;
+		}
+		delta_len += ret;
+	}
+}
+
+ZTEST(hot_paths, test_delta_encode)
+{
+	struct sensor_delta_state state = {0};
+	struct bench_result result;
+	struct sensor_sample sample;
+	size_t frames_len = CONFIG_BENCH_DELTA_SAMPLES * sizeof(struct sensor_frame);
+	size_t json_len = 0;
+	uint32_t ratio_x10;
+	uint32_t json_ratio_x10;
+	uint32_t seq;
+	size_t off = 0;
+	int ret;
+
+	sensors_adxl367_subscribe();
+	for (int i = 0; i < CONFIG_BENCH_DELTA_SAMPLES; i++) {
+		k_sleep(K_USEC(CONFIG_BENCH_DELTA_INTERVAL_US));
+		zassert_ok(sensor_measure(&delta_samples[i]));
+		zassert_equal(delta_samples[i].valid & DELTA_VALID, DELTA_VALID,
+			      "sample %d valid 0x%x", i, delta_samples[i].valid);
+
+		ret = sensors_sample_to_json(&delta_samples[i], delta_json, sizeof(delta_json));
+		zassert_true(ret > 0);
+		json_len += ret;
+	}
+	sensors_adxl367_unsubscribe();
+
+	bench_run("delta_encode", bench_delta_encode, CONFIG_BENCH_DELTA_ITERATIONS,
+		  CONFIG_BENCH_BUDGET_DELTA_ENCODE_NS * CONFIG_BENCH_DELTA_SAMPLES, &result);
+
+	ratio_x10 = 10 * frames_len / delta_len;
+	json_ratio_x10 = 10 * json_len / delta_len;
+	TC_PRINT("%-20s %8zu B for %u samples, %u.%u B per sample, %u.%ux smaller than %zu B frames\n",
+		 "delta_size", delta_len, CONFIG_BENCH_DELTA_SAMPLES,
+		 (uint32_t)(10 * delta_len / CONFIG_BENCH_DELTA_SAMPLES) / 10,
+		 (uint32_t)(10 * delta_len / CONFIG_BENCH_DELTA_SAMPLES) % 10, ratio_x10 / 10,
+		 ratio_x10 % 10, frames_len);
+	TC_PRINT("%-20s %8zu B, %u.%ux the delta stream\n", "delta_json_size", json_len,
+		 json_ratio_x10 / 10, json_ratio_x10 % 10);
+
+	// Every sample comes back within half a step of every channel, see sensor_channels.h
+	for (int i = 0; i < CONFIG_BENCH_DELTA_SAMPLES; i++) {
+		ret = sensor_delta_decode(&state, delta_buf + off, delta_len - off, &sample, &seq);
+		zassert_true(ret > 0, "record %d: %d", i, ret);
+		off += ret;
+
+		zassert_equal(seq, i);
+		zassert_equal(sample.timestamp_us, delta_samples[i].timestamp_us);
+		zassert_equal(sample.valid, delta_samples[i].valid);
+		zassert_within(sample.data[SENSOR_CH_BMI270_AZ],
+			       delta_samples[i].data[SENSOR_CH_BMI270_AZ], 0.0003 + 1e-9);
+		zassert_within(sample.data[SENSOR_CH_BMI270_GX],
+			       delta_samples[i].data[SENSOR_CH_BMI270_GX], 0.00025 + 1e-9);
+		zassert_within(sample.data[SENSOR_CH_BME680_PRESSURE],
+			       delta_samples[i].data[SENSOR_CH_BME680_PRESSURE], 0.0001 + 1e-9);
+	}
+	zassert_equal(off, delta_len);
+
+	zassert_true(ratio_x10 >= CONFIG_BENCH_DELTA_MIN_RATIO_X10,
+		     "%u.%ux smaller than the frames, target %u.%ux", ratio_x10 / 10,
+		     ratio_x10 % 10, CONFIG_BENCH_DELTA_MIN_RATIO_X10 / 10,
+		     CONFIG_BENCH_DELTA_MIN_RATIO_X10 % 10);
+}
+
+//////////////////////////////////////// Location //////////////////////////////////////////
+
+// Like the scan result handler with CONFIG_BENCH_AP_COUNT access points in range
+static char ap_macs[CONFIG_BENCH_AP_COUNT][sizeof("xx:xx:xx:xx:xx:xx")];
+static char ap_buf[CONFIG_BENCH_AP_COUNT * 64];
+static struct location_api_aps ap_list;
+
+static void bench_ap_list(void)
+{
+	ap_list = (struct location_api_aps)LOCATION_API_APS_INIT(ap_buf);
+
+	for (int i = 0; i < CONFIG_BENCH_AP_COUNT; i++) {
+		if (location_api_aps_append(&ap_list, ap_macs[i], -40 - (i % 50))) {
+			break;
+		}
+	}
+}
+
+ZTEST(hot_paths, test_ap_list)
+{
+	struct bench_result result;
+
+	for (int i = 0; i < CONFIG_BENCH_AP_COUNT; i++) {
+		snprintf(ap_macs[i], sizeof(ap_macs[i]), "F6:CE:36:%02X:%02X:%02X", i >> 16,
+			 (i >> 8) & 0xff, i & 0xff);
+	}
+
+	bench_run("ap_list", bench_ap_list, CONFIG_BENCH_ITERATIONS / 10,
+		  CONFIG_BENCH_BUDGET_AP_LIST_NS, &result);
+
+	zassert_equal(ap_list.count, CONFIG_BENCH_AP_COUNT);
+	zassert_equal(strlen(ap_buf), ap_list.len);
+	zassert_ok(strncmp(ap_buf, "{\"macAddress\":\"F6:CE:36:00:00:00\",\"signalStrength\":-40 },",
+			   58));
+}
+
+static const char led_json[] = "{\"r\":255,\"g\":128,\"b\":0}";
+static uint8_t led_buf[sizeof(led_json)];
+static int led_ret;
+
+/* The POST /led handler, on a copy like its payload buffer, the parser works in place */
+static void bench_led_parse(void)
+{
+	memcpy(led_buf, led_json, sizeof(led_json));
+	led_ret = parse_led_post(led_buf, sizeof(led_json) - 1);
+}
+
+ZTEST(hot_paths, test_led_parse)
+{
+	static const char bad_json[] = "{\"r\":255,\"g\":128}";
+	struct bench_result result;
+
+	zassert_true(led_is_ready());
+
+	bench_run("led_parse", bench_led_parse, CONFIG_BENCH_ITERATIONS,
+		  CONFIG_BENCH_BUDGET_LED_PARSE_NS, &result);
+
+	zassert_ok(led_ret);
+
+	memcpy(led_buf, bad_json, sizeof(bad_json));
+	zassert_equal(parse_led_post(led_buf, sizeof(bad_json) - 1), -EINVAL);
+}
+
+static const char location_response[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Date: Mon, 02 Dec 2024 10:00:00 GMT\r\n"
+	"Content-Type: application/json\r\n"
+	"Content-Length: 74\r\n"
+	"Connection: close\r\n"
+	"x-amzn-RequestId: 3f6c1c52-0b1d-4d6e-9a55-1d6c2b7a9e10\r\n"
+	"\r\n"
+	"{\"lat\":63.42153,\"lon\":10.43761,\"uncertainty\":25,\"fulfilledWith\":\"WIFI\"}";
+static char response_buf[sizeof(location_response)];
+static const char *response_body;
+static int response_code;
+
+/* The parsing of send_http_request(), on a copy like its receive buffer */
+static void bench_response_parse(void)
+{
+	memcpy(response_buf, location_response, sizeof(location_response));
+	response_code = location_api_parse_response(response_buf, &response_body);
+}
+
+ZTEST(hot_paths, test_response_parse)
+{
+	struct bench_result result;
+
+	bench_run("response_parse", bench_response_parse, CONFIG_BENCH_ITERATIONS,
+		  CONFIG_BENCH_BUDGET_RESPONSE_PARSE_NS, &result);
+
+	zassert_equal(response_code, 200);
+	zassert_ok(strncmp(response_body, "{\"lat\":63.42153,", 16));
+	zassert_is_null(strstr(response_buf, "\r\n\r\n"));
+}
+
+/* Start the sensors like the application, the BME680 is only measured by the gas thread */
+static void *hot_paths_setup(void)
+{
+	struct sensor_sample sample = {0};
+
+	zassert_ok(sensors_init());
+
+	for (int i = 0; i < 30 && !(sample.valid & SENSORS_VALID_BME680); i++) {
+		k_sleep(K_MSEC(100));
+		zassert_ok(sensor_measure(&sample));
+	}
+	zassert_true(sample.valid & SENSORS_VALID_BME680, "No BME680 measurement after 3 s");
+
+	return NULL;
+}
+
+ZTEST_SUITE(hot_paths, NULL, hot_paths_setup, NULL, NULL, NULL);
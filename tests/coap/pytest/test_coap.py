@@ -0,0 +1,58 @@
+"""Observe /sensors of the CoAP server with the libcoap client and compare with the JSON stream.
+
+The notification rate must follow CONFIG_APP_COAP_NOTIFY_INTERVAL_MS, and a CBOR notification must
+be smaller than the websocket JSON frame of the same sample. Needs coap-client from libcoap and the
+cbor2 package.
+"""
+
+import io
+import re
+import subprocess
+
+import cbor2
+from twister_harness import DeviceAdapter
+
+PORT = 5683
+SECONDS = 10
+NOTIFY_INTERVAL_MS = 100
+MIN_RATE_PERCENT = 80
+
+
+def read_json_totals(dut: DeviceAdapter):
+    """Samples and bytes of the JSON frames so far, from the last totals printed by the test"""
+    lines = dut.readlines_until(regex=r"json \d+ samples \d+ bytes", timeout=5)
+    samples, nbytes = re.search(r"json (\d+) samples (\d+) bytes", lines[-1]).groups()
+    return int(samples), int(nbytes)
+
+
+def test_observe_sensors(dut: DeviceAdapter, tmp_path):
+    dut.readlines_until(regex="CoAP test ready", timeout=10)
+    json_start = read_json_totals(dut)
+
+    # Every notification is appended to the output file, the CBOR items delimit themselves
+    output = tmp_path / "sensors.cbor"
+    subprocess.run(["coap-client", "-m", "get", "-s", str(SECONDS), "-o", str(output),
+                    f"coap://127.0.0.1:{PORT}/sensors"], check=True, timeout=SECONDS + 10)
+
+    json_end = read_json_totals(dut)
+
+    data = output.read_bytes()
+    decoder = cbor2.CBORDecoder(io.BytesIO(data))
+    samples = []
+    while decoder.fp.tell() < len(data):
+        samples.append(decoder.decode())
+
+    n = len(samples)
+    expected = SECONDS * 1000 // NOTIFY_INTERVAL_MS
+    cbor_per_sample = len(data) / n if n else 0
+    json_samples = json_end[0] - json_start[0]
+    json_per_sample = (json_end[1] - json_start[1]) / json_samples if json_samples else 0
+
+    print(f"{n} notifications in {SECONDS} s, {n / SECONDS:.1f} /s")
+    print(f"CBOR {cbor_per_sample:.1f} B per sample, websocket JSON {json_per_sample:.1f} B "
+          f"per sample")
+
+    assert n * 100 >= expected * MIN_RATE_PERCENT, f"{n} notifications, {expected} expected"
+    assert all(s["ts"] < t["ts"] for s, t in zip(samples, samples[1:])), "Repeated samples"
+    assert json_samples > 0
+    assert cbor_per_sample < json_per_sample
@@ -0,0 +1,54 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+#include "sensors.h"
+
+// Runs the CoAP server of the application for pytest/test_coap.py, which observes /sensors with
+// the libcoap client of the host. Every sample is also rendered as a frame of the websocket JSON
+// stream, and the totals are printed every second for the comparison with the notifications.
+
+// Last location reply, set by the HTTP resources of the application, which are not built here
+uint8_t location_buf[256];
+
+static atomic_t json_samples;
+static atomic_t json_bytes;
+
+static void json_on_sample(const struct sensor_sample *sample)
+{
+	// Only used by the acquisition thread
+	static char buf[512];
+	int len;
+
+	len = sensors_sample_to_json(sample, buf, sizeof(buf));
+	if (len > 0) {
+		atomic_inc(&json_samples);
+		atomic_add(&json_bytes, len);
+	}
+}
+
+static struct sensors_listener json_listener = {
+	.on_sample = json_on_sample,
+};
+
+int main(void)
+{
+	int ret;
+
+	ret = sensors_init();
+	if (ret) {
+		printk("Failed to initialize the sensors, err %d\n", ret);
+		return 0;
+	}
+	sensors_set_interval(CONFIG_TEST_COAP_INTERVAL_MS);
+	sensors_add_listener(&json_listener);
+
+	printk("CoAP test ready on port %d\n", CONFIG_APP_COAP_PORT);
+
+	while (true) {
+		k_sleep(K_SECONDS(1));
+		printk("json %u samples %u bytes\n", (uint32_t)atomic_get(&json_samples),
+		       (uint32_t)atomic_get(&json_bytes));
+	}
+
+	return 0;
+}
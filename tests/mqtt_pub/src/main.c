@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/ztest.h>
+
+#include "sensors.h"
+
+// Subscribes to the sensor topic of the publisher on a broker of the host and checks the batches it
+// receives: whole frames, no more than CONFIG_APP_MQTT_BATCH_SIZE per message and no gap in the
+// sequence numbers. Reports the message rate, the samples per second and the bytes per sample.
+//
+// Needs a broker on 127.0.0.1:CONFIG_APP_MQTT_BROKER_PORT, e.g. `mosquitto -d`.
+
+#define TOPIC_SENSORS CONFIG_APP_MQTT_TOPIC_PREFIX "/sensors"
+
+struct sub_stats {
+	uint32_t messages;
+	uint32_t samples;
+	uint32_t bytes;
+	uint32_t gaps;
+	uint32_t bad_payloads;
+	uint32_t next_seq;
+	bool subscribed;
+};
+
+static struct mqtt_client client;
+static struct sockaddr_in broker;
+static uint8_t rx_buf[256];
+static uint8_t tx_buf[256];
+static uint8_t payload[CONFIG_APP_MQTT_BATCH_SIZE * sizeof(struct sensor_frame)];
+static struct sub_stats stats;
+static bool connected;
+
+static void sub_check_payload(size_t len)
+{
+	const struct sensor_frame *frames = (const struct sensor_frame *)payload;
+	size_t count = len / sizeof(struct sensor_frame);
+
+	if (len == 0 || len % sizeof(struct sensor_frame) != 0) {
+		stats.bad_payloads++;
+		return;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		if (frames[i].magic != SENSOR_FRAME_MAGIC) {
+			stats.bad_payloads++;
+			return;
+		}
+
+		if (stats.samples > 0 && frames[i].seq != stats.next_seq) {
+			stats.gaps++;
+		}
+		stats.next_seq = frames[i].seq + 1;
+		stats.samples++;
+	}
+
+	stats.messages++;
+	stats.bytes += len;
+}
+
+static void sub_evt_handler(struct mqtt_client *const c, const struct mqtt_evt *evt)
+{
+	size_t len;
+	int ret;
+
+	switch (evt->type) {
+	case MQTT_EVT_CONNACK:
+		connected = evt->result == 0;
+		break;
+
+	case MQTT_EVT_DISCONNECT:
+		connected = false;
+		break;
+
+	case MQTT_EVT_SUBACK:
+		stats.subscribed = true;
+		break;
+
+	case MQTT_EVT_PUBLISH:
+		// A message of more than CONFIG_APP_MQTT_BATCH_SIZE frames does not fit
+		len = evt->param.publish.message.payload.len;
+		if (len > sizeof(payload)) {
+			stats.bad_payloads++;
+			break;
+		}
+
+		ret = mqtt_readall_publish_payload(c, payload, len);
+		if (ret) {
+			stats.bad_payloads++;
+			break;
+		}
+		sub_check_payload(len);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* Process the input of the subscriber until the uptime reaches end_ms */
+static void sub_run_until(int64_t end_ms)
+{
+	struct zsock_pollfd fds = {
+		.fd = client.transport.tcp.sock,
+		.events = ZSOCK_POLLIN,
+	};
+	int64_t left_ms;
+
+	while ((left_ms = end_ms - k_uptime_get()) > 0) {
+		if (zsock_poll(&fds, 1, MIN(left_ms, 100)) > 0) {
+			zassert_ok(mqtt_input(&client), "Lost the connection to the broker");
+		}
+		(void)mqtt_live(&client);
+	}
+}
+
+static void *mqtt_pub_setup(void)
+{
+	struct mqtt_topic topic = {
+		.topic = {
+			.utf8 = (const uint8_t *)TOPIC_SENSORS,
+			.size = sizeof(TOPIC_SENSORS) - 1,
+		},
+		.qos = MQTT_QOS_0_AT_MOST_ONCE,
+	};
+	struct mqtt_subscription_list list = {
+		.list = &topic,
+		.list_count = 1,
+		.message_id = 1,
+	};
+
+	broker.sin_family = AF_INET;
+	broker.sin_port = htons(CONFIG_APP_MQTT_BROKER_PORT);
+	zassert_equal(zsock_inet_pton(AF_INET, CONFIG_APP_MQTT_BROKER_HOSTNAME, &broker.sin_addr), 1,
+		      "The broker must be an IPv4 address");
+
+	mqtt_client_init(&client);
+	client.broker = &broker;
+	client.evt_cb = sub_evt_handler;
+	client.client_id.utf8 = (const uint8_t *)"thingy91x-test-sub";
+	client.client_id.size = strlen("thingy91x-test-sub");
+	client.protocol_version = MQTT_VERSION_3_1_1;
+	client.rx_buf = rx_buf;
+	client.rx_buf_size = sizeof(rx_buf);
+	client.tx_buf = tx_buf;
+	client.tx_buf_size = sizeof(tx_buf);
+	client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+
+	zassert_ok(mqtt_connect(&client), "No broker on %s:%d", CONFIG_APP_MQTT_BROKER_HOSTNAME,
+		   CONFIG_APP_MQTT_BROKER_PORT);
+	sub_run_until(k_uptime_get() + CONFIG_APP_MQTT_CONNECT_TIMEOUT_MS);
+	zassert_true(connected, "No CONNACK from the broker");
+
+	zassert_ok(mqtt_subscribe(&client, &list));
+	sub_run_until(k_uptime_get() + 1000);
+	zassert_true(stats.subscribed, "No SUBACK from the broker");
+
+	// The acquisition thread starts publishing from here on
+	zassert_ok(sensors_init());
+	sensors_set_interval(CONFIG_TEST_MQTT_INTERVAL_MS);
+
+	return NULL;
+}
+
+static void mqtt_pub_teardown(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	(void)mqtt_disconnect(&client);
+}
+
+ZTEST(mqtt_pub, test_sensor_batches)
+{
+	uint32_t expected = CONFIG_TEST_MQTT_SECONDS * MSEC_PER_SEC / CONFIG_TEST_MQTT_INTERVAL_MS;
+	uint32_t samples;
+
+	// The first batch may have been closed before the interval was set, so only whole runs at
+	// the test interval are counted
+	sub_run_until(k_uptime_get() + 2 * CONFIG_APP_MQTT_BATCH_TIMEOUT_MS);
+	memset(&stats, 0, sizeof(stats));
+	sub_run_until(k_uptime_get() + CONFIG_TEST_MQTT_SECONDS * MSEC_PER_SEC);
+	samples = stats.samples;
+
+	TC_PRINT("%u messages in %d s, %u.%u messages/s\n", stats.messages,
+		 CONFIG_TEST_MQTT_SECONDS, stats.messages / CONFIG_TEST_MQTT_SECONDS,
+		 (stats.messages * 10 / CONFIG_TEST_MQTT_SECONDS) % 10);
+	TC_PRINT("%u samples of %u taken, %u samples/s, %u bytes/sample, %u gaps\n", samples,
+		 expected, samples / CONFIG_TEST_MQTT_SECONDS, samples ? stats.bytes / samples : 0,
+		 stats.gaps);
+
+	zassert_equal(stats.bad_payloads, 0, "Payloads that are not whole sensor frames");
+	zassert_equal(stats.gaps, 0, "Sequence numbers missing between the received samples");
+	zassert_true(samples * 100 >= expected * CONFIG_TEST_MQTT_MIN_RATE_PERCENT,
+		     "%u samples received, %u taken", samples, expected);
+}
+
+ZTEST_SUITE(mqtt_pub, NULL, mqtt_pub_setup, NULL, NULL, mqtt_pub_teardown);
@@ -0,0 +1,80 @@
+#include <math.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "sensor_channels.h"
+#include "sensor_replay.h"
+#include "sensors.h"
+
+// Replays sessions/step.tses through the simulated sensors and the normal sensor API, and checks
+// which record every read gets. The session lasts 1 s:
+//
+//   0 ms    BMI270 and ADXL367
+//   500 ms  BMI270 and ADXL367, other values
+//   750 ms  ADXL367 only, the BMI270 keeps the values of 500 ms
+//
+// after which the last values are held. The values are as the drivers return them, the BMI270
+// channels are turned by the signs of sensor_channels.h.
+
+#define TOLERANCE 1e-4
+
+struct replay_step {
+	int64_t at_ms;
+	double bmi270[6];
+	double adxl367[3];
+};
+
+static const struct replay_step steps[] = {
+	{100, {0.5, -0.25, 9.75, 0.01, -0.02, 0.03}, {0.1, 0.2, 9.8}},
+	{600, {2.0, -1.0, 9.0, 0.5, -0.5, 0.25}, {-1.0, 1.5, 8.5}},
+	{800, {2.0, -1.0, 9.0, 0.5, -0.5, 0.25}, {3.0, -3.0, 7.0}},
+	{1500, {2.0, -1.0, 9.0, 0.5, -0.5, 0.25}, {3.0, -3.0, 7.0}},
+};
+
+#define REPLAY_SIGN(_id, _name, _unit, _chan, _sign, ...) [SENSOR_CH_##_id] = _sign,
+static const int signs[SENSOR_CH_COUNT] = {SENSOR_CHANNELS(REPLAY_SIGN)};
+#undef REPLAY_SIGN
+
+static void check_channel(const struct sensor_sample *sample, int id, double recorded)
+{
+	double expected = signs[id] * recorded;
+
+	zassert_true(fabs(sample->data[id] - expected) < TOLERANCE,
+		     "Channel %d at %lld ms: %f, recorded %f", id, k_uptime_get(),
+		     sample->data[id], expected);
+}
+
+static void *sensor_replay_setup(void)
+{
+	zassert_true(sensor_replay_active(), "No session, CONFIG_APP_SENSOR_REPLAY_FILE is not set");
+	zassert_ok(sensors_init());
+	sensors_adxl367_subscribe();
+
+	return NULL;
+}
+
+ZTEST(sensor_replay, test_step)
+{
+	struct sensor_sample sample;
+
+	for (int i = 0; i < ARRAY_SIZE(steps); i++) {
+		k_sleep(K_TIMEOUT_ABS_MS(steps[i].at_ms));
+		zassert_ok(sensor_measure(&sample));
+
+		zassert_equal(sample.valid & SENSORS_VALID_BMI270, SENSORS_VALID_BMI270);
+		zassert_equal(sample.valid & SENSORS_VALID_ADXL367, SENSORS_VALID_ADXL367);
+
+		check_channel(&sample, SENSOR_CH_BMI270_AX, steps[i].bmi270[0]);
+		check_channel(&sample, SENSOR_CH_BMI270_AY, steps[i].bmi270[1]);
+		check_channel(&sample, SENSOR_CH_BMI270_AZ, steps[i].bmi270[2]);
+		check_channel(&sample, SENSOR_CH_BMI270_GX, steps[i].bmi270[3]);
+		check_channel(&sample, SENSOR_CH_BMI270_GY, steps[i].bmi270[4]);
+		check_channel(&sample, SENSOR_CH_BMI270_GZ, steps[i].bmi270[5]);
+		check_channel(&sample, SENSOR_CH_ADXL_AX, steps[i].adxl367[0]);
+		check_channel(&sample, SENSOR_CH_ADXL_AY, steps[i].adxl367[1]);
+		check_channel(&sample, SENSOR_CH_ADXL_AZ, steps[i].adxl367[2]);
+	}
+}
+
+ZTEST_SUITE(sensor_replay, NULL, sensor_replay_setup, NULL, NULL, NULL);
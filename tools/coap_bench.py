@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Observe the CoAP sensor resource of the device and report the notification rate and size.
+
+Usage: coap_bench.py [--seconds 30] <host>
+
+The bytes per sample of the CBOR notifications are compared with the size of the same samples
+rendered as the JSON frames of the websocket stream. Needs the aiocoap and cbor2 packages.
+"""
+
+import argparse
+import asyncio
+import time
+
+import aiocoap
+import cbor2
+
+NAMES = ["bmi270_ax", "bmi270_ay", "bmi270_az", "bmi270_gx", "bmi270_gy", "bmi270_gz",
+         "adxl_ax", "adxl_ay", "adxl_az", "bme680_temperature", "bme680_pressure",
+         "bme680_humidity", "bme680_gas", "bmm350_magn_x", "bmm350_magn_y", "bmm350_magn_z"]
+
+
+def as_json_frame(sample):
+    """Size of the websocket JSON frame of a sample, see sensors_sample_to_json()"""
+    fields = [f'"ts":{sample["ts"]}', f'"tx":{sample["ts"]}', f'"valid":{sample["valid"]}']
+    for i, (name, value) in enumerate(zip(NAMES, sample["v"])):
+        fields.append(f'"{name}":{value:.6f}' if i < 9 else f'"{name}":{value:.3f}')
+    return len("{" + ",".join(fields) + "}")
+
+
+async def run(args):
+    context = await aiocoap.Context.create_client_context()
+    request = aiocoap.Message(code=aiocoap.GET, uri=f"coap://{args.host}/sensors", observe=0)
+    pr = context.request(request)
+
+    first = await pr.response
+    notifications = [first]
+    start = time.monotonic()
+
+    async def collect():
+        async for message in pr.observation:
+            notifications.append(message)
+
+    try:
+        await asyncio.wait_for(collect(), args.seconds)
+    except asyncio.TimeoutError:
+        pass
+    elapsed = time.monotonic() - start
+    pr.observation.cancel()
+
+    payload_bytes = sum(len(m.payload) for m in notifications)
+    # CoAP header, token and options, without the UDP/IP headers
+    message_bytes = sum(len(m.encode()) for m in notifications)
+    json_bytes = sum(as_json_frame(cbor2.loads(m.payload)) for m in notifications)
+    n = len(notifications)
+
+    print(f"{n} notifications in {elapsed:.1f} s, {(n - 1) / elapsed:.2f} /s")
+    print(f"CBOR payload {payload_bytes / n:.1f} B, CoAP message {message_bytes / n:.1f} B "
+          f"per sample")
+    print(f"websocket JSON {json_bytes / n:.1f} B per sample, "
+          f"{json_bytes / message_bytes:.1f}x the CoAP message")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host", help="device address, e.g. 192.168.1.99")
+    parser.add_argument("--seconds", type=float, default=30)
+    asyncio.run(run(parser.parse_args()))
+
+
+if __name__ == "__main__":
+    main()
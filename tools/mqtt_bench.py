@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Subscribe to the MQTT topics of the device and report the message rate and the throughput.
+
+Usage: mqtt_bench.py [--broker localhost] [--port 1883] [--prefix thingy91x] [--seconds 30]
+
+The sensor batches are decoded as struct sensor_frame (src/sensors.h) to count the samples and the
+lost ones, from the gaps in the sequence numbers. Needs the paho-mqtt package.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import paho.mqtt.client as mqtt
+
+# struct sensor_frame in src/sensors.h
+HEADER = struct.Struct("<HBBIqI")
+MAGIC = 0x5354
+
+
+class Stats:
+    def __init__(self):
+        self.messages = {"sensors": 0, "events": 0}
+        self.bytes = {"sensors": 0, "events": 0}
+        self.samples = 0
+        self.lost = 0
+        self.last_seq = None
+
+    def on_sensors(self, payload):
+        offset = 0
+        while offset + HEADER.size <= len(payload):
+            magic, _, channels, seq, _, _ = HEADER.unpack_from(payload, offset)
+            if magic != MAGIC:
+                print("bad frame magic", file=sys.stderr)
+                return
+            if self.last_seq is not None:
+                gap = (seq - self.last_seq) & 0xFFFFFFFF
+                if 0 < gap < 0x80000000:
+                    self.lost += gap - 1
+            self.last_seq = seq
+            self.samples += 1
+            offset += HEADER.size + 4 * channels
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--prefix", default="thingy91x")
+    parser.add_argument("--qos", type=int, default=1, choices=(0, 1))
+    parser.add_argument("--seconds", type=float, default=30)
+    args = parser.parse_args()
+
+    stats = Stats()
+
+    def on_connect(client, userdata, flags, reason_code, properties=None):
+        client.subscribe(f"{args.prefix}/#", qos=args.qos)
+
+    def on_message(client, userdata, message):
+        topic = message.topic.rsplit("/", 1)[-1]
+        if topic not in stats.messages:
+            return
+        stats.messages[topic] += 1
+        stats.bytes[topic] += len(message.payload)
+        if topic == "sensors":
+            stats.on_sensors(message.payload)
+        else:
+            print(message.payload.decode(errors="replace"))
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.broker, args.port)
+
+    start = time.monotonic()
+    client.loop_start()
+    time.sleep(args.seconds)
+    client.loop_stop()
+    elapsed = time.monotonic() - start
+
+    for topic in stats.messages:
+        print(f"{topic}: {stats.messages[topic] / elapsed:.2f} msg/s, "
+              f"{stats.bytes[topic] / elapsed:.0f} B/s")
+    total = stats.samples + stats.lost
+    print(f"samples: {stats.samples / elapsed:.1f} /s, "
+          f"{stats.samples / max(1, stats.messages['sensors']):.1f} per message, "
+          f"{stats.lost} lost ({stats.lost / total if total else 0:.2%})")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""Record the sensor samples of the device into a session file for replay on native_sim.
+
+Usage: record_session.py udp [--group 239.255.84.91] [--port 5491] [--seconds 30] <out>
+       record_session.py ws [--seconds 30] <host> <out>
+       record_session.py capture <capture.bin or http://<host>/capture/<id>.bin> <out>
+
+The session format is described in src/sensor_replay.h. The live sources record the UDP frames or
+the websocket JSON frames, with the channels of the device read from its /schema. The capture
+source converts a capture download, which has every BMI270 and ADXL367 sample. The BMI270 values
+are rotated back to the orientation of the driver, so that the replay goes through the same
+rotation as the live data. Replay with
+./build/zephyr/zephyr.exe --replay=<out>, and add --no-rt to replay as fast as possible. The ws
+source needs the websockets package.
+"""
+
+import argparse
+import asyncio
+import json
+import socket
+import struct
+import sys
+import time
+import urllib.request
+
+# struct sensor_session_header and struct sensor_session_record in src/sensor_replay.h
+SESSION_HEADER = struct.Struct("<IHHII")
+SESSION_RECORD = struct.Struct("<II")
+SESSION_MAGIC = 0x53455354
+SESSION_VERSION = 1
+CHANNELS = 16
+
+# struct sensor_frame in src/sensors.h
+FRAME_HEADER = struct.Struct("<HBBIqI")
+FRAME_MAGIC = 0x5354
+FRAME_VERSION = 2
+
+# struct capture_header, capture_footer and capture_record in src/capture.c
+CAPTURE_HEADER = struct.Struct("<IHHIIqIHHfff")
+CAPTURE_FOOTER = struct.Struct("<IIII")
+CAPTURE_RECORD = struct.Struct("<IBBH6h")
+CAPTURE_MAGIC = 0x54504143
+CAPTURE_VERSION = 2
+
+# Channels of the session, every channel of src/sensor_channels.h enabled. The device may have been
+# built with fewer, its channels are mapped by name from its GET /schema.
+SESSION_NAMES = ["bmi270_ax", "bmi270_ay", "bmi270_az", "bmi270_gx", "bmi270_gy", "bmi270_gz",
+                 "adxl_ax", "adxl_ay", "adxl_az", "bme680_temperature", "bme680_pressure",
+                 "bme680_humidity", "bme680_gas", "bmm350_magn_x", "bmm350_magn_y",
+                 "bmm350_magn_z"]
+
+BMI270_VALID = 0x3F
+ADXL367_VALID = 0x7 << 6
+
+# The BMI270 x and y axes are negated by the signs in src/sensor_channels.h
+BMI270_ROTATED = (0, 1, 3, 4)
+
+
+def read_schema(host):
+    with urllib.request.urlopen(f"http://{host}/schema", timeout=5) as response:
+        schema = json.load(response)
+    return [SESSION_NAMES.index(channel["name"]) for channel in schema["channels"]]
+
+
+def to_session(mapping, valid, values):
+    """Move the values and valid bits of a device frame to the session channels."""
+    session_valid = 0
+    session_values = [0.0] * CHANNELS
+    for bit, index in enumerate(mapping):
+        if valid & (1 << bit):
+            session_valid |= 1 << index
+        session_values[index] = values[bit]
+    return session_valid, session_values
+
+
+def unrotate(valid, values):
+    if valid & BMI270_VALID:
+        for i in BMI270_ROTATED:
+            values[i] = -values[i]
+    return values
+
+
+class Session:
+    def __init__(self):
+        self.records = []
+        self.start_us = None
+
+    def add(self, ts_us, valid, values):
+        if self.start_us is None:
+            self.start_us = ts_us
+        t_us = ts_us - self.start_us
+        # Samples that arrive late are not worth reordering a live recording for
+        if t_us < 0 or (self.records and t_us < self.records[-1][0]):
+            return
+        valid &= (1 << CHANNELS) - 1
+        self.records.append((t_us, valid, unrotate(valid, list(values))))
+
+    def write(self, path):
+        # Loop with the typical spacing of the samples after the last one
+        duration_us = 0
+        if self.records:
+            gap = (self.records[-1][0] // len(self.records)) if len(self.records) > 1 else 0
+            duration_us = self.records[-1][0] + gap + 1
+        with open(path, "wb") as out:
+            out.write(SESSION_HEADER.pack(SESSION_MAGIC, SESSION_VERSION, CHANNELS,
+                                          len(self.records), duration_us))
+            for t_us, valid, values in self.records:
+                out.write(SESSION_RECORD.pack(t_us, valid))
+                present = [values[i] for i in range(CHANNELS) if valid & (1 << i)]
+                out.write(struct.pack(f"<{len(present)}f", *present))
+        return duration_us
+
+
+def record_udp(args, session):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    membership = struct.pack("4s4s", socket.inet_aton(args.group), socket.inet_aton("0.0.0.0"))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    sock.settimeout(1.0)
+
+    mapping = None
+    end = time.monotonic() + args.seconds
+    while time.monotonic() < end:
+        try:
+            frame, (host, _) = sock.recvfrom(1500)
+        except socket.timeout:
+            continue
+        if len(frame) < FRAME_HEADER.size:
+            continue
+        magic, version, channels, _, ts_us, valid = FRAME_HEADER.unpack_from(frame)
+        if (magic != FRAME_MAGIC or version != FRAME_VERSION or
+                len(frame) < FRAME_HEADER.size + 4 * channels):
+            continue
+        if mapping is None:
+            mapping = read_schema(host)
+        if channels != len(mapping):
+            continue
+        values = struct.unpack_from(f"<{channels}f", frame, FRAME_HEADER.size)
+        session.add(ts_us, *to_session(mapping, valid, values))
+
+
+async def record_ws(args, session):
+    import websockets
+
+    mapping = read_schema(args.host)
+    async with websockets.connect(f"ws://{args.host}/") as ws:
+        await ws.send(json.dumps({"subscribe": "adxl367"}))
+        end = time.monotonic() + args.seconds
+        while (remaining := end - time.monotonic()) > 0:
+            try:
+                message = await asyncio.wait_for(ws.recv(), remaining)
+            except asyncio.TimeoutError:
+                break
+            if not isinstance(message, str) or '"event"' in message:
+                continue
+            frame = json.loads(message)
+            if "ts" not in frame:
+                continue
+            # A batch has the timestamp of its first sample and the offsets of the others
+            samples = frame["batch"] if "batch" in frame else [dict(frame, dt=0)]
+            for sample in samples:
+                values = [sample.get(SESSION_NAMES[index], 0.0) for index in mapping]
+                session.add(frame["ts"] + sample["dt"],
+                            *to_session(mapping, sample.get("valid", 0), values))
+
+
+def record_capture(args, session):
+    if args.source.startswith("http://"):
+        with urllib.request.urlopen(args.source, timeout=30) as response:
+            data = response.read()
+    else:
+        with open(args.source, "rb") as capture:
+            data = capture.read()
+
+    header = CAPTURE_HEADER.unpack_from(data)
+    footer = CAPTURE_FOOTER.unpack_from(data, CAPTURE_HEADER.size)
+    if header[0] != CAPTURE_MAGIC or footer[0] != CAPTURE_MAGIC:
+        sys.exit(f"{args.source} is not a complete capture")
+    if header[1] != CAPTURE_VERSION:
+        sys.exit(f"{args.source} is a version {header[1]} capture, expected {CAPTURE_VERSION}")
+    accel_scale, gyro_scale, adxl367_scale = header[9:12]
+
+    off = CAPTURE_HEADER.size + CAPTURE_FOOTER.size
+    for _ in range(footer[1]):
+        t_us, source, _, _, *raw = CAPTURE_RECORD.unpack_from(data, off)
+        off += CAPTURE_RECORD.size
+        values = [0.0] * CHANNELS
+        if source == 0:
+            values[0:3] = [v * accel_scale for v in raw[0:3]]
+            values[3:6] = [v * gyro_scale for v in raw[3:6]]
+            session.add(t_us, BMI270_VALID, values)
+        else:
+            values[6:9] = [v * adxl367_scale for v in raw[0:3]]
+            session.add(t_us, ADXL367_VALID, values)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sources = parser.add_subparsers(dest="kind", required=True)
+
+    udp = sources.add_parser("udp", help="record the UDP multicast frames")
+    udp.add_argument("--group", default="239.255.84.91")
+    udp.add_argument("--port", type=int, default=5491)
+    udp.add_argument("--seconds", type=float, default=30)
+    udp.add_argument("out")
+
+    ws = sources.add_parser("ws", help="record the websocket frames")
+    ws.add_argument("--seconds", type=float, default=30)
+    ws.add_argument("host", help="device address, e.g. 192.168.1.99")
+    ws.add_argument("out")
+
+    capture = sources.add_parser("capture", help="convert a capture download")
+    capture.add_argument("source", help="capture .bin file or its URL")
+    capture.add_argument("out")
+
+    args = parser.parse_args()
+    session = Session()
+
+    if args.kind == "udp":
+        record_udp(args, session)
+    elif args.kind == "ws":
+        asyncio.run(record_ws(args, session))
+    else:
+        record_capture(args, session)
+
+    if not session.records:
+        sys.exit("No samples recorded")
+
+    duration_us = session.write(args.out)
+    print(f"{len(session.records)} records in {duration_us / 1e6:.3f} s written to {args.out}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
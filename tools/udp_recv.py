@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Receive the UDP sensor frames of the device and report the loss and the jitter.
+
+Usage: udp_recv.py [--group 239.255.84.91] [--port 5491] [--seconds 30] [--print]
+
+Lost frames are counted from the gaps in the sequence numbers. The jitter is the smoothed
+variation of the transit time, the difference between the arrival time and the device timestamp,
+computed like the interarrival jitter of RFC 3550.
+"""
+
+import argparse
+import socket
+import struct
+import sys
+import time
+
+# struct sensor_frame in src/sensors.h
+HEADER = struct.Struct("<HBBIqI")
+MAGIC = 0x5354
+VERSION = 2
+
+
+def open_socket(group, port):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    if socket.inet_aton(group)[0] & 0xF0 == 0xE0:
+        membership = struct.pack("4s4s", socket.inet_aton(group), socket.inet_aton("0.0.0.0"))
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    sock.settimeout(1.0)
+    return sock
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--group", default="239.255.84.91")
+    parser.add_argument("--port", type=int, default=5491)
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--print", action="store_true", help="print every frame")
+    args = parser.parse_args()
+
+    sock = open_socket(args.group, args.port)
+
+    received = 0
+    lost = 0
+    reordered = 0
+    last_seq = None
+    last_transit = None
+    jitter_us = 0.0
+    max_jitter_us = 0.0
+    frame_bytes = 0
+
+    end = time.monotonic() + args.seconds
+    while time.monotonic() < end:
+        try:
+            data = sock.recv(2048)
+        except socket.timeout:
+            continue
+        arrival_us = time.monotonic_ns() // 1000
+
+        if len(data) < HEADER.size:
+            continue
+        magic, version, channels, seq, ts_us, valid = HEADER.unpack_from(data)
+        if magic != MAGIC or version != VERSION or len(data) < HEADER.size + 4 * channels:
+            print(f"ignoring a frame of {len(data)} bytes", file=sys.stderr)
+            continue
+        values = struct.unpack_from(f"<{channels}f", data, HEADER.size)
+
+        received += 1
+        frame_bytes = len(data)
+        if last_seq is not None:
+            gap = (seq - last_seq) & 0xFFFFFFFF
+            if gap == 0 or gap > 0x7FFFFFFF:
+                reordered += 1
+                continue
+            lost += gap - 1
+        last_seq = seq
+
+        transit = arrival_us - ts_us
+        if last_transit is not None:
+            jitter_us += (abs(transit - last_transit) - jitter_us) / 16
+            max_jitter_us = max(max_jitter_us, jitter_us)
+        last_transit = transit
+
+        if args.print:
+            print(seq, ts_us, f"{valid:#x}", " ".join(f"{v:.3f}" for v in values))
+
+    total = received + lost
+    print(f"{received} frames received, {lost} lost ({lost / total if total else 0:.2%}), "
+          f"{reordered} duplicated or reordered")
+    print(f"jitter {jitter_us / 1000:.2f} ms, max {max_jitter_us / 1000:.2f} ms")
+    print(f"{frame_bytes} bytes per frame")
+
+
+if __name__ == "__main__":
+    main()
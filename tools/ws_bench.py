@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Open many websocket viewers on the device and report the frame rate each of them gets.
+
+Usage: ws_bench.py [--viewers 16] [--seconds 30] [--interval-ms 50]
+                   [--batch 1] [--latency-ms 100] <host>
+
+Every viewer subscribes to the sensor stream like the web page does, and asks for batches of
+--batch samples per message when it is above 1. At the end the sample rate of each viewer is
+compared with the rate of the acquisition interval, with the payload bytes per sample, and the
+per-viewer RAM and the viewer count are read from the /metrics endpoint. Needs the websockets
+package.
+"""
+
+import argparse
+import asyncio
+import json
+import re
+import sys
+import time
+import urllib.request
+
+import websockets
+
+
+async def viewer(url, seconds, counts, index, batch, latency_ms):
+    samples = 0
+    messages = 0
+    payload = 0
+    async with websockets.connect(url) as ws:
+        if batch > 1:
+            await ws.send(json.dumps({"batch": batch, "latency_ms": latency_ms}))
+        end = time.monotonic() + seconds
+        while True:
+            remaining = end - time.monotonic()
+            if remaining <= 0:
+                break
+            try:
+                message = await asyncio.wait_for(ws.recv(), remaining)
+            except asyncio.TimeoutError:
+                break
+            if not isinstance(message, str) or '"ts"' not in message or '"event"' in message:
+                continue
+            if '"batch"' in message:
+                samples += len(json.loads(message)["batch"])
+            else:
+                samples += 1
+            messages += 1
+            payload += len(message)
+    counts[index] = (samples, messages, payload)
+
+
+def read_metrics(host):
+    try:
+        with urllib.request.urlopen(f"http://{host}/metrics", timeout=5) as response:
+            text = response.read().decode()
+    except OSError as err:
+        print(f"Could not read /metrics: {err}", file=sys.stderr)
+        return {}
+
+    metrics = {}
+    for line in text.splitlines():
+        match = re.match(r"^(thingy_ws_\w+) (\S+)$", line)
+        if match:
+            metrics[match.group(1)] = float(match.group(2))
+    return metrics
+
+
+async def run(args):
+    url = f"ws://{args.host}/"
+    counts = [(0, 0, 0)] * args.viewers
+    tasks = [viewer(url, args.seconds, counts, i, args.batch, args.latency_ms)
+             for i in range(args.viewers)]
+
+    # The viewers must all be connected while the metrics are read
+    bench = asyncio.gather(*tasks, return_exceptions=True)
+    await asyncio.sleep(min(2, args.seconds / 2))
+    metrics = await asyncio.get_running_loop().run_in_executor(None, read_metrics, args.host)
+    results = await bench
+
+    expected = 1000.0 / args.interval_ms
+    failed = 0
+    for i, ((samples, messages, payload), result) in enumerate(zip(counts, results)):
+        if isinstance(result, Exception):
+            print(f"viewer {i:2d}: failed, {result}")
+            failed += 1
+            continue
+        rate = samples / args.seconds
+        per_sample = payload / samples if samples else 0
+        print(f"viewer {i:2d}: {samples:5d} samples in {messages:5d} messages, "
+              f"{rate:6.1f} sps ({rate / expected:4.0%}), {per_sample:5.1f} bytes/sample")
+        # Allow for the connection setup and the edges of the window
+        if rate < 0.9 * expected:
+            failed += 1
+
+    print(f"expected {expected:.1f} samples/s per viewer")
+    if metrics:
+        print(f"viewers connected: {metrics.get('thingy_ws_viewers', 0):.0f} "
+              f"of {metrics.get('thingy_ws_viewer_slots', 0):.0f} slots, "
+              f"{metrics.get('thingy_ws_viewer_bytes', 0):.0f} bytes of app RAM per viewer")
+
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host", help="device address, e.g. 192.168.1.99")
+    parser.add_argument("--viewers", type=int, default=16)
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--interval-ms", type=int, default=50,
+                        help="CONFIG_NET_SAMPLE_WEBSOCKET_SENSOR_INTERVAL of the build")
+    parser.add_argument("--batch", type=int, default=1, help="samples per message")
+    parser.add_argument("--latency-ms", type=int, default=100,
+                        help="longest wait of a sample for its batch")
+    sys.exit(asyncio.run(run(parser.parse_args())))
+
+
+if __name__ == "__main__":
+    main()